@@ -4,6 +4,8 @@ Implement a TCP client-server program in C where:
 - The client sends a string to the server.
 - The server removes duplicate characters from the string and sends the modified string back.
 - If the client sends the string "Stop", both client and server programs terminate.
+- Extension: the client can also request a byte-frequency histogram (and the top-k characters) of a file.
+- Extension: whole files can be deduplicated; large payloads are processed by all server cores in parallel.
 */
 
 /*
@@ -11,6 +13,9 @@ client.c
 - This program creates a TCP client that connects to a server on IP 192.168.10.10 and port 10200.
 - It prompts the user to enter a string, sends this string to the server, and receives the modified string without duplicate characters.
 - The client exits when the input string is "Stop".
+- Usage: ./client                 interactive duplicate removal (original behaviour)
+         ./client hist <file> [k]  send the file for a 256-bin byte histogram and its top-k characters
+         ./client dedup <file>     remove duplicate characters from a whole file
 */
 
 #include <stdio.h>      // Standard input-output library
@@ -21,26 +26,179 @@ client.c
 #include <sys/socket.h> // Socket API
 #include <netinet/in.h> // Structures for storing addresses
 #include <stdlib.h>     // Standard library functions
+#include <stdint.h>     // Fixed-width integer types
+#include <endian.h>     // Host/network conversion for 64-bit values
+#include <ctype.h>      // Character classification
 #define PORTNO 10250    // Port number for server connection
 
-int main() {
-    char buff[256];               // Buffer to store server response
-    int n = 1;                    // Loop control variable
+#define REQUEST_MAGIC "\x7fREQ" // Marks a framed request (the legacy protocol sends plain text)
+#define REQ_HISTOGRAM 1         // Request type: byte frequency histogram
+#define REQ_DEDUP 2             // Request type: duplicate character removal for a large payload
 
-    while (1) {
-        int socket_id = socket(AF_INET, SOCK_STREAM, 0); // Create TCP socket
-        struct sockaddr_in address;                      // Structure to store server address
+// Header sent in front of every framed request; all fields are in network byte order
+struct request_header {
+    char magic[4];              // REQUEST_MAGIC
+    uint32_t type;              // Request type
+    uint32_t topk;              // Number of most frequent characters wanted
+    uint32_t reserved;          // Must be zero
+    uint64_t length;            // Payload length in bytes
+};
 
-        address.sin_family = AF_INET;                    // Address family (IPv4)
-        address.sin_addr.s_addr = inet_addr("192.168.10.10"); // Server IP
-        address.sin_port = htons(10200);                 // Port number in network byte order
+// Function to write a whole buffer, retrying on partial writes
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
 
-        // Connecting to the server
-        int result = connect(socket_id, (struct sockaddr*)&address, sizeof(address));
-        if (result == -1) {
-            perror("\nClient Error");                   // Error handling for connection
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to connect a new TCP socket to the server
+int connect_to_server() {
+    int socket_id = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    address.sin_family = AF_INET;                         // Address family (IPv4)
+    address.sin_addr.s_addr = inet_addr("192.168.10.10"); // Server IP
+    address.sin_port = htons(PORTNO);                     // Port number in network byte order
+    if (connect(socket_id, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        perror("\nClient Error");
+        exit(1);
+    }
+    return socket_id;
+}
+
+// Function to stream a file to the server as a framed request; returns the connected socket
+int send_file_request(const char *path, uint32_t type, uint32_t topk, uint64_t *file_length) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror("Open failed");
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    uint64_t length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    int socket_id = connect_to_server();
+    struct request_header header;
+    memcpy(header.magic, REQUEST_MAGIC, 4);
+    header.type = htonl(type);
+    header.topk = htonl(topk);
+    header.reserved = 0;
+    header.length = htobe64(length);
+    if (write_all(socket_id, &header, sizeof(header)) < 0) {
+        perror("Send failed");
+        exit(1);
+    }
+
+    // Send the file in large blocks
+    static char block[1 << 20];
+    size_t got;
+    while ((got = fread(block, 1, sizeof(block), fp)) > 0) {
+        if (write_all(socket_id, block, got) < 0) {
+            perror("Send failed");
             exit(1);
         }
+    }
+    fclose(fp);
+    *file_length = length;
+    return socket_id;
+}
+
+// Function to send a file for a histogram and print the reply
+void request_histogram(const char *path, uint32_t topk) {
+    uint64_t length;
+    int socket_id = send_file_request(path, REQ_HISTOGRAM, topk, &length);
+
+    // Reply: 256 counts, then k and the k most frequent byte values
+    uint64_t counts[256];
+    uint32_t k;
+    unsigned char top[256];
+    if (read_all(socket_id, counts, sizeof(counts)) < 0 || read_all(socket_id, &k, sizeof(k)) < 0) {
+        perror("Read failed");
+        exit(1);
+    }
+    k = ntohl(k);
+    if (k > 256 || read_all(socket_id, top, k) < 0) {
+        perror("Read failed");
+        exit(1);
+    }
+    close(socket_id);
+
+    printf("Histogram of %llu bytes:\n", (unsigned long long)length);
+    for (int c = 0; c < 256; c++) {
+        uint64_t count = be64toh(counts[c]);
+        if (count == 0)
+            continue;
+        if (isprint(c))
+            printf("  '%c' (%3d): %llu\n", c, c, (unsigned long long)count);
+        else
+            printf("  0x%02x     : %llu\n", c, (unsigned long long)count);
+    }
+    if (k > 0) {
+        printf("Top %u characters:\n", k);
+        for (uint32_t i = 0; i < k; i++)
+            printf("  %u. 0x%02x %c %llu\n", i + 1, top[i], isprint(top[i]) ? top[i] : '.',
+                   (unsigned long long)be64toh(counts[top[i]]));
+    }
+}
+
+// Function to send a file for duplicate removal and print the unique characters
+void request_dedup(const char *path) {
+    uint64_t length, result_len;
+    unsigned char result[256];
+    int socket_id = send_file_request(path, REQ_DEDUP, 0, &length);
+
+    // Reply: the number of unique characters followed by the characters in first-occurrence order
+    if (read_all(socket_id, &result_len, sizeof(result_len)) < 0) {
+        perror("Read failed");
+        exit(1);
+    }
+    result_len = be64toh(result_len);
+    if (result_len > sizeof(result) || read_all(socket_id, result, result_len) < 0) {
+        perror("Read failed");
+        exit(1);
+    }
+    close(socket_id);
+
+    printf("%llu bytes reduced to %llu unique characters: ", (unsigned long long)length,
+           (unsigned long long)result_len);
+    fwrite(result, 1, result_len, stdout);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    char buff[256];               // Buffer to store server response
+    int n = 1;                    // Loop control variable
+
+    // Histogram and whole-file dedup request modes
+    if (argc > 2 && strcmp(argv[1], "hist") == 0) {
+        request_histogram(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "dedup") == 0) {
+        request_dedup(argv[2]);
+        return 0;
+    }
+
+    while (1) {
+        int socket_id = connect_to_server();             // Create TCP socket and connect to the server
         
         // Prompting user for input
         char str[256];
@@ -68,6 +226,13 @@ server.c
 - This program creates a TCP server that listens on IP 192.168.10.10 and port 10250.
 - For each connected client, it reads the client's string, removes duplicate characters, and sends back the modified string.
 - If the client sends the string "Stop", the server terminates.
+- Framed requests (see struct request_header) select other services; REQ_HISTOGRAM streams a payload through
+  a multi-table byte histogram and returns the 256 counts plus the top-k characters.
+- REQ_DEDUP removes duplicate characters from a whole payload. Large payloads are split into one chunk per core:
+  each thread records where every byte value first appears in its chunk, the chunks are merged in order
+  (a prefix OR of the per-chunk presence bitsets, i.e. a prefix-min of first positions), and each thread then
+  writes the characters that first appear in its chunk at its own offset of the output. Payloads are limited to
+  MAX_PAYLOAD (1 GiB), and if a thread cannot be started the payload is split among those that did start.
 */
 
 #include <stdio.h>      // Standard input-output library
@@ -78,8 +243,319 @@ server.c
 #include <sys/socket.h> // Socket API
 #include <netinet/in.h> // Structures for storing addresses
 #include <stdlib.h>     // Standard library functions
+#include <stdint.h>     // Fixed-width integer types
+#include <endian.h>     // Host/network conversion for 64-bit values
+#include <pthread.h>    // POSIX threads library
 #define PORTNO 10250    // Port number for server connection
 
+#define REQUEST_MAGIC "\x7fREQ" // Marks a framed request (the legacy protocol sends plain text)
+#define REQ_HISTOGRAM 1         // Request type: byte frequency histogram
+#define REQ_DEDUP 2             // Request type: duplicate character removal for a large payload
+#define STREAM_BLOCK (1 << 20)  // Payloads are processed in blocks of this size
+#define MAX_PAYLOAD (1ULL << 30)       // Largest payload buffered for a dedup request
+#define MIN_CHUNK (4 << 20)            // Smallest per-thread chunk worth a thread of its own
+#define MAX_THREADS 64                 // Upper bound on dedup worker threads
+
+// Header sent in front of every framed request; all fields are in network byte order
+struct request_header {
+    char magic[4];              // REQUEST_MAGIC
+    uint32_t type;              // Request type
+    uint32_t topk;              // Number of most frequent characters wanted
+    uint32_t reserved;          // Must be zero
+    uint64_t length;            // Payload length in bytes
+};
+
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to write a whole buffer, retrying on partial writes
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to add the byte frequencies of a buffer to hist[].
+// Each of the 8 byte lanes of a 64-bit word counts into its own table, so runs of equal bytes
+// never make consecutive increments wait on the same counter; the tables are summed at the end.
+void byte_histogram(const unsigned char *data, size_t len, uint64_t hist[256]) {
+    uint32_t tables[8][256];
+    while (len > 0) {
+        size_t block = len < ((size_t)1 << 31) ? len : ((size_t)1 << 31); // Keeps 32-bit counters from overflowing
+        size_t i = 0;
+        memset(tables, 0, sizeof(tables));
+        for (; i + 8 <= block; i += 8) {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            tables[0][w & 0xFF]++;
+            tables[1][(w >> 8) & 0xFF]++;
+            tables[2][(w >> 16) & 0xFF]++;
+            tables[3][(w >> 24) & 0xFF]++;
+            tables[4][(w >> 32) & 0xFF]++;
+            tables[5][(w >> 40) & 0xFF]++;
+            tables[6][(w >> 48) & 0xFF]++;
+            tables[7][w >> 56]++;
+        }
+        for (; i < block; i++)
+            tables[0][data[i]]++;
+        for (int c = 0; c < 256; c++) {
+            hist[c] += (uint64_t)tables[0][c] + tables[1][c] + tables[2][c] + tables[3][c] +
+                       tables[4][c] + tables[5][c] + tables[6][c] + tables[7][c];
+        }
+        data += block;
+        len -= block;
+    }
+}
+
+// Function to pick the k most frequent byte values (ties go to the smaller value)
+int top_k(const uint64_t hist[256], unsigned char top[256], int k) {
+    int taken[256] = {0}, n = 0;
+    for (; n < k; n++) {
+        int best = -1;
+        for (int c = 0; c < 256; c++) {
+            if (!taken[c] && hist[c] > 0 && (best < 0 || hist[c] > hist[best]))
+                best = c;
+        }
+        if (best < 0)
+            break;               // Fewer than k distinct bytes in the input
+        taken[best] = 1;
+        top[n] = best;
+    }
+    return n;
+}
+
+// Function to stream a histogram request's payload and send back the counts and top-k bytes
+void serve_histogram(int fd, struct request_header *header) {
+    uint64_t remaining = be64toh(header->length);
+    uint32_t k = ntohl(header->topk);
+    uint64_t hist[256] = {0};
+    unsigned char *block = malloc(STREAM_BLOCK);
+    if (block == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    while (remaining > 0) {
+        size_t want = remaining < STREAM_BLOCK ? remaining : STREAM_BLOCK;
+        if (read_all(fd, block, want) < 0) {
+            perror("Read failed");
+            free(block);
+            return;
+        }
+        byte_histogram(block, want, hist);
+        remaining -= want;
+    }
+    free(block);
+
+    // Reply: 256 big-endian counts, the number of top entries, then the top byte values
+    uint64_t counts[256];
+    unsigned char top[256];
+    for (int c = 0; c < 256; c++)
+        counts[c] = htobe64(hist[c]);
+    uint32_t found = top_k(hist, top, k > 256 ? 256 : k);
+    uint32_t wire_found = htonl(found);
+    if (write_all(fd, counts, sizeof(counts)) < 0 || write_all(fd, &wire_found, sizeof(wire_found)) < 0 ||
+        write_all(fd, top, found) < 0)
+        perror("Send failed");
+}
+
+// Per-thread state of a parallel dedup
+struct dedup_chunk {
+    const unsigned char *data;  // Whole payload
+    size_t begin, end;          // This thread's chunk [begin, end)
+    size_t first[256];          // Offset of each byte value's first occurrence in the chunk
+    uint64_t present[4];        // Bitset of byte values found in the chunk
+    uint64_t fresh[4];          // Byte values whose first occurrence in the whole payload is in this chunk
+    unsigned char *out;         // Where this chunk's fresh characters are written
+    struct dedup_job *job;      // Shared job state
+};
+
+// Shared state of a parallel dedup
+struct dedup_job {
+    struct dedup_chunk chunks[MAX_THREADS];
+    int nthreads;               // Threads that actually started, the caller included
+    int ready;                  // Set once the chunks are assigned and the barrier is initialized
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // Signalled when ready is set
+    pthread_barrier_t barrier;  // Separates the scan, merge and compaction phases
+    unsigned char output[256];  // Unique characters in first-occurrence order
+    size_t output_len;
+};
+
+// Function to record the first occurrence of every byte value in one chunk
+void scan_chunk(struct dedup_chunk *chunk) {
+    unsigned char seen[256] = {0};
+    const unsigned char *data = chunk->data;
+    size_t i = chunk->begin, end = chunk->end;
+    int distinct = 0;
+    while (i < end && distinct < 256) {       // Stop early once all 256 values have been seen
+        // Skip 8 bytes at a time while every one of them is already known
+        if (i + 8 <= end && (seen[data[i]] & seen[data[i + 1]] & seen[data[i + 2]] & seen[data[i + 3]] &
+                             seen[data[i + 4]] & seen[data[i + 5]] & seen[data[i + 6]] & seen[data[i + 7]])) {
+            i += 8;
+            continue;
+        }
+        unsigned char c = data[i];
+        if (!seen[c]) {
+            seen[c] = 1;
+            chunk->first[c] = i;
+            chunk->present[c >> 6] |= 1ULL << (c & 63);
+            distinct++;
+        }
+        i++;
+    }
+}
+
+// Function to merge the chunks in order: a byte value belongs to the first chunk that contains it
+void merge_chunks(struct dedup_job *job) {
+    uint64_t seen[4] = {0};
+    size_t offset = 0;
+    for (int t = 0; t < job->nthreads; t++) {
+        struct dedup_chunk *chunk = &job->chunks[t];
+        chunk->out = job->output + offset;
+        for (int w = 0; w < 4; w++) {
+            chunk->fresh[w] = chunk->present[w] & ~seen[w];
+            seen[w] |= chunk->present[w];
+            offset += __builtin_popcountll(chunk->fresh[w]);
+        }
+    }
+    job->output_len = offset;
+}
+
+// Function to write a chunk's fresh characters in the order they first appear
+void compact_chunk(struct dedup_chunk *chunk) {
+    int n = 0;
+    unsigned char order[256];
+    for (int c = 0; c < 256; c++) {
+        if (!(chunk->fresh[c >> 6] & (1ULL << (c & 63))))
+            continue;
+        int j = n++;
+        while (j > 0 && chunk->first[order[j - 1]] > chunk->first[c]) {  // Insertion sort by position
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = c;
+    }
+    memcpy(chunk->out, order, n);
+}
+
+// Thread function running the three phases of a parallel dedup
+void *dedup_worker(void *arg) {
+    struct dedup_chunk *chunk = arg;
+    struct dedup_job *job = chunk->job;
+
+    pthread_mutex_lock(&job->lock);           // Wait until it is known how many threads started
+    while (!job->ready)
+        pthread_cond_wait(&job->start, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+    scan_chunk(chunk);
+    if (pthread_barrier_wait(&job->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+        merge_chunks(job);      // One thread merges while the others wait
+    pthread_barrier_wait(&job->barrier);
+    compact_chunk(chunk);
+    return NULL;
+}
+
+// Function to remove duplicate characters from a payload using one thread per chunk; returns the number of
+// unique characters, or (size_t)-1 if the job could not be allocated. The payload is split among the threads
+// that actually start, so a failed pthread_create only means fewer threads
+size_t parallel_dedup(const unsigned char *data, size_t len, unsigned char output[256]) {
+    struct dedup_job *job = calloc(1, sizeof(struct dedup_job));
+    if (job == NULL) {
+        perror("calloc");
+        return (size_t)-1;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = len / MIN_CHUNK;
+    if (nthreads > cores)
+        nthreads = cores;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->start, NULL);
+    pthread_t threads[MAX_THREADS];
+    int started = 1;                // The calling thread handles the first chunk
+    for (; started < nthreads; started++) {
+        job->chunks[started].job = job;
+        int err = pthread_create(&threads[started], NULL, dedup_worker, &job->chunks[started]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s; using %d threads\n", strerror(err), started);
+            break;
+        }
+    }
+    nthreads = started;
+
+    job->nthreads = nthreads;
+    pthread_barrier_init(&job->barrier, NULL, nthreads);
+    for (int t = 0; t < nthreads; t++) {
+        struct dedup_chunk *chunk = &job->chunks[t];
+        chunk->data = data;
+        chunk->begin = len * t / nthreads;
+        chunk->end = len * (t + 1) / nthreads;
+        chunk->job = job;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->ready = 1;
+    pthread_cond_broadcast(&job->start);
+    pthread_mutex_unlock(&job->lock);
+    dedup_worker(&job->chunks[0]);
+    for (int t = 1; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+
+    size_t n = job->output_len;
+    memcpy(output, job->output, n);
+    pthread_barrier_destroy(&job->barrier);
+    pthread_cond_destroy(&job->start);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+    return n;
+}
+
+// Function to receive a dedup request's payload and send back its unique characters
+void serve_dedup(int fd, struct request_header *header) {
+    uint64_t length = be64toh(header->length);
+    if (length > MAX_PAYLOAD) {
+        fprintf(stderr, "Dedup payload too large: %llu bytes\n", (unsigned long long)length);
+        return;
+    }
+    unsigned char *data = malloc(length > 0 ? length : 1);
+    if (data == NULL || read_all(fd, data, length) < 0) {
+        perror("Read failed");
+        free(data);
+        return;
+    }
+
+    unsigned char output[256];
+    size_t n = parallel_dedup(data, length, output);
+    free(data);
+    if (n == (size_t)-1)
+        return;
+
+    // Reply: the number of unique characters followed by the characters
+    uint64_t wire_n = htobe64(n);
+    if (write_all(fd, &wire_n, sizeof(wire_n)) < 0 || write_all(fd, output, n) < 0)
+        perror("Send failed");
+}
+
 // Function to check if character is already present in 'character' array
 int isPresent(char ch, char character[], int index) {
     for (int i = 0; i < strlen(character); i++) {
@@ -91,16 +567,6 @@ int isPresent(char ch, char character[], int index) {
     return 0;                      // Return 0 if character is unique
 }
 
-// Function to count occurrences of a character in a buffer
-int count(char ch, char buffer[]) {
-    int occ = 0;
-    for (int i = 0; i < strlen(buffer); i++) {
-        if (ch == buffer[i])
-            occ++;
-    }
-    return occ;
-}
-
 int main() {
     printf("Server running...\n");
     int socket_id = socket(AF_INET, SOCK_STREAM, 0);     // Create TCP socket
@@ -126,17 +592,33 @@ int main() {
         // Accept client connection
         int new_socket_id = accept(socket_id, (struct sockaddr *)&clientaddress, &client_len);
         
-        // Read message from client
-        read(new_socket_id, buffer, sizeof(buffer));
+        // Read the start of the message: either a request header or the first bytes of a plain string
+        struct request_header header;
+        memset(buffer, 0, sizeof(buffer));
+        if (read_all(new_socket_id, &header, sizeof(header)) == 0 && memcmp(header.magic, REQUEST_MAGIC, 4) == 0) {
+            if (ntohl(header.type) == REQ_HISTOGRAM)
+                serve_histogram(new_socket_id, &header);
+            else if (ntohl(header.type) == REQ_DEDUP)
+                serve_dedup(new_socket_id, &header);
+            close(new_socket_id);
+            continue;
+        }
+
+        // Plain string: the client always writes the whole 256-byte buffer
+        memcpy(buffer, &header, sizeof(header));
+        read_all(new_socket_id, buffer + sizeof(header), sizeof(buffer) - sizeof(header));
+        buffer[sizeof(buffer) - 1] = '\0';
         if (strcmp(buffer, "Stop") == 0)                 // If client sends "Stop", exit server
             break;
         
         // Initialize arrays for processing
+        uint64_t hist[256] = {0};
         for (int i = 0; i < 256; i++) {
             frequency[i] = 0;
             character[i] = '\0';
             result[i] = '\0';
         }
+        byte_histogram((unsigned char *)buffer, strlen(buffer), hist); // Count every character in one pass
 
         // Remove duplicates by checking presence and counting occurrences
         for (int i = 0; i < strlen(buffer); i++) {
@@ -144,7 +626,7 @@ int main() {
                 character[i] = '$';                      // Mark duplicate with special character
                 frequency[i] = -1;                       // Set frequency to -1 for duplicates
             } else {
-                frequency[i] = count(buffer[i], buffer); // Count occurrences of character
+                frequency[i] = hist[(unsigned char)buffer[i]]; // Occurrences of the character
                 character[i] = buffer[i];                // Store unique character
                 result[unique_count] = character[i];     // Append to result string
                 unique_count++;                          // Increment unique count
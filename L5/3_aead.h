@@ -0,0 +1,701 @@
+/*
+3_aead.h
+- Authenticated encryption for the encrypt/decrypt client and server in 3_encrypt_decrypt_4.c.
+- Two suites with a 256-bit pre-shared key and 96-bit nonces:
+    SUITE_CHACHA20_POLY1305 (RFC 8439): ChaCha20 runs 8 blocks in parallel with AVX2, one 32-bit lane per block;
+                                        a scalar version is used on CPUs without AVX2.
+    SUITE_AES256_GCM        (NIST SP 800-38D): AES-NI for the cipher (8 counter blocks in flight) and PCLMULQDQ
+                                        for GHASH, folding 8 blocks per reduction with precomputed powers of H.
+- aead_default_suite() picks AES-256-GCM when cpuid reports AES-NI and PCLMULQDQ, ChaCha20-Poly1305 otherwise.
+- Sealed streams: AEAD_MAGIC, a suite byte, 3 zero bytes and an 8-byte random nonce prefix, then frames of
+  a 4-byte big-endian word (plaintext length, top bit set on the final frame), the ciphertext and a 16-byte tag.
+  Frame i uses the nonce prefix followed by i as a 4-byte big-endian number, and authenticates i and the final
+  flag as associated data, so frames cannot be reordered, dropped or truncated without detection.
+*/
+
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stdint.h>     // Fixed-width integer types
+#include <string.h>     // memcpy / memset
+#include <fcntl.h>      // open
+#include <sys/uio.h>    // writev
+#include <immintrin.h>  // AVX2, AES-NI and PCLMULQDQ intrinsics
+#include "3_stream.h"   // write_all / read_all
+
+#define SUITE_CHACHA20_POLY1305 1
+#define SUITE_AES256_GCM 2
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+#define AEAD_MAGIC "\0AEA"          // Starts a sealed stream (see 3_stream.h for STREAM_MAGIC)
+#define AEAD_FINAL 0x80000000u      // Frame length flag marking the last frame
+
+// Key schedule and implementation choice for one key
+struct aead {
+    int suite;                  // SUITE_CHACHA20_POLY1305 or SUITE_AES256_GCM
+    int use_avx2;               // ChaCha20: use the 8-way AVX2 kernel
+    uint32_t chacha_key[8];     // ChaCha20 key words
+    __m128i aes_rk[15];         // AES-256 round keys
+    __m128i h_pow[8];           // H^1..H^8 in the byte-reflected GHASH domain
+};
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;                   // x86 is little-endian
+}
+
+static inline uint64_t load_le64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline void store_le64(uint8_t *p, uint64_t v) {
+    memcpy(p, &v, 8);
+}
+
+// ---------------------------------------------------------------- ChaCha20
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d)                     \
+    a += b; d ^= a; d = ROTL32(d, 16);            \
+    c += d; b ^= c; b = ROTL32(b, 12);            \
+    a += b; d ^= a; d = ROTL32(d, 8);             \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+// Function to set up the ChaCha20 input state for a key, nonce and block counter
+static inline void chacha20_state(uint32_t state[16], const uint32_t key[8], const uint8_t nonce[12], uint32_t counter) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(state + 4, key, 32);
+    state[12] = counter;
+    state[13] = load_le32(nonce);
+    state[14] = load_le32(nonce + 4);
+    state[15] = load_le32(nonce + 8);
+}
+
+// Function to compute one 64-byte keystream block
+static inline void chacha20_block(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        CHACHA_QR(x[0], x[4], x[8], x[12]) CHACHA_QR(x[1], x[5], x[9], x[13])
+        CHACHA_QR(x[2], x[6], x[10], x[14]) CHACHA_QR(x[3], x[7], x[11], x[15])
+        CHACHA_QR(x[0], x[5], x[10], x[15]) CHACHA_QR(x[1], x[6], x[11], x[12])
+        CHACHA_QR(x[2], x[7], x[8], x[13]) CHACHA_QR(x[3], x[4], x[9], x[14])
+    }
+    for (int i = 0; i < 16; i++)
+        x[i] += state[i];
+    memcpy(out, x, 64);
+}
+
+// Function to XOR a buffer with the keystream one block at a time; state[12] is advanced
+static inline void chacha20_xor_scalar(uint32_t state[16], const uint8_t *in, uint8_t *out, size_t len) {
+    uint8_t block[64];
+    while (len > 0) {
+        size_t n = len < 64 ? len : 64;
+        chacha20_block(state, block);
+        state[12]++;
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i] ^ block[i];
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+#define VROTL16(v) _mm256_shuffle_epi8(v, rot16)
+#define VROTL8(v) _mm256_shuffle_epi8(v, rot8)
+#define VROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define VCHACHA_QR(a, b, c, d)                                                          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = VROTL16(d);            \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = VROTL(b, 12);          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = VROTL8(d);             \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = VROTL(b, 7);
+
+// Function to XOR one 32-byte half block (8 state words of one block) into the output
+__attribute__((target("avx2")))
+static inline void chacha20_xor32(const uint8_t *in, uint8_t *out, __m256i words) {
+    __m256i data = _mm256_loadu_si256((const __m256i *)in);
+    _mm256_storeu_si256((__m256i *)out, _mm256_xor_si256(data, words));
+}
+
+// Function to XOR a buffer with the keystream 8 blocks (512 bytes) at a time; state[12] is advanced.
+// Vector x[k] holds state word k of 8 consecutive blocks, so each quarter round serves all 8 blocks;
+// the words are transposed back into block order before the XOR.
+__attribute__((target("avx2")))
+static inline void chacha20_xor_avx2(uint32_t state[16], const uint8_t *in, uint8_t *out, size_t len) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    while (len >= 512) {
+        __m256i s[16], x[16];
+        for (int i = 0; i < 16; i++)
+            s[i] = _mm256_set1_epi32(state[i]);
+        s[12] = _mm256_add_epi32(s[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        for (int i = 0; i < 16; i++)
+            x[i] = s[i];
+
+        for (int i = 0; i < 10; i++) {
+            VCHACHA_QR(x[0], x[4], x[8], x[12]) VCHACHA_QR(x[1], x[5], x[9], x[13])
+            VCHACHA_QR(x[2], x[6], x[10], x[14]) VCHACHA_QR(x[3], x[7], x[11], x[15])
+            VCHACHA_QR(x[0], x[5], x[10], x[15]) VCHACHA_QR(x[1], x[6], x[11], x[12])
+            VCHACHA_QR(x[2], x[7], x[8], x[13]) VCHACHA_QR(x[3], x[4], x[9], x[14])
+        }
+        for (int i = 0; i < 16; i++)
+            x[i] = _mm256_add_epi32(x[i], s[i]);
+
+        // Transpose each group of 8 words: afterwards q[g][b] holds words 8g..8g+7 of block b
+        __m256i q[2][8];
+        for (int g = 0; g < 2; g++) {
+            __m256i *w = x + 8 * g;
+            __m256i t0 = _mm256_unpacklo_epi32(w[0], w[1]), t1 = _mm256_unpackhi_epi32(w[0], w[1]);
+            __m256i t2 = _mm256_unpacklo_epi32(w[2], w[3]), t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+            __m256i t4 = _mm256_unpacklo_epi32(w[4], w[5]), t5 = _mm256_unpackhi_epi32(w[4], w[5]);
+            __m256i t6 = _mm256_unpacklo_epi32(w[6], w[7]), t7 = _mm256_unpackhi_epi32(w[6], w[7]);
+            __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+            __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+            __m256i v0 = _mm256_unpacklo_epi64(t4, t6), v1 = _mm256_unpackhi_epi64(t4, t6);
+            __m256i v2 = _mm256_unpacklo_epi64(t5, t7), v3 = _mm256_unpackhi_epi64(t5, t7);
+            q[g][0] = _mm256_permute2x128_si256(u0, v0, 0x20);
+            q[g][1] = _mm256_permute2x128_si256(u1, v1, 0x20);
+            q[g][2] = _mm256_permute2x128_si256(u2, v2, 0x20);
+            q[g][3] = _mm256_permute2x128_si256(u3, v3, 0x20);
+            q[g][4] = _mm256_permute2x128_si256(u0, v0, 0x31);
+            q[g][5] = _mm256_permute2x128_si256(u1, v1, 0x31);
+            q[g][6] = _mm256_permute2x128_si256(u2, v2, 0x31);
+            q[g][7] = _mm256_permute2x128_si256(u3, v3, 0x31);
+        }
+        for (int b = 0; b < 8; b++) {
+            chacha20_xor32(in + 64 * b, out + 64 * b, q[0][b]);
+            chacha20_xor32(in + 64 * b + 32, out + 64 * b + 32, q[1][b]);
+        }
+
+        state[12] += 8;
+        in += 512;
+        out += 512;
+        len -= 512;
+    }
+    chacha20_xor_scalar(state, in, out, len);
+}
+
+// ---------------------------------------------------------------- Poly1305 (44/44/42-bit limbs)
+
+struct poly1305 {
+    uint64_t r[3];              // Clamped multiplier r
+    uint64_t h[3];              // Accumulator
+    uint64_t pad[2];            // s, added at the end
+};
+
+// Function to load the one-time key (r is clamped, s is kept for the final addition)
+static inline void poly1305_init(struct poly1305 *st, const uint8_t key[32]) {
+    uint64_t t0 = load_le64(key), t1 = load_le64(key + 8);
+    st->r[0] = t0 & 0xffc0fffffffULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = load_le64(key + 16);
+    st->pad[1] = load_le64(key + 24);
+}
+
+// Function to absorb whole 16-byte blocks: h = (h + m) * r mod 2^130-5
+static inline void poly1305_blocks(struct poly1305 *st, const uint8_t *m, size_t len) {
+    const uint64_t mask44 = 0xfffffffffffULL, mask42 = 0x3ffffffffffULL, hibit = 1ULL << 40;
+    uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);   // 2^132 = 4 * 2^130 = 20 (mod p)
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    while (len >= 16) {
+        uint64_t t0 = load_le64(m), t1 = load_le64(m + 8);
+        h0 += t0 & mask44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+        h2 += ((t1 >> 24) & mask42) | hibit;
+
+        unsigned __int128 d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+        unsigned __int128 d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+        unsigned __int128 d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & mask44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & mask44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & mask42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= mask44;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+// Function to absorb data zero-padded to a multiple of 16 bytes (the RFC 8439 AEAD layout)
+static inline void poly1305_padded(struct poly1305 *st, const uint8_t *m, size_t len) {
+    poly1305_blocks(st, m, len & ~(size_t)15);
+    if (len & 15) {
+        uint8_t block[16] = {0};
+        memcpy(block, m + (len & ~(size_t)15), len & 15);
+        poly1305_blocks(st, block, 16);
+    }
+}
+
+// Function to produce the tag: fully reduce h mod 2^130-5 and add s
+static inline void poly1305_finish(struct poly1305 *st, uint8_t mac[16]) {
+    const uint64_t mask44 = 0xfffffffffffULL, mask42 = 0x3ffffffffffULL;
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], c;
+    c = h1 >> 44; h1 &= mask44; h2 += c;
+    c = h2 >> 42; h2 &= mask42; h0 += c * 5;
+    c = h0 >> 44; h0 &= mask44; h1 += c;
+    c = h1 >> 44; h1 &= mask44; h2 += c;
+    c = h2 >> 42; h2 &= mask42; h0 += c * 5;
+    c = h0 >> 44; h0 &= mask44; h1 += c;
+
+    // g = h + 5 - 2^130; use it instead of h if it did not go negative
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44; g0 &= mask44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44; g1 &= mask44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+
+    uint64_t t0 = st->pad[0], t1 = st->pad[1];
+    h0 += t0 & mask44;
+    c = h0 >> 44; h0 &= mask44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & mask44) + c;
+    c = h1 >> 44; h1 &= mask44;
+    h2 += ((t1 >> 24) & mask42) + c;
+    h2 &= mask42;
+
+    store_le64(mac, h0 | (h1 << 44));
+    store_le64(mac + 8, (h1 >> 20) | (h2 << 24));
+}
+
+// Function to run ChaCha20 over a buffer with whichever kernel the context selected
+static inline void chacha20_xor(const struct aead *ctx, uint32_t state[16], const uint8_t *in, uint8_t *out, size_t len) {
+    if (ctx->use_avx2)
+        chacha20_xor_avx2(state, in, out, len);
+    else
+        chacha20_xor_scalar(state, in, out, len);
+}
+
+// Function to compute the ChaCha20-Poly1305 tag over the associated data and ciphertext
+static inline void chacha20_poly1305_tag(const uint8_t poly_key[32], const uint8_t *aad, size_t aad_len,
+                                         const uint8_t *ct, size_t len, uint8_t tag[16]) {
+    struct poly1305 mac;
+    uint8_t lengths[16];
+    poly1305_init(&mac, poly_key);
+    poly1305_padded(&mac, aad, aad_len);
+    poly1305_padded(&mac, ct, len);
+    store_le64(lengths, aad_len);
+    store_le64(lengths + 8, len);
+    poly1305_blocks(&mac, lengths, 16);
+    poly1305_finish(&mac, tag);
+}
+
+// ---------------------------------------------------------------- AES-256-GCM
+
+#define AES_TARGET __attribute__((target("aes,pclmul,sse4.1,ssse3")))
+
+// Function to derive the next pair of AES-256 round keys (t = keygenassist of the previous odd key)
+AES_TARGET static inline __m128i aes256_expand_even(__m128i prev, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 8));
+    return _mm_xor_si128(prev, assist);
+}
+
+AES_TARGET static inline __m128i aes256_expand_odd(__m128i even, __m128i prev) {
+    __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0), 0xaa);
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 8));
+    return _mm_xor_si128(prev, assist);
+}
+
+// Function to expand a 256-bit key into the 15 AES round keys
+AES_TARGET static inline void aes256_key_schedule(__m128i rk[15], const uint8_t key[32]) {
+    rk[0] = _mm_loadu_si128((const __m128i *)key);
+    rk[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+#define AES256_ROUND(i, rcon)                                                          \
+    rk[i] = aes256_expand_even(rk[i - 2], _mm_aeskeygenassist_si128(rk[i - 1], rcon)); \
+    if (i < 14)                                                                        \
+        rk[i + 1] = aes256_expand_odd(rk[i], rk[i - 1]);
+    AES256_ROUND(2, 0x01) AES256_ROUND(4, 0x02) AES256_ROUND(6, 0x04) AES256_ROUND(8, 0x08)
+    AES256_ROUND(10, 0x10) AES256_ROUND(12, 0x20) AES256_ROUND(14, 0x40)
+#undef AES256_ROUND
+}
+
+// Function to encrypt one block
+AES_TARGET static inline __m128i aes256_encrypt(const __m128i rk[15], __m128i b) {
+    b = _mm_xor_si128(b, rk[0]);
+    for (int r = 1; r < 14; r++)
+        b = _mm_aesenc_si128(b, rk[r]);
+    return _mm_aesenclast_si128(b, rk[14]);
+}
+
+// Function to reverse the bytes of a block (GHASH works on byte-reflected values)
+AES_TARGET static inline __m128i bswap128(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// Function to accumulate the unreduced 256-bit carry-less product a*b into (lo, hi)
+AES_TARGET static inline void gf_mul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *hi) {
+    __m128i l = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i h = _mm_clmulepi64_si128(a, b, 0x11);
+    __m128i m = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(l, _mm_slli_si128(m, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(h, _mm_srli_si128(m, 8)));
+}
+
+// Function to reduce a 256-bit product modulo the GCM polynomial (Intel white paper, algorithm 5).
+// Reduction is linear, so several products can be summed first and reduced once.
+AES_TARGET static inline __m128i gf_reduce(__m128i lo, __m128i hi) {
+    // Shift the 256-bit value left by one bit to account for the reflected representation
+    __m128i lo_carry = _mm_srli_epi32(lo, 31), hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    hi = _mm_or_si128(hi, _mm_srli_si128(lo_carry, 12));
+    hi = _mm_or_si128(hi, _mm_slli_si128(hi_carry, 4));
+    lo = _mm_or_si128(lo, _mm_slli_si128(lo_carry, 4));
+
+    // Fold the low half into the high half: x^128 = x^7 + x^2 + x + 1
+    __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    __m128i b = _mm_srli_si128(a, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+    __m128i c = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    c = _mm_xor_si128(c, b);
+    lo = _mm_xor_si128(lo, c);
+    return _mm_xor_si128(hi, lo);
+}
+
+AES_TARGET static inline __m128i gf_mul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    gf_mul_acc(a, b, &lo, &hi);
+    return gf_reduce(lo, hi);
+}
+
+// Function to load up to 16 bytes as a zero-padded block
+AES_TARGET static inline __m128i load_partial(const uint8_t *p, size_t n) {
+    uint8_t block[16] = {0};
+    memcpy(block, p, n);
+    return _mm_loadu_si128((const __m128i *)block);
+}
+
+// Function to absorb data into the GHASH state x, 8 blocks per reduction
+AES_TARGET static inline __m128i ghash(const struct aead *ctx, __m128i x, const uint8_t *p, size_t len) {
+    while (len >= 128) {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        __m128i b = _mm_xor_si128(x, bswap128(_mm_loadu_si128((const __m128i *)p)));
+        gf_mul_acc(b, ctx->h_pow[7], &lo, &hi);
+        for (int i = 1; i < 8; i++)
+            gf_mul_acc(bswap128(_mm_loadu_si128((const __m128i *)(p + 16 * i))), ctx->h_pow[7 - i], &lo, &hi);
+        x = gf_reduce(lo, hi);
+        p += 128;
+        len -= 128;
+    }
+    while (len >= 16) {
+        x = gf_mul(_mm_xor_si128(x, bswap128(_mm_loadu_si128((const __m128i *)p))), ctx->h_pow[0]);
+        p += 16;
+        len -= 16;
+    }
+    if (len > 0)
+        x = gf_mul(_mm_xor_si128(x, bswap128(load_partial(p, len))), ctx->h_pow[0]);
+    return x;
+}
+
+// Function to build the counter block nonce || counter (big-endian)
+AES_TARGET static inline __m128i gcm_counter(__m128i j0, uint32_t counter) {
+    return _mm_insert_epi32(j0, (int)__builtin_bswap32(counter), 3);
+}
+
+// Function to run AES-256 in counter mode from the given counter, 8 blocks in flight
+#define AES_ROUND8(op, k)                                                         \
+    b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k);              \
+    b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k);
+#define AES_XOR_OUT(i, b)                                                         \
+    _mm_storeu_si128((__m128i *)(out + 16 * i),                                   \
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i)), b));
+AES_TARGET static inline void aes256_ctr(const struct aead *ctx, __m128i j0, uint32_t counter,
+                                         const uint8_t *in, uint8_t *out, size_t len) {
+    const __m128i *rk = ctx->aes_rk;
+    while (len >= 128) {
+        __m128i b0 = gcm_counter(j0, counter), b1 = gcm_counter(j0, counter + 1);
+        __m128i b2 = gcm_counter(j0, counter + 2), b3 = gcm_counter(j0, counter + 3);
+        __m128i b4 = gcm_counter(j0, counter + 4), b5 = gcm_counter(j0, counter + 5);
+        __m128i b6 = gcm_counter(j0, counter + 6), b7 = gcm_counter(j0, counter + 7);
+        AES_ROUND8(_mm_xor_si128, rk[0])
+        for (int r = 1; r < 14; r++) {
+            AES_ROUND8(_mm_aesenc_si128, rk[r])
+        }
+        AES_ROUND8(_mm_aesenclast_si128, rk[14])
+        AES_XOR_OUT(0, b0) AES_XOR_OUT(1, b1) AES_XOR_OUT(2, b2) AES_XOR_OUT(3, b3)
+        AES_XOR_OUT(4, b4) AES_XOR_OUT(5, b5) AES_XOR_OUT(6, b6) AES_XOR_OUT(7, b7)
+        counter += 8;
+        in += 128;
+        out += 128;
+        len -= 128;
+    }
+    while (len > 0) {
+        size_t n = len < 16 ? len : 16;
+        uint8_t ks[16];
+        _mm_storeu_si128((__m128i *)ks, aes256_encrypt(rk, gcm_counter(j0, counter++)));
+        for (size_t i = 0; i < n; i++)
+            out[i] = in[i] ^ ks[i];
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+// Function to compute the GCM tag over the associated data and ciphertext
+AES_TARGET static inline void gcm_tag(const struct aead *ctx, __m128i j0, const uint8_t *aad, size_t aad_len,
+                                      const uint8_t *ct, size_t len, uint8_t tag[16]) {
+    __m128i x = _mm_setzero_si128();
+    x = ghash(ctx, x, aad, aad_len);
+    x = ghash(ctx, x, ct, len);
+    __m128i lengths = _mm_set_epi64x((long long)aad_len * 8, (long long)len * 8);  // Reflected len(A) || len(C)
+    x = gf_mul(_mm_xor_si128(x, lengths), ctx->h_pow[0]);
+    __m128i mask = aes256_encrypt(ctx->aes_rk, gcm_counter(j0, 1));
+    _mm_storeu_si128((__m128i *)tag, _mm_xor_si128(bswap128(x), mask));
+}
+
+AES_TARGET static inline void aes256_gcm_init(struct aead *ctx, const uint8_t key[32]) {
+    aes256_key_schedule(ctx->aes_rk, key);
+    ctx->h_pow[0] = bswap128(aes256_encrypt(ctx->aes_rk, _mm_setzero_si128()));
+    for (int i = 1; i < 8; i++)
+        ctx->h_pow[i] = gf_mul(ctx->h_pow[i - 1], ctx->h_pow[0]);
+}
+
+// ---------------------------------------------------------------- AEAD interface
+
+// Function to report whether this CPU can run a suite
+static inline int aead_suite_supported(int suite) {
+    __builtin_cpu_init();
+    if (suite == SUITE_AES256_GCM)
+        return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") &&
+               __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+    return suite == SUITE_CHACHA20_POLY1305;
+}
+
+// Function to choose the fastest suite for this CPU
+static inline int aead_default_suite(void) {
+    return aead_suite_supported(SUITE_AES256_GCM) ? SUITE_AES256_GCM : SUITE_CHACHA20_POLY1305;
+}
+
+static inline const char *aead_suite_name(int suite) {
+    return suite == SUITE_AES256_GCM ? "AES-256-GCM" : "ChaCha20-Poly1305";
+}
+
+// Function to prepare a context; returns -1 if the CPU cannot run the suite
+static inline int aead_init(struct aead *ctx, int suite, const uint8_t key[AEAD_KEY_SIZE]) {
+    memset(ctx, 0, sizeof(*ctx));
+    if (!aead_suite_supported(suite))
+        return -1;
+    ctx->suite = suite;
+    if (suite == SUITE_AES256_GCM) {
+        aes256_gcm_init(ctx, key);
+    } else {
+        memcpy(ctx->chacha_key, key, AEAD_KEY_SIZE);
+        ctx->use_avx2 = __builtin_cpu_supports("avx2");
+    }
+    return 0;
+}
+
+// Function to encrypt len bytes (in and out may be the same buffer) and produce the tag
+static inline void aead_seal(const struct aead *ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                             size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, uint8_t tag[AEAD_TAG_SIZE]) {
+    if (ctx->suite == SUITE_AES256_GCM) {
+        uint8_t j0_bytes[16] = {0};
+        memcpy(j0_bytes, nonce, AEAD_NONCE_SIZE);
+        __m128i j0 = _mm_loadu_si128((const __m128i *)j0_bytes);
+        aes256_ctr(ctx, j0, 2, in, out, len);
+        gcm_tag(ctx, j0, aad, aad_len, out, len, tag);
+    } else {
+        uint32_t state[16];
+        uint8_t poly_key[64];
+        chacha20_state(state, ctx->chacha_key, nonce, 0);
+        chacha20_block(state, poly_key);               // Block 0 gives the one-time Poly1305 key
+        state[12] = 1;
+        chacha20_xor(ctx, state, in, out, len);
+        chacha20_poly1305_tag(poly_key, aad, aad_len, out, len, tag);
+    }
+}
+
+// Function to check the tag and decrypt (in and out may be the same buffer); returns -1 on a bad tag
+static inline int aead_open(const struct aead *ctx, const uint8_t nonce[AEAD_NONCE_SIZE], const uint8_t *aad,
+                            size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, const uint8_t tag[AEAD_TAG_SIZE]) {
+    uint8_t expected[AEAD_TAG_SIZE], diff = 0;
+    if (ctx->suite == SUITE_AES256_GCM) {
+        uint8_t j0_bytes[16] = {0};
+        memcpy(j0_bytes, nonce, AEAD_NONCE_SIZE);
+        __m128i j0 = _mm_loadu_si128((const __m128i *)j0_bytes);
+        gcm_tag(ctx, j0, aad, aad_len, in, len, expected);
+        for (int i = 0; i < AEAD_TAG_SIZE; i++)
+            diff |= expected[i] ^ tag[i];              // Constant-time comparison
+        if (diff != 0)
+            return -1;
+        aes256_ctr(ctx, j0, 2, in, out, len);
+    } else {
+        uint32_t state[16];
+        uint8_t poly_key[64];
+        chacha20_state(state, ctx->chacha_key, nonce, 0);
+        chacha20_block(state, poly_key);
+        chacha20_poly1305_tag(poly_key, aad, aad_len, in, len, expected);
+        for (int i = 0; i < AEAD_TAG_SIZE; i++)
+            diff |= expected[i] ^ tag[i];
+        if (diff != 0)
+            return -1;
+        state[12] = 1;
+        chacha20_xor(ctx, state, in, out, len);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------- Sealed streams
+
+#define AEAD_HEADER_SIZE 16         // AEAD_MAGIC, suite byte, 3 zero bytes, nonce prefix
+#define AEAD_FRAME_OVERHEAD (4 + AEAD_TAG_SIZE)
+
+// One direction of a sealed stream
+struct aead_stream {
+    struct aead ctx;
+    uint8_t prefix[8];          // Random nonce prefix chosen by the sender
+    uint32_t index;             // Number of the next frame sent with send_sealed_frame()
+    int finished;               // Set once the final frame has been sent
+};
+
+// Source of raw sealed frames for fill_from_sealed_frames()
+struct sealed_source {
+    int fd;
+    int final_seen;             // A frame flagged final was read (it is only trusted once opened)
+};
+
+// Function to read a raw 32-byte key from a file
+static inline int aead_load_key(const char *path, uint8_t key[AEAD_KEY_SIZE]) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int rc = read_all(fd, key, AEAD_KEY_SIZE);
+    close(fd);
+    return rc;
+}
+
+// Function to derive the nonce and associated data of frame index
+static inline void aead_frame_params(const uint8_t prefix[8], uint32_t index, int final,
+                                     uint8_t nonce[AEAD_NONCE_SIZE], uint8_t aad[5]) {
+    uint32_t be_index = htonl(index);
+    memcpy(nonce, prefix, 8);
+    memcpy(nonce + 8, &be_index, 4);
+    memcpy(aad, &be_index, 4);
+    aad[4] = final ? 1 : 0;
+}
+
+// Function to send the stream header
+static inline int send_sealed_header(int fd, const struct aead_stream *s) {
+    uint8_t header[AEAD_HEADER_SIZE] = {0};
+    memcpy(header, AEAD_MAGIC, 4);
+    header[4] = s->ctx.suite;
+    memcpy(header + 8, s->prefix, 8);
+    return write_all(fd, header, sizeof(header));
+}
+
+// Function to parse the stream header after AEAD_MAGIC has been read; returns the suite or -1
+static inline int read_sealed_header(int fd, struct aead_stream *s) {
+    uint8_t rest[AEAD_HEADER_SIZE - 4];
+    if (read_all(fd, rest, sizeof(rest)) < 0 || rest[1] != 0 || rest[2] != 0 || rest[3] != 0)
+        return -1;
+    memcpy(s->prefix, rest + 4, 8);
+    s->index = 0;
+    s->finished = 0;
+    return rest[0];
+}
+
+// Function to seal frame index in place: the plaintext is at frame + 4, and the length word and tag
+// are written around it. Returns the size of the whole frame
+static inline size_t seal_frame(const struct aead_stream *s, uint32_t index, int final, uint8_t *frame, uint32_t len) {
+    uint8_t nonce[AEAD_NONCE_SIZE], aad[5];
+    uint32_t word = htonl(len | (final ? AEAD_FINAL : 0));
+    aead_frame_params(s->prefix, index, final, nonce, aad);
+    aead_seal(&s->ctx, nonce, aad, sizeof(aad), frame + 4, frame + 4, len, frame + 4 + len);
+    memcpy(frame, &word, 4);
+    return 4 + (size_t)len + AEAD_TAG_SIZE;
+}
+
+// Function to seal data in place and send it as the next frame (the final frame ends the stream)
+static inline int send_sealed_frame(int fd, struct aead_stream *s, uint8_t *data, uint32_t len, int final) {
+    uint8_t nonce[AEAD_NONCE_SIZE], aad[5], tag[AEAD_TAG_SIZE];
+    if (s->finished || s->index == UINT32_MAX || len >= AEAD_FINAL)   // Never reuse a nonce
+        return -1;
+    aead_frame_params(s->prefix, s->index, final, nonce, aad);
+    aead_seal(&s->ctx, nonce, aad, sizeof(aad), data, data, len, tag);
+    s->index++;
+    s->finished = final;
+
+    uint32_t word = htonl(len | (final ? AEAD_FINAL : 0));
+    struct iovec iov[3] = {{&word, 4}, {data, len}, {tag, AEAD_TAG_SIZE}};
+    size_t left = 4 + (size_t)len + AEAD_TAG_SIZE;
+    int i = 0;
+    while (left > 0) {                             // One system call per frame, resumed on partial writes
+        ssize_t n = writev(fd, iov + i, 3 - i);
+        if (n <= 0)
+            return -1;
+        left -= n;
+        while (i < 3 && (size_t)n >= iov[i].iov_len)
+            n -= iov[i++].iov_len;
+        if (i < 3) {
+            iov[i].iov_base = (char *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Producer callback: read one sealed frame (length word, ciphertext and tag) into buf without opening it.
+// Returns 0 once a frame flagged final has been read, so a stream without one ends in an error
+static inline ssize_t fill_from_sealed_frames(void *ctx, unsigned char *buf, size_t cap) {
+    struct sealed_source *src = ctx;
+    if (src->final_seen)
+        return 0;
+    if (read_all(src->fd, buf, 4) < 0)
+        return -1;
+    uint32_t word;
+    memcpy(&word, buf, 4);
+    word = ntohl(word);
+    size_t len = (word & ~AEAD_FINAL) + AEAD_TAG_SIZE;
+    if (len > cap - 4 || read_all(src->fd, buf + 4, len) < 0)
+        return -1;
+    src->final_seen = (word & AEAD_FINAL) != 0;
+    return 4 + len;
+}
+
+// Function to verify and decrypt in place frame index as read by fill_from_sealed_frames(); the
+// plaintext starts at frame + 4. Returns its length, or -1 if the frame is forged or out of place
+static inline ssize_t open_sealed_frame(const struct aead_stream *s, uint32_t index, unsigned char *frame, size_t n) {
+    uint8_t nonce[AEAD_NONCE_SIZE], aad[5];
+    uint32_t word;
+    memcpy(&word, frame, 4);
+    word = ntohl(word);
+    size_t len = word & ~AEAD_FINAL;
+    if (n != 4 + len + AEAD_TAG_SIZE)
+        return -1;
+    aead_frame_params(s->prefix, index, word & AEAD_FINAL, nonce, aad);
+    if (aead_open(&s->ctx, nonce, aad, sizeof(aad), frame + 4, frame + 4, len, frame + 4 + len) < 0)
+        return -1;
+    return len;
+}
+
+#endif
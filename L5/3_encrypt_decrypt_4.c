@@ -2,6 +2,17 @@
 client.c
 - This program creates a TCP client that connects to a server on IP 127.0.0.1 and port 10200.
 - The client takes a message input from the user, encrypts it by adding 4 to the ASCII value of each character, and sends it to the server.
+- Usage: ./client                  encrypt one typed message (original behaviour)
+         ./client stream <file>    encrypt a whole file and stream it in 1 MiB frames; reading the next chunk
+                                   overlaps with shifting and sending the current one (see 3_stream.h)
+         ./client aead <file> <keyfile> [chacha|aes]
+                                   seal a whole file with a real cipher and a 32-byte pre-shared key (see 3_aead.h);
+                                   the suite defaults to AES-256-GCM when the CPU has AES-NI, ChaCha20-Poly1305 otherwise
+         ./client parallel <file> <keyfile> [chacha|aes|default] [workers]
+                                   same stream, but 1 MiB chunks are sealed as independent frames (each with its own
+                                   nonce and counter range) by one worker thread per core and sent in order
+         ./client bench            print the single-core seal/open throughput of each cipher implementation
+- Build: gcc client.c -o client -pthread
 */
 
 #include <stdio.h>      // Standard I/O library
@@ -12,16 +23,247 @@ client.c
 #include <netinet/in.h> // Structures for internet addresses
 #include <arpa/inet.h>  // Definitions for internet operations
 #include <unistd.h>     // POSIX API for UNIX system calls
+#include <fcntl.h>      // File control options
+#include <time.h>       // Timing of the stream transfer
+#include <sys/random.h> // getrandom for the nonce prefix
+#include "3_stream.h"   // Vectorized shift, double-buffered pipeline and stream framing
+#include "3_aead.h"     // ChaCha20-Poly1305 / AES-256-GCM and sealed-stream framing
 
 #define PORTNO 10200    // Port number for server connection
 #define OFFSET 4        // Offset value for encryption
 
-int main() {
+// Function to encrypt a file and stream it to the server
+void stream_file(int sock, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Open failed");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (write_all(sock, STREAM_MAGIC, 4) < 0) {
+        perror("Send failed");
+        exit(1);
+    }
+
+    // The pipeline thread reads the next chunk while this thread shifts and sends the current one
+    struct pipeline pipe;
+    if (pipeline_start(&pipe, STREAM_CHUNK, fill_from_fd, &fd) < 0) {
+        perror("Pipeline start failed");
+        exit(1);
+    }
+    unsigned char *chunk;
+    ssize_t n;
+    unsigned long long total = 0;
+    while ((n = pipeline_next(&pipe, &chunk)) > 0) {
+        shift_bytes(chunk, n, OFFSET);         // Encrypt the whole chunk in place
+        if (send_frame(sock, chunk, n) < 0) {
+            perror("Send failed");
+            exit(1);
+        }
+        total += n;
+        pipeline_release(&pipe);
+    }
+    pipeline_finish(&pipe);
+    close(fd);
+    if (n < 0 || send_frame(sock, NULL, 0) < 0) {  // Zero-length frame ends the stream
+        perror("Stream failed");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Encrypted stream sent: %llu bytes in %.3f s (%.2f MB/s)\n", total, secs, total / secs / 1e6);
+}
+
+// Function to load the key and start a sealed stream with a fresh random nonce prefix
+void seal_setup(struct aead_stream *st, const char *key_path, int suite) {
+    uint8_t key[AEAD_KEY_SIZE];
+    if (aead_load_key(key_path, key) < 0) {
+        fprintf(stderr, "Key file must hold %d bytes\n", AEAD_KEY_SIZE);
+        exit(1);
+    }
+    if (aead_init(&st->ctx, suite, key) < 0) {
+        fprintf(stderr, "%s is not supported on this CPU\n", aead_suite_name(suite));
+        exit(1);
+    }
+    if (getrandom(st->prefix, sizeof(st->prefix), 0) != sizeof(st->prefix)) {
+        perror("getrandom failed");
+        exit(1);
+    }
+    st->index = 0;
+    st->finished = 0;
+}
+
+// Function to seal a file with the given suite and stream it to the server
+void seal_file(int sock, const char *path, const char *key_path, int suite) {
+    struct aead_stream st;
+    seal_setup(&st, key_path, suite);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Open failed");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (send_sealed_header(sock, &st) < 0) {
+        perror("Send failed");
+        exit(1);
+    }
+
+    // The pipeline thread reads the next chunk while this thread seals and sends the current one
+    struct pipeline pipe;
+    if (pipeline_start(&pipe, STREAM_CHUNK, fill_from_fd, &fd) < 0) {
+        perror("Pipeline start failed");
+        exit(1);
+    }
+    unsigned char *chunk;
+    ssize_t n;
+    unsigned long long total = 0;
+    while ((n = pipeline_next(&pipe, &chunk)) > 0) {
+        if (send_sealed_frame(sock, &st, chunk, n, 0) < 0) {
+            perror("Send failed");
+            exit(1);
+        }
+        total += n;
+        pipeline_release(&pipe);
+    }
+    pipeline_finish(&pipe);
+    close(fd);
+    unsigned char none[1];
+    if (n < 0 || send_sealed_frame(sock, &st, none, 0, 1) < 0) {   // Empty final frame ends the stream
+        perror("Stream failed");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s stream sent: %llu bytes in %.3f s (%.2f MB/s)\n", aead_suite_name(suite), total, secs,
+           total / secs / 1e6);
+}
+
+// Worker callback: seal one chunk as frame index (ctx is the stream; the chunk was read to buf + 4)
+ssize_t seal_chunk(void *ctx, uint32_t index, unsigned char *buf, size_t len, size_t *out) {
+    *out = 0;
+    return seal_frame(ctx, index, 0, buf, len);
+}
+
+// Writer callback: send one sealed frame (ctx points to the socket descriptor)
+int send_chunk(void *ctx, const unsigned char *data, size_t len) {
+    return write_all(*(int *)ctx, data, len);
+}
+
+// Function to seal a file on nworkers cores: chunks are sealed as independent frames in parallel and
+// sent in order, so the server receives the same kind of stream seal_file() produces
+void seal_file_parallel(int sock, const char *path, const char *key_path, int suite, int nworkers) {
+    struct aead_stream st;
+    seal_setup(&st, key_path, suite);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Open failed");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (send_sealed_header(sock, &st) < 0) {
+        perror("Send failed");
+        exit(1);
+    }
+
+    // This thread reads chunks, the workers seal them and the pool's writer thread sends them in order
+    struct pool_stages stages = {
+        .fill = fill_from_fd, .fill_ctx = &fd,
+        .work = seal_chunk, .work_ctx = &st,
+        .drain = send_chunk, .drain_ctx = &sock,
+        .fill_size = STREAM_CHUNK, .headroom = 4, .tailroom = AEAD_TAG_SIZE,
+    };
+    long long chunks = ordered_pool_run(&stages, nworkers);
+    unsigned long long total = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+    unsigned char none[1];
+    st.index = chunks;                         // The final frame follows the last chunk
+    if (chunks < 0 || send_sealed_frame(sock, &st, none, 0, 1) < 0) {
+        perror("Stream failed");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s stream sent on %d workers: %llu bytes in %.3f s (%.2f MB/s)\n", aead_suite_name(suite), nworkers,
+           total, secs, total / secs / 1e6);
+}
+
+// Function to time one implementation sealing and then opening 1 MiB frames for about half a second each
+void bench_one(const char *name, int suite, int use_avx2, unsigned char *plain, unsigned char *sealed) {
+    struct aead ctx;
+    uint8_t key[AEAD_KEY_SIZE] = {1}, nonce[AEAD_NONCE_SIZE] = {0}, tag[AEAD_TAG_SIZE];
+    if (aead_init(&ctx, suite, key) < 0) {
+        printf("%-28s not supported on this CPU\n", name);
+        return;
+    }
+    ctx.use_avx2 = use_avx2;
+
+    double rate[2];
+    for (int pass = 0; pass < 2; pass++) {      // Pass 0 seals plain into sealed, pass 1 opens it back
+        struct timespec start, now;
+        unsigned long long bytes = 0;
+        double secs;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            for (int i = 0; i < 16; i++) {
+                if (pass == 0)
+                    aead_seal(&ctx, nonce, NULL, 0, plain, sealed, STREAM_CHUNK, tag);
+                else if (aead_open(&ctx, nonce, NULL, 0, sealed, plain, STREAM_CHUNK, tag) < 0) {
+                    fprintf(stderr, "%s: tag mismatch\n", name);
+                    return;
+                }
+                bytes += STREAM_CHUNK;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            secs = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        } while (secs < 0.5);
+        rate[pass] = bytes / secs / 1e9;
+    }
+    printf("%-28s seal %5.2f GB/s   open %5.2f GB/s\n", name, rate[0], rate[1]);
+}
+
+// Function to print the per-core throughput of every cipher implementation
+void bench(void) {
+    unsigned char *plain = aligned_alloc(64, STREAM_CHUNK);
+    unsigned char *sealed = aligned_alloc(64, STREAM_CHUNK);
+    if (plain == NULL || sealed == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    memset(plain, 'a', STREAM_CHUNK);
+    __builtin_cpu_init();
+    bench_one("ChaCha20-Poly1305 (scalar)", SUITE_CHACHA20_POLY1305, 0, plain, sealed);
+    if (__builtin_cpu_supports("avx2"))
+        bench_one("ChaCha20-Poly1305 (AVX2)", SUITE_CHACHA20_POLY1305, 1, plain, sealed);
+    else
+        printf("%-28s not supported on this CPU\n", "ChaCha20-Poly1305 (AVX2)");
+    bench_one("AES-256-GCM (AES-NI)", SUITE_AES256_GCM, 0, plain, sealed);
+    free(plain);
+    free(sealed);
+}
+
+int main(int argc, char *argv[]) {
     int sock;                               // Socket descriptor
     struct sockaddr_in address;             // Structure for server address
     char message[256];                      // Buffer for input message
     char encrypted_message[256];            // Buffer for encrypted message
 
+    // Benchmark mode needs no server
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+
     // Create a TCP socket
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
@@ -41,6 +283,38 @@ int main() {
         exit(1);
     }
 
+    // Stream mode: encrypt and send a whole file
+    if (argc > 2 && strcmp(argv[1], "stream") == 0) {
+        stream_file(sock, argv[2]);
+        close(sock);
+        return 0;
+    }
+
+    // Sealed mode: authenticated encryption of a whole file
+    if (argc > 3 && strcmp(argv[1], "aead") == 0) {
+        int suite = aead_default_suite();
+        if (argc > 4)
+            suite = strcmp(argv[4], "aes") == 0 ? SUITE_AES256_GCM : SUITE_CHACHA20_POLY1305;
+        seal_file(sock, argv[2], argv[3], suite);
+        close(sock);
+        return 0;
+    }
+
+    // Parallel sealed mode: one sealing worker per core unless a count is given
+    if (argc > 3 && strcmp(argv[1], "parallel") == 0) {
+        int suite = aead_default_suite();
+        int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 4 && strcmp(argv[4], "default") != 0)
+            suite = strcmp(argv[4], "aes") == 0 ? SUITE_AES256_GCM : SUITE_CHACHA20_POLY1305;
+        if (argc > 5)
+            nworkers = atoi(argv[5]);
+        if (nworkers > POOL_MAX_WORKERS)
+            nworkers = POOL_MAX_WORKERS;
+        seal_file_parallel(sock, argv[2], argv[3], suite, nworkers > 0 ? nworkers : 1);
+        close(sock);
+        return 0;
+    }
+
     // Get input message from user
     printf("Enter a message to encrypt: ");
     fgets(message, sizeof(message), stdin);
@@ -64,6 +338,13 @@ int main() {
 server.c
 - This program creates a TCP server that listens on IP 127.0.0.1 and port 10200.
 - The server receives an encrypted message from the client, decrypts it by subtracting 4 from each character, and displays both the encrypted and decrypted messages.
+- If the client opens a stream (see 3_stream.h), frames are received on a pipeline thread while the previous frame is
+  decrypted; the plaintext goes to the file named by the first argument, or is only counted if none is given.
+- A sealed stream (see 3_aead.h) is received on this thread, while one worker per core opens frames in parallel
+  and a writer thread writes their plaintext in order. Every frame is authenticated before its plaintext is
+  written, and the transfer only counts as complete once the authenticated final frame arrives.
+- Usage: ./server [output-file|-] [keyfile]      (the key file is needed for sealed streams; "-" discards the output)
+- Build: gcc server.c -o server -pthread
 */
 
 #include <stdio.h>      // Standard I/O library
@@ -74,11 +355,118 @@ server.c
 #include <netinet/in.h> // Structures for internet addresses
 #include <arpa/inet.h>  // Definitions for internet operations
 #include <unistd.h>     // POSIX API for UNIX system calls
+#include <fcntl.h>      // File control options
+#include <time.h>       // Timing of the stream transfer
+#include "3_stream.h"   // Vectorized shift, double-buffered pipeline and stream framing
+#include "3_aead.h"     // ChaCha20-Poly1305 / AES-256-GCM and sealed-stream framing
 
 #define PORTNO 10200    // Port number for server connection
 #define OFFSET 4        // Offset value for decryption
 
-int main() {
+// Function to receive an encrypted stream (after its magic), decrypt it and write the plaintext to out_fd (-1 to discard)
+void receive_stream(int sock, int out_fd) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The pipeline thread receives the next frame while this thread decrypts and writes the current one
+    struct pipeline pipe;
+    if (pipeline_start(&pipe, STREAM_CHUNK, fill_from_frames, &sock) < 0) {
+        perror("Pipeline start failed");
+        return;
+    }
+    unsigned char *chunk;
+    ssize_t n;
+    unsigned long long total = 0;
+    while ((n = pipeline_next(&pipe, &chunk)) > 0) {
+        shift_bytes(chunk, n, -OFFSET);        // Decrypt the whole frame in place
+        if (out_fd >= 0 && write_all(out_fd, chunk, n) < 0) {
+            perror("Write failed");
+            break;
+        }
+        total += n;
+        pipeline_release(&pipe);
+    }
+    if (n > 0) {                               // Stopped early: fail the producer's next read so it exits
+        shutdown(sock, SHUT_RD);
+        pipeline_cancel(&pipe);
+    }
+    pipeline_finish(&pipe);
+    if (n < 0)
+        fprintf(stderr, "Stream ended early\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Decrypted stream received: %llu bytes in %.3f s (%.2f MB/s)\n", total, secs, total / secs / 1e6);
+}
+
+// Worker callback: verify and decrypt frame index in place (ctx is the stream)
+ssize_t open_chunk(void *ctx, uint32_t index, unsigned char *buf, size_t len, size_t *out) {
+    *out = 4;
+    return open_sealed_frame(ctx, index, buf, len);
+}
+
+// Destination of the plaintext of a sealed stream
+struct plain_sink {
+    int fd;                     // Output file, or -1 to discard
+    unsigned long long total;   // Plaintext bytes written
+};
+
+// Writer callback: write one opened frame's plaintext
+int write_chunk(void *ctx, const unsigned char *data, size_t len) {
+    struct plain_sink *sink = ctx;
+    sink->total += len;
+    return sink->fd >= 0 ? write_all(sink->fd, data, len) : 0;
+}
+
+// Cancel callback: a frame failed to open or the output failed, so wake the reader blocked on the socket
+void cancel_sealed_frames(void *ctx) {
+    shutdown(((struct sealed_source *)ctx)->fd, SHUT_RD);
+}
+
+// Function to receive a sealed stream (after its magic), open the frames on every core and write the
+// plaintext in order to out_fd (-1 to discard)
+void receive_sealed(int sock, int out_fd, const char *key_path) {
+    struct aead_stream st;
+    uint8_t key[AEAD_KEY_SIZE];
+    int suite = read_sealed_header(sock, &st);
+    if (suite < 0) {
+        fprintf(stderr, "Bad stream header\n");
+        return;
+    }
+    if (key_path == NULL || aead_load_key(key_path, key) < 0) {
+        fprintf(stderr, "A %d-byte key file is needed for sealed streams\n", AEAD_KEY_SIZE);
+        return;
+    }
+    if (aead_init(&st.ctx, suite, key) < 0) {
+        fprintf(stderr, "Cipher suite %d is not supported here\n", suite);
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // This thread receives frames, the workers open them and the pool's writer thread writes them in order
+    struct sealed_source src = {sock, 0};
+    struct plain_sink sink = {out_fd, 0};
+    struct pool_stages stages = {
+        .fill = fill_from_sealed_frames, .fill_ctx = &src, .cancel = cancel_sealed_frames,
+        .work = open_chunk, .work_ctx = &st,
+        .drain = write_chunk, .drain_ctx = &sink,
+        .fill_size = STREAM_CHUNK + AEAD_FRAME_OVERHEAD,
+    };
+    int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers > POOL_MAX_WORKERS)
+        nworkers = POOL_MAX_WORKERS;
+    if (ordered_pool_run(&stages, nworkers > 0 ? nworkers : 1) < 0)
+        fprintf(stderr, "Stream failed authentication or ended before its final frame: output is incomplete\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s stream received on %d workers: %llu bytes in %.3f s (%.2f MB/s)\n", aead_suite_name(suite),
+           nworkers, sink.total, secs, sink.total / secs / 1e6);
+}
+
+int main(int argc, char *argv[]) {
     int server_fd, newsockfd;              // Socket descriptors
     struct sockaddr_in address;            // Structure for server address
     socklen_t addrlen;                     // Length of client address structure
@@ -121,6 +509,27 @@ int main() {
         exit(1);
     }
 
+    // A leading NUL byte marks a stream; plain messages are handled as before
+    char first;
+    if (recv(newsockfd, &first, 1, MSG_PEEK) == 1 && first == '\0') {
+        char magic[4];
+        int out_fd = -1;
+        if (argc > 1 && strcmp(argv[1], "-") != 0 && (out_fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            perror("Open failed");
+        int got = read_all(newsockfd, magic, sizeof(magic)) == 0;
+        if (got && memcmp(magic, STREAM_MAGIC, 4) == 0)
+            receive_stream(newsockfd, out_fd);
+        else if (got && memcmp(magic, AEAD_MAGIC, 4) == 0)
+            receive_sealed(newsockfd, out_fd, argc > 2 ? argv[2] : NULL);
+        else
+            fprintf(stderr, "Bad stream header\n");
+        if (out_fd >= 0)
+            close(out_fd);
+        close(newsockfd);
+        close(server_fd);
+        return 0;
+    }
+
     // Read the encrypted message from the client
     int bytes_read = read(newsockfd, encrypted_message, sizeof(encrypted_message) - 1);
     if (bytes_read < 0) {
@@ -0,0 +1,431 @@
+/*
+3_stream.h
+- Shared by the client and server in 3_encrypt_decrypt_4.c for the streaming mode.
+- shift_bytes() applies the +/-OFFSET shift 64 (AVX-512BW) or 32 (AVX2) bytes per instruction,
+  chosen at runtime, with a plain loop as fallback.
+- A pipeline overlaps I/O with the transform: a producer thread fills one buffer while the caller
+  transforms and forwards the other one.
+- An ordered pool spreads the transform over several cores: the caller reads chunks, worker threads
+  transform them in any order, and a writer thread forwards them in their original order.
+- Stream framing: STREAM_MAGIC, then frames of a 4-byte big-endian length and that many bytes;
+  a zero-length frame ends the stream.
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>     // Fixed-width integer types
+#include <stdlib.h>     // aligned_alloc / free
+#include <string.h>     // memcpy
+#include <unistd.h>     // read / write
+#include <pthread.h>    // POSIX threads library
+#include <arpa/inet.h>  // htonl / ntohl
+#include <immintrin.h>  // AVX2 / AVX-512 intrinsics
+
+#define STREAM_MAGIC "\0STR"       // Starts a stream (plain messages never contain a NUL byte)
+#define STREAM_CHUNK (1 << 20)     // Bytes carried by one frame
+#define POOL_MAX_WORKERS 64        // Most transform threads an ordered pool starts
+
+// Function to write a whole buffer, retrying on partial writes
+static inline int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes, retrying on partial reads (returns -1 on error or early EOF)
+static inline int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to shift every byte of a buffer by delta (scalar version)
+static inline void shift_bytes_scalar(unsigned char *buf, size_t len, int delta) {
+    for (size_t i = 0; i < len; i++)
+        buf[i] += delta;
+}
+
+// Function to shift every byte of a buffer by delta, 32 bytes per instruction
+__attribute__((target("avx2")))
+static inline void shift_bytes_avx2(unsigned char *buf, size_t len, int delta) {
+    __m256i d = _mm256_set1_epi8((char)delta);
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {           // Four independent vectors per iteration
+        __m256i a = _mm256_loadu_si256((__m256i *)(buf + i));
+        __m256i b = _mm256_loadu_si256((__m256i *)(buf + i + 32));
+        __m256i c = _mm256_loadu_si256((__m256i *)(buf + i + 64));
+        __m256i e = _mm256_loadu_si256((__m256i *)(buf + i + 96));
+        _mm256_storeu_si256((__m256i *)(buf + i), _mm256_add_epi8(a, d));
+        _mm256_storeu_si256((__m256i *)(buf + i + 32), _mm256_add_epi8(b, d));
+        _mm256_storeu_si256((__m256i *)(buf + i + 64), _mm256_add_epi8(c, d));
+        _mm256_storeu_si256((__m256i *)(buf + i + 96), _mm256_add_epi8(e, d));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((__m256i *)(buf + i));
+        _mm256_storeu_si256((__m256i *)(buf + i), _mm256_add_epi8(a, d));
+    }
+    shift_bytes_scalar(buf + i, len - i, delta);
+}
+
+// Function to shift every byte of a buffer by delta, 64 bytes per instruction
+__attribute__((target("avx512bw")))
+static inline void shift_bytes_avx512(unsigned char *buf, size_t len, int delta) {
+    __m512i d = _mm512_set1_epi8((char)delta);
+    size_t i = 0;
+    for (; i + 256 <= len; i += 256) {
+        __m512i a = _mm512_loadu_si512(buf + i);
+        __m512i b = _mm512_loadu_si512(buf + i + 64);
+        __m512i c = _mm512_loadu_si512(buf + i + 128);
+        __m512i e = _mm512_loadu_si512(buf + i + 192);
+        _mm512_storeu_si512(buf + i, _mm512_add_epi8(a, d));
+        _mm512_storeu_si512(buf + i + 64, _mm512_add_epi8(b, d));
+        _mm512_storeu_si512(buf + i + 128, _mm512_add_epi8(c, d));
+        _mm512_storeu_si512(buf + i + 192, _mm512_add_epi8(e, d));
+    }
+    for (; i < len; i += 64) {                     // Masked tail: no scalar loop needed
+        size_t left = len - i;
+        __mmask64 m = left >= 64 ? ~0ULL : (1ULL << left) - 1;
+        __m512i a = _mm512_maskz_loadu_epi8(m, buf + i);
+        _mm512_mask_storeu_epi8(buf + i, m, _mm512_add_epi8(a, d));
+    }
+}
+
+// Function to shift a buffer in place with the widest kernel this CPU supports
+static inline void shift_bytes(unsigned char *buf, size_t len, int delta) {
+    static void (*kernel)(unsigned char *, size_t, int) = NULL;
+    if (kernel == NULL) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw"))
+            kernel = shift_bytes_avx512;
+        else if (__builtin_cpu_supports("avx2"))
+            kernel = shift_bytes_avx2;
+        else
+            kernel = shift_bytes_scalar;
+    }
+    kernel(buf, len, delta);
+}
+
+// Producer callback: fill buf with up to cap bytes; return the count, 0 at the end or -1 on error
+typedef ssize_t (*fill_fn)(void *ctx, unsigned char *buf, size_t cap);
+
+// Double-buffered pipeline: the producer thread fills one buffer while the consumer uses the other
+struct pipeline {
+    unsigned char *buf[2];      // The two buffers
+    ssize_t len[2];             // Bytes held by each full buffer (0 = end, -1 = error)
+    int full[2];                // Whether each buffer is waiting for the consumer
+    size_t cap;                 // Capacity of each buffer
+    int next;                   // Buffer the consumer takes next
+    int stop;                   // Set by pipeline_cancel()
+    fill_fn fill;               // Producer callback
+    void *ctx;                  // Producer callback argument
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+// Thread function filling the buffers in turn until the producer reports the end
+static inline void *pipeline_producer(void *arg) {
+    struct pipeline *p = arg;
+    for (int i = 0;; i ^= 1) {
+        pthread_mutex_lock(&p->lock);
+        while (p->full[i] && !p->stop)
+            pthread_cond_wait(&p->cond, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+
+        ssize_t n = p->fill(p->ctx, p->buf[i], p->cap);
+
+        pthread_mutex_lock(&p->lock);
+        if (p->stop) {
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        p->len[i] = n;
+        p->full[i] = 1;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        if (n <= 0)
+            return NULL;
+    }
+}
+
+// Function to allocate the buffers and start the producer thread
+static inline int pipeline_start(struct pipeline *p, size_t cap, fill_fn fill, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->cap = cap;
+    p->fill = fill;
+    p->ctx = ctx;
+    p->buf[0] = aligned_alloc(64, cap);
+    p->buf[1] = aligned_alloc(64, cap);
+    if (p->buf[0] == NULL || p->buf[1] == NULL)
+        return -1;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    return pthread_create(&p->thread, NULL, pipeline_producer, p) == 0 ? 0 : -1;
+}
+
+// Function to wait for the next full buffer; returns its length (0 at the end, -1 on error)
+static inline ssize_t pipeline_next(struct pipeline *p, unsigned char **data) {
+    pthread_mutex_lock(&p->lock);
+    while (!p->full[p->next])
+        pthread_cond_wait(&p->cond, &p->lock);
+    ssize_t n = p->len[p->next];
+    pthread_mutex_unlock(&p->lock);
+    *data = p->buf[p->next];
+    return n;
+}
+
+// Function to hand the buffer returned by pipeline_next() back to the producer
+static inline void pipeline_release(struct pipeline *p) {
+    pthread_mutex_lock(&p->lock);
+    p->full[p->next] = 0;
+    p->next ^= 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Function to make the producer exit before the end; a fill() call blocked on I/O must be made to fail
+// by the caller (e.g. with shutdown()), then pipeline_finish() joins the thread
+static inline void pipeline_cancel(struct pipeline *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Function to wait for the producer thread and free the buffers
+static inline void pipeline_finish(struct pipeline *p) {
+    pthread_join(p->thread, NULL);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p->buf[0]);
+    free(p->buf[1]);
+}
+
+// Worker callback: transform chunk index in place; the chunk was filled at buf + headroom with len bytes.
+// Returns the length of the result and sets *out to where it starts in buf, or returns -1 on error
+typedef ssize_t (*work_fn)(void *ctx, uint32_t index, unsigned char *buf, size_t len, size_t *out);
+
+// Writer callback: forward one transformed chunk; returns -1 on error
+typedef int (*drain_fn)(void *ctx, const unsigned char *data, size_t len);
+
+// Cancel callback: make a fill() blocked in I/O return, e.g. by shutting down its socket (gets fill_ctx)
+typedef void (*cancel_fn)(void *ctx);
+
+// Stages of an ordered pool
+struct pool_stages {
+    fill_fn fill;               // Reads the next chunk (runs on the calling thread)
+    void *fill_ctx;
+    work_fn work;               // Transforms one chunk (runs on the workers, in any order)
+    void *work_ctx;
+    drain_fn drain;             // Forwards chunks in their original order (runs on the writer thread)
+    void *drain_ctx;
+    cancel_fn cancel;           // Optional: called once when a worker or the writer fails
+    size_t fill_size;           // Bytes fill() may write
+    size_t headroom;            // Bytes left free before the filled data
+    size_t tailroom;            // Bytes left free after it
+};
+
+enum { SLOT_FREE, SLOT_FILLED, SLOT_BUSY, SLOT_DONE };
+
+struct pool_slot {
+    unsigned char *buf;
+    size_t len;                 // Filled bytes, then the length of the result
+    size_t out;                 // Offset of the result in buf
+    int state;
+};
+
+// Ring of chunk buffers; chunk k always uses slot k % nslots
+struct ordered_pool {
+    const struct pool_stages *st;
+    struct pool_slot *slots;
+    int nslots;
+    uint32_t filled;            // Chunks read so far
+    uint32_t next_work;         // Next chunk for a worker
+    uint32_t next_drain;        // Next chunk for the writer
+    int end;                    // No more chunks will be read
+    int failed;                 // A stage failed: everyone stops
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+// Function to stop the pool after a worker or writer failure (called with the lock held); the reader may be
+// blocked in fill(), so it is cancelled too
+static inline void pool_fail(struct ordered_pool *p) {
+    if (!p->failed && p->st->cancel != NULL)
+        p->st->cancel(p->st->fill_ctx);
+    p->failed = 1;
+}
+
+// Thread function transforming chunks until the reader ends or a stage fails
+static inline void *pool_worker(void *arg) {
+    struct ordered_pool *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->failed && !p->end && p->next_work == p->filled)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->failed || p->next_work == p->filled)
+            break;
+        uint32_t k = p->next_work++;
+        struct pool_slot *s = &p->slots[k % p->nslots];
+        s->state = SLOT_BUSY;
+        pthread_mutex_unlock(&p->lock);
+
+        ssize_t n = p->st->work(p->st->work_ctx, k, s->buf, s->len, &s->out);
+
+        pthread_mutex_lock(&p->lock);
+        if (n < 0) {
+            pool_fail(p);
+        } else {
+            s->len = n;
+            s->state = SLOT_DONE;
+        }
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Thread function forwarding transformed chunks strictly in order
+static inline void *pool_writer(void *arg) {
+    struct ordered_pool *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        struct pool_slot *s = &p->slots[p->next_drain % p->nslots];
+        while (!p->failed && s->state != SLOT_DONE && !(p->end && p->next_drain == p->filled))
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->failed || s->state != SLOT_DONE)
+            break;
+        pthread_mutex_unlock(&p->lock);
+
+        int rc = p->st->drain(p->st->drain_ctx, s->buf + s->out, s->len);
+
+        pthread_mutex_lock(&p->lock);
+        if (rc < 0)
+            pool_fail(p);
+        s->state = SLOT_FREE;
+        p->next_drain++;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Function to run all chunks through the pool with nworkers (at most POOL_MAX_WORKERS) transform threads.
+// Returns the number of chunks, or -1 if any stage failed
+static inline long long ordered_pool_run(const struct pool_stages *st, int nworkers) {
+    struct ordered_pool p;
+    pthread_t writer, workers[POOL_MAX_WORKERS];
+    int started = 0, writer_started = 0;
+    if (nworkers > POOL_MAX_WORKERS)
+        nworkers = POOL_MAX_WORKERS;
+    if (nworkers < 1)
+        nworkers = 1;
+    memset(&p, 0, sizeof(p));
+    p.st = st;
+    p.nslots = 2 * nworkers + 2;               // Enough for every worker plus chunks queued on both sides
+    p.slots = calloc(p.nslots, sizeof(*p.slots));
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    if (p.slots == NULL)
+        p.failed = 1;
+    for (int i = 0; !p.failed && i < p.nslots; i++) {
+        size_t size = (st->headroom + st->fill_size + st->tailroom + 63) & ~(size_t)63;
+        if ((p.slots[i].buf = aligned_alloc(64, size)) == NULL)
+            p.failed = 1;
+    }
+    for (; !p.failed && started < nworkers; started++)
+        if (pthread_create(&workers[started], NULL, pool_worker, &p) != 0)
+            p.failed = 1;
+    if (!p.failed && pthread_create(&writer, NULL, pool_writer, &p) == 0)
+        writer_started = 1;
+    else
+        p.failed = 1;
+
+    // This thread is the reader: fill the slot of the next chunk as soon as the writer has freed it
+    pthread_mutex_lock(&p.lock);
+    while (!p.failed) {
+        struct pool_slot *s = &p.slots[p.filled % p.nslots];
+        while (!p.failed && s->state != SLOT_FREE)
+            pthread_cond_wait(&p.cond, &p.lock);
+        if (p.failed)
+            break;
+        pthread_mutex_unlock(&p.lock);
+
+        ssize_t n = st->fill(st->fill_ctx, s->buf + st->headroom, st->fill_size);
+
+        pthread_mutex_lock(&p.lock);
+        if (n <= 0) {
+            if (n < 0)
+                p.failed = 1;
+            break;
+        }
+        s->len = n;
+        s->state = SLOT_FILLED;
+        p.filled++;
+        pthread_cond_broadcast(&p.cond);
+    }
+    p.end = 1;
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    if (writer_started)
+        pthread_join(writer, NULL);
+    for (int i = 0; p.slots != NULL && i < p.nslots; i++)
+        free(p.slots[i].buf);
+    free(p.slots);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+    return p.failed ? -1 : (long long)p.filled;
+}
+
+// Function to send one frame (length 0 ends the stream)
+static inline int send_frame(int fd, const unsigned char *data, uint32_t len) {
+    uint32_t wire_len = htonl(len);
+    if (write_all(fd, &wire_len, sizeof(wire_len)) < 0)
+        return -1;
+    return write_all(fd, data, len);
+}
+
+// Producer callback: read the next frame from a socket into buf (ctx points to the socket descriptor)
+static inline ssize_t fill_from_frames(void *ctx, unsigned char *buf, size_t cap) {
+    int fd = *(int *)ctx;
+    uint32_t len;
+    if (read_all(fd, &len, sizeof(len)) < 0)
+        return -1;
+    len = ntohl(len);
+    if (len > cap || read_all(fd, buf, len) < 0)
+        return -1;
+    return len;
+}
+
+// Producer callback: read up to cap bytes from a file descriptor (ctx points to it)
+static inline ssize_t fill_from_fd(void *ctx, unsigned char *buf, size_t cap) {
+    int fd = *(int *)ctx;
+    size_t got = 0;
+    while (got < cap) {
+        ssize_t n = read(fd, buf + got, cap - got);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+#endif
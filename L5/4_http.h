@@ -0,0 +1,451 @@
+/*
+4_http.h
+- Reusable HTTP/1.1 client pieces for 4_https_request_response.c.
+- A pool keeps up to HTTP_MAX_IDLE idle keep-alive connections per host (resolved once), so repeated GETs
+  skip TCP setup and teardown. A connection the server has quietly closed is replaced and the request resent.
+- Responses are parsed in the receive buffer (see 4_http_parse.h) and delimited by Content-Length, chunked
+  transfer encoding, or the end of the connection, so the bytes after one response (e.g. the next pipelined
+  response) stay buffered on the connection for the next read. Body bytes are handed on straight from the buffer.
+- http_get_pipelined() keeps up to depth GETs outstanding per connection, sending each batch in one write.
+*/
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // malloc / realloc / free
+#include <string.h>     // String manipulation functions
+#include <strings.h>    // strncasecmp
+#include <unistd.h>     // read / write / close
+#include <netdb.h>      // getaddrinfo
+#include <sys/socket.h> // Socket API
+#include <netinet/in.h> // Structures for internet addresses
+#include <netinet/tcp.h> // TCP_NODELAY
+#include "4_http_parse.h" // Incremental zero-copy response parser
+
+#define HTTP_BUF_SIZE 65536      // Receive buffer per connection
+#define HTTP_MAX_HOSTS 64        // Hosts remembered by a pool
+#define HTTP_MAX_IDLE 8          // Idle connections kept per host
+#define HTTP_MAX_RETRIES 3       // Fresh connections tried before a request fails
+
+// Parsed http:// URL
+struct http_url {
+    char host[256];
+    int port;
+    char path[2048];
+};
+
+// One TCP connection with its receive buffer (bytes start..end are received but not consumed yet)
+struct http_conn {
+    int fd;
+    int served;                 // Responses read on this connection so far
+    size_t start, end;
+    ssize_t (*recv)(void *io, char *buf, size_t len);   // Reads through a transport such as TLS, NULL for read()
+    void *io;
+    char buf[HTTP_BUF_SIZE];
+};
+
+// A host with its resolved address and idle connections
+struct http_host {
+    char name[256];
+    int port;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct http_conn *idle[HTTP_MAX_IDLE];
+    int nidle;
+};
+
+struct http_pool {
+    struct http_host hosts[HTTP_MAX_HOSTS];
+    int nhosts;
+    unsigned long connects;     // Connections opened, for statistics
+};
+
+// Body callback: receives the body in pieces as it arrives; returns -1 to abort
+typedef int (*http_body_fn)(void *ctx, const char *data, size_t len);
+
+struct http_response {
+    int status;                 // Status code, -1 if the request failed
+    int keep_alive;             // The connection may carry another request
+    int head;                   // Set by the caller for HEAD requests: no body follows
+    long long content_length;   // -1 if the response did not give one
+    int chunked;
+    struct http_head hdr;       // Status line and header fields (views, see http_read_head())
+    http_body_fn on_body;       // If set, the body goes here instead of into body
+    void *body_ctx;
+    char *body;                 // Collected body (grows as needed, reused across responses)
+    size_t body_len, body_cap;
+};
+
+// Completion callback for http_get_pipelined(): response to urls[index]
+typedef void (*http_done_fn)(void *ctx, int index, struct http_response *r);
+
+// Function to split "http://host[:port]/path" (the scheme is optional) into its parts
+static inline int http_parse_url(const char *s, struct http_url *u) {
+    if (strncmp(s, "http://", 7) == 0)
+        s += 7;
+    size_t n = strcspn(s, ":/");
+    if (n == 0 || n >= sizeof(u->host))
+        return -1;
+    memcpy(u->host, s, n);
+    u->host[n] = '\0';
+    s += n;
+    u->port = 80;
+    if (*s == ':') {
+        u->port = atoi(s + 1);
+        if (u->port <= 0 || u->port > 65535)
+            return -1;
+        s += 1 + strspn(s + 1, "0123456789");
+    }
+    if (*s == '\0')
+        s = "/";
+    if (*s != '/' || strlen(s) >= sizeof(u->path))
+        return -1;
+    strcpy(u->path, s);
+    return 0;
+}
+
+static inline int http_same_host(const struct http_url *a, const struct http_url *b) {
+    return a->port == b->port && strcasecmp(a->host, b->host) == 0;
+}
+
+static inline void http_pool_init(struct http_pool *pool) {
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Function to close every idle connection of a pool
+static inline void http_pool_free(struct http_pool *pool) {
+    for (int i = 0; i < pool->nhosts; i++)
+        for (int j = 0; j < pool->hosts[i].nidle; j++) {
+            close(pool->hosts[i].idle[j]->fd);
+            free(pool->hosts[i].idle[j]);
+        }
+    pool->nhosts = 0;
+}
+
+// Function to find the pool entry of a host, resolving it the first time; NULL if it cannot be resolved
+static inline struct http_host *http_host_lookup(struct http_pool *pool, const struct http_url *u) {
+    for (int i = 0; i < pool->nhosts; i++)
+        if (pool->hosts[i].port == u->port && strcasecmp(pool->hosts[i].name, u->host) == 0)
+            return &pool->hosts[i];
+    if (pool->nhosts == HTTP_MAX_HOSTS)
+        return NULL;
+
+    struct addrinfo hints = {0}, *res;
+    char port[8];
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", u->port);
+    if (getaddrinfo(u->host, port, &hints, &res) != 0)
+        return NULL;
+    struct http_host *h = &pool->hosts[pool->nhosts++];
+    memset(h, 0, sizeof(*h));
+    strcpy(h->name, u->host);
+    h->port = u->port;
+    memcpy(&h->addr, res->ai_addr, res->ai_addrlen);
+    h->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return h;
+}
+
+// Function to take an idle connection to a host, or open a new one; NULL on failure
+static inline struct http_conn *http_checkout(struct http_pool *pool, struct http_host *h, int fresh) {
+    if (!fresh && h->nidle > 0)
+        return h->idle[--h->nidle];
+    struct http_conn *c = malloc(sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    c->fd = socket(h->addr.ss_family, SOCK_STREAM, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&h->addr, h->addrlen) < 0) {
+        if (c->fd >= 0)
+            close(c->fd);
+        free(c);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // Small requests go out at once
+    c->served = 0;
+    c->start = c->end = 0;
+    c->recv = NULL;
+    pool->connects++;
+    return c;
+}
+
+// Function to close a connection for good
+static inline void http_conn_close(struct http_conn *c) {
+    close(c->fd);
+    free(c);
+}
+
+// Function to return a connection to its host's idle list (or close it if the list is full)
+static inline void http_checkin(struct http_host *h, struct http_conn *c) {
+    if (h->nidle < HTTP_MAX_IDLE)
+        h->idle[h->nidle++] = c;
+    else
+        http_conn_close(c);
+}
+
+// Function to format a request; keep_alive 0 asks the server to close after responding. extra holds more
+// header lines, each ending in CRLF (NULL for none). Returns the length, or -1 if it does not fit
+static inline int http_format_request(char *buf, size_t size, const char *method, const struct http_url *u,
+                                      int keep_alive, const char *extra) {
+    int n = snprintf(buf, size,
+                     "%s %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Connection: %s\r\n"
+                     "%s"
+                     "\r\n",
+                     method, u->path, u->host, keep_alive ? "keep-alive" : "close", extra != NULL ? extra : "");
+    return n < (int)size ? n : -1;
+}
+
+// Function to write a whole buffer to a socket (a peer that has closed gives an error, not SIGPIPE)
+static inline int http_write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read more bytes into a connection buffer, moving unconsumed bytes to the front first.
+// Returns the number of bytes read (0 at the end of the connection, -1 on error or a full buffer)
+static inline ssize_t http_fill(struct http_conn *c) {
+    if (c->start > 0) {
+        memmove(c->buf, c->buf + c->start, c->end - c->start);
+        c->end -= c->start;
+        c->start = 0;
+    }
+    if (c->end == sizeof(c->buf))
+        return -1;
+    ssize_t n = c->recv != NULL ? c->recv(c->io, c->buf + c->end, sizeof(c->buf) - c->end)
+                                : read(c->fd, c->buf + c->end, sizeof(c->buf) - c->end);
+    if (n > 0)
+        c->end += n;
+    return n;
+}
+
+// Function to hand body bytes to the callback or append them to the collected body
+static inline int http_deliver(struct http_response *r, const char *data, size_t len) {
+    if (r->on_body != NULL)
+        return r->on_body(r->body_ctx, data, len);
+    if (r->body_len + len > r->body_cap) {
+        size_t cap = r->body_cap ? r->body_cap : 4096;
+        while (cap < r->body_len + len)
+            cap *= 2;
+        char *p = realloc(r->body, cap);
+        if (p == NULL)
+            return -1;
+        r->body = p;
+        r->body_cap = cap;
+    }
+    memcpy(r->body + r->body_len, data, len);
+    r->body_len += len;
+    return 0;
+}
+
+// Function to pass exactly len buffered or received body bytes on (len -1: until the connection ends)
+static inline int http_read_body(struct http_conn *c, struct http_response *r, long long len) {
+    for (;;) {
+        size_t avail = c->end - c->start;
+        if (len >= 0 && (long long)avail > len)
+            avail = len;
+        if (avail > 0) {
+            if (http_deliver(r, c->buf + c->start, avail) < 0)
+                return -1;
+            c->start += avail;
+            if (len >= 0)
+                len -= avail;
+        }
+        if (len == 0)
+            return 0;
+        ssize_t n = http_fill(c);
+        if (n == 0 && len < 0)
+            return 0;                               // Body delimited by the end of the connection
+        if (n <= 0)
+            return -1;
+    }
+}
+
+// Function to read a chunked body, decoding the framing in place in the connection buffer
+static inline int http_read_chunked(struct http_conn *c, struct http_response *r) {
+    struct http_chunked d = {0};
+    for (;;) {
+        size_t len = c->end - c->start;
+        ssize_t rest = http_decode_chunked(&d, c->buf + c->start, &len);
+        if (rest == -1 || (len > 0 && http_deliver(r, c->buf + c->start, len) < 0))
+            return -1;
+        if (rest >= 0) {                           // Body complete: the bytes after it belong to the next response
+            c->start += len;
+            c->end = c->start + rest;
+            return 0;
+        }
+        c->start = c->end;
+        if (http_fill(c) <= 0)
+            return -1;
+    }
+}
+
+// Function to set status, keep_alive, content_length and chunked from a parsed head in r->hdr
+static inline void http_apply_head(struct http_response *r) {
+    r->status = r->hdr.status;
+    r->content_length = -1;
+    r->chunked = 0;
+    r->keep_alive = r->hdr.minor >= 1;             // HTTP/1.1 keeps the connection by default
+    for (int i = 0; i < r->hdr.nheaders; i++) {
+        const struct http_header *h = &r->hdr.headers[i];
+        if (http_header_is(h, "content-length", 14))
+            r->content_length = strtoll(h->value, NULL, 10);
+        else if (http_header_is(h, "transfer-encoding", 17) && http_has_token(h, "chunked"))
+            r->chunked = 1;
+        else if (http_header_is(h, "connection", 10)) {
+            if (http_has_token(h, "close"))
+                r->keep_alive = 0;
+            else if (http_has_token(h, "keep-alive"))
+                r->keep_alive = 1;
+        }
+    }
+}
+
+// Function to tell whether a response to this request can have a body
+static inline int http_has_body(const struct http_response *r) {
+    return !r->head && r->status != 204 && r->status != 304;
+}
+
+// Function to read the head of one response, skipping interim 1xx responses. r->hdr then holds views into
+// the connection buffer, valid until the body is read. Returns -1 if the connection failed or the head is bad
+static inline int http_read_head(struct http_conn *c, struct http_response *r) {
+    r->status = -1;
+    r->body_len = 0;
+    do {
+        size_t scanned = 0;
+        ssize_t n;
+        while ((n = http_parse_head(c->buf + c->start, c->end - c->start, &scanned, &r->hdr)) == 0)
+            if (http_fill(c) <= 0)
+                return -1;
+        if (n < 0)
+            return -1;
+        c->start += n;
+    } while (r->hdr.status >= 100 && r->hdr.status < 200);
+    http_apply_head(r);
+    return 0;
+}
+
+// Function to read the body that follows a head read with http_read_head()
+static inline int http_read_response_body(struct http_conn *c, struct http_response *r) {
+    int rc;
+    if (!http_has_body(r))
+        rc = 0;
+    else if (r->chunked)
+        rc = http_read_chunked(c, r);
+    else if (r->content_length >= 0)
+        rc = http_read_body(c, r, r->content_length);
+    else {
+        r->keep_alive = 0;                         // Only the end of the connection ends the body
+        rc = http_read_body(c, r, -1);
+    }
+    if (rc == 0)
+        c->served++;
+    return rc;
+}
+
+// Function to read one response from a connection. The caller sets r->head, r->on_body and r->body_ctx;
+// the other fields are filled in. Returns -1 if the connection failed before the response was complete
+static inline int http_read_response(struct http_conn *c, struct http_response *r) {
+    if (http_read_head(c, r) < 0)
+        return -1;
+    return http_read_response_body(c, r);
+}
+
+// Function to run a request on a pooled connection, retrying on a fresh one if a reused connection turns
+// out to be closed before it answered. Once a response head arrived there is no retry: body bytes may already
+// have gone to r->on_body. Returns 0 with the response in r, or -1
+static inline int http_request(struct http_pool *pool, const char *method, const struct http_url *u,
+                               struct http_response *r) {
+    char req[4096];
+    int len = http_format_request(req, sizeof(req), method, u, 1, NULL);
+    struct http_host *h = http_host_lookup(pool, u);
+    if (len < 0 || h == NULL)
+        return -1;
+    r->head = strcmp(method, "HEAD") == 0;
+    for (int attempt = 0; attempt < HTTP_MAX_RETRIES; attempt++) {
+        struct http_conn *c = http_checkout(pool, h, attempt > 0);
+        if (c == NULL)
+            return -1;
+        int reused = c->served > 0;
+        r->status = -1;
+        if (http_write_all(c->fd, req, len) == 0 && http_read_response(c, r) == 0) {
+            if (r->keep_alive)
+                http_checkin(h, c);
+            else
+                http_conn_close(c);
+            return 0;
+        }
+        http_conn_close(c);
+        if (!reused || r->status >= 0)
+            return -1;                             // A fresh connection failed, or the response had started
+    }
+    return -1;
+}
+
+// Function to GET urls[0..n-1] in order with up to depth requests outstanding per connection (depth 0 opens
+// a new connection for every request, the way the original client did). Consecutive URLs on the same host
+// share a connection; requests left unanswered when a server closes one are resent on a new connection.
+// done() is called for every URL in order; the response is only valid during the call
+static inline void http_get_pipelined(struct http_pool *pool, const struct http_url *urls, int n, int depth,
+                                      http_done_fn done, void *ctx) {
+    struct http_response r = {0};
+    char *batch = malloc(HTTP_BUF_SIZE);
+    int next = 0, failures = 0;
+    while (next < n) {
+        struct http_host *h = http_host_lookup(pool, &urls[next]);
+        struct http_conn *c = h != NULL && batch != NULL ? http_checkout(pool, h, depth == 0 || failures > 0) : NULL;
+        if (c == NULL) {                           // This URL cannot be fetched: report it and move on
+            r.status = -1;
+            r.body_len = 0;
+            done(ctx, next++, &r);
+            continue;
+        }
+
+        int sent = next, alive = 1, window = depth > 0 ? depth : 1;
+        while (alive) {
+            // Top the window up with requests for the same host, then send them in one write
+            size_t blen = 0;
+            while (sent < n && sent - next < window && http_same_host(&urls[sent], &urls[next])) {
+                int len = http_format_request(batch + blen, HTTP_BUF_SIZE - blen, "GET", &urls[sent], depth > 0,
+                                              NULL);
+                if (len < 0)
+                    break;
+                blen += len;
+                sent++;
+            }
+            if (next == sent)
+                break;                             // Nothing outstanding: the next URL is for another host
+            r.head = 0;
+            if ((blen > 0 && http_write_all(c->fd, batch, blen) < 0) || http_read_response(c, &r) < 0) {
+                alive = 0;
+                if (++failures == HTTP_MAX_RETRIES) {
+                    r.status = -1;
+                    r.body_len = 0;
+                    done(ctx, next++, &r);
+                    failures = 0;
+                }
+                break;
+            }
+            failures = 0;
+            done(ctx, next++, &r);                 // Responses arrive in request order
+            alive = r.keep_alive && depth > 0;
+        }
+        if (alive && depth > 0)
+            http_checkin(h, c);
+        else
+            http_conn_close(c);
+    }
+    free(r.body);
+    free(batch);
+}
+
+#endif
@@ -0,0 +1,343 @@
+/*
+4_http_bench.h
+- HTTP load generator in the manner of wrk, for 4_https_request_response.c (link with -pthread).
+- Each of the threads runs its own epoll loop over its share of the keep-alive connections. Each connection keeps
+  one request outstanding and sends the next as soon as the response is complete. Threads share nothing until
+  they merge their counts at the end.
+- Requests are formatted once. With several paths (a "script"), each connection walks the list in turn, starting
+  at its own offset, so the paths are hit evenly.
+- Responses are framed by Content-Length, chunked encoding or the end of the connection (see 4_http_parse.h), and
+  the body is only counted. Latency is measured from the first byte of the request to the end of the response.
+- A connection that fails or is closed by the server is reopened and counted as a socket error. So is a request
+  that takes longer than the timeout.
+*/
+
+#ifndef HTTP_BENCH_H
+#define HTTP_BENCH_H
+
+#include <pthread.h>    // One event loop per thread
+#include "4_http_fetch.h" // Latency histogram, request formatting, response parsing
+
+#define BENCH_BUF_SIZE 16384         // Receive buffer per connection
+#define BENCH_REQ_MAX 2048           // Longest formatted request
+
+struct bench_options {
+    int threads;
+    int conns;                  // Connections over all threads
+    double duration_s;
+    int timeout_ms;             // A request taking longer counts as a timeout
+};
+
+// Counts of one thread, merged at the end
+struct bench_stats {
+    unsigned long long requests;
+    unsigned long long bytes;   // Everything read: heads and bodies
+    unsigned long connect_errors, read_errors, write_errors, timeouts;
+    unsigned long status_errors;      // Responses other than 2xx or 3xx
+    struct latency_hist hist;
+};
+
+enum { BENCH_CONNECTING, BENCH_SENDING, BENCH_HEAD, BENCH_BODY };
+
+struct bench_conn {
+    int fd;
+    int state;
+    int next_req;               // Index of the request to send next
+    const char *req;            // Request being sent
+    size_t req_len, req_sent;
+    double start;               // When the request started, ms
+    size_t start_off, end;      // Unparsed bytes buf[start_off..end)
+    size_t scanned;
+    struct http_response r;
+    struct http_chunked chunk;
+    long long body_left;        // -1: until the connection ends
+    char buf[BENCH_BUF_SIZE];
+};
+
+struct bench_thread {
+    const struct sockaddr_storage *addr;
+    socklen_t addrlen;
+    char **reqs;                // Formatted requests
+    size_t *req_lens;
+    int nreqs;
+    int nconns;
+    int first_conn;             // Global index of its first connection (request offsets)
+    double stop;                // Monotonic ms to stop at
+    int timeout_ms;
+    int epfd;
+    struct bench_conn *conns;
+    struct bench_stats stats;
+};
+
+// Function to (re)open a connection; the request goes out once it is connected
+static inline void bench_open(struct bench_thread *t, struct bench_conn *c) {
+    c->fd = socket(t->addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->state = BENCH_CONNECTING;
+    c->start = fetch_now_ms();                     // A connect that hangs times out too
+    c->start_off = c->end = 0;
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+    if (c->fd < 0 || (connect(c->fd, (const struct sockaddr *)t->addr, t->addrlen) < 0 && errno != EINPROGRESS)
+        || epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        t->stats.connect_errors++;
+        if (c->fd >= 0)
+            close(c->fd);
+        c->fd = -1;                                // Retried on the next tick
+    }
+}
+
+// Function to close a connection and open a new one in its place
+static inline void bench_reopen(struct bench_thread *t, struct bench_conn *c) {
+    if (c->fd >= 0) {
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    bench_open(t, c);
+}
+
+// Function to set which readiness a connection waits for
+static inline void bench_watch(struct bench_thread *t, struct bench_conn *c, unsigned events) {
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Function to start the connection's next request and send as much of it as the socket takes
+static inline void bench_send(struct bench_thread *t, struct bench_conn *c) {
+    if (c->state != BENCH_SENDING) {
+        c->req = t->reqs[c->next_req];
+        c->req_len = t->req_lens[c->next_req];
+        c->req_sent = 0;
+        c->next_req = (c->next_req + 1) % t->nreqs;
+        c->start = fetch_now_ms();
+        c->state = BENCH_SENDING;
+    }
+    while (c->req_sent < c->req_len) {
+        ssize_t n = send(c->fd, c->req + c->req_sent, c->req_len - c->req_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN) {
+            bench_watch(t, c, EPOLLOUT);
+            return;
+        }
+        if (n <= 0) {
+            t->stats.write_errors++;
+            bench_reopen(t, c);
+            return;
+        }
+        c->req_sent += n;
+    }
+    c->state = BENCH_HEAD;
+    c->scanned = 0;
+    bench_watch(t, c, EPOLLIN);
+}
+
+// Function to record a complete response and send the next request, on this connection if it stays open
+static inline void bench_complete(struct bench_thread *t, struct bench_conn *c) {
+    t->stats.requests++;
+    latency_add(&t->stats.hist, fetch_now_ms() - c->start);
+    if (c->r.status < 200 || c->r.status >= 400)
+        t->stats.status_errors++;
+    if (!c->r.keep_alive)
+        bench_reopen(t, c);
+    else
+        bench_send(t, c);
+}
+
+// Function to parse what has arrived; returns 1 when the response is complete, 0 if more is needed, -1 if bad
+static inline int bench_advance(struct bench_conn *c) {
+    if (c->state == BENCH_HEAD) {
+        ssize_t n;
+        do {
+            n = http_parse_head(c->buf + c->start_off, c->end - c->start_off, &c->scanned, &c->r.hdr);
+            if (n <= 0)
+                return n;
+            c->start_off += n;
+            c->scanned = 0;
+        } while (c->r.hdr.status >= 100 && c->r.hdr.status < 200);
+        http_apply_head(&c->r);
+        if (!http_has_body(&c->r))
+            return 1;
+        c->state = BENCH_BODY;
+        c->body_left = c->r.chunked ? 0 : c->r.content_length;
+        memset(&c->chunk, 0, sizeof(c->chunk));
+        if (!c->r.chunked && c->body_left < 0)
+            c->r.keep_alive = 0;
+    }
+    size_t avail = c->end - c->start_off;
+    if (c->r.chunked) {
+        size_t len = avail;
+        ssize_t rest = http_decode_chunked(&c->chunk, c->buf + c->start_off, &len);
+        if (rest == -1)
+            return -1;
+        if (rest >= 0) {
+            c->start_off += len;
+            c->end = c->start_off + rest;
+            return 1;
+        }
+        c->start_off = c->end;
+        return 0;
+    }
+    if (c->body_left >= 0 && (long long)avail > c->body_left)
+        avail = c->body_left;
+    c->start_off += avail;
+    if (c->body_left >= 0)
+        c->body_left -= avail;
+    return c->body_left == 0;
+}
+
+// Function to handle readiness of a connection
+static inline void bench_event(struct bench_thread *t, struct bench_conn *c) {
+    if (c->state == BENCH_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            t->stats.connect_errors++;
+            epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+            close(c->fd);
+            c->fd = -1;                            // Retried on the next tick, not in a tight loop
+            return;
+        }
+    }
+    if (c->state == BENCH_CONNECTING || c->state == BENCH_SENDING) {
+        bench_send(t, c);
+        return;
+    }
+    for (;;) {
+        if (c->start_off == c->end) {
+            c->start_off = c->end = 0;
+        } else if (c->start_off > 0) {             // Keep unparsed bytes at the front
+            memmove(c->buf, c->buf + c->start_off, c->end - c->start_off);
+            c->end -= c->start_off;
+            c->start_off = 0;
+        }
+        if (c->end == sizeof(c->buf)) {
+            t->stats.read_errors++;                // Head too large
+            bench_reopen(t, c);
+            return;
+        }
+        ssize_t n = read(c->fd, c->buf + c->end, sizeof(c->buf) - c->end);
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n <= 0) {
+            if (n == 0 && c->state == BENCH_BODY && !c->r.chunked && c->body_left < 0)
+                bench_complete(t, c);              // The end of the connection ends this body
+            else {
+                t->stats.read_errors++;
+                bench_reopen(t, c);
+            }
+            return;
+        }
+        t->stats.bytes += n;
+        c->end += n;
+        int rc;
+        while ((rc = bench_advance(c)) == 1) {
+            int reopened = !c->r.keep_alive;
+            bench_complete(t, c);
+            if (reopened || c->state != BENCH_HEAD)
+                return;                            // New connection, or the next request is still being sent
+        }
+        if (rc < 0) {
+            t->stats.read_errors++;
+            bench_reopen(t, c);
+            return;
+        }
+    }
+}
+
+// Function to run one thread's connections until the stop time
+static inline void *bench_loop(void *arg) {
+    struct bench_thread *t = arg;
+    struct epoll_event events[256];
+    for (int i = 0; i < t->nconns; i++) {
+        struct bench_conn *c = &t->conns[i];
+        c->next_req = (t->first_conn + i) % t->nreqs;
+        bench_open(t, c);
+    }
+    double tick = fetch_now_ms();
+    for (;;) {
+        double now = fetch_now_ms();
+        if (now >= t->stop)
+            break;
+        int wait = (int)(t->stop - now) + 1;
+        int nev = epoll_wait(t->epfd, events, 256, wait < 10 ? wait : 10);
+        for (int i = 0; i < nev; i++)
+            bench_event(t, events[i].data.ptr);
+
+        // Every 10 ms: time out slow requests and reopen connections that failed
+        now = fetch_now_ms();
+        if (now < tick + 10)
+            continue;
+        tick = now;
+        for (int i = 0; i < t->nconns; i++) {
+            struct bench_conn *c = &t->conns[i];
+            if (c->fd < 0) {
+                bench_open(t, c);
+            } else if (now - c->start > t->timeout_ms) {
+                t->stats.timeouts++;
+                bench_reopen(t, c);
+            }
+        }
+    }
+    for (int i = 0; i < t->nconns; i++)
+        if (t->conns[i].fd >= 0)
+            close(t->conns[i].fd);
+    close(t->epfd);
+    return NULL;
+}
+
+// Function to load a URL's host with the given requests (nreqs formatted requests, used in turn) and return the
+// merged counts in *total. Returns the seconds actually run
+static inline double bench_run(const struct bench_options *opt, const struct sockaddr_storage *addr,
+                               socklen_t addrlen, char **reqs, size_t *req_lens, int nreqs,
+                               struct bench_stats *total) {
+    struct bench_thread *threads = calloc(opt->threads, sizeof(*threads));
+    pthread_t *ids = calloc(opt->threads, sizeof(*ids));
+    if (threads == NULL || ids == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    double start = fetch_now_ms();
+    for (int i = 0, first = 0; i < opt->threads; i++) {
+        struct bench_thread *t = &threads[i];
+        t->addr = addr;
+        t->addrlen = addrlen;
+        t->reqs = reqs;
+        t->req_lens = req_lens;
+        t->nreqs = nreqs;
+        t->nconns = opt->conns / opt->threads + (i < opt->conns % opt->threads);
+        t->first_conn = first;
+        first += t->nconns;
+        t->stop = start + opt->duration_s * 1e3;
+        t->timeout_ms = opt->timeout_ms;
+        t->epfd = epoll_create1(0);
+        t->conns = calloc(t->nconns, sizeof(*t->conns));
+        if (t->epfd < 0 || t->conns == NULL) {
+            perror("Benchmark setup failed");
+            exit(1);
+        }
+        if (pthread_create(&ids[i], NULL, bench_loop, t) != 0) {
+            perror("Thread creation failed");
+            exit(1);
+        }
+    }
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < opt->threads; i++) {
+        pthread_join(ids[i], NULL);
+        const struct bench_stats *s = &threads[i].stats;
+        total->requests += s->requests;
+        total->bytes += s->bytes;
+        total->connect_errors += s->connect_errors;
+        total->read_errors += s->read_errors;
+        total->write_errors += s->write_errors;
+        total->timeouts += s->timeouts;
+        total->status_errors += s->status_errors;
+        latency_merge(&total->hist, &s->hist);
+        free(threads[i].conns);
+    }
+    double secs = (fetch_now_ms() - start) / 1e3;
+    free(threads);
+    free(ids);
+    return secs;
+}
+
+#endif
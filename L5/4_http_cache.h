@@ -0,0 +1,401 @@
+/*
+4_http_cache.h
+- Persistent response cache for the bulk fetcher in 4_http_fetch.h, so that repeated runs over the same URLs do not
+  download the same bodies again.
+- The cache is a directory. Each URL hashes (FNV-1a, 64 bits) to two files: <hash>.body holds the body as the
+  callbacks receive it (already inflated if it came compressed) and is mmap()ed to serve it, and <hash>.meta is a
+  small text index entry. The entry holds the URL (to detect hash collisions), the validators (ETag,
+  Last-Modified), the body size and the time until which the entry is fresh.
+- A fresh entry is served straight from the body file, with no connection at all. A stale entry is fetched with
+  If-None-Match / If-Modified-Since. On 304 Not Modified only the index entry is rewritten, and the body comes from
+  the cache.
+- Freshness comes from Cache-Control max-age or Expires. Without them it is 10% of the time since Last-Modified
+  (at most a day), as HTTP caches usually do. no-cache entries are revalidated every time, and no-store responses
+  are not kept.
+- New bodies are written to a temporary file while they stream in, then renamed over the old body. The index
+  entry is renamed into place after that, so a crash never leaves an index entry pointing at a partial body.
+*/
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdio.h>      // snprintf, fopen
+#include <stdlib.h>     // strtoll
+#include <string.h>     // memcpy, strncmp
+#include <errno.h>      // EEXIST
+#include <time.h>       // time
+#include <fcntl.h>      // open
+#include <unistd.h>     // write, unlink
+#include <sys/mman.h>   // mmap
+#include <sys/stat.h>   // mkdir, fstat
+#include "4_http_fetch.h" // Bulk fetcher the cache sits in front of
+
+#define CACHE_HEURISTIC_MAX (24 * 3600)   // Longest freshness guessed from Last-Modified
+
+// Index entry of one URL
+struct cache_entry {
+    char url[2400];
+    char etag[256];             // Empty if the response had none
+    char last_modified[64];
+    long long size;
+    time_t stored;
+    time_t fresh_until;         // Served without asking the server until then
+};
+
+// A cache directory and what it saved during one run
+struct http_cache {
+    char dir[1024];
+    unsigned long fresh_hits;   // Served with no network round trip
+    unsigned long revalidated;  // 304: served from the cache after asking
+    unsigned long stored;       // New or changed bodies written
+    unsigned long misses;
+    unsigned long long bytes_saved;   // Body bytes not downloaded
+};
+
+// Per-URL state of a cached bulk fetch
+struct cache_slot {
+    struct cache_entry e;
+    int have;                   // e holds a valid entry with its body
+    int storing;                // The response body is being written to tmp_fd
+    int tmp_fd;                 // Temporary body file, or -1
+    int status;
+    char conditional[512];      // If-None-Match / If-Modified-Since lines, then the caller's extra headers
+};
+
+// State shared by the callbacks that wrap the caller's
+struct cache_fetch {
+    struct http_cache *cache;
+    struct cache_slot *slots;
+    int *index;                 // Caller's index of every URL that goes to the network
+    struct fetch_callbacks user;
+};
+
+// Function to open (creating if needed) a cache directory
+static inline int http_cache_open(struct http_cache *c, const char *dir) {
+    memset(c, 0, sizeof(*c));
+    if (snprintf(c->dir, sizeof(c->dir), "%s", dir) >= (int)sizeof(c->dir))
+        return -1;
+    return mkdir(dir, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Function to build the cache key of a URL ("http://host:port/path")
+static inline void cache_key(const struct http_url *u, char *key, size_t size) {
+    snprintf(key, size, "http://%s:%d%s", u->host, u->port, u->path);
+}
+
+// Function to name a cache file of a key: <dir>/<hash><suffix>
+static inline void cache_path(const struct http_cache *c, const char *key, const char *suffix, char *path,
+                              size_t size) {
+    unsigned long long h = 14695981039346656037ULL;   // FNV-1a 64
+    for (const char *p = key; *p; p++)
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    snprintf(path, size, "%s/%016llx%s", c->dir, h, suffix);
+}
+
+// Function to parse an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"); returns -1 if it is not one
+static inline time_t http_parse_date(const char *s, size_t len) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char buf[64], mon[4];
+    int d, y, hh, mm, ss;
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    if (sscanf(buf, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &d, mon, &y, &hh, &mm, &ss) != 6)
+        return -1;
+    const char *m = strstr(months, mon);
+    if (m == NULL || (m - months) % 3 != 0)
+        return -1;
+    int month = (m - months) / 3 + 1;
+
+    // Days since 1970-01-01 of a civil date (proleptic Gregorian calendar)
+    y -= month <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097 + doe - 719468;
+    return (time_t)days * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+// Function to work out until when a response may be served without revalidation. last_modified is used for
+// the heuristic when the response itself has none (a 304 usually). Returns -1 if it must not be stored
+static inline time_t cache_freshness(const struct http_head *hdr, const char *last_modified, time_t now) {
+    const struct http_header *cc = http_find_header(hdr, "cache-control");
+    if (cc != NULL) {
+        if (http_has_token(cc, "no-store"))
+            return -1;
+        if (http_has_token(cc, "no-cache"))
+            return 0;
+        for (size_t i = 0; i + 8 <= cc->value_len; i++)
+            if (strncasecmp(cc->value + i, "max-age=", 8) == 0)
+                return now + strtoll(cc->value + i + 8, NULL, 10);
+    }
+    const struct http_header *date = http_find_header(hdr, "date");
+    time_t served = date != NULL ? http_parse_date(date->value, date->value_len) : -1;
+    if (served < 0)
+        served = now;
+    const struct http_header *expires = http_find_header(hdr, "expires");
+    if (expires != NULL) {
+        time_t t = http_parse_date(expires->value, expires->value_len);
+        return t < 0 ? 0 : now + (t - served);     // Unparsable Expires means already expired
+    }
+    const struct http_header *lm = http_find_header(hdr, "last-modified");
+    time_t modified = lm != NULL ? http_parse_date(lm->value, lm->value_len)
+                                 : http_parse_date(last_modified, strlen(last_modified));
+    if (modified < 0 || modified > served)
+        return 0;
+    time_t guess = (served - modified) / 10;
+    return now + (guess < CACHE_HEURISTIC_MAX ? guess : CACHE_HEURISTIC_MAX);
+}
+
+// Function to copy a header value into a fixed buffer (empty if missing or too long)
+static inline void cache_copy_header(const struct http_head *hdr, const char *name, char *out, size_t size) {
+    const struct http_header *h = http_find_header(hdr, name);
+    out[0] = '\0';
+    if (h != NULL && h->value_len < size) {
+        memcpy(out, h->value, h->value_len);
+        out[h->value_len] = '\0';
+    }
+}
+
+// Function to read the index entry of a key; 0 if it exists, matches the key and its body file is complete
+static inline int cache_load(const struct http_cache *c, const char *key, struct cache_entry *e) {
+    char path[1200], line[2600];
+    cache_path(c, key, ".meta", path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    memset(e, 0, sizeof(*e));
+    e->size = -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *v = strchr(line, ' ');
+        if (v == NULL)
+            continue;
+        *v++ = '\0';
+        if (strcmp(line, "url") == 0)
+            snprintf(e->url, sizeof(e->url), "%s", v);
+        else if (strcmp(line, "etag") == 0)
+            snprintf(e->etag, sizeof(e->etag), "%s", v);
+        else if (strcmp(line, "last-modified") == 0)
+            snprintf(e->last_modified, sizeof(e->last_modified), "%s", v);
+        else if (strcmp(line, "size") == 0)
+            e->size = strtoll(v, NULL, 10);
+        else if (strcmp(line, "stored") == 0)
+            e->stored = strtoll(v, NULL, 10);
+        else if (strcmp(line, "fresh-until") == 0)
+            e->fresh_until = strtoll(v, NULL, 10);
+    }
+    fclose(fp);
+
+    struct stat st;
+    cache_path(c, key, ".body", path, sizeof(path));
+    if (strcmp(e->url, key) != 0 || e->size < 0 || stat(path, &st) < 0 || st.st_size != e->size)
+        return -1;
+    return 0;
+}
+
+// Function to write the index entry of a key (to a temporary file renamed into place)
+static inline int cache_save(const struct http_cache *c, const struct cache_entry *e) {
+    char path[1200], tmp[1220];
+    cache_path(c, e->url, ".meta", path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+        return -1;
+    fprintf(fp, "url %s\n", e->url);
+    if (e->etag[0] != '\0')
+        fprintf(fp, "etag %s\n", e->etag);
+    if (e->last_modified[0] != '\0')
+        fprintf(fp, "last-modified %s\n", e->last_modified);
+    fprintf(fp, "size %lld\nstored %lld\nfresh-until %lld\n", e->size, (long long)e->stored,
+            (long long)e->fresh_until);
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to hand a cached body to a body callback straight from its mapping
+static inline int cache_deliver(const struct http_cache *c, const struct cache_entry *e,
+                                const struct fetch_callbacks *cb, int index) {
+    char path[1200];
+    cache_path(c, e->url, ".body", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (e->size > 0 && cb->on_body != NULL) {
+        void *p = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(p, e->size, MADV_SEQUENTIAL);
+        cb->on_body(cb->ctx, index, p, e->size);
+        munmap(p, e->size);
+    }
+    close(fd);
+    return 0;
+}
+
+// Request headers callback: validators of the cached copy, then the caller's own headers
+static inline const char *cache_headers(void *ctx, int i) {
+    struct cache_fetch *cf = ctx;
+    struct cache_slot *s = &cf->slots[cf->index[i]];
+    const char *extra = cf->user.headers != NULL ? cf->user.headers(cf->user.ctx, cf->index[i]) : NULL;
+    int n = 0;
+    if (s->have && s->e.etag[0] != '\0')
+        n += snprintf(s->conditional + n, sizeof(s->conditional) - n, "If-None-Match: %s\r\n", s->e.etag);
+    if (s->have && s->e.last_modified[0] != '\0' && n < (int)sizeof(s->conditional))
+        n += snprintf(s->conditional + n, sizeof(s->conditional) - n, "If-Modified-Since: %s\r\n",
+                      s->e.last_modified);
+    if (extra != NULL && n < (int)sizeof(s->conditional))
+        snprintf(s->conditional + n, sizeof(s->conditional) - n, "%s", extra);
+    return s->conditional;
+}
+
+// Head callback: decide whether the cached copy is still good or the new body is to be stored
+static inline void cache_head(void *ctx, int i, const struct http_response *r) {
+    struct cache_fetch *cf = ctx;
+    struct cache_slot *s = &cf->slots[cf->index[i]];
+    time_t now = time(NULL);
+    s->status = r->status;
+    if (r->status == 304 && s->have) {
+        time_t fresh = cache_freshness(&r->hdr, s->e.last_modified, now);
+        s->e.fresh_until = fresh > 0 ? fresh : 0;
+        char etag[256];
+        cache_copy_header(&r->hdr, "etag", etag, sizeof(etag));
+        if (etag[0] != '\0')
+            memcpy(s->e.etag, etag, sizeof(etag));
+    } else if (r->status == 200) {
+        time_t fresh = cache_freshness(&r->hdr, "", now);
+        const struct http_header *vary = http_find_header(&r->hdr, "vary");
+        cache_copy_header(&r->hdr, "etag", s->e.etag, sizeof(s->e.etag));
+        cache_copy_header(&r->hdr, "last-modified", s->e.last_modified, sizeof(s->e.last_modified));
+        int validated = s->e.etag[0] != '\0' || s->e.last_modified[0] != '\0';
+        if (fresh >= 0 && (fresh > now || validated) && (vary == NULL || !http_has_token(vary, "*"))) {
+            char path[1200];
+            cache_path(cf->cache, s->e.url, ".tmp", path, sizeof(path));
+            snprintf(path + strlen(path), sizeof(path) - strlen(path), "%d.%d", (int)getpid(), cf->index[i]);
+            s->tmp_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            s->storing = s->tmp_fd >= 0;
+            s->e.fresh_until = fresh;
+            s->e.stored = now;
+            s->e.size = 0;
+        }
+    }
+    if (cf->user.on_head != NULL)
+        cf->user.on_head(cf->user.ctx, cf->index[i], r);
+}
+
+// Body callback: copy new bodies into the cache while passing them on
+static inline void cache_body(void *ctx, int i, const char *data, size_t len) {
+    struct cache_fetch *cf = ctx;
+    struct cache_slot *s = &cf->slots[cf->index[i]];
+    for (size_t off = 0; s->storing && off < len;) {
+        ssize_t n = write(s->tmp_fd, data + off, len - off);
+        if (n <= 0) {
+            s->storing = 0;                        // Disk trouble: fetch on, just do not keep this one
+            break;
+        }
+        off += n;
+        s->e.size += n;
+    }
+    if (cf->user.on_body != NULL)
+        cf->user.on_body(cf->user.ctx, cf->index[i], data, len);
+}
+
+// Completion callback: serve a revalidated body from the cache, or commit a newly stored one
+static inline void cache_done(void *ctx, int i, int status, unsigned long long bytes, double ms, const char *error) {
+    struct cache_fetch *cf = ctx;
+    int index = cf->index[i];
+    struct cache_slot *s = &cf->slots[index];
+    char tmp[1200], path[1200];
+    if (s->tmp_fd >= 0) {
+        cache_path(cf->cache, s->e.url, ".tmp", tmp, sizeof(tmp));
+        snprintf(tmp + strlen(tmp), sizeof(tmp) - strlen(tmp), "%d.%d", (int)getpid(), index);
+        close(s->tmp_fd);
+        s->tmp_fd = -1;
+        cache_path(cf->cache, s->e.url, ".body", path, sizeof(path));
+        if (status == 200 && s->storing && rename(tmp, path) == 0 && cache_save(cf->cache, &s->e) == 0)
+            cf->cache->stored++;
+        else
+            unlink(tmp);
+        s->storing = 0;
+    }
+    if (status == 304 && s->have) {
+        if (cache_deliver(cf->cache, &s->e, &cf->user, index) < 0) {
+            status = -1;
+            error = "cached body unreadable";
+        } else {
+            cache_save(cf->cache, &s->e);
+            cf->cache->revalidated++;
+            cf->cache->bytes_saved += s->e.size;
+            bytes = s->e.size;
+        }
+    }
+    if (cf->user.on_done != NULL)
+        cf->user.on_done(cf->user.ctx, index, status, bytes, ms, error);
+}
+
+// Function to fetch urls[0..n-1] through the cache: fresh entries are delivered at once from their body files,
+// everything else goes to fetch_all() with validators attached. Callbacks see the same indices as the URLs;
+// status 304 in on_done means the body delivered was the cached one
+static inline void cache_fetch_all(struct http_cache *c, const struct http_url *urls, int n,
+                                   const struct fetch_options *opt, const struct fetch_callbacks *cb,
+                                   struct fetch_totals *totals) {
+    struct cache_fetch cf = {c, calloc(n, sizeof(struct cache_slot)), malloc(n * sizeof(int)), *cb};
+    struct http_url *net = malloc(n * sizeof(*net));
+    if (cf.slots == NULL || cf.index == NULL || net == NULL) {
+        perror("Cache setup failed");
+        exit(1);
+    }
+    time_t now = time(NULL);
+    int nnet = 0;
+    for (int i = 0; i < n; i++) {
+        struct cache_slot *s = &cf.slots[i];
+        s->tmp_fd = -1;
+        cache_key(&urls[i], s->e.url, sizeof(s->e.url));
+        char key[sizeof(s->e.url)];
+        memcpy(key, s->e.url, sizeof(key));
+        s->have = cache_load(c, key, &s->e) == 0;
+        if (!s->have) {
+            memset(&s->e, 0, sizeof(s->e));
+            memcpy(s->e.url, key, sizeof(key));
+        }
+        // Fresh: no round trip at all (unless the caller adds headers such as a Range the copy may not match)
+        if (s->have && s->e.fresh_until > now && cb->headers == NULL) {
+            struct http_response r = {0};
+            r.status = r.hdr.status = 200;
+            r.content_length = s->e.size;
+            r.keep_alive = 1;
+            if (cb->on_head != NULL)
+                cb->on_head(cb->ctx, i, &r);
+            if (cache_deliver(c, &s->e, cb, i) == 0) {
+                c->fresh_hits++;
+                c->bytes_saved += s->e.size;
+                if (cb->on_done != NULL)
+                    cb->on_done(cb->ctx, i, 200, s->e.size, 0, NULL);
+                continue;
+            }
+            s->have = 0;                           // Body vanished: fetch it afresh
+        }
+        if (!s->have)
+            c->misses++;
+        cf.index[nnet] = i;
+        net[nnet++] = urls[i];
+    }
+
+    struct fetch_callbacks wrapped = {cache_head, cache_body, cache_done, cache_headers, &cf};
+    if (totals != NULL)
+        memset(totals, 0, sizeof(*totals));
+    if (nnet > 0)
+        fetch_all(net, nnet, opt, &wrapped, totals);
+    free(cf.slots);
+    free(cf.index);
+    free(net);
+}
+
+#endif
@@ -0,0 +1,437 @@
+/*
+4_http_dns.h
+- Non-blocking DNS resolution with an in-process cache, for the fetch loop in 4_http_fetch.h.
+- A small stub resolver: A queries go over one non-blocking UDP socket to the first nameserver in /etc/resolv.conf
+  (or a given "ip[:port]", e.g. a local test server). The caller polls the socket on its own epoll loop, so a
+  lookup never blocks. Many lookups are in flight at once; up to DNS_MAX_INFLIGHT queries are outstanding and the
+  rest wait in order.
+- Answers are cached for their TTL, taken as the smallest TTL of the records in the answer (at least DNS_MIN_TTL).
+- Negative answers are cached too (RFC 2308): NXDOMAIN or no A record for the SOA's negative TTL. Server failures
+  and timeouts are cached for DNS_FAIL_TTL seconds, so a dead name is not re-queried for every URL.
+- Queries are resent after DNS_RETRY_MS and given up after DNS_ATTEMPTS tries. Replies must match a query's random
+  ID, and the question they carry must match the name asked. Names with a label over 63 bytes are refused.
+- Numeric addresses need no query, and names in /etc/hosts (IPv4) are answered from it and never expire.
+- Only IPv4 (A records) is resolved.
+*/
+
+#ifndef HTTP_DNS_H
+#define HTTP_DNS_H
+
+#include <stdio.h>      // fopen for resolv.conf and hosts
+#include <stdlib.h>     // realloc, free
+#include <string.h>     // memcpy, strcasecmp
+#include <strings.h>    // strcasecmp
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // close
+#include <errno.h>      // EAGAIN
+#include <sys/socket.h> // UDP socket
+#include <sys/random.h> // getrandom for query IDs
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h>  // inet_pton
+
+#define DNS_MAX_INFLIGHT 64          // Queries outstanding at once
+#define DNS_RETRY_MS 1000            // Resend a query after this long without an answer
+#define DNS_ATTEMPTS 3               // Tries before a lookup fails
+#define DNS_FAIL_TTL 5               // Seconds a server failure or timeout is cached
+#define DNS_NEGATIVE_TTL 60          // Seconds NXDOMAIN is cached if the reply has no SOA
+#define DNS_MIN_TTL 1                // Shortest time an answer is cached, so a TTL of 0 is still used once
+#define DNS_MAX_TTL 86400            // Longest time any answer is cached
+
+enum { DNS_QUEUED, DNS_SENT, DNS_OK, DNS_FAILED };
+
+// One cached (or pending) name
+struct dns_entry {
+    char name[256];
+    int state;
+    struct in_addr addr;        // Valid in DNS_OK
+    double expires;             // Monotonic ms; 0 never (numeric or /etc/hosts)
+    unsigned short id;          // Query ID while in DNS_SENT
+    int tries;
+    double resend;              // When the query is sent again
+    int next;                   // Waiting FIFO link
+};
+
+struct dns_resolver {
+    int fd;                     // UDP socket connected to the nameserver
+    struct dns_entry *entries;
+    int n, cap;
+    int *table;                 // Open addressing over entry indices (-1 empty), size a power of two
+    int table_size;
+    int inflight[DNS_MAX_INFLIGHT];   // Entries with a query outstanding
+    int ninflight;
+    int wait_head, wait_tail;   // Entries waiting for a free query slot
+    unsigned long completed;    // Lookups answered or failed
+    unsigned long hits, negative_hits, queries, timeouts;
+};
+
+static inline double dns_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static inline unsigned dns_hash(const char *name) {
+    unsigned hash = 2166136261u;                   // FNV-1a over the lower-cased name
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)(*name | 0x20)) * 16777619u;
+    return hash;
+}
+
+// Function to find a name's entry, adding an empty one if add is set; -1 if absent (or out of memory)
+static inline int dns_entry_find(struct dns_resolver *r, const char *name, int add) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(r->entries[0].name))
+        return -1;
+    unsigned mask = r->table_size - 1, slot = dns_hash(name) & mask;
+    for (; r->table[slot] >= 0; slot = (slot + 1) & mask)
+        if (strcasecmp(r->entries[r->table[slot]].name, name) == 0)
+            return r->table[slot];
+    if (!add)
+        return -1;
+
+    if (2 * (r->n + 1) > r->table_size) {          // Keep the table at most half full
+        int size = r->table_size * 2, *table = malloc(size * sizeof(int));
+        if (table == NULL)
+            return -1;
+        memset(table, -1, size * sizeof(int));
+        for (int i = 0; i < r->n; i++) {
+            unsigned s = dns_hash(r->entries[i].name) & (size - 1);
+            while (table[s] >= 0)
+                s = (s + 1) & (size - 1);
+            table[s] = i;
+        }
+        free(r->table);
+        r->table = table;
+        r->table_size = size;
+        mask = size - 1;
+        for (slot = dns_hash(name) & mask; r->table[slot] >= 0; slot = (slot + 1) & mask)
+            ;
+    }
+    if (r->n == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 64;
+        struct dns_entry *e = realloc(r->entries, cap * sizeof(*e));
+        if (e == NULL)
+            return -1;
+        r->entries = e;
+        r->cap = cap;
+    }
+    struct dns_entry *e = &r->entries[r->n];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->name, name, len + 1);
+    e->state = DNS_FAILED;
+    e->expires = -1;                               // Already expired: the first lookup queries
+    r->table[slot] = r->n;
+    return r->n++;
+}
+
+// Function to read the IPv4 names of /etc/hosts into the cache, never to expire
+static inline void dns_load_hosts(struct dns_resolver *r) {
+    FILE *fp = fopen("/etc/hosts", "r");
+    if (fp == NULL)
+        return;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "#\n")] = '\0';
+        char *save, *addr = strtok_r(line, " \t", &save), *name;
+        struct in_addr a;
+        if (addr == NULL || inet_pton(AF_INET, addr, &a) != 1)
+            continue;
+        while ((name = strtok_r(NULL, " \t", &save)) != NULL) {
+            int i = dns_entry_find(r, name, 1);
+            if (i >= 0 && r->entries[i].expires != 0) {   // The first line naming a host wins
+                r->entries[i].state = DNS_OK;
+                r->entries[i].addr = a;
+                r->entries[i].expires = 0;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+// Function to set up a resolver. server is "ip[:port]", or NULL for the first nameserver in /etc/resolv.conf.
+// Returns 0, or -1 with errno set
+static inline int dns_init(struct dns_resolver *r, const char *server) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->wait_head = r->wait_tail = -1;
+    r->table_size = 256;
+    r->table = malloc(r->table_size * sizeof(int));
+    if (r->table == NULL)
+        return -1;
+    memset(r->table, -1, r->table_size * sizeof(int));
+
+    char ns[64] = "127.0.0.1";
+    if (server != NULL) {
+        snprintf(ns, sizeof(ns), "%s", server);
+    } else {
+        FILE *fp = fopen("/etc/resolv.conf", "r");
+        char line[256], addr[64];
+        struct in_addr a;
+        while (fp != NULL && fgets(line, sizeof(line), fp) != NULL)
+            if (sscanf(line, "nameserver %63s", addr) == 1 && inet_pton(AF_INET, addr, &a) == 1) {
+                memcpy(ns, addr, sizeof(ns));
+                break;
+            }
+        if (fp != NULL)
+            fclose(fp);
+    }
+    struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(53)};
+    char *colon = strchr(ns, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        sa.sin_port = htons(atoi(colon + 1));
+    }
+    if (inet_pton(AF_INET, ns, &sa.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Connected, so only the nameserver's replies are received
+    r->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (r->fd < 0 || connect(r->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        return -1;
+    dns_load_hosts(r);
+    return 0;
+}
+
+static inline void dns_free(struct dns_resolver *r) {
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r->entries);
+    free(r->table);
+}
+
+// Function to send (or resend) the A query of an entry. A resend keeps the ID, so a slow reply to an earlier
+// copy still counts
+static inline void dns_send(struct dns_resolver *r, int i, double now) {
+    struct dns_entry *e = &r->entries[i];
+    unsigned char q[300];
+    if (e->tries == 0 && getrandom(&e->id, sizeof(e->id), 0) != sizeof(e->id))
+        e->id = (unsigned short)(now * 1000) ^ i;
+    size_t n = 0;
+    q[n++] = e->id >> 8;
+    q[n++] = e->id & 0xff;
+    static const unsigned char flags[] = {0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};   // RD, one question
+    memcpy(q + n, flags, sizeof(flags));
+    n += sizeof(flags);
+    for (const char *label = e->name; *label;) {   // Name as length-prefixed labels
+        size_t len = strcspn(label, ".");
+        if (len > 0) {                             // At most 63 bytes, checked by dns_lookup()
+            q[n++] = len;
+            memcpy(q + n, label, len);
+            n += len;
+        }
+        label += len + (label[len] == '.');
+    }
+    static const unsigned char tail[] = {0, 0, 1, 0, 1};                          // Root, type A, class IN
+    memcpy(q + n, tail, sizeof(tail));
+    n += sizeof(tail);
+    send(r->fd, q, n, 0);                          // A lost datagram is resent at the deadline
+    e->state = DNS_SENT;
+    e->tries++;
+    e->resend = now + DNS_RETRY_MS;
+    r->queries++;
+}
+
+// Function to start a query now if a slot is free, or queue it
+static inline void dns_start(struct dns_resolver *r, int i, double now) {
+    struct dns_entry *e = &r->entries[i];
+    e->tries = 0;
+    if (r->ninflight < DNS_MAX_INFLIGHT) {
+        r->inflight[r->ninflight++] = i;
+        dns_send(r, i, now);
+        return;
+    }
+    e->state = DNS_QUEUED;
+    e->next = -1;
+    if (r->wait_tail >= 0)
+        r->entries[r->wait_tail].next = i;
+    else
+        r->wait_head = i;
+    r->wait_tail = i;
+}
+
+// Function to check that a name can be sent: every label fits its 6-bit length (63 bytes)
+static inline int dns_name_valid(const char *name) {
+    for (const char *label = name; *label;) {
+        size_t len = strcspn(label, ".");
+        if (len > 63)
+            return 0;
+        label += len + (label[len] == '.');
+    }
+    return 1;
+}
+
+// Function to look a name up. Returns 1 with the address, -1 if the name cannot be resolved (cached failure),
+// or 0 if a query is in progress: watch r->fd and call dns_input() and dns_expire() until it completes
+static inline int dns_lookup(struct dns_resolver *r, const char *name, struct in_addr *addr) {
+    if (inet_pton(AF_INET, name, addr) == 1)
+        return 1;
+    if (!dns_name_valid(name))
+        return -1;
+    int i = dns_entry_find(r, name, 1);
+    if (i < 0)
+        return -1;
+    struct dns_entry *e = &r->entries[i];
+    if (e->state == DNS_QUEUED || e->state == DNS_SENT)
+        return 0;
+    double now = dns_now_ms();
+    if (e->expires == 0 || e->expires > now) {
+        if (e->state == DNS_OK) {
+            r->hits++;
+            *addr = e->addr;
+            return 1;
+        }
+        r->negative_hits++;
+        return -1;
+    }
+    dns_start(r, i, now);
+    return 0;
+}
+
+// Function to finish the query of inflight slot k: cache the result for ttl seconds and send the next waiting one
+static inline void dns_complete(struct dns_resolver *r, int k, int ok, unsigned ttl, double now) {
+    struct dns_entry *e = &r->entries[r->inflight[k]];
+    e->state = ok ? DNS_OK : DNS_FAILED;
+    e->expires = now + (ttl < DNS_MIN_TTL ? DNS_MIN_TTL : ttl < DNS_MAX_TTL ? ttl : DNS_MAX_TTL) * 1000.0;
+    r->completed++;
+    r->inflight[k] = r->inflight[--r->ninflight];
+    if (r->wait_head >= 0) {
+        int i = r->wait_head;
+        r->wait_head = r->entries[i].next;
+        if (r->wait_head < 0)
+            r->wait_tail = -1;
+        r->inflight[r->ninflight++] = i;
+        dns_send(r, i, now);
+    }
+}
+
+// Function to skip an encoded (possibly compressed) name; returns the offset after it, or 0 if malformed
+static inline size_t dns_skip_name(const unsigned char *m, size_t len, size_t p) {
+    while (p < len) {
+        if (m[p] == 0)
+            return p + 1;
+        if ((m[p] & 0xc0) == 0xc0)
+            return p + 2 <= len ? p + 2 : 0;       // A pointer ends the name
+        p += 1 + m[p];
+    }
+    return 0;
+}
+
+static inline unsigned dns_u16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+static inline unsigned dns_u32(const unsigned char *p) { return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+// Function to check that a reply's question is the name an entry asked, label by label and ignoring case.
+// Returns the offset after the question, or 0 if it differs
+static inline size_t dns_question_is(const struct dns_entry *e, const unsigned char *m, size_t len) {
+    size_t p = 12;
+    for (const char *label = e->name; *label;) {
+        size_t n = strcspn(label, ".");
+        if (n > 0) {
+            if (p + 1 + n > len || m[p] != n || strncasecmp((const char *)m + p + 1, label, n) != 0)
+                return 0;
+            p += 1 + n;
+        }
+        label += n + (label[n] == '.');
+    }
+    if (p + 5 > len || m[p] != 0 || dns_u16(m + p + 1) != 1)
+        return 0;
+    return p + 5;
+}
+
+// Function to handle one reply: match it to a query and cache the answer
+static inline void dns_reply(struct dns_resolver *r, const unsigned char *m, size_t len, double now) {
+    if (len < 12 || !(m[2] & 0x80) || dns_u16(m + 4) != 1)
+        return;                                    // Not a reply to a single question
+    unsigned id = dns_u16(m), rcode = m[3] & 0x0f;
+    int k = 0;
+    size_t p = 0;
+    for (; k < r->ninflight; k++)                  // IDs are 16 bits, so two lookups may share one
+        if (r->entries[r->inflight[k]].id == id && (p = dns_question_is(&r->entries[r->inflight[k]], m, len)) > 0)
+            break;
+    if (k == r->ninflight)
+        return;                                    // Late reply to a resent query, or not ours
+
+    if (rcode != 0 && rcode != 3) {                // SERVFAIL, REFUSED, ...: a short negative entry
+        dns_complete(r, k, 0, DNS_FAIL_TTL, now);
+        return;
+    }
+    // Answers: the first A record is the address, and the smallest TTL along the chain bounds the cache time
+    unsigned ancount = dns_u16(m + 6), nscount = dns_u16(m + 8), ttl = DNS_MAX_TTL, neg_ttl = DNS_NEGATIVE_TTL;
+    int found = 0;
+    struct in_addr addr;
+    for (unsigned i = 0; i < ancount + nscount; i++) {
+        if ((p = dns_skip_name(m, len, p)) == 0 || p + 10 > len || p + 10 + dns_u16(m + p + 8) > len)
+            return;                                // Malformed: the resend or timeout decides
+        unsigned type = dns_u16(m + p), rr_ttl = dns_u32(m + p + 4), rdlen = dns_u16(m + p + 8);
+        const unsigned char *rdata = m + p + 10;
+        if (i < ancount && (type == 1 || type == 5)) {
+            if (rr_ttl < ttl)
+                ttl = rr_ttl;
+            if (type == 1 && rdlen == 4 && !found) {
+                memcpy(&addr, rdata, 4);
+                found = 1;
+            }
+        } else if (i >= ancount && type == 6 && rdlen >= 22) {
+            unsigned minimum = dns_u32(rdata + rdlen - 4);   // SOA: negative TTL is min(TTL, MINIMUM)
+            neg_ttl = rr_ttl < minimum ? rr_ttl : minimum;
+        }
+        p += 10 + rdlen;
+    }
+    if (found) {
+        r->entries[r->inflight[k]].addr = addr;
+        dns_complete(r, k, 1, ttl, now);
+    } else {
+        dns_complete(r, k, 0, neg_ttl, now);       // NXDOMAIN, or the name has no A record
+    }
+}
+
+// Function to read every reply waiting on the socket; returns how many lookups completed
+static inline int dns_input(struct dns_resolver *r) {
+    unsigned char m[1500];
+    unsigned long before = r->completed;
+    for (;;) {
+        ssize_t len = recv(r->fd, m, sizeof(m), 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            break;                                 // EAGAIN, or an ICMP error for a past query
+        dns_reply(r, m, len, dns_now_ms());
+    }
+    return r->completed - before;
+}
+
+// Function to resend queries whose answer is late and fail those out of tries; returns how many failed
+static inline int dns_expire(struct dns_resolver *r) {
+    double now = dns_now_ms();
+    int failed = 0;
+    if (r->ninflight == 0)
+        return 0;
+    for (int k = 0; k < r->ninflight;) {
+        struct dns_entry *e = &r->entries[r->inflight[k]];
+        if (e->resend > now) {
+            k++;
+        } else if (e->tries < DNS_ATTEMPTS) {
+            dns_send(r, r->inflight[k], now);
+            k++;
+        } else {
+            r->timeouts++;
+            failed++;
+            dns_complete(r, k, 0, DNS_FAIL_TTL, now);   // Moves another entry into slot k
+        }
+    }
+    return failed;
+}
+
+// Function to return the milliseconds until dns_expire() has work, or -1 if no query is outstanding
+static inline int dns_timeout(const struct dns_resolver *r) {
+    if (r->ninflight == 0)
+        return -1;
+    double first = r->entries[r->inflight[0]].resend;
+    for (int k = 1; k < r->ninflight; k++)
+        if (r->entries[r->inflight[k]].resend < first)
+            first = r->entries[r->inflight[k]].resend;
+    double left = first - dns_now_ms();
+    return left > 0 ? (int)left + 1 : 0;
+}
+
+#endif
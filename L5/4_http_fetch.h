@@ -0,0 +1,659 @@
+/*
+4_http_fetch.h
+- Bulk URL fetching for 4_https_request_response.c on a single epoll loop.
+- Up to max_conns non-blocking connections are in flight at once, and at most per_host of them to any one host;
+  URLs wait in a FIFO per host and hosts take turns, so one slow host cannot hold up the others.
+- A connection whose response allowed keep-alive goes back to its host's idle list and carries that host's next URL.
+- Every request has a deadline. Requests start in order, so the in-flight list is also ordered by deadline and
+  the loop only ever checks its head.
+- Responses are parsed incrementally as bytes arrive (see 4_http_parse.h); body bytes are streamed to a callback.
+- With compress set, requests offer gzip and deflate, and compressed bodies are inflated on the fly
+  (see 4_http_gzip.h) through one output buffer, so callbacks always see the decoded body.
+- Host names are resolved through the stub resolver of 4_http_dns.h on the same epoll loop. URLs of a host whose
+  lookup is still in flight wait in its queue, while other hosts proceed. Answers stay cached in the resolver,
+  which the caller may share between fetches.
+- struct latency_hist records latencies in log2 buckets with 16 linear sub-buckets each (about 6% resolution).
+*/
+
+#ifndef HTTP_FETCH_H
+#define HTTP_FETCH_H
+
+#include <errno.h>      // EAGAIN / EINPROGRESS
+#include <fcntl.h>      // O_NONBLOCK
+#include <time.h>       // clock_gettime
+#include <sys/epoll.h>  // epoll API
+#include "4_http.h"     // URLs, request formatting and response framing
+#include "4_http_gzip.h" // Streaming inflate of compressed bodies
+#include "4_http_dns.h" // Non-blocking resolver with TTL cache
+
+#define FETCH_REQ_MAX 4096           // Longest request a connection can hold
+#define FETCH_MAX_RETRIES 2          // Resends after a reused connection turned out to be closed
+
+// Callbacks for a bulk fetch; any may be NULL
+struct fetch_callbacks {
+    void (*on_head)(void *ctx, int index, const struct http_response *r);
+    void (*on_body)(void *ctx, int index, const char *data, size_t len);
+    // status is -1 if the request failed, with error describing why
+    void (*on_done)(void *ctx, int index, int status, unsigned long long bytes, double ms, const char *error);
+    // Extra header lines for a request, each ending in CRLF (e.g. a Range), or NULL
+    const char *(*headers)(void *ctx, int index);
+    void *ctx;
+};
+
+struct fetch_options {
+    int max_conns;              // Connections in flight at once
+    int per_host;               // Connections in flight to one host
+    int timeout_ms;             // Per-request deadline
+    int compress;               // Send Accept-Encoding: gzip, deflate and decode what comes back
+    struct dns_resolver *dns;   // Resolver (and its cache) to use, or NULL for one set up from /etc/resolv.conf
+};
+
+// What a bulk fetch cost
+struct fetch_totals {
+    unsigned long connects;
+    unsigned long long wire_bytes;    // Body bytes received, before decoding
+    unsigned long long body_bytes;    // Body bytes delivered to the callbacks
+};
+
+enum { FETCH_CONNECTING, FETCH_SENDING, FETCH_HEAD, FETCH_BODY, FETCH_IDLE };
+
+struct fetch_conn {
+    struct http_conn io;        // Socket and receive buffer
+    int host;                   // Index of its host
+    int url;                    // Request in progress
+    int state;
+    int reused;                 // The connection served an earlier response
+    size_t req_len, req_sent;
+    char req[FETCH_REQ_MAX];
+    struct http_response r;
+    size_t scanned;             // Head scan progress
+    struct http_chunked chunk;  // Chunked decoding state
+    long long body_left;        // Content-Length bytes still to come
+    unsigned long long bytes;   // Body bytes delivered
+    int coding;                 // Content coding of the current body
+    struct http_inflate *inflate;     // Kept for the connection's next compressed body
+    double started, deadline;   // Milliseconds on the monotonic clock
+    struct fetch_conn *prev, *next;   // In-flight list, oldest first
+    struct fetch_conn *idle_next;     // Host idle list
+};
+
+struct fetch_host {
+    struct http_url name;       // Host and port (path unused)
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int resolved;               // 1 resolved, 0 lookup in flight, -1 failed
+    int active;                 // Connections busy with a request
+    int pending_head, pending_tail;   // FIFO of waiting URLs, linked through fetcher.next_url
+    int in_ring;                // Queued in the ready ring
+    struct fetch_conn *idle;
+};
+
+struct fetcher {
+    const struct http_url *urls;
+    int nurls;
+    struct fetch_options opt;
+    struct fetch_callbacks cb;
+    int *url_host;              // Host of every URL
+    int *next_url;              // Pending FIFO links
+    unsigned char *retries;
+    struct fetch_host *hosts;
+    int nhosts;
+    struct dns_resolver *dns;
+    int *resolving;             // Hosts waiting for their lookup
+    int nresolving;
+    int *ring;                  // Hosts with waiting URLs and a free connection slot
+    int ring_head, ring_len;
+    struct fetch_conn *oldest, *newest;   // In-flight list
+    int inflight, done;
+    int epfd;
+    struct fetch_totals totals;
+    struct fetch_conn *emitting;      // Connection whose body is being inflated
+    char *zbuf;                       // Inflate output buffer
+};
+
+// Latency histogram: bucket (e, s) holds values in [2^e + s * 2^e / 16, 2^e + (s + 1) * 2^e / 16) microseconds
+struct latency_hist {
+    unsigned long long count[64 * 16];
+    unsigned long long total;
+    double max_ms;
+};
+
+static inline double fetch_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static inline int latency_bucket(unsigned long long us) {
+    if (us < 16)
+        return us;                                 // Exact below 16 us
+    int e = 63 - __builtin_clzll(us);
+    return e * 16 + ((us >> (e - 4)) & 15);
+}
+
+// Function to record one latency
+static inline void latency_add(struct latency_hist *h, double ms) {
+    h->count[latency_bucket((unsigned long long)(ms * 1000))]++;
+    h->total++;
+    if (ms > h->max_ms)
+        h->max_ms = ms;
+}
+
+// Function to add the counts of one histogram to another
+static inline void latency_merge(struct latency_hist *to, const struct latency_hist *from) {
+    for (int i = 0; i < 64 * 16; i++)
+        to->count[i] += from->count[i];
+    to->total += from->total;
+    if (from->max_ms > to->max_ms)
+        to->max_ms = from->max_ms;
+}
+
+// Function to return the latency (upper edge of its bucket, in ms) below which a fraction q of the samples fall
+static inline double latency_percentile(const struct latency_hist *h, double q) {
+    unsigned long long want = (unsigned long long)(q * h->total + 0.5), seen = 0;
+    for (int i = 0; i < 64 * 16; i++) {
+        seen += h->count[i];
+        if (seen >= want && seen > 0) {
+            if (i < 16)
+                return (i + 1) / 1000.0;
+            int e = i / 16, s = i % 16;
+            double upper = (double)(1ULL << e) + (s + 1) * (double)(1ULL << e) / 16;
+            return upper / 1000.0 < h->max_ms ? upper / 1000.0 : h->max_ms;
+        }
+    }
+    return h->max_ms;
+}
+
+// Function to print percentiles and a bar per power-of-two millisecond range
+static inline void latency_print(const struct latency_hist *h) {
+    if (h->total == 0)
+        return;
+    printf("Latency: p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  p99.9 %.2f ms  max %.2f ms\n",
+           latency_percentile(h, 0.5), latency_percentile(h, 0.9), latency_percentile(h, 0.99),
+           latency_percentile(h, 0.999), h->max_ms);
+    unsigned long long ranges[40] = {0};           // ranges[k]: [2^(k-1), 2^k) ms, ranges[0]: below 1 ms
+    for (int i = 0; i < 64 * 16; i++) {
+        if (h->count[i] == 0)
+            continue;
+        double ms = (i < 16 ? i : (double)(1ULL << (i / 16)) * (1 + (i % 16) / 16.0)) / 1000.0;
+        int k = ms < 1 ? 0 : 64 - __builtin_clzll((unsigned long long)ms);
+        ranges[k < 40 ? k : 39] += h->count[i];
+    }
+    for (int k = 0; k < 40; k++) {
+        if (ranges[k] == 0)
+            continue;
+        int bar = (int)(50.0 * ranges[k] / h->total + 0.5);
+        if (k == 0)
+            printf("  %8s < %-6d ms %8llu |", "", 1, ranges[k]);
+        else
+            printf("  %8d - %-6d ms %8llu |", 1 << (k - 1), 1 << k, ranges[k]);
+        for (int i = 0; i < bar; i++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+// Function to queue a host in the ready ring if it has waiting URLs and a free connection slot
+static inline void fetch_ready(struct fetcher *f, int h) {
+    struct fetch_host *host = &f->hosts[h];
+    if (!host->in_ring && host->resolved > 0 && host->pending_head >= 0 && host->active < f->opt.per_host) {
+        f->ring[(f->ring_head + f->ring_len++) % f->nhosts] = h;
+        host->in_ring = 1;
+    }
+}
+
+// Function to put a URL back at the front of its host's queue (for a resend)
+static inline void fetch_requeue(struct fetcher *f, int url) {
+    struct fetch_host *host = &f->hosts[f->url_host[url]];
+    f->next_url[url] = host->pending_head;
+    host->pending_head = url;
+    if (host->pending_tail < 0)
+        host->pending_tail = url;
+}
+
+static inline void fetch_unlink(struct fetcher *f, struct fetch_conn *c) {
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        f->oldest = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    else
+        f->newest = c->prev;
+    c->prev = c->next = NULL;
+}
+
+// Function to close a connection and free it
+static inline void fetch_close(struct fetcher *f, struct fetch_conn *c) {
+    epoll_ctl(f->epfd, EPOLL_CTL_DEL, c->io.fd, NULL);
+    close(c->io.fd);
+    if (c->inflate != NULL) {
+        http_inflate_free(c->inflate);
+        free(c->inflate);
+    }
+    free(c);
+}
+
+// Function to end the request on a connection. error NULL means success; the connection then stays open
+// for the host's next URL if the response allowed it. A failed request on a reused connection is resent once
+// in case the server had just closed it
+static inline void fetch_finish(struct fetcher *f, struct fetch_conn *c, const char *error) {
+    int h = c->host, url = c->url;
+    struct fetch_host *host = &f->hosts[h];
+    fetch_unlink(f, c);
+    f->inflight--;
+    host->active--;
+
+    int nothing_received = c->state <= FETCH_HEAD && c->io.end == 0 && c->scanned == 0;
+    if (error != NULL && c->reused && nothing_received && f->retries[url] < FETCH_MAX_RETRIES
+        && strcmp(error, "timeout") != 0) {
+        f->retries[url]++;
+        fetch_requeue(f, url);
+    } else {
+        if (f->cb.on_done != NULL)
+            f->cb.on_done(f->cb.ctx, url, error == NULL ? c->r.status : -1, c->bytes,
+                          fetch_now_ms() - c->started, error);
+        f->done++;
+    }
+
+    if (error == NULL && c->r.keep_alive && c->io.start == c->io.end) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        epoll_ctl(f->epfd, EPOLL_CTL_MOD, c->io.fd, &ev);   // Notice if the server closes it while idle
+        c->state = FETCH_IDLE;
+        c->reused = 1;
+        c->idle_next = host->idle;
+        host->idle = c;
+    } else {
+        fetch_close(f, c);
+    }
+    fetch_ready(f, h);
+}
+
+// Function to start URL url on an idle connection to its host or on a new one
+static inline void fetch_start(struct fetcher *f, int url) {
+    int h = f->url_host[url];
+    struct fetch_host *host = &f->hosts[h];
+    struct fetch_conn *c = host->idle;
+    const char *error = NULL;
+
+    if (c != NULL) {
+        host->idle = c->idle_next;
+        c->state = FETCH_SENDING;
+    } else if ((c = malloc(sizeof(*c))) == NULL) {
+        error = "out of memory";
+    } else {
+        c->reused = 0;
+        c->inflate = NULL;
+        c->io.fd = socket(host->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(c->io.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c->io.fd < 0 || (connect(c->io.fd, (struct sockaddr *)&host->addr, host->addrlen) < 0
+                             && errno != EINPROGRESS)) {
+            error = "connect failed";
+            if (c->io.fd >= 0)
+                close(c->io.fd);
+            free(c);
+        } else {
+            struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+            epoll_ctl(f->epfd, EPOLL_CTL_ADD, c->io.fd, &ev);
+            c->state = FETCH_CONNECTING;
+            f->totals.connects++;
+        }
+    }
+    if (error != NULL) {
+        if (f->cb.on_done != NULL)
+            f->cb.on_done(f->cb.ctx, url, -1, 0, 0, error);
+        f->done++;
+        return;
+    }
+
+    c->host = h;
+    c->url = url;
+    c->io.start = c->io.end = 0;
+    c->scanned = 0;
+    c->bytes = 0;
+    c->r.head = 0;
+    c->r.body_len = 0;
+    c->req_sent = 0;
+    c->coding = HTTP_CODING_IDENTITY;
+    const char *extra = f->cb.headers != NULL ? f->cb.headers(f->cb.ctx, url) : NULL;
+    char headers[1024];
+    if (f->opt.compress) {
+        snprintf(headers, sizeof(headers), "Accept-Encoding: gzip, deflate\r\n%s", extra != NULL ? extra : "");
+        extra = headers;
+    }
+    c->req_len = http_format_request(c->req, sizeof(c->req), "GET", &f->urls[url], 1, extra);
+    c->started = fetch_now_ms();
+    c->deadline = c->started + f->opt.timeout_ms;
+    c->prev = f->newest;                           // Newest request has the latest deadline
+    c->next = NULL;
+    if (f->newest != NULL)
+        f->newest->next = c;
+    else
+        f->oldest = c;
+    f->newest = c;
+    f->inflight++;
+    host->active++;
+    if (c->state == FETCH_SENDING) {
+        struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+        epoll_ctl(f->epfd, EPOLL_CTL_MOD, c->io.fd, &ev);
+    }
+}
+
+// Function to apply the result of a host's lookup: set its address, or fail every URL waiting for it
+static inline void fetch_resolve(struct fetcher *f, int h, int rc, struct in_addr addr) {
+    struct fetch_host *host = &f->hosts[h];
+    host->resolved = rc;
+    if (rc > 0) {
+        struct sockaddr_in *sa = (struct sockaddr_in *)&host->addr;
+        memset(sa, 0, sizeof(*sa));
+        sa->sin_family = AF_INET;
+        sa->sin_port = htons(host->name.port);
+        sa->sin_addr = addr;
+        host->addrlen = sizeof(*sa);
+        fetch_ready(f, h);
+        return;
+    }
+    for (int url = host->pending_head; url >= 0; url = f->next_url[url]) {
+        if (f->cb.on_done != NULL)
+            f->cb.on_done(f->cb.ctx, url, -1, 0, 0, "cannot resolve host");
+        f->done++;
+    }
+    host->pending_head = host->pending_tail = -1;
+}
+
+// Function to pick up the lookups that have completed
+static inline void fetch_resolved(struct fetcher *f) {
+    for (int i = 0; i < f->nresolving;) {
+        int h = f->resolving[i];
+        struct in_addr addr;
+        int rc = dns_lookup(f->dns, f->hosts[h].name.host, &addr);
+        if (rc == 0) {
+            i++;
+            continue;
+        }
+        f->resolving[i] = f->resolving[--f->nresolving];
+        fetch_resolve(f, h, rc, addr);
+    }
+}
+
+// Function to start as many waiting URLs as the connection limits allow, hosts taking turns
+static inline void fetch_dispatch(struct fetcher *f) {
+    while (f->inflight < f->opt.max_conns && f->ring_len > 0) {
+        int h = f->ring[f->ring_head];
+        f->ring_head = (f->ring_head + 1) % f->nhosts;
+        f->ring_len--;
+        struct fetch_host *host = &f->hosts[h];
+        host->in_ring = 0;
+        if (host->pending_head < 0 || host->active >= f->opt.per_host)
+            continue;
+        int url = host->pending_head;
+        host->pending_head = f->next_url[url];
+        if (host->pending_head < 0)
+            host->pending_tail = -1;
+        fetch_start(f, url);
+        fetch_ready(f, h);
+    }
+}
+
+// Function to hand decoded body bytes to the callback
+static inline void fetch_emit(void *ctx, const char *data, size_t len) {
+    struct fetcher *f = ctx;
+    struct fetch_conn *c = f->emitting;
+    c->bytes += len;
+    f->totals.body_bytes += len;
+    if (f->cb.on_body != NULL && len > 0)
+        f->cb.on_body(f->cb.ctx, c->url, data, len);
+}
+
+// Function to pass body bytes on as received, inflating them first if the body is compressed; -1 if corrupt
+static inline int fetch_deliver(struct fetcher *f, struct fetch_conn *c, const char *data, size_t len) {
+    f->totals.wire_bytes += len;
+    f->emitting = c;
+    if (c->coding == HTTP_CODING_GZIP || c->coding == HTTP_CODING_DEFLATE)
+        return http_inflate_feed(c->inflate, data, len, f->zbuf, HTTP_INFLATE_OUT, fetch_emit, f);
+    fetch_emit(f, data, len);
+    return 0;
+}
+
+// Function to tell whether a body that has ended was also complete as a compressed stream
+static inline int fetch_body_complete(const struct fetch_conn *c) {
+    return (c->coding != HTTP_CODING_GZIP && c->coding != HTTP_CODING_DEFLATE) || c->inflate->finished;
+}
+
+// Function to parse what has arrived; returns 1 when the response is complete, 0 if more is needed, -1 if bad
+static inline int fetch_advance(struct fetcher *f, struct fetch_conn *c) {
+    struct http_conn *io = &c->io;
+    while (c->state == FETCH_HEAD) {
+        ssize_t n = http_parse_head(io->buf + io->start, io->end - io->start, &c->scanned, &c->r.hdr);
+        if (n <= 0)
+            return n;
+        io->start += n;
+        c->scanned = 0;
+        if (c->r.hdr.status >= 100 && c->r.hdr.status < 200)
+            continue;                              // Interim response
+        http_apply_head(&c->r);
+        if (f->cb.on_head != NULL)
+            f->cb.on_head(f->cb.ctx, c->url, &c->r);
+        if (!http_has_body(&c->r))
+            return 1;
+        c->state = FETCH_BODY;
+        c->body_left = c->r.content_length;
+        c->coding = f->opt.compress ? http_content_coding(&c->r.hdr) : HTTP_CODING_IDENTITY;
+        if (c->coding == HTTP_CODING_GZIP || c->coding == HTTP_CODING_DEFLATE) {
+            if (c->inflate == NULL && (c->inflate = calloc(1, sizeof(*c->inflate))) == NULL)
+                return -1;
+            if (http_inflate_start(c->inflate, c->coding, 0) < 0)
+                return -1;
+        }
+        memset(&c->chunk, 0, sizeof(c->chunk));
+        if (!c->r.chunked && c->body_left < 0)
+            c->r.keep_alive = 0;                   // Body ends with the connection
+    }
+
+    size_t avail = io->end - io->start;
+    if (c->r.chunked) {
+        size_t len = avail;
+        ssize_t rest = http_decode_chunked(&c->chunk, io->buf + io->start, &len);
+        if (rest == -1 || fetch_deliver(f, c, io->buf + io->start, len) < 0)
+            return -1;
+        if (rest >= 0) {
+            io->start += len;
+            io->end = io->start + rest;
+            return fetch_body_complete(c) ? 1 : -1;
+        }
+        io->start = io->end;
+        return 0;
+    }
+    if (c->body_left >= 0 && (long long)avail > c->body_left)
+        avail = c->body_left;
+    if (fetch_deliver(f, c, io->buf + io->start, avail) < 0)
+        return -1;
+    io->start += avail;
+    if (c->body_left >= 0)
+        c->body_left -= avail;
+    if (c->body_left != 0)
+        return 0;
+    return fetch_body_complete(c) ? 1 : -1;
+}
+
+// Function to handle readiness of a connection
+static inline void fetch_event(struct fetcher *f, struct fetch_conn *c, unsigned events) {
+    if (c->state == FETCH_IDLE) {                  // Server closed an idle connection (or sent junk)
+        struct fetch_host *host = &f->hosts[c->host];
+        struct fetch_conn **p = &host->idle;
+        while (*p != c)
+            p = &(*p)->idle_next;
+        *p = c->idle_next;
+        fetch_close(f, c);
+        return;
+    }
+    if (c->state == FETCH_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->io.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            fetch_finish(f, c, "connect failed");
+            return;
+        }
+        c->state = FETCH_SENDING;
+    }
+    if (c->state == FETCH_SENDING) {
+        while (c->req_sent < c->req_len) {
+            ssize_t n = send(c->io.fd, c->req + c->req_sent, c->req_len - c->req_sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EAGAIN)
+                return;
+            if (n <= 0) {
+                fetch_finish(f, c, "send failed");
+                return;
+            }
+            c->req_sent += n;
+        }
+        c->state = FETCH_HEAD;
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        epoll_ctl(f->epfd, EPOLL_CTL_MOD, c->io.fd, &ev);
+        return;                                    // The response cannot be there yet
+    }
+
+    for (;;) {
+        struct http_conn *io = &c->io;
+        if (io->start > 0) {                       // Keep unparsed bytes at the front
+            memmove(io->buf, io->buf + io->start, io->end - io->start);
+            io->end -= io->start;
+            io->start = 0;
+        }
+        if (io->end == sizeof(io->buf)) {
+            fetch_finish(f, c, "head too large");
+            return;
+        }
+        ssize_t n = read(io->fd, io->buf + io->end, sizeof(io->buf) - io->end);
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n <= 0) {
+            if (n == 0 && c->state == FETCH_BODY && !c->r.chunked && c->body_left < 0 && fetch_body_complete(c))
+                fetch_finish(f, c, NULL);          // The end of the connection ends this body
+            else
+                fetch_finish(f, c, n == 0 ? "connection closed" : "read failed");
+            return;
+        }
+        io->end += n;
+        int rc = fetch_advance(f, c);
+        if (rc != 0) {
+            fetch_finish(f, c, rc > 0 ? NULL : "bad response");
+            return;
+        }
+    }
+}
+
+// Function to fetch urls[0..n-1]; callbacks run on this thread as responses arrive. totals (may be NULL)
+// receives the connection and byte counts
+static inline void fetch_all(const struct http_url *urls, int n, const struct fetch_options *opt,
+                             const struct fetch_callbacks *cb, struct fetch_totals *totals) {
+    struct fetcher f = {0};
+    f.urls = urls;
+    f.nurls = n;
+    f.opt = *opt;
+    f.cb = *cb;
+    f.url_host = malloc(n * sizeof(int));
+    f.next_url = malloc(n * sizeof(int));
+    f.retries = calloc(n, 1);
+    f.hosts = malloc(n * sizeof(*f.hosts));
+    f.ring = malloc(n * sizeof(int));
+    f.resolving = malloc(n * sizeof(int));
+    f.epfd = epoll_create1(0);
+    f.zbuf = malloc(HTTP_INFLATE_OUT);
+    struct dns_resolver own_dns;
+    f.dns = opt->dns != NULL ? opt->dns : &own_dns;
+    if (f.zbuf == NULL || f.url_host == NULL || f.next_url == NULL || f.retries == NULL || f.hosts == NULL || f.ring == NULL
+        || f.resolving == NULL || f.epfd < 0 || (opt->dns == NULL && dns_init(&own_dns, NULL) < 0)) {
+        perror("Fetcher setup failed");
+        exit(1);
+    }
+    struct epoll_event dns_ev = {.events = EPOLLIN, .data.ptr = NULL};   // NULL marks the resolver socket
+    epoll_ctl(f.epfd, EPOLL_CTL_ADD, f.dns->fd, &dns_ev);
+
+    // Group the URLs by host (hash table of host indices); lookups start here and complete on the loop
+    int hsize = 1;
+    while (hsize < 2 * n)
+        hsize <<= 1;
+    int *table = malloc(hsize * sizeof(int));
+    memset(table, -1, hsize * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        unsigned hash = urls[i].port;
+        for (const char *p = urls[i].host; *p; p++)
+            hash = hash * 31 + (*p | 0x20);
+        int slot = hash & (hsize - 1);
+        while (table[slot] >= 0 && !http_same_host(&f.hosts[table[slot]].name, &urls[i]))
+            slot = (slot + 1) & (hsize - 1);
+        if (table[slot] < 0) {
+            struct fetch_host *host = &f.hosts[f.nhosts];
+            memset(host, 0, sizeof(*host));
+            host->name = urls[i];
+            host->pending_head = host->pending_tail = -1;
+            f.resolving[f.nresolving++] = f.nhosts;
+            table[slot] = f.nhosts++;
+        }
+        int h = table[slot];
+        f.url_host[i] = h;
+        f.next_url[i] = -1;
+        if (f.hosts[h].pending_tail >= 0)
+            f.next_url[f.hosts[h].pending_tail] = i;
+        else
+            f.hosts[h].pending_head = i;
+        f.hosts[h].pending_tail = i;
+    }
+    free(table);
+    fetch_resolved(&f);                            // Cached names and addresses are ready at once
+
+    struct epoll_event events[256];
+    while (f.done < n) {
+        fetch_dispatch(&f);
+        int timeout = -1;
+        if (f.oldest != NULL) {
+            double left = f.oldest->deadline - fetch_now_ms();
+            timeout = left > 0 ? (int)left + 1 : 0;
+        }
+        int dns_timeout_ms = f.nresolving > 0 ? dns_timeout(f.dns) : -1;
+        if (dns_timeout_ms >= 0 && (timeout < 0 || dns_timeout_ms < timeout))
+            timeout = dns_timeout_ms;
+        int nev = epoll_wait(f.epfd, events, 256, timeout);
+        if (nev < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            exit(1);
+        }
+        for (int i = 0; i < nev; i++) {
+            if (events[i].data.ptr == NULL) {
+                if (dns_input(f.dns) > 0)
+                    fetch_resolved(&f);
+            } else {
+                fetch_event(&f, events[i].data.ptr, events[i].events);
+            }
+        }
+        if (f.nresolving > 0 && dns_expire(f.dns) > 0)
+            fetch_resolved(&f);
+        double now = fetch_now_ms();
+        while (f.oldest != NULL && f.oldest->deadline <= now)
+            fetch_finish(&f, f.oldest, "timeout");
+    }
+
+    for (int h = 0; h < f.nhosts; h++)
+        while (f.hosts[h].idle != NULL) {
+            struct fetch_conn *c = f.hosts[h].idle;
+            f.hosts[h].idle = c->idle_next;
+            fetch_close(&f, c);
+        }
+    if (totals != NULL)
+        *totals = f.totals;
+    if (opt->dns == NULL)
+        dns_free(&own_dns);
+    free(f.resolving);
+    close(f.epfd);
+    free(f.zbuf);
+    free(f.url_host);
+    free(f.next_url);
+    free(f.retries);
+    free(f.hosts);
+    free(f.ring);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+4_http_gzip.h
+- Streaming gzip / deflate decoding of response bodies for 4_http_fetch.h (link with -lz).
+- Compressed bytes are inflated as they arrive, through an output buffer of fixed size owned by the caller, and
+  every filled buffer is handed to a callback. Memory stays the same however large the response is.
+- A connection keeps one inflate context: it is set up on its first compressed response and only reset
+  (inflateReset2) for the next, so zlib's window and tables are not allocated per response.
+- "deflate" is meant to be zlib-wrapped, but some servers send raw deflate. The zlib header is checked on the
+  first bytes and decoding switches to raw deflate if it is not there.
+- A gzip body may hold several members one after another, and they are decoded in turn.
+*/
+
+#ifndef HTTP_GZIP_H
+#define HTTP_GZIP_H
+
+#include <stdlib.h>     // calloc, free
+#include <zlib.h>       // inflate
+#include "4_http_parse.h" // Header lookup
+
+#define HTTP_INFLATE_OUT (64 * 1024)   // Output buffer size used by the fetcher
+
+enum { HTTP_CODING_IDENTITY, HTTP_CODING_GZIP, HTTP_CODING_DEFLATE, HTTP_CODING_OTHER };
+
+// Inflate state of one connection
+struct http_inflate {
+    z_stream z;
+    int ready;                  // inflateInit2 has been called
+    int coding;                 // HTTP_CODING_GZIP or HTTP_CODING_DEFLATE
+    int started;                // Input has been fed for the current body
+    int finished;               // The stream (or the last gzip member so far) is complete
+    unsigned long long in_total, out_total;
+};
+
+// Function to find the content coding of a response from its Content-Encoding field
+static inline int http_content_coding(const struct http_head *hdr) {
+    const struct http_header *h = http_find_header(hdr, "content-encoding");
+    if (h == NULL || h->value_len == 0 || http_header_is(h, "identity", 8))
+        return HTTP_CODING_IDENTITY;
+    if (h->value_len == 4 && strncasecmp(h->value, "gzip", 4) == 0)
+        return HTTP_CODING_GZIP;
+    if (h->value_len == 6 && strncasecmp(h->value, "x-gzip", 6) == 0)
+        return HTTP_CODING_GZIP;
+    if (h->value_len == 7 && strncasecmp(h->value, "deflate", 7) == 0)
+        return HTTP_CODING_DEFLATE;
+    return HTTP_CODING_OTHER;
+}
+
+// Function to (re)initialise a context for a body with the given coding; windowBits picks the wrapper
+static inline int http_inflate_start(struct http_inflate *d, int coding, int window_bits) {
+    if (window_bits == 0)
+        window_bits = coding == HTTP_CODING_GZIP ? 16 + MAX_WBITS : MAX_WBITS;
+    if (!d->ready) {
+        memset(&d->z, 0, sizeof(d->z));
+        if (inflateInit2(&d->z, window_bits) != Z_OK)
+            return -1;
+        d->ready = 1;
+    } else if (inflateReset2(&d->z, window_bits) != Z_OK) {
+        return -1;
+    }
+    d->coding = coding;
+    d->started = 0;
+    d->finished = 0;
+    return 0;
+}
+
+// Function to inflate len more body bytes, calling emit for every filled stretch of out[0..out_size).
+// Returns 0, or -1 if the data is corrupt
+static inline int http_inflate_feed(struct http_inflate *d, const char *data, size_t len, char *out,
+                                    size_t out_size, void (*emit)(void *ctx, const char *data, size_t len),
+                                    void *ctx) {
+    // Raw deflate where a zlib header was expected: CMF/FLG must name method 8 and be a multiple of 31
+    if (!d->started && d->coding == HTTP_CODING_DEFLATE && len >= 2) {
+        unsigned char cmf = data[0], flg = data[1];
+        if ((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 != 0)
+            http_inflate_start(d, HTTP_CODING_DEFLATE, -MAX_WBITS);
+    }
+    d->started |= len > 0;
+    d->in_total += len;
+    d->z.next_in = (Bytef *)data;
+    d->z.avail_in = len;
+    while (d->z.avail_in > 0) {
+        if (d->finished) {
+            if (d->coding != HTTP_CODING_GZIP)
+                break;                             // Anything after a deflate stream is ignored
+            d->finished = 0;                       // Another gzip member follows
+        }
+        d->z.next_out = (Bytef *)out;
+        d->z.avail_out = out_size;
+        int rc = inflate(&d->z, Z_NO_FLUSH);
+        size_t produced = out_size - d->z.avail_out;
+        if (produced > 0) {
+            d->out_total += produced;
+            emit(ctx, out, produced);
+        }
+        if (rc == Z_STREAM_END) {
+            d->finished = 1;
+            if (d->coding == HTTP_CODING_GZIP)
+                inflateReset(&d->z);               // Ready for a following member
+        } else if (rc == Z_BUF_ERROR && produced == 0) {
+            break;                                 // Needs more input
+        } else if (rc != Z_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to release a context
+static inline void http_inflate_free(struct http_inflate *d) {
+    if (d->ready)
+        inflateEnd(&d->z);
+    d->ready = 0;
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*
+4_http_parse.h
+- Incremental HTTP/1.1 response parsing for 4_http.h, without copying.
+- http_parse_request() parses request heads the same way, for the static file server in 4_https_request_response.c.
+- http_parse_head() can be called again after every read: it remembers how far it has scanned for the blank line
+  that ends the head, so no byte is scanned twice. Once the head is complete it returns the status, reason and
+  header fields as (pointer, length) views into the receive buffer.
+- Line ends and ':' are found 32 bytes at a time with AVX2 or 16 with SSE4.2 (PCMPESTRI), chosen once at startup.
+- http_decode_chunked() removes chunked framing in place. It is a byte-level state machine, so a chunk size
+  line, chunk or trailer may be split across reads at any point.
+*/
+
+#ifndef HTTP_PARSE_H
+#define HTTP_PARSE_H
+
+#include <stddef.h>     // size_t
+#include <string.h>     // memmove
+#include <strings.h>    // strncasecmp
+#include <sys/types.h>  // ssize_t
+#include <immintrin.h>  // SSE4.2 / AVX2 intrinsics
+
+#define HTTP_MAX_HEADERS 64
+
+// One header field: views into the receive buffer
+struct http_header {
+    const char *name;
+    size_t name_len;
+    const char *value;          // Without surrounding whitespace
+    size_t value_len;
+};
+
+// Parsed request head
+struct http_request {
+    const char *method;
+    size_t method_len;
+    const char *target;         // Request target as sent, query string included
+    size_t target_len;
+    int minor;                  // HTTP/1.<minor>
+    struct http_header headers[HTTP_MAX_HEADERS];
+    int nheaders;
+};
+
+// Parsed response head
+struct http_head {
+    int minor;                  // HTTP/1.<minor>
+    int status;
+    const char *reason;
+    size_t reason_len;
+    struct http_header headers[HTTP_MAX_HEADERS];
+    int nheaders;
+};
+
+// Function to find the first byte equal to a or b in [p, end); returns end if there is none (scalar version)
+static inline const char *http_find2_scalar(const char *p, const char *end, char a, char b) {
+    for (; p < end; p++)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+
+// Function to find the first byte equal to a or b, 16 bytes per PCMPESTRI
+__attribute__((target("sse4.2")))
+static inline const char *http_find2_sse42(const char *p, const char *end, char a, char b) {
+    __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int i = _mm_cmpestri(set, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (i < 16)
+            return p + i;
+    }
+    return http_find2_scalar(p, end, a, b);
+}
+
+// Function to find the first byte equal to a or b, 32 bytes per comparison
+__attribute__((target("avx2,bmi")))
+static inline const char *http_find2_avx2(const char *p, const char *end, char a, char b) {
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; p + 32 <= end; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask != 0)
+            return p + _tzcnt_u32(mask);
+    }
+    return http_find2_scalar(p, end, a, b);
+}
+
+static const char *(*http_find2_kernel)(const char *, const char *, char, char) = http_find2_scalar;
+
+// Function to pick the widest kernel this CPU supports. It runs as a constructor, before main() and so before any
+// thread, because the parser is called from several threads at once
+__attribute__((constructor))
+static void http_find2_init(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        http_find2_kernel = http_find2_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        http_find2_kernel = http_find2_sse42;
+}
+
+// Function to find the first a or b with the kernel chosen at startup
+static inline const char *http_find2(const char *p, const char *end, char a, char b) {
+    return http_find2_kernel(p, end, a, b);
+}
+
+// Function to compare a header name with a lower-case name, ignoring case
+static inline int http_header_is(const struct http_header *h, const char *name, size_t len) {
+    return h->name_len == len && strncasecmp(h->name, name, len) == 0;
+}
+
+// Function to find a header field by its lower-case name in a parsed list; NULL if there is none
+static inline const struct http_header *http_find_field(const struct http_header *headers, int n, const char *name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < n; i++)
+        if (http_header_is(&headers[i], name, len))
+            return &headers[i];
+    return NULL;
+}
+
+// Function to find a header field of a response by its lower-case name; NULL if the response has none
+static inline const struct http_header *http_find_header(const struct http_head *head, const char *name) {
+    return http_find_field(head->headers, head->nheaders, name);
+}
+
+// Function to check whether a header value mentions a token, ignoring case (e.g. "chunked" in "gzip, chunked")
+static inline int http_has_token(const struct http_header *h, const char *token) {
+    size_t n = strlen(token);
+    for (size_t i = 0; i + n <= h->value_len; i++)
+        if (strncasecmp(h->value + i, token, n) == 0)
+            return 1;
+    return 0;
+}
+
+// Function to find the blank line ending a head in buf[0..len), resuming at *scanned. Returns the head length
+// once complete, or 0 if more bytes are needed (*scanned then records where to resume)
+static inline size_t http_head_end(const char *buf, size_t len, size_t *scanned) {
+    const char *end = buf + len, *p = buf + *scanned;
+    for (;;) {
+        const char *nl = http_find2(p, end, '\n', '\n');
+        if (nl + 1 >= end || (nl[1] == '\r' && nl + 2 >= end)) {
+            *scanned = (nl < end ? nl : end) - buf;    // Look at this line end again next time
+            return 0;
+        }
+        if (nl[1] == '\n')
+            return nl + 2 - buf;
+        if (nl[1] == '\r' && nl[2] == '\n')
+            return nl + 3 - buf;
+        p = nl + 1;
+    }
+}
+
+// Function to parse the header fields from p (the start of the line after the first) up to the blank line
+// before stop. Returns the number of fields, or -1 if one is malformed or there are too many
+static inline int http_parse_fields(const char *p, const char *stop, struct http_header *headers) {
+    int n = 0;
+    while (*p != '\r' && *p != '\n') {
+        const char *colon = http_find2(p, stop, ':', '\n');
+        if (*colon != ':' || colon == p || n == HTTP_MAX_HEADERS)
+            return -1;
+        struct http_header *h = &headers[n++];
+        h->name = p;
+        h->name_len = colon - p;
+        const char *v = colon + 1;
+        const char *eol = http_find2(v, stop, '\n', '\n');
+        while (v < eol && (*v == ' ' || *v == '\t'))
+            v++;
+        const char *ve = eol;
+        while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t'))
+            ve--;
+        h->value = v;
+        h->value_len = ve - v;
+        p = eol + 1;
+    }
+    return n;
+}
+
+// Function to parse the head at the start of buf[0..len). *scanned must be 0 for a new head and is kept
+// between calls. Returns the head length (the body starts there) once complete, 0 if more bytes are needed,
+// or -1 if the head is malformed or has too many fields
+static inline ssize_t http_parse_head(const char *buf, size_t len, size_t *scanned, struct http_head *head) {
+    size_t head_len = http_head_end(buf, len, scanned);
+    if (head_len == 0)
+        return 0;
+    const char *stop = buf + head_len, *p;
+
+    // Status line: HTTP/1.x SP status SP reason
+    if (head_len < 13 || memcmp(buf, "HTTP/1.", 7) != 0 || buf[7] < '0' || buf[7] > '9' || buf[8] != ' ')
+        return -1;
+    head->minor = buf[7] - '0';
+    head->status = 0;
+    for (p = buf + 9; p < buf + 12; p++) {
+        if (*p < '0' || *p > '9')
+            return -1;
+        head->status = head->status * 10 + (*p - '0');
+    }
+    const char *eol = http_find2(p, stop, '\n', '\n');
+    head->reason = p + (*p == ' ');
+    head->reason_len = eol - head->reason - (eol > head->reason && eol[-1] == '\r');
+
+    // Header fields: name ':' OWS value OWS CRLF
+    head->nheaders = http_parse_fields(eol + 1, stop, head->headers);
+    return head->nheaders < 0 ? -1 : (ssize_t)head_len;
+}
+
+// Function to parse a request head at the start of buf[0..len), resumable like http_parse_head(). Returns the
+// head length once complete, 0 if more bytes are needed, or -1 if the request line or a field is malformed
+static inline ssize_t http_parse_request(const char *buf, size_t len, size_t *scanned, struct http_request *req) {
+    size_t head_len = http_head_end(buf, len, scanned);
+    if (head_len == 0)
+        return 0;
+    const char *stop = buf + head_len;
+
+    // Request line: method SP target SP HTTP/1.x
+    const char *eol = http_find2(buf, stop, '\n', '\n');
+    const char *sp = memchr(buf, ' ', eol - buf);
+    if (sp == NULL || sp == buf)
+        return -1;
+    req->method = buf;
+    req->method_len = sp - buf;
+    req->target = sp + 1;
+    sp = memchr(req->target, ' ', eol - req->target);
+    if (sp == NULL || sp == req->target || eol - sp < 9 || memcmp(sp + 1, "HTTP/1.", 7) != 0
+        || sp[8] < '0' || sp[8] > '9')
+        return -1;
+    req->target_len = sp - req->target;
+    req->minor = sp[8] - '0';
+
+    req->nheaders = http_parse_fields(eol + 1, stop, req->headers);
+    return req->nheaders < 0 ? -1 : (ssize_t)head_len;
+}
+
+enum { CHUNK_SIZE, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER, CHUNK_DONE };
+
+// State of a chunked body between reads (zero-initialise for a new body)
+struct http_chunked {
+    int state;
+    int digits;                 // Hex digits read of the current size
+    int line_len;               // Non-CR bytes on the current trailer line
+    long long remaining;        // Chunk bytes still to come
+};
+
+// Function to decode chunked framing in buf[0..*len) in place: the chunk data is moved to the front and *len
+// becomes its length. Returns -2 if the body continues in later bytes, -1 on malformed framing, or once the
+// last chunk and trailer are complete, the number of bytes after the body (moved to follow the data)
+static inline ssize_t http_decode_chunked(struct http_chunked *d, char *buf, size_t *len) {
+    size_t src = 0, dst = 0, n = *len;
+    while (src < n) {
+        switch (d->state) {
+        case CHUNK_SIZE:
+            for (; src < n; src++) {
+                char c = buf[src];
+                int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if (v < 0)
+                    break;
+                if (++d->digits > 15)                  // Sizes up to 2^60 only
+                    return -1;
+                d->remaining = d->remaining * 16 + v;
+            }
+            if (src == n)
+                break;
+            if (d->digits == 0)
+                return -1;
+            d->state = CHUNK_EXT;
+            /* fall through */
+        case CHUNK_EXT: {                              // Skip chunk extensions up to the line end
+            const char *nl = memchr(buf + src, '\n', n - src);
+            if (nl == NULL) {
+                src = n;
+                break;
+            }
+            src = nl + 1 - buf;
+            d->state = d->remaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+            d->line_len = 0;
+            break;
+        }
+        case CHUNK_DATA: {
+            size_t take = n - src < (unsigned long long)d->remaining ? n - src : (size_t)d->remaining;
+            if (dst != src)
+                memmove(buf + dst, buf + src, take);
+            dst += take;
+            src += take;
+            d->remaining -= take;
+            if (d->remaining == 0)
+                d->state = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:                           // CRLF after the chunk data
+            if (buf[src] == '\n') {
+                d->state = CHUNK_SIZE;
+                d->digits = 0;
+            } else if (buf[src] != '\r') {
+                return -1;
+            }
+            src++;
+            break;
+        case CHUNK_TRAILER:                            // Trailer fields end with an empty line
+            if (buf[src] == '\n') {
+                if (d->line_len == 0) {
+                    d->state = CHUNK_DONE;
+                    src++;
+                    size_t rest = n - src;
+                    memmove(buf + dst, buf + src, rest);
+                    *len = dst;
+                    return rest;
+                }
+                d->line_len = 0;
+            } else if (buf[src] != '\r') {
+                d->line_len++;
+            }
+            src++;
+            break;
+        default:
+            return -1;
+        }
+    }
+    *len = dst;
+    return -2;
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+4_http_static.h
+- Open-file and stat cache for the static file server in 4_https_request_response.c.
+- A file is opened and stat'ed on its first request. Its response head is formatted once and kept with the open
+  descriptor: status line, Content-Type, Content-Length, Last-Modified, ETag and Accept-Ranges. After that a
+  request costs no open() and no stat(). A cached entry is checked against the file system at most once a second,
+  so edits to the served tree are still picked up.
+- Files up to STATIC_INLINE_MAX bytes are also kept in memory. A small-file response is then a copy into the
+  connection's output buffer, and larger bodies are sent from the descriptor with sendfile().
+- Entries are reference counted, so a connection still sending an evicted or replaced file keeps its descriptor.
+- Each server thread owns its cache, so nothing here is locked.
+*/
+
+#ifndef HTTP_STATIC_H
+#define HTTP_STATIC_H
+
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcpy, memcmp
+#include <strings.h>    // strcasecmp
+#include <fcntl.h>      // openat
+#include <unistd.h>     // close
+#include <time.h>       // time, gmtime_r, strftime
+#include <sys/stat.h>   // fstat, fstatat
+
+#define STATIC_CACHE_SLOTS 4096         // Direct-mapped: a colliding path replaces the older entry
+#define STATIC_INLINE_MAX (8 * 1024)    // Largest body kept in memory
+#define STATIC_HEAD_MAX 512
+
+// One cached file
+struct static_file {
+    int fd;
+    int refs;                   // The cache slot and every connection sending the body
+    char *path;                 // Relative to the served directory
+    size_t path_len;
+    unsigned hash;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t checked;             // Second of the last fstatat() check
+    char etag[48];              // Quoted, from size and modification time
+    char last_modified[40];
+    char head[STATIC_HEAD_MAX]; // "HTTP/1.1 200 OK" ... Accept-Ranges, without Date, Connection or the blank line
+    size_t head_len;
+    char *body;                 // Whole body if size <= STATIC_INLINE_MAX, else NULL
+};
+
+// Cache of one server thread
+struct static_cache {
+    int root_fd;                // Directory being served
+    struct static_file *slot[STATIC_CACHE_SLOTS];
+    unsigned long hits, misses;
+};
+
+// Function to choose a Content-Type from the file name extension
+static inline const char *static_mime_type(const char *path) {
+    static const char *const types[][2] = {
+        {"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+        {"css", "text/css"}, {"js", "text/javascript"}, {"json", "application/json"},
+        {"txt", "text/plain; charset=utf-8"}, {"xml", "application/xml"}, {"svg", "image/svg+xml"},
+        {"png", "image/png"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"}, {"gif", "image/gif"},
+        {"webp", "image/webp"}, {"ico", "image/x-icon"}, {"pdf", "application/pdf"},
+        {"wasm", "application/wasm"}, {"woff2", "font/woff2"}, {"gz", "application/gzip"},
+    };
+    const char *dot = strrchr(path, '.');
+    if (dot != NULL && strchr(dot, '/') == NULL)
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+            if (strcasecmp(dot + 1, types[i][0]) == 0)
+                return types[i][1];
+    return "application/octet-stream";
+}
+
+// Function to format a time as an HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT")
+static inline size_t static_http_date(time_t t, char *out, size_t size) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(out, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Function to get the "Date: ...\r\n" line for the current second, formatted once per second per thread
+static inline const char *static_date_line(time_t now, size_t *len) {
+    static __thread time_t formatted = -1;
+    static __thread char line[64];
+    static __thread size_t line_len;
+    if (now != formatted) {
+        memcpy(line, "Date: ", 6);
+        line_len = 6 + static_http_date(now, line + 6, sizeof(line) - 8);
+        memcpy(line + line_len, "\r\n", 2);
+        line_len += 2;
+        formatted = now;
+    }
+    *len = line_len;
+    return line;
+}
+
+// Function to drop one reference to a cached file, closing it with the last one
+static inline void static_release(struct static_file *f) {
+    if (--f->refs > 0)
+        return;
+    close(f->fd);
+    free(f->body);
+    free(f->path);
+    free(f);
+}
+
+// Function to open, stat and format a file for the cache; NULL if it is missing or not a regular file. The path
+// must be relative: openat() ignores root_fd for an absolute one
+static inline struct static_file *static_load(struct static_cache *c, const char *path, size_t len, unsigned hash,
+                                              time_t now) {
+    if (path[0] == '/')
+        return NULL;
+    int fd = openat(c->root_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    struct static_file *f = calloc(1, sizeof(*f));
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || f == NULL || (f->path = malloc(len + 1)) == NULL) {
+        if (f != NULL)
+            free(f);
+        close(fd);
+        return NULL;
+    }
+    memcpy(f->path, path, len + 1);
+    f->path_len = len;
+    f->hash = hash;
+    f->fd = fd;
+    f->refs = 1;
+    f->size = st.st_size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->mtime = st.st_mtim;
+    f->checked = now;
+
+    static_http_date(st.st_mtim.tv_sec, f->last_modified, sizeof(f->last_modified));
+    snprintf(f->etag, sizeof(f->etag), "\"%llx-%llx\"", (unsigned long long)st.st_size,
+             (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    f->head_len = snprintf(f->head, sizeof(f->head),
+                           "HTTP/1.1 200 OK\r\n"
+                           "Server: l5-static\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Length: %lld\r\n"
+                           "Last-Modified: %s\r\n"
+                           "ETag: %s\r\n"
+                           "Accept-Ranges: bytes\r\n",
+                           static_mime_type(path), (long long)st.st_size, f->last_modified, f->etag);
+
+    // Keep small bodies in memory; a file that changes while it is read is simply sent from the descriptor
+    if (st.st_size <= STATIC_INLINE_MAX && (f->body = malloc(st.st_size + 1)) != NULL
+        && pread(fd, f->body, st.st_size, 0) != st.st_size) {
+        free(f->body);
+        f->body = NULL;
+    }
+    return f;
+}
+
+// Function to look a path up in the cache, loading it on a miss and re-checking a hit once a second.
+// Returns a referenced entry (release it with static_release()) or NULL if the file cannot be served
+static inline struct static_file *static_lookup(struct static_cache *c, const char *path, size_t len, time_t now) {
+    unsigned hash = 2166136261u;                   // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)path[i]) * 16777619u;
+    struct static_file **slot = &c->slot[hash % STATIC_CACHE_SLOTS];
+    struct static_file *f = *slot;
+
+    if (f != NULL && f->hash == hash && f->path_len == len && memcmp(f->path, path, len) == 0) {
+        struct stat st;
+        if (f->checked == now
+            || (fstatat(c->root_fd, path, &st, 0) == 0 && st.st_dev == f->dev && st.st_ino == f->ino
+                && st.st_size == f->size && st.st_mtim.tv_sec == f->mtime.tv_sec
+                && st.st_mtim.tv_nsec == f->mtime.tv_nsec)) {
+            f->checked = now;
+            c->hits++;
+            f->refs++;
+            return f;
+        }
+    }
+
+    // Miss, collision or stale entry: replace the slot
+    c->misses++;
+    if (f != NULL) {
+        *slot = NULL;
+        static_release(f);
+    }
+    f = static_load(c, path, len, hash, now);
+    if (f == NULL)
+        return NULL;
+    *slot = f;
+    f->refs++;
+    return f;
+}
+
+// Function to release every cached file
+static inline void static_cache_free(struct static_cache *c) {
+    for (int i = 0; i < STATIC_CACHE_SLOTS; i++)
+        if (c->slot[i] != NULL) {
+            static_release(c->slot[i]);
+            c->slot[i] = NULL;
+        }
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+4_http_tls.h
+- TLS client connections with session resumption for 4_https_request_response.c, built on OpenSSL (link with
+  -lssl -lcrypto).
+- Sessions are cached per host:port. TLS 1.3 servers send resumption tickets after the handshake, and OpenSSL
+  hands them to the new-session callback, which keeps the newest one per host. With a cache directory the ticket
+  is also written to <dir>/<host>_<port>.session (DER), so the next process can resume too.
+- A connection that has a cached session offers it. The server can then resume: a PSK handshake with no
+  certificate sent or verified.
+- If the ticket allows early data and the caller passes an idempotent request, the request goes out as 0-RTT
+  data right behind the ClientHello. If the server rejects the early data, the request is sent again after the
+  handshake.
+- TLS 1.3 tickets are used once: a ticket leaves the cache when it is offered, and the server's fresh tickets
+  replace it. Reusing tickets would let 0-RTT data be replayed and gives passive observers a linkable identifier.
+- Certificates are verified against the system store, or against a given CA file (e.g. a self-signed test
+  certificate), and must match the host name or IP address.
+*/
+
+#ifndef HTTP_TLS_H
+#define HTTP_TLS_H
+
+#include <stdio.h>      // FILE, snprintf
+#include <stdlib.h>     // realloc, free
+#include <string.h>     // strcmp
+#include <arpa/inet.h>  // inet_pton: IP addresses get no SNI
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "4_http.h"     // URLs and response framing
+
+#define TLS_SESSION_FILE_MAX 16384   // Largest session file read back
+
+enum { TLS_FULL, TLS_RESUMED, TLS_EARLY };   // How a connection was set up
+
+// Cached session of one host
+struct tls_session_entry {
+    char key[300];              // "host:port"
+    SSL_SESSION *session;       // NULL once taken
+    int loaded;                 // The disk copy has been looked for
+};
+
+struct tls_client {
+    SSL_CTX *ctx;
+    char dir[1024];             // Session directory, "" to keep sessions in memory only
+    struct tls_session_entry *entries;
+    int n, cap;
+    int use_sessions;           // 0 forces full handshakes (for comparison)
+    unsigned long full, resumed, early_accepted, early_rejected;
+};
+
+static int tls_ex_key = -1;     // SSL ex_data slot holding a connection's cache entry index
+
+// Function to split "https://host[:port]/path" like http_parse_url(), with 443 as the default port
+static inline int tls_parse_url(const char *s, struct http_url *u) {
+    if (strncmp(s, "https://", 8) != 0)
+        return -1;
+    s += 8;
+    if (http_parse_url(s, u) < 0)
+        return -1;
+    if (memchr(s, ':', strcspn(s, "/")) == NULL)
+        u->port = 443;
+    return 0;
+}
+
+// Function to print the OpenSSL error queue after a message
+static inline void tls_print_errors(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    ERR_print_errors_fp(stderr);
+}
+
+// Function to find (or add) the cache entry of a host
+static inline int tls_entry(struct tls_client *t, const char *host, int port) {
+    char key[300];
+    snprintf(key, sizeof(key), "%s:%d", host, port);
+    for (int i = 0; i < t->n; i++)
+        if (strcmp(t->entries[i].key, key) == 0)
+            return i;
+    if (t->n == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 16;
+        struct tls_session_entry *e = realloc(t->entries, cap * sizeof(*e));
+        if (e == NULL)
+            return -1;
+        t->entries = e;
+        t->cap = cap;
+    }
+    struct tls_session_entry *e = &t->entries[t->n];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->key, key, sizeof(key));
+    return t->n++;
+}
+
+// Function to name the session file of an entry (':' becomes '_')
+static inline void tls_session_path(const struct tls_client *t, const struct tls_session_entry *e, char *path,
+                                    size_t size) {
+    snprintf(path, size, "%s/%s.session", t->dir, e->key);
+    char *colon = strrchr(path, ':');
+    if (colon != NULL)
+        *colon = '_';
+}
+
+// Function to write a session to its file (to a temporary file renamed into place)
+static inline void tls_save_session(const struct tls_client *t, const struct tls_session_entry *e) {
+    unsigned char *der = NULL;
+    int len = i2d_SSL_SESSION(e->session, &der);
+    if (len <= 0)
+        return;
+    char path[1400], tmp[1420];
+    tls_session_path(t, e, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp != NULL) {
+        int ok = fwrite(der, 1, len, fp) == (size_t)len;
+        if (fclose(fp) == 0 && ok)
+            rename(tmp, path);
+        else
+            remove(tmp);
+    }
+    OPENSSL_free(der);
+}
+
+// Function to read an entry's session back from its file, once per process
+static inline void tls_load_session(struct tls_client *t, struct tls_session_entry *e) {
+    if (e->loaded || t->dir[0] == '\0')
+        return;
+    e->loaded = 1;
+    char path[1400];
+    unsigned char buf[TLS_SESSION_FILE_MAX];
+    tls_session_path(t, e, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return;
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    const unsigned char *p = buf;
+    SSL_SESSION *s = d2i_SSL_SESSION(NULL, &p, len);
+    if (s != NULL && e->session == NULL)
+        e->session = s;
+    else if (s != NULL)
+        SSL_SESSION_free(s);
+}
+
+// New-session callback: keep the newest ticket of the connection's host. Returns 1: the cache owns it
+static inline int tls_new_session(SSL *ssl, SSL_SESSION *session) {
+    struct tls_client *t = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    long index = (long)SSL_get_ex_data(ssl, tls_ex_key) - 1;
+    if (t == NULL || index < 0 || index >= t->n || !SSL_SESSION_is_resumable(session))
+        return 0;
+    struct tls_session_entry *e = &t->entries[index];
+    if (e->session != NULL)
+        SSL_SESSION_free(e->session);
+    e->session = session;
+    if (t->dir[0] != '\0')
+        tls_save_session(t, e);
+    return 1;
+}
+
+// Function to set up a client context. ca_file NULL uses the system trust store; dir NULL keeps sessions in
+// memory only
+static inline int tls_client_init(struct tls_client *t, const char *ca_file, const char *dir) {
+    memset(t, 0, sizeof(*t));
+    t->use_sessions = 1;
+    if (dir != NULL)
+        snprintf(t->dir, sizeof(t->dir), "%s", dir);
+    if (tls_ex_key < 0)
+        tls_ex_key = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    t->ctx = SSL_CTX_new(TLS_client_method());
+    if (t->ctx == NULL)
+        return -1;
+    SSL_CTX_set_min_proto_version(t->ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(t->ctx, SSL_VERIFY_PEER, NULL);
+    if ((ca_file != NULL ? SSL_CTX_load_verify_locations(t->ctx, ca_file, NULL)
+                         : SSL_CTX_set_default_verify_paths(t->ctx)) != 1) {
+        tls_print_errors("Loading trusted certificates failed");
+        return -1;
+    }
+    // Sessions live in this cache (keyed by host), not in OpenSSL's internal one
+    SSL_CTX_set_session_cache_mode(t->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(t->ctx, tls_new_session);
+    SSL_CTX_set_app_data(t->ctx, t);
+    return 0;
+}
+
+// Function to release a client context and its cached sessions
+static inline void tls_client_free(struct tls_client *t) {
+    for (int i = 0; i < t->n; i++)
+        if (t->entries[i].session != NULL)
+            SSL_SESSION_free(t->entries[i].session);
+    free(t->entries);
+    SSL_CTX_free(t->ctx);
+}
+
+// Function to run the TLS handshake on a connected blocking socket. early (may be NULL) is a request that may
+// be sent as 0-RTT data; *early_done tells whether the server took it (if not, the caller sends it normally).
+// Returns the connection, or NULL with the error printed
+static inline SSL *tls_connect(struct tls_client *t, int fd, const char *host, int port, const char *early,
+                               size_t early_len, int *early_done, int *kind) {
+    *early_done = 0;
+    int index = tls_entry(t, host, port);
+    SSL *ssl = SSL_new(t->ctx);
+    if (ssl == NULL || index < 0) {
+        tls_print_errors("TLS setup failed");
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_ex_data(ssl, tls_ex_key, (void *)(long)(index + 1));
+    unsigned char ip[16];
+    if (inet_pton(AF_INET, host, ip) == 1 || inet_pton(AF_INET6, host, ip) == 1) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);   // No SNI for addresses
+    } else {
+        SSL_set_tlsext_host_name(ssl, host);
+        SSL_set1_host(ssl, host);
+    }
+
+    // Offer the cached session; a TLS 1.3 ticket is single use, so it leaves the cache here
+    struct tls_session_entry *e = &t->entries[index];
+    SSL_SESSION *offered = NULL;
+    if (t->use_sessions) {
+        tls_load_session(t, e);
+        if (e->session != NULL) {
+            SSL_set_session(ssl, e->session);
+            offered = e->session;
+            if (SSL_SESSION_get_protocol_version(e->session) == TLS1_3_VERSION)
+                e->session = NULL;
+            else
+                SSL_SESSION_up_ref(offered);
+        }
+    }
+
+    // 0-RTT: the request rides along with the ClientHello
+    if (offered != NULL && early != NULL && SSL_SESSION_get_max_early_data(offered) >= early_len) {
+        size_t written;
+        if (SSL_write_early_data(ssl, early, early_len, &written) != 1) {
+            tls_print_errors("Early data failed");
+            SSL_SESSION_free(offered);
+            SSL_free(ssl);
+            return NULL;
+        }
+    }
+    if (offered != NULL)
+        SSL_SESSION_free(offered);
+    if (SSL_connect(ssl) != 1) {
+        tls_print_errors("TLS handshake failed");
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    int early_status = SSL_get_early_data_status(ssl);
+    *early_done = early_status == SSL_EARLY_DATA_ACCEPTED;
+    if (early_status == SSL_EARLY_DATA_ACCEPTED)
+        t->early_accepted++;
+    else if (early_status == SSL_EARLY_DATA_REJECTED)
+        t->early_rejected++;
+    if (SSL_session_reused(ssl))
+        t->resumed++;
+    else
+        t->full++;
+    *kind = *early_done ? TLS_EARLY : SSL_session_reused(ssl) ? TLS_RESUMED : TLS_FULL;
+    return ssl;
+}
+
+// Function to write a whole buffer over TLS; 0 or -1
+static inline int tls_write_all(SSL *ssl, const char *p, size_t len) {
+    while (len > 0) {
+        size_t n;
+        if (SSL_write_ex(ssl, p, len, &n) != 1)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Receive hook for struct http_conn: read decrypted bytes (0 once the server has closed the TLS session)
+static inline ssize_t tls_recv(void *io, char *buf, size_t len) {
+    size_t n;
+    if (SSL_read_ex(io, buf, len, &n) == 1)
+        return n;
+    return SSL_get_error(io, 0) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+}
+
+// Function to end a TLS session in order. Reading until the server's close_notify also takes in session tickets
+// that arrived after the last response (a server answering 0-RTT data sends them only after the handshake ends)
+static inline void tls_close(SSL *ssl) {
+    char buf[4096];
+    size_t n;
+    if (SSL_shutdown(ssl) == 0)
+        while (SSL_read_ex(ssl, buf, sizeof(buf), &n) == 1)
+            ;
+    SSL_free(ssl);
+}
+
+#endif
@@ -2,8 +2,53 @@
 client.c
 - This program creates a TCP client that connects to a web server on a specified IP and port (usually 80 for HTTP).
 - The client sends a manually crafted HTTP GET request and receives the HTTP response, displaying all headers and content.
+- Usage: ./client                              GET / from the example server (original behaviour)
+         ./client get <depth> <url>...         GET every URL over pooled keep-alive connections (see 4_http.h) with up
+                                               to depth requests pipelined per connection; depth 0 opens a new
+                                               connection per request like the original client
+         ./client bulk <url-file> [conns] [per-host] [timeout-ms] [out-dir|-] [cache-dir|-] [identity|-] [nameserver]
+                                               GET every URL in the file (one per line) with up to conns (default
+                                               64) non-blocking connections on one epoll loop, at most per-host
+                                               (default 8) per host (see 4_http_fetch.h); prints a line per response
+                                               as it completes, streams bodies to out-dir/<line number> if given,
+                                               and ends with throughput and a latency histogram. With a cache-dir,
+                                               responses are kept on disk (see 4_http_cache.h): fresh ones are
+                                               served without any request and stale ones are revalidated (304).
+                                               Bodies are requested with gzip/deflate and inflated as they stream
+                                               in (see 4_http_gzip.h) unless "identity" is given. Host names are
+                                               resolved without blocking the loop (see 4_http_dns.h), through the
+                                               nameserver ("ip[:port]") if given, else /etc/resolv.conf
+         ./client download <url> <output-file> [segments]
+                                               download one large body as segments (default 4) Range requests
+                                               on parallel connections, each written at its offset into a
+                                               preallocated file; a failed segment is retried from where it
+                                               stopped (falls back to one GET if the server takes no ranges)
+         ./client https <url> [count] [session-dir|-] [ca-file]
+                                               GET an https:// URL count times (default 1), each on a new
+                                               TLS connection (see 4_http_tls.h) that resumes the session of the
+                                               one before and sends the GET as 0-RTT data when the ticket allows;
+                                               sessions are also kept in session-dir across runs. Certificates are
+                                               checked against ca-file if given, else the system store
+         ./client tls-bench <url> [count] [ca-file]
+                                               connection setup latency of count (default 200) full handshakes,
+                                               resumed handshakes and resumed handshakes with 0-RTT data, e.g.
+                                               against the server below started with a self-signed certificate
+         ./client bench <url> [threads] [connections] [seconds] [paths-file|-] [timeout-ms]
+                                               load-test the URL's server like wrk: threads (default 2) share
+                                               connections (default 10) kept alive for seconds (default 10), each
+                                               with one request outstanding (see 4_http_bench.h). A paths file
+                                               lists paths ("/...") requested in turn instead of the URL's own.
+                                               Reports requests/s, transfer/s, latency percentiles and socket
+                                               errors (requests over timeout-ms, default 2000, time out)
+         ./client resolve <nameserver|-> <name>...
+                                               resolve names concurrently with the stub resolver, then again from
+                                               its cache; nameserver "ip[:port]" or - for /etc/resolv.conf
+         ./client parse-bench                  measure the response parser (4_http_parse.h): heads per second and
+                                               chunked decoding GB/s, with no network involved
+- Build: gcc client.c -o client -pthread -lz -lssl -lcrypto
 */
 
+#define _GNU_SOURCE     // fallocate
 #include <stdio.h>      // Standard I/O library
 #include <stdlib.h>     // Standard library functions
 #include <string.h>     // String manipulation functions
@@ -12,17 +57,809 @@ client.c
 #include <netinet/in.h> // Structures for internet addresses
 #include <arpa/inet.h>  // Definitions for internet operations
 #include <unistd.h>     // POSIX API for UNIX system calls
+#include <time.h>       // Timing of the fetches
+#include <fcntl.h>      // open and fallocate for downloaded bodies
+#include <poll.h>       // Waiting for resolver replies
+#include "4_http.h"     // Keep-alive connection pool, pipelining and response framing
+#include "4_http_fetch.h" // Concurrent epoll fetcher and latency histogram
+#include "4_http_cache.h" // Persistent response cache with revalidation
+#include "4_http_tls.h" // TLS connections with session resumption and 0-RTT
+#include "4_http_bench.h" // wrk-style load generator
 
 #define PORT 80         // Port number for HTTP requests (default for HTTP)
 #define BUFFER_SIZE 4096 // Size of buffer to store the response
 
-int main() {
+// Totals of a multi-URL fetch
+struct fetch_stats {
+    const struct http_url *urls;
+    int ok, failed;
+    unsigned long long bytes;
+};
+
+// Completion callback: print one line per response
+void print_response(void *ctx, int index, struct http_response *r) {
+    struct fetch_stats *st = ctx;
+    const struct http_url *u = &st->urls[index];
+    if (r->status < 0) {
+        st->failed++;
+        printf("ERR %8s http://%s:%d%s\n", "-", u->host, u->port, u->path);
+        return;
+    }
+    st->ok++;
+    st->bytes += r->body_len;
+    printf("%3d %8zu http://%s:%d%s\n", r->status, r->body_len, u->host, u->port, u->path);
+}
+
+// Function to GET a list of URLs through a connection pool and report the totals
+void fetch_urls(int depth, char **args, int n) {
+    struct http_url *urls = malloc(n * sizeof(*urls));
+    struct http_pool *pool = malloc(sizeof(*pool));
+    if (urls == NULL || pool == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++)
+        if (http_parse_url(args[i], &urls[i]) < 0) {
+            fprintf(stderr, "Bad URL: %s\n", args[i]);
+            exit(1);
+        }
+
+    struct fetch_stats st = {urls, 0, 0, 0};
+    struct timespec start, end;
+    http_pool_init(pool);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    http_get_pipelined(pool, urls, n, depth, print_response, &st);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d ok, %d failed, %llu body bytes, %lu connections in %.3f s (%.0f req/s)\n", st.ok, st.failed,
+           st.bytes, pool->connects, secs, n / secs);
+    http_pool_free(pool);
+    free(pool);
+    free(urls);
+}
+
+// State of a bulk fetch shared by its callbacks
+struct bulk_state {
+    const struct http_url *urls;
+    const char *out_dir;        // Where bodies are streamed, or NULL
+    int *out_fd;                // Body file of every URL in progress
+    int ok, failed;
+    unsigned long long bytes;
+    struct latency_hist hist;
+};
+
+// Head callback: open the body file of a response
+void bulk_head(void *ctx, int index, const struct http_response *r) {
+    struct bulk_state *st = ctx;
+    (void)r;
+    if (st->out_dir != NULL && st->out_fd[index] < 0) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%d", st->out_dir, index + 1);
+        st->out_fd[index] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+}
+
+// Body callback: stream body bytes to the file as they arrive
+void bulk_body(void *ctx, int index, const char *data, size_t len) {
+    struct bulk_state *st = ctx;
+    if (st->out_fd == NULL || st->out_fd[index] < 0)
+        return;
+    while (len > 0) {
+        ssize_t n = write(st->out_fd[index], data, len);
+        if (n <= 0) {
+            perror("Write failed");
+            close(st->out_fd[index]);
+            st->out_fd[index] = -1;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Completion callback: print one line and record the latency
+void bulk_done(void *ctx, int index, int status, unsigned long long bytes, double ms, const char *error) {
+    struct bulk_state *st = ctx;
+    const struct http_url *u = &st->urls[index];
+    if (st->out_fd != NULL && st->out_fd[index] >= 0) {
+        close(st->out_fd[index]);
+        st->out_fd[index] = -1;
+    }
+    if (status < 0) {
+        st->failed++;
+        printf("ERR %8s %9.2f ms http://%s:%d%s (%s)\n", "-", ms, u->host, u->port, u->path, error);
+        return;
+    }
+    st->ok++;
+    st->bytes += bytes;
+    latency_add(&st->hist, ms);
+    printf("%3d %8llu %9.2f ms http://%s:%d%s\n", status, bytes, ms, u->host, u->port, u->path);
+}
+
+// Function to fetch every URL listed in a file concurrently and report throughput and latencies
+void bulk_fetch(const char *list, struct fetch_options *opt, const char *out_dir, const char *cache_dir) {
+    FILE *fp = fopen(list, "r");
+    if (fp == NULL) {
+        perror("Open failed");
+        exit(1);
+    }
+    int n = 0, cap = 1024;
+    struct http_url *urls = malloc(cap * sizeof(*urls));
+    char line[4096];
+    while (urls != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        if (n == cap)
+            urls = realloc(urls, (cap *= 2) * sizeof(*urls));
+        if (urls != NULL && http_parse_url(line, &urls[n]) < 0) {
+            fprintf(stderr, "Bad URL: %s\n", line);
+            exit(1);
+        }
+        n++;
+    }
+    fclose(fp);
+    struct bulk_state *st = calloc(1, sizeof(*st));
+    if (urls == NULL || st == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    st->urls = urls;
+    st->out_dir = out_dir;
+    if (out_dir != NULL) {
+        st->out_fd = malloc(n * sizeof(int));
+        for (int i = 0; st->out_fd != NULL && i < n; i++)
+            st->out_fd[i] = -1;
+    }
+
+    struct fetch_callbacks cb = {bulk_head, bulk_body, bulk_done, NULL, st};
+    struct fetch_totals totals;
+    struct http_cache cache;
+    if (cache_dir != NULL && http_cache_open(&cache, cache_dir) < 0) {
+        perror("Cache directory failed");
+        exit(1);
+    }
+    double start = fetch_now_ms();
+    if (cache_dir != NULL)
+        cache_fetch_all(&cache, urls, n, opt, &cb, &totals);
+    else
+        fetch_all(urls, n, opt, &cb, &totals);
+    double secs = (fetch_now_ms() - start) / 1e3;
+    printf("%d ok, %d failed, %lu connections in %.3f s: %.0f req/s, %.2f MB/s of bodies\n", st->ok, st->failed,
+           totals.connects, secs, n / secs, st->bytes / secs / 1e6);
+    if (opt->compress && totals.wire_bytes > 0 && totals.body_bytes != totals.wire_bytes)
+        printf("Encoding: %.2f MB on the wire inflated to %.2f MB (%.1fx)\n", totals.wire_bytes / 1e6,
+               totals.body_bytes / 1e6, (double)totals.body_bytes / totals.wire_bytes);
+    if (opt->dns != NULL)
+        printf("DNS: %lu queries, %lu cached answers, %lu cached failures, %lu timeouts\n", opt->dns->queries,
+               opt->dns->hits, opt->dns->negative_hits, opt->dns->timeouts);
+    if (cache_dir != NULL)
+        printf("Cache: %lu fresh, %lu revalidated (304), %lu stored, %lu misses; %.2f MB not downloaded\n",
+               cache.fresh_hits, cache.revalidated, cache.stored, cache.misses, cache.bytes_saved / 1e6);
+    latency_print(&st->hist);
+    free(st->out_fd);
+    free(st);
+    free(urls);
+}
+
+#define SEGMENT_MIN (256 * 1024)   // Smallest segment worth its own connection
+#define SEGMENT_ATTEMPTS 5          // Rounds in a row without progress before a download gives up
+
+// One byte range of a segmented download
+struct segment {
+    long long start, end;       // Inclusive range; end -1 if the size is unknown
+    long long done;             // Bytes written from start on
+    int accepted;               // The response to the current attempt carries this range
+    int complete;
+    char range[64];             // "Range: ..." line of the current attempt
+};
+
+// State of a segmented download shared by its callbacks
+struct download {
+    int fd;
+    int ranged;                 // Segments are fetched with Range requests
+    struct segment *seg;
+    int *attempt_seg;           // Segment of every request in the current round
+    int failed;
+};
+
+// Request headers callback: ask for the part of the segment not yet written
+const char *download_headers(void *ctx, int index) {
+    struct download *d = ctx;
+    struct segment *s = &d->seg[d->attempt_seg[index]];
+    if (!d->ranged)
+        return NULL;
+    snprintf(s->range, sizeof(s->range), "Range: bytes=%lld-%lld\r\n", s->start + s->done, s->end);
+    return s->range;
+}
+
+// Head callback: accept the body only if it is the range that was asked for
+void download_head(void *ctx, int index, const struct http_response *r) {
+    struct download *d = ctx;
+    struct segment *s = &d->seg[d->attempt_seg[index]];
+    if (!d->ranged) {
+        s->accepted = r->status == 200;
+        s->done = 0;                               // Without ranges a retry starts over
+        return;
+    }
+    const struct http_header *cr = http_find_header(&r->hdr, "content-range");
+    char want[48];
+    int n = snprintf(want, sizeof(want), "bytes %lld-", s->start + s->done);
+    s->accepted = r->status == 206 && cr != NULL && cr->value_len > (size_t)n && memcmp(cr->value, want, n) == 0;
+}
+
+// Body callback: write the bytes at their offset in the file
+void download_body(void *ctx, int index, const char *data, size_t len) {
+    struct download *d = ctx;
+    struct segment *s = &d->seg[d->attempt_seg[index]];
+    if (!s->accepted)
+        return;
+    if (s->end >= 0 && (long long)len > s->end + 1 - s->start - s->done)
+        len = s->end + 1 - s->start - s->done;     // Never write past the segment
+    while (len > 0) {
+        ssize_t n = pwrite(d->fd, data, len, s->start + s->done);
+        if (n <= 0) {
+            perror("Write failed");
+            exit(1);
+        }
+        data += n;
+        len -= n;
+        s->done += n;
+    }
+}
+
+// Completion callback: report a segment that has to be retried
+void download_done(void *ctx, int index, int status, unsigned long long bytes, double ms, const char *error) {
+    struct download *d = ctx;
+    int k = d->attempt_seg[index];
+    struct segment *s = &d->seg[k];
+    (void)bytes;
+    (void)ms;
+    s->complete = status >= 0 && s->accepted && (s->end < 0 || s->start + s->done == s->end + 1);
+    if (s->complete)
+        return;
+    d->failed++;
+    fprintf(stderr, "Segment %d: %s after %lld of %lld bytes\n", k + 1,
+            status < 0 ? error : !s->accepted ? "unexpected response" : "short body", s->done,
+            s->end >= 0 ? s->end + 1 - s->start : -1LL);
+}
+
+// Function to download one URL into a file with nseg parallel Range requests, retrying failed segments from
+// where they stopped. Falls back to a single plain GET if the server gives no size or does not take ranges
+void download(const char *url, const char *path, int nseg) {
+    struct http_url u;
+    if (http_parse_url(url, &u) < 0) {
+        fprintf(stderr, "Bad URL: %s\n", url);
+        exit(1);
+    }
+    double start = fetch_now_ms();
+
+    // Probe the size and range support with HEAD
+    struct http_pool pool;
+    struct http_response r = {0};
+    http_pool_init(&pool);
+    if (http_request(&pool, "HEAD", &u, &r) < 0 || r.status != 200) {
+        fprintf(stderr, "HEAD %s failed (status %d)\n", url, r.status);
+        exit(1);
+    }
+    const struct http_header *ar = http_find_header(&r.hdr, "accept-ranges");
+    long long size = r.content_length;
+    int ranged = size > 0 && ar != NULL && http_has_token(ar, "bytes");
+    http_pool_free(&pool);
+    if (!ranged)
+        nseg = 1;
+    else if (nseg > (size + SEGMENT_MIN - 1) / SEGMENT_MIN)
+        nseg = (size + SEGMENT_MIN - 1) / SEGMENT_MIN;
+
+    // Preallocate the whole file so segments can be written at their offsets in any order
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Open failed");
+        exit(1);
+    }
+    if (size > 0 && fallocate(fd, 0, 0, size) < 0 && ftruncate(fd, size) < 0) {
+        perror("Preallocation failed");
+        exit(1);
+    }
+
+    struct download d = {fd, ranged, calloc(nseg, sizeof(struct segment)), malloc(nseg * sizeof(int)), 0};
+    struct http_url *urls = malloc(nseg * sizeof(*urls));
+    if (d.seg == NULL || d.attempt_seg == NULL || urls == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    for (int k = 0; k < nseg; k++) {
+        d.seg[k].start = ranged ? size / nseg * k : 0;
+        d.seg[k].end = !ranged ? -1 : k == nseg - 1 ? size - 1 : size / nseg * (k + 1) - 1;
+    }
+
+    // Each round fetches every unfinished segment on its own connection
+    struct fetch_options opt = {nseg, nseg, 60000, 0, NULL};   // Ranges of an encoded body would not line up
+    struct fetch_callbacks cb = {download_head, download_body, download_done, download_headers, &d};
+    int retries = 0, stalled = 0;
+    for (int round = 0; stalled < SEGMENT_ATTEMPTS; round++) {
+        int n = 0;
+        long long before = 0, after = 0;
+        for (int k = 0; k < nseg; k++)
+            if (!d.seg[k].complete) {
+                d.seg[k].accepted = 0;
+                d.attempt_seg[n] = k;
+                urls[n++] = u;
+                before += d.seg[k].done;
+            }
+        if (n == 0)
+            break;
+        retries += round > 0 ? n : 0;
+        d.failed = 0;
+        fetch_all(urls, n, &opt, &cb, NULL);
+        if (d.failed == 0)
+            break;
+        for (int i = 0; i < n; i++)
+            after += d.seg[d.attempt_seg[i]].done;
+        stalled = after > before ? 0 : stalled + 1;
+    }
+    close(fd);
+    if (d.failed > 0) {
+        fprintf(stderr, "Download failed: %d segment(s) incomplete after %d rounds without progress\n", d.failed,
+                stalled);
+        exit(1);
+    }
+
+    long long total = 0;
+    for (int k = 0; k < nseg; k++)
+        total += d.seg[k].done;
+    double secs = (fetch_now_ms() - start) / 1e3;
+    printf("%lld bytes in %.3f s (%.2f MB/s) with %d %s, %d retried\n", total, secs, total / secs / 1e6, nseg,
+           ranged ? "range segment(s)" : "plain GET (no range support)", retries);
+    free(d.seg);
+    free(d.attempt_seg);
+    free(urls);
+}
+
+// Function to time the response parser on canned responses held in memory
+void parse_bench(void) {
+    static const char head[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Date: Mon, 19 Oct 2026 06:51:41 GMT\r\n"
+        "Server: Apache/2.4.57 (Debian)\r\n"
+        "Last-Modified: Tue, 02 Sep 2025 11:22:33 GMT\r\n"
+        "ETag: \"3c5e-5f1c2b8a3e4c0\"\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "Cache-Control: max-age=3600, public\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Content-Type: text/html; charset=UTF-8\r\n"
+        "X-Content-Type-Options: nosniff\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+    size_t head_len = sizeof(head) - 1, count = 100000;
+    char *buf = malloc(head_len * count);
+    if (buf == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++)
+        memcpy(buf + i * head_len, head, head_len);
+
+    // Heads: parse back-to-back pipelined responses, as they sit in a receive buffer
+    struct http_head *parsed = malloc(sizeof(*parsed));
+    struct timespec start, end;
+    size_t heads = 0;
+    double secs;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for (size_t off = 0; off < head_len * count;) {
+            size_t scanned = 0;
+            ssize_t n = http_parse_head(buf + off, head_len * count - off, &scanned, parsed);
+            if (n <= 0) {
+                fprintf(stderr, "Parse failed\n");
+                exit(1);
+            }
+            off += n;
+            heads++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    } while (secs < 0.5);
+    printf("Heads:   %.2f M/s (%.2f GB/s of %zu-byte heads with %d fields)\n", heads / secs / 1e6,
+           heads * head_len / secs / 1e9, head_len, parsed->nheaders);
+    free(buf);
+
+    // Chunked bodies: 64 MiB in 16 KiB chunks, decoded in place in one call
+    size_t body = 64 << 20, chunk = 16 << 10, framed = body + body / chunk * 9 + 5;
+    buf = malloc(framed);
+    if (buf == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        size_t off = 0;
+        for (size_t i = 0; i < body; i += chunk) {
+            off += sprintf(buf + off, "4000\r\n");
+            memset(buf + off, 'a' + run, chunk);
+            off += chunk;
+            off += sprintf(buf + off, "\r\n");
+        }
+        off += sprintf(buf + off, "0\r\n\r\n");
+        struct http_chunked d = {0};
+        size_t len = off;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ssize_t rest = http_decode_chunked(&d, buf, &len);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (rest != 0 || len != body) {
+            fprintf(stderr, "Chunked decoding failed\n");
+            exit(1);
+        }
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (body / secs / 1e9 > best)
+            best = body / secs / 1e9;
+    }
+    printf("Chunked: %.2f GB/s decoded in place (16 KiB chunks)\n", best);
+    free(buf);
+    free(parsed);
+}
+
+// Function to resolve names concurrently with the stub resolver (see 4_http_dns.h), printing each answer as it
+// comes; a second round shows the cached answers
+void resolve_names(const char *server, char **names, int n) {
+    struct dns_resolver r;
+    char *waiting = malloc(n);
+    if (waiting == NULL || dns_init(&r, server) < 0) {
+        perror("Resolver setup failed");
+        exit(1);
+    }
+    for (int round = 0; round < 2; round++) {
+        double start = fetch_now_ms();
+        int left = n;
+        memset(waiting, 1, n);
+        while (left > 0) {
+            for (int i = 0; i < n; i++) {
+                struct in_addr addr;
+                int rc = waiting[i] ? dns_lookup(&r, names[i], &addr) : 0;
+                if (rc == 0)
+                    continue;
+                waiting[i] = 0;
+                left--;
+                printf("%-40s %-15s %8.2f ms\n", names[i], rc > 0 ? inet_ntoa(addr) : "(cannot resolve)",
+                       fetch_now_ms() - start);
+            }
+            if (left == 0)
+                break;
+            struct pollfd pfd = {.fd = r.fd, .events = POLLIN};
+            if (poll(&pfd, 1, dns_timeout(&r)) > 0)
+                dns_input(&r);
+            dns_expire(&r);
+        }
+        printf("Round %d: %d names in %.2f ms\n", round + 1, n, fetch_now_ms() - start);
+    }
+    printf("DNS: %lu queries, %lu cached answers, %lu cached failures, %lu timeouts\n", r.queries, r.hits,
+           r.negative_hits, r.timeouts);
+    dns_free(&r);
+    free(waiting);
+}
+
+// Result of one GET on a new TLS connection
+struct tls_result {
+    int status;
+    int kind;                   // TLS_FULL, TLS_RESUMED or TLS_EARLY
+    double setup_ms;            // TCP connect and TLS handshake
+    double total_ms;            // Until the whole response was read
+};
+
+// Function to resolve a URL's host once; every connection of a run reuses the address
+void resolve_host(const struct http_url *u, struct sockaddr_storage *addr, socklen_t *addrlen) {
+    struct addrinfo hints = {0}, *res;
+    char port[16];
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", u->port);
+    if (getaddrinfo(u->host, port, &hints, &res) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", u->host);
+        exit(1);
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
+// Function to GET a URL on a new TLS connection, offering the request as 0-RTT data if early is set.
+// The body is collected in r. Returns 0, or -1 if the connection failed
+int tls_get(struct tls_client *t, const struct sockaddr_storage *addr, socklen_t addrlen, const struct http_url *u,
+            int early, struct http_conn *c, struct http_response *r, struct tls_result *res) {
+    char request[4096];
+    int len = http_format_request(request, sizeof(request), "GET", u, 1, NULL);
+    double start = fetch_now_ms();
+    c->fd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (len < 0 || c->fd < 0 || connect(c->fd, (const struct sockaddr *)addr, addrlen) < 0) {
+        perror("Connection failed");
+        if (c->fd >= 0)
+            close(c->fd);
+        return -1;
+    }
+    int one = 1, sent;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    SSL *ssl = tls_connect(t, c->fd, u->host, u->port, early ? request : NULL, len, &sent, &res->kind);
+    if (ssl == NULL) {
+        close(c->fd);
+        return -1;
+    }
+    res->setup_ms = fetch_now_ms() - start;
+
+    c->start = c->end = 0;
+    c->recv = tls_recv;
+    c->io = ssl;
+    r->head = 0;
+    int rc = !sent && tls_write_all(ssl, request, len) < 0 ? -1 : http_read_response(c, r);
+    res->total_ms = fetch_now_ms() - start;
+    res->status = r->status;
+    tls_close(ssl);
+    close(c->fd);
+    return rc;
+}
+
+// Function to load-test a URL's host like wrk: keep-alive connections on several threads for a fixed time,
+// requesting the URL's path or, with a paths file, every path listed there in turn
+void http_bench(const char *url, const struct bench_options *opt, const char *paths_file) {
+    struct http_url u;
+    if (http_parse_url(url, &u) < 0) {
+        fprintf(stderr, "Bad URL: %s\n", url);
+        exit(1);
+    }
+    int n = 0, cap = 16;
+    char **reqs = malloc(cap * sizeof(char *));
+    size_t *lens = malloc(cap * sizeof(size_t));
+    FILE *fp = paths_file != NULL ? fopen(paths_file, "r") : NULL;
+    if (paths_file != NULL && fp == NULL) {
+        perror("Open failed");
+        exit(1);
+    }
+    char line[2048];
+    int more = 1;
+    while (reqs != NULL && lens != NULL && more) {
+        struct http_url target = u;
+        if (fp == NULL) {
+            more = 0;                              // Just the URL's own path
+        } else if (fgets(line, sizeof(line), fp) == NULL) {
+            break;
+        } else {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#')
+                continue;
+            if (line[0] != '/' || strlen(line) >= sizeof(target.path)) {
+                fprintf(stderr, "Bad path: %s\n", line);
+                exit(1);
+            }
+            strcpy(target.path, line);
+        }
+        if (n == cap) {
+            cap *= 2;
+            reqs = realloc(reqs, cap * sizeof(char *));
+            lens = realloc(lens, cap * sizeof(size_t));
+            if (reqs == NULL || lens == NULL)
+                break;
+        }
+        reqs[n] = malloc(BENCH_REQ_MAX);
+        int len = reqs[n] != NULL ? http_format_request(reqs[n], BENCH_REQ_MAX, "GET", &target, 1, NULL) : -1;
+        if (len < 0) {
+            fprintf(stderr, "Request too long: %s\n", target.path);
+            exit(1);
+        }
+        lens[n++] = len;
+    }
+    if (fp != NULL)
+        fclose(fp);
+    if (reqs == NULL || lens == NULL || n == 0) {
+        fprintf(stderr, "No paths to request\n");
+        exit(1);
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct bench_stats *st = malloc(sizeof(*st));
+    if (st == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    resolve_host(&u, &addr, &addrlen);
+    printf("Running %gs test @ %s\n", opt->duration_s, url);
+    if (paths_file != NULL)
+        printf("  %d paths from %s in turn\n", n, paths_file);
+    printf("  %d threads and %d connections\n", opt->threads, opt->conns);
+    double secs = bench_run(opt, &addr, addrlen, reqs, lens, n, st);
+    latency_print(&st->hist);
+    printf("%llu requests in %.2fs, %.2f MB read\n", st->requests, secs, st->bytes / 1e6);
+    if (st->connect_errors + st->read_errors + st->write_errors + st->timeouts > 0)
+        printf("Socket errors: connect %lu, read %lu, write %lu, timeout %lu\n", st->connect_errors,
+               st->read_errors, st->write_errors, st->timeouts);
+    if (st->status_errors > 0)
+        printf("Non-2xx or 3xx responses: %lu\n", st->status_errors);
+    printf("Requests/sec: %.2f\n", st->requests / secs);
+    printf("Transfer/sec: %.2f MB\n", st->bytes / secs / 1e6);
+    for (int i = 0; i < n; i++)
+        free(reqs[i]);
+    free(reqs);
+    free(lens);
+    free(st);
+}
+
+static const char *const tls_kinds[] = {"full", "resumed", "0-rtt"};
+
+// Function to GET a URL count times over HTTPS, each time on a new connection that resumes the last session
+void https_fetch(const char *url, int count, const char *session_dir, const char *ca_file) {
+    struct http_url u;
+    struct tls_client t;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct http_conn *c = malloc(sizeof(*c));
+    struct http_response r = {0};
+    if (tls_parse_url(url, &u) < 0) {
+        fprintf(stderr, "Bad URL: %s\n", url);
+        exit(1);
+    }
+    if (c == NULL || tls_client_init(&t, ca_file, session_dir) < 0) {
+        fprintf(stderr, "TLS client setup failed\n");
+        exit(1);
+    }
+    resolve_host(&u, &addr, &addrlen);
+    for (int i = 0; i < count; i++) {
+        struct tls_result res;
+        if (tls_get(&t, &addr, addrlen, &u, 1, c, &r, &res) < 0) {
+            printf("ERR https://%s:%d%s\n", u.host, u.port, u.path);
+            continue;
+        }
+        printf("%3d %8zu %-7s setup %.2f ms, total %.2f ms\n", res.status, r.body_len, tls_kinds[res.kind],
+               res.setup_ms, res.total_ms);
+        if (count == 1)
+            fwrite(r.body, 1, r.body_len, stdout);
+    }
+    printf("Handshakes: %lu full, %lu resumed; early data %lu accepted, %lu rejected\n", t.full, t.resumed,
+           t.early_accepted, t.early_rejected);
+    tls_client_free(&t);
+    free(r.body);
+    free(c);
+}
+
+// Function to compare connection setup with full handshakes, resumed handshakes and resumption with 0-RTT data:
+// count new connections of each kind, with percentiles of setup time and of time to the complete response
+void tls_bench(const char *url, int count, const char *ca_file) {
+    struct http_url u;
+    struct tls_client t;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct http_conn *c = malloc(sizeof(*c));
+    struct latency_hist *hist = calloc(2, sizeof(*hist));
+    struct http_response r = {0};
+    if (tls_parse_url(url, &u) < 0) {
+        fprintf(stderr, "Bad URL: %s\n", url);
+        exit(1);
+    }
+    if (c == NULL || hist == NULL || tls_client_init(&t, ca_file, NULL) < 0) {
+        fprintf(stderr, "TLS client setup failed\n");
+        exit(1);
+    }
+    resolve_host(&u, &addr, &addrlen);
+
+    printf("%-8s %6s  %-32s %s\n", "", "", "setup (TCP + TLS) p50/p90/p99", "request total p50/p90/p99");
+    for (int round = 0; round < 3; round++) {
+        t.use_sessions = round > 0;                // Round 0 never offers a session, so every handshake is full
+        memset(hist, 0, 2 * sizeof(*hist));
+        int kinds[3] = {0}, failed = 0;
+        for (int i = 0; i < count; i++) {
+            struct tls_result res;
+            if (tls_get(&t, &addr, addrlen, &u, round == 2, c, &r, &res) < 0 || res.status < 0) {
+                failed++;
+                continue;
+            }
+            kinds[res.kind]++;
+            latency_add(&hist[0], res.setup_ms);
+            latency_add(&hist[1], res.total_ms);
+        }
+        printf("%-8s %6d  %6.3f / %6.3f / %6.3f ms       %6.3f / %6.3f / %6.3f ms   (%d full, %d resumed, "
+               "%d 0-rtt, %d failed)\n",
+               tls_kinds[round], count, latency_percentile(&hist[0], 0.5), latency_percentile(&hist[0], 0.9),
+               latency_percentile(&hist[0], 0.99), latency_percentile(&hist[1], 0.5),
+               latency_percentile(&hist[1], 0.9), latency_percentile(&hist[1], 0.99), kinds[TLS_FULL],
+               kinds[TLS_RESUMED], kinds[TLS_EARLY], failed);
+    }
+    printf("Early data: %lu accepted, %lu rejected\n", t.early_accepted, t.early_rejected);
+    tls_client_free(&t);
+    free(r.body);
+    free(hist);
+    free(c);
+}
+
+int main(int argc, char *argv[]) {
     int sockfd;                          // Socket descriptor
     struct sockaddr_in server_addr;      // Structure for server address
     char request[512];                   // Buffer for HTTP request
     char response[BUFFER_SIZE];          // Buffer for HTTP response
     char *server_ip = "93.184.216.34";   // Example server IP (example.com); replace with actual IP if needed
 
+    if (argc > 1 && strcmp(argv[1], "parse-bench") == 0) {
+        parse_bench();
+        return 0;
+    }
+
+    // Bulk mode: many URLs concurrently on one epoll loop
+    if (argc > 2 && strcmp(argv[1], "bulk") == 0) {
+        struct fetch_options opt = {64, 8, 10000, 1, NULL};
+        if (argc > 3)
+            opt.max_conns = atoi(argv[3]);
+        if (argc > 4)
+            opt.per_host = atoi(argv[4]);
+        if (argc > 5)
+            opt.timeout_ms = atoi(argv[5]);
+        if (opt.max_conns <= 0 || opt.per_host <= 0 || opt.timeout_ms <= 0) {
+            fprintf(stderr, "conns, per-host and timeout-ms must be positive\n");
+            exit(1);
+        }
+        const char *out_dir = argc > 6 && strcmp(argv[6], "-") != 0 ? argv[6] : NULL;
+        const char *cache_dir = argc > 7 && strcmp(argv[7], "-") != 0 ? argv[7] : NULL;
+        if (argc > 8 && strcmp(argv[8], "identity") == 0)
+            opt.compress = 0;
+        struct dns_resolver dns;
+        if (dns_init(&dns, argc > 9 ? argv[9] : NULL) < 0) {
+            perror("Resolver setup failed");
+            exit(1);
+        }
+        opt.dns = &dns;
+        bulk_fetch(argv[2], &opt, out_dir, cache_dir);
+        dns_free(&dns);
+        return 0;
+    }
+
+    // Resolver check: names looked up concurrently, then again from the cache
+    if (argc > 3 && strcmp(argv[1], "resolve") == 0) {
+        resolve_names(strcmp(argv[2], "-") != 0 ? argv[2] : NULL, argv + 3, argc - 3);
+        return 0;
+    }
+
+    // Segmented download: parallel Range requests written at their offsets
+    if (argc > 3 && strcmp(argv[1], "download") == 0) {
+        int nseg = argc > 4 ? atoi(argv[4]) : 4;
+        if (nseg <= 0) {
+            fprintf(stderr, "segments must be positive\n");
+            exit(1);
+        }
+        download(argv[2], argv[3], nseg);
+        return 0;
+    }
+
+    // HTTPS: new TLS connections that resume the cached session, with the request sent as 0-RTT data if allowed
+    if (argc > 2 && strcmp(argv[1], "https") == 0) {
+        int count = argc > 3 ? atoi(argv[3]) : 1;
+        const char *session_dir = argc > 4 && strcmp(argv[4], "-") != 0 ? argv[4] : NULL;
+        https_fetch(argv[2], count > 0 ? count : 1, session_dir, argc > 5 ? argv[5] : NULL);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "bench") == 0) {
+        struct bench_options opt = {2, 10, 10, 2000};
+        if (argc > 3)
+            opt.threads = atoi(argv[3]);
+        if (argc > 4)
+            opt.conns = atoi(argv[4]);
+        if (argc > 5)
+            opt.duration_s = atof(argv[5]);
+        if (argc > 7)
+            opt.timeout_ms = atoi(argv[7]);
+        if (opt.threads <= 0 || opt.conns < opt.threads || opt.duration_s <= 0 || opt.timeout_ms <= 0) {
+            fprintf(stderr, "threads, seconds and timeout-ms must be positive, with a connection per thread\n");
+            exit(1);
+        }
+        http_bench(argv[2], &opt, argc > 6 && strcmp(argv[6], "-") != 0 ? argv[6] : NULL);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "tls-bench") == 0) {
+        int count = argc > 3 ? atoi(argv[3]) : 200;
+        tls_bench(argv[2], count > 0 ? count : 200, argc > 4 ? argv[4] : NULL);
+        return 0;
+    }
+
+    // Multi-URL mode over pooled keep-alive connections
+    if (argc > 3 && strcmp(argv[1], "get") == 0) {
+        fetch_urls(atoi(argv[2]), argv + 3, argc - 3);
+        return 0;
+    }
+
     // Create a TCP socket
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
@@ -68,3 +905,606 @@ int main() {
     close(sockfd);                                 // Close the socket
     return 0;
 }
+
+/*
+server.c
+- This program is a static HTTP/1.1 file server: the local counterpart of the client above, for testing and load
+  testing it without leaving the machine.
+- Each thread runs its own epoll loop on its own listening socket. SO_REUSEPORT lets the kernel spread new
+  connections across the threads, so threads share nothing.
+- Connections are kept alive, and pipelined requests are answered in order.
+- Files come from the open-file and stat cache in 4_http_static.h, which keeps each file's response head already
+  formatted. Small bodies are copied from memory into the output buffer next to their head, so a batch of pipelined
+  responses leaves in one send(). Larger bodies go out with sendfile(). TCP_CORK holds the head back until the
+  first body segment can join it.
+- Single byte ranges are honoured with 206 Partial Content, so the client can download in parallel segments.
+- Responses carry an ETag and Last-Modified, and If-None-Match / If-Modified-Since get 304 Not Modified.
+- Only GET and HEAD are served. "/" and paths ending in "/" map to index.html, and paths containing ".." are refused.
+- Given a certificate and key, it serves HTTPS instead (OpenSSL). The handshake runs non-blocking on the same event
+  loop. TLS 1.3 clients get session tickets and may send requests as 0-RTT early data, which are answered before
+  the handshake completes. OpenSSL accepts early data only once per ticket, so replayed data is rejected. Bodies
+  are read into the output buffer and encrypted there, because sendfile() cannot encrypt.
+- Usage: ./server [directory] [port] [threads] [cert.pem key.pem]
+                                             (defaults: ".", 8080, one thread per online CPU, plain HTTP)
+         e.g. ./client get 8 http://127.0.0.1:8080/index.html
+         A self-signed certificate for the TLS benchmark:
+         openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 30 -subj /CN=localhost
+                 -addext subjectAltName=DNS:localhost,IP:127.0.0.1 -keyout key.pem -out cert.pem
+         ./server . 8443 1 cert.pem key.pem
+         ./client tls-bench https://127.0.0.1:8443/index.html 500 cert.pem
+- Build: gcc server.c -o server -pthread -lssl -lcrypto
+*/
+
+#define _GNU_SOURCE     // accept4
+#include <stdio.h>      // Standard I/O library
+#include <string.h>     // String manipulation functions
+#include <stdlib.h>     // Standard library functions
+#include <sys/types.h>  // Data types used in system calls
+#include <sys/socket.h> // Socket API
+#include <netinet/in.h> // Structures for internet addresses
+#include <netinet/tcp.h> // TCP_NODELAY, TCP_CORK
+#include <arpa/inet.h>  // Definitions for internet operations
+#include <unistd.h>     // POSIX API for UNIX system calls
+#include <fcntl.h>      // open for the served directory
+#include <errno.h>      // EAGAIN
+#include <signal.h>     // Ignoring SIGPIPE
+#include <pthread.h>    // One event loop per thread
+#include <sys/epoll.h>  // Event loop
+#include <sys/sendfile.h> // Large bodies straight from the page cache
+#include "4_http_parse.h"  // Request head parsing
+#include "4_http_static.h" // Open-file and stat cache with precomputed heads
+#include <openssl/ssl.h>  // HTTPS
+#include <openssl/err.h>
+
+#define PORTNO 8080             // Default port number
+#define IN_SIZE 8192            // Largest request head
+#define OUT_SIZE (32 * 1024)    // Output buffer per connection
+#define MAX_EVENTS 256
+
+// One client connection
+struct client {
+    int fd;
+    char in[IN_SIZE];
+    size_t in_len, scanned;     // Received bytes and how far the current head has been scanned
+    char out[OUT_SIZE];
+    size_t out_len, out_sent;   // Formatted responses and how much of them has been sent
+    struct static_file *file;   // Body being sent with sendfile(), or NULL
+    off_t file_off, file_end;
+    int corked;                 // TCP_CORK is set for the file being sent
+    int closing;                // Close once everything queued is sent
+    int want_out;               // Registered for EPOLLOUT instead of EPOLLIN
+    SSL *ssl;                   // TLS session, or NULL for plain HTTP
+    int handshaking;            // 1: reading early data, 2: finishing the handshake, 0: done
+    int blocked_out;            // The last transfer that would block waits for room to send (else for input)
+};
+
+// State of one server thread
+struct worker {
+    int listen_fd, epoll_fd;
+    struct static_cache cache;
+    unsigned long requests;
+};
+
+const char *served_dir = ".";
+int server_port = PORTNO;
+SSL_CTX *tls_ctx = NULL;        // Set when serving HTTPS
+
+// Function to queue a response with no file body (errors), and close the connection after it if asked
+void queue_error(struct client *cl, int status, const char *reason, int close_after, time_t now) {
+    size_t date_len;
+    const char *date = static_date_line(now, &date_len);
+    cl->out_len += snprintf(cl->out + cl->out_len, OUT_SIZE - cl->out_len,
+                            "HTTP/1.1 %d %s\r\n"
+                            "Server: l5-static\r\n"
+                            "%.*s"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: %zu\r\n"
+                            "%s"
+                            "\r\n"
+                            "%s\n",
+                            status, reason, (int)date_len, date, strlen(reason) + 1,
+                            close_after ? "Connection: close\r\n" : "", reason);
+    if (close_after)
+        cl->closing = 1;
+}
+
+// Function to map a request target to a path under the served directory (without the leading '/').
+// Decodes %XX escapes, drops the query string and refuses ".." and empty segments: "//etc/passwd" or
+// "/%2fetc/passwd" would otherwise decode to an absolute path, which openat() resolves outside the directory.
+// Returns the length or -1
+int target_to_path(const char *target, size_t len, char *path, size_t size) {
+    size_t n = 0;
+    if (len == 0 || target[0] != '/')
+        return -1;
+    for (size_t i = 1; i < len && target[i] != '?' && target[i] != '#'; i++) {
+        char c = target[i];
+        if (c == '%' && i + 2 < len) {
+            char hex[3] = {target[i + 1], target[i + 2], '\0'};
+            char *end;
+            c = (char)strtol(hex, &end, 16);
+            if (*end != '\0' || c == '\0')
+                return -1;
+            i += 2;
+        }
+        if (n + 1 >= size)
+            return -1;
+        path[n++] = c;
+    }
+    path[n] = '\0';
+    if (path[0] == '/' || strstr(path, "//") != NULL)
+        return -1;
+    for (char *p = path; (p = strstr(p, "..")) != NULL; p += 2)
+        if ((p == path || p[-1] == '/') && (p[2] == '\0' || p[2] == '/'))
+            return -1;
+    if (n == 0 || path[n - 1] == '/') {
+        static const char index[] = "index.html";
+        if (n + sizeof(index) > size)
+            return -1;
+        memcpy(path + n, index, sizeof(index));
+        n += sizeof(index) - 1;
+    }
+    return n;
+}
+
+// Function to read a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range of a file of the given
+// size into [*first, *last]. Returns 1 for a satisfiable range, 0 to ignore the header (several ranges or a
+// form not understood: the whole file is sent), or -1 if the range lies outside the file
+int parse_range(const struct http_header *h, off_t size, off_t *first, off_t *last) {
+    if (h->value_len < 7 || strncasecmp(h->value, "bytes=", 6) != 0 || memchr(h->value, ',', h->value_len) != NULL)
+        return 0;
+    const char *p = h->value + 6, *end = h->value + h->value_len;
+    long long a = -1, b = -1;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        a = (a < 0 ? 0 : a * 10) + (*p - '0');
+    if (p == end || *p++ != '-')
+        return 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        b = (b < 0 ? 0 : b * 10) + (*p - '0');
+    if (p != end || (a < 0 && b < 0))
+        return 0;
+    if (a < 0) {                                   // Suffix: the last b bytes
+        if (b == 0)
+            return -1;
+        a = b < size ? size - b : 0;
+        b = size - 1;
+    } else if (b < 0 || b >= size) {
+        b = size - 1;
+    }
+    if (a >= size || a > b)
+        return -1;
+    *first = a;
+    *last = b;
+    return 1;
+}
+
+// Function to answer one parsed request by queueing its response; the body of a large file is left for sendfile()
+void handle_request(struct worker *w, struct client *cl, const struct http_request *req, time_t now) {
+    int head_only = req->method_len == 4 && memcmp(req->method, "HEAD", 4) == 0;
+    int keep_alive = req->minor >= 1;
+    const struct http_header *conn = http_find_field(req->headers, req->nheaders, "connection");
+    if (conn != NULL && http_has_token(conn, "close"))
+        keep_alive = 0;
+    else if (conn != NULL && http_has_token(conn, "keep-alive"))
+        keep_alive = 1;
+    w->requests++;
+
+    if (!head_only && !(req->method_len == 3 && memcmp(req->method, "GET", 3) == 0)) {
+        queue_error(cl, 405, "Method Not Allowed", 1, now);   // A request body would follow; don't parse it
+        return;
+    }
+    char path[1024];
+    int len = target_to_path(req->target, req->target_len, path, sizeof(path));
+    if (len < 0) {
+        queue_error(cl, 400, "Bad Request", !keep_alive, now);
+        return;
+    }
+    struct static_file *f = static_lookup(&w->cache, path, len, now);
+    if (f == NULL) {
+        queue_error(cl, 404, "Not Found", !keep_alive, now);
+        return;
+    }
+
+    // Conditional request answered by the client's cached copy: 304 with no body
+    const struct http_header *inm = http_find_field(req->headers, req->nheaders, "if-none-match");
+    const struct http_header *ims = http_find_field(req->headers, req->nheaders, "if-modified-since");
+    if (inm != NULL ? http_has_token(inm, f->etag) || (inm->value_len == 1 && inm->value[0] == '*')
+                    : ims != NULL && ims->value_len == strlen(f->last_modified)
+                          && memcmp(ims->value, f->last_modified, ims->value_len) == 0) {
+        size_t date_len;
+        const char *date = static_date_line(now, &date_len);
+        cl->out_len += snprintf(cl->out + cl->out_len, OUT_SIZE - cl->out_len,
+                                "HTTP/1.1 304 Not Modified\r\n"
+                                "Server: l5-static\r\n"
+                                "ETag: %s\r\n"
+                                "%.*s"
+                                "%s"
+                                "\r\n",
+                                f->etag, (int)date_len, date, keep_alive ? "" : "Connection: close\r\n");
+        cl->closing |= !keep_alive;
+        static_release(f);
+        return;
+    }
+
+    // A Range request gets a 206 head formatted here; everything else uses the precomputed 200 head
+    off_t first = 0, last = f->size - 1;
+    const struct http_header *range = http_find_field(req->headers, req->nheaders, "range");
+    int ranged = range != NULL ? parse_range(range, f->size, &first, &last) : 0;
+    if (ranged < 0) {
+        cl->out_len += snprintf(cl->out + cl->out_len, OUT_SIZE - cl->out_len,
+                                "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                                "Content-Range: bytes */%lld\r\n"
+                                "Content-Length: 0\r\n"
+                                "%s"
+                                "\r\n",
+                                (long long)f->size, keep_alive ? "" : "Connection: close\r\n");
+        cl->closing |= !keep_alive;
+        static_release(f);
+        return;
+    }
+
+    // Head, then the per-second Date line, the connection header and the inline body if any
+    size_t date_len;
+    const char *date = static_date_line(now, &date_len);
+    char *o = cl->out + cl->out_len;
+    if (ranged) {
+        const char *type = memmem(f->head, f->head_len, "Content-Type:", 13);
+        const char *type_end = memchr(type, '\n', f->head + f->head_len - type) + 1;
+        o += snprintf(o, OUT_SIZE - cl->out_len,
+                      "HTTP/1.1 206 Partial Content\r\n"
+                      "Server: l5-static\r\n"
+                      "%.*s"
+                      "Content-Range: bytes %lld-%lld/%lld\r\n"
+                      "Content-Length: %lld\r\n",
+                      (int)(type_end - type), type, (long long)first, (long long)last, (long long)f->size,
+                      (long long)(last + 1 - first));
+    } else {
+        memcpy(o, f->head, f->head_len);
+        o += f->head_len;
+    }
+    memcpy(o, date, date_len);
+    o += date_len;
+    if (!keep_alive) {
+        memcpy(o, "Connection: close\r\n", 19);
+        o += 19;
+        cl->closing = 1;
+    }
+    memcpy(o, "\r\n", 2);
+    o += 2;
+    if (!head_only && f->body != NULL) {
+        memcpy(o, f->body + first, last + 1 - first);
+        o += last + 1 - first;
+    } else if (!head_only && f->size > 0) {
+        cl->file = f;                              // Keeps the reference until the body is sent
+        cl->file_off = first;
+        cl->file_end = last + 1;
+        cl->out_len = o - cl->out;
+        return;
+    }
+    cl->out_len = o - cl->out;
+    static_release(f);
+}
+
+// Function to parse and answer every complete request in the input buffer while the output buffer has room
+void process_requests(struct worker *w, struct client *cl, time_t now) {
+    size_t off = 0;
+    while (cl->file == NULL && !cl->closing && OUT_SIZE - cl->out_len >= STATIC_HEAD_MAX + 128 + STATIC_INLINE_MAX) {
+        struct http_request req;
+        ssize_t n = http_parse_request(cl->in + off, cl->in_len - off, &cl->scanned, &req);
+        if (n == 0) {
+            if (off == 0 && cl->in_len == IN_SIZE)
+                queue_error(cl, 431, "Request Header Fields Too Large", 1, now);
+            break;
+        }
+        if (n < 0) {
+            queue_error(cl, 400, "Bad Request", 1, now);
+            break;
+        }
+        handle_request(w, cl, &req, now);
+        off += n;
+        cl->scanned = 0;
+    }
+    memmove(cl->in, cl->in + off, cl->in_len - off);
+    cl->in_len -= off;
+}
+
+// Function to set or clear TCP_CORK
+void set_cork(struct client *cl, int on) {
+    if (cl->corked != on && setsockopt(cl->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == 0)
+        cl->corked = on;
+}
+
+// Function to map a failed TLS call to errno: EAGAIN (noting whether it waits to send or to receive) or EIO
+ssize_t tls_failed(struct client *cl, int rc) {
+    int err = SSL_get_error(cl->ssl, rc);
+    errno = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? EAGAIN : EIO;
+    cl->blocked_out = err == SSL_ERROR_WANT_WRITE;
+    if (err == SSL_ERROR_SSL)
+        ERR_clear_error();                         // The error queue is per thread: leave it clean for the next client
+    return -1;
+}
+
+// Function to send bytes on a connection. Until the TLS handshake completes, responses to early data go out as
+// 0.5-RTT data, right behind the server's handshake messages
+ssize_t client_send(struct client *cl, const char *buf, size_t len) {
+    cl->blocked_out = 1;
+    if (cl->ssl == NULL)
+        return send(cl->fd, buf, len, MSG_NOSIGNAL);
+    size_t n;
+    int rc = cl->handshaking ? SSL_write_early_data(cl->ssl, buf, len, &n) : SSL_write_ex(cl->ssl, buf, len, &n);
+    return rc == 1 ? (ssize_t)n : tls_failed(cl, rc);
+}
+
+// Function to receive bytes on a connection (0 when the client has closed). A TLS connection first reads any
+// early data, then finishes the handshake, then reads normally
+ssize_t client_recv(struct client *cl, char *buf, size_t len) {
+    cl->blocked_out = 0;
+    if (cl->ssl == NULL)
+        return recv(cl->fd, buf, len, 0);
+    size_t n;
+    if (cl->handshaking == 1) {
+        int rc = SSL_read_early_data(cl->ssl, buf, len, &n);
+        if (rc == SSL_READ_EARLY_DATA_SUCCESS)
+            return n;
+        if (rc == SSL_READ_EARLY_DATA_ERROR)
+            return tls_failed(cl, 0);
+        cl->handshaking = 2;                       // No (more) early data
+    }
+    if (cl->handshaking == 2) {
+        int rc = SSL_do_handshake(cl->ssl);
+        if (rc != 1)
+            return tls_failed(cl, rc);
+        cl->handshaking = 0;
+    }
+    int rc = SSL_read_ex(cl->ssl, buf, len, &n);
+    if (rc == 1)
+        return n;
+    if (SSL_get_error(cl->ssl, rc) == SSL_ERROR_ZERO_RETURN)
+        return 0;
+    return tls_failed(cl, rc);
+}
+
+// Function to send queued output and any file body. Returns 1 if everything was sent, 0 if the socket is full,
+// or -1 if the connection failed
+int flush_client(struct client *cl) {
+    if (cl->file != NULL && cl->ssl == NULL)
+        set_cork(cl, 1);                           // Head and first body segment leave in the same packets
+    for (;;) {
+        while (cl->out_sent < cl->out_len) {
+            ssize_t n = client_send(cl, cl->out + cl->out_sent, cl->out_len - cl->out_sent);
+            if (n < 0)
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            cl->out_sent += n;
+        }
+        cl->out_len = cl->out_sent = 0;
+        if (cl->file == NULL || cl->ssl == NULL)
+            break;
+
+        // TLS encrypts in user space, so the body is read into the output buffer instead of using sendfile()
+        size_t want = cl->file_end - cl->file_off < OUT_SIZE ? cl->file_end - cl->file_off : OUT_SIZE;
+        ssize_t n = pread(cl->file->fd, cl->out, want, cl->file_off);
+        if (n <= 0)
+            return -1;                             // The file shrank: stop short
+        cl->out_len = n;
+        cl->file_off += n;
+        if (cl->file_off >= cl->file_end) {
+            static_release(cl->file);
+            cl->file = NULL;
+        }
+    }
+    while (cl->file != NULL) {
+        ssize_t n = sendfile(cl->fd, cl->file->fd, &cl->file_off, cl->file_end - cl->file_off);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        if (n == 0 || cl->file_off >= cl->file_end) {  // Done (or the file shrank: stop short)
+            if (cl->file_off < cl->file_end)
+                return -1;
+            static_release(cl->file);
+            cl->file = NULL;
+            set_cork(cl, 0);
+        }
+    }
+    return 1;
+}
+
+// Function to close a connection and release what it holds
+void close_client(struct client *cl) {
+    if (cl->file != NULL)
+        static_release(cl->file);
+    if (cl->ssl != NULL) {
+        if (!cl->handshaking)
+            SSL_shutdown(cl->ssl);                 // close_notify, without waiting for the client's
+        SSL_free(cl->ssl);
+        ERR_clear_error();
+    }
+    close(cl->fd);
+    free(cl);
+}
+
+// Function to switch a connection between waiting for requests and waiting to send
+void watch_client(struct worker *w, struct client *cl, int want_out) {
+    if (cl->want_out == want_out)
+        return;
+    struct epoll_event ev = {.events = want_out ? EPOLLOUT : EPOLLIN, .data.ptr = cl};
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, cl->fd, &ev);
+    cl->want_out = want_out;
+}
+
+// Function to handle readiness of a connection: send what is queued, answer buffered requests and read more,
+// until the socket is drained or full
+void serve_client(struct worker *w, struct client *cl) {
+    time_t now = time(NULL);
+    int drained = 0;
+    for (;;) {
+        int sent = flush_client(cl);
+        if (sent < 0 || (sent == 1 && cl->closing)) {
+            close_client(cl);
+            return;
+        }
+        if (sent == 0) {
+            watch_client(w, cl, cl->blocked_out);  // Resume when the socket has room again
+            return;
+        }
+        process_requests(w, cl, now);              // Requests already buffered (pipelining)
+        if (cl->out_len > 0 || cl->file != NULL || cl->closing)
+            continue;
+        if (drained) {                             // A short read emptied the socket; epoll reports more
+            watch_client(w, cl, 0);
+            return;
+        }
+        ssize_t n = client_recv(cl, cl->in + cl->in_len, IN_SIZE - cl->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_client(cl);
+            return;
+        }
+        if (n < 0) {
+            watch_client(w, cl, cl->blocked_out);
+            return;
+        }
+        drained = cl->ssl == NULL && (size_t)n < IN_SIZE - cl->in_len;   // A TLS read returns one record at most
+        cl->in_len += n;
+    }
+}
+
+// Function to create a non-blocking listening socket that shares its port with the other threads
+int open_listener(void) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;          // Address family (IPv4)
+    address.sin_addr.s_addr = INADDR_ANY;  // Accept connections from any IP
+    address.sin_port = htons(server_port); // Port number
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("Bind failed");
+        exit(1);
+    }
+    if (listen(fd, 4096) < 0) {
+        perror("Listen failed");
+        exit(1);
+    }
+    return fd;
+}
+
+// Function to accept every pending connection
+void accept_clients(struct worker *w) {
+    for (;;) {
+        int fd = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+                perror("Accept failed");
+            if (errno != ECONNABORTED)
+                return;
+            continue;
+        }
+        struct client *cl = calloc(1, sizeof(*cl));
+        if (cl == NULL) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // Small responses leave at once
+        cl->fd = fd;
+        if (tls_ctx != NULL) {
+            if ((cl->ssl = SSL_new(tls_ctx)) == NULL) {
+                close_client(cl);
+                continue;
+            }
+            SSL_set_fd(cl->ssl, fd);
+            SSL_set_accept_state(cl->ssl);
+            cl->handshaking = 1;
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = cl};
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            close_client(cl);
+    }
+}
+
+// Function to run one thread's event loop
+void *serve_loop(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};   // NULL marks the listening socket
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev);
+    for (;;) {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("Epoll wait failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_clients(w);
+            else
+                serve_client(w, events[i].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        served_dir = argv[1];
+    if (argc > 2)
+        server_port = atoi(argv[2]);
+    if (argc > 3)
+        nthreads = atoi(argv[3]);
+    if (nthreads < 1)
+        nthreads = 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    // HTTPS: tickets for resumption, and early data up to what fits in a connection's input buffer
+    if (argc > 5) {
+        tls_ctx = SSL_CTX_new(TLS_server_method());
+        if (tls_ctx == NULL || SSL_CTX_use_certificate_chain_file(tls_ctx, argv[4]) != 1
+            || SSL_CTX_use_PrivateKey_file(tls_ctx, argv[5], SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(tls_ctx) != 1) {
+            fprintf(stderr, "Loading the certificate and key failed\n");
+            ERR_print_errors_fp(stderr);
+            exit(1);
+        }
+        SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+        SSL_CTX_set_max_early_data(tls_ctx, IN_SIZE);
+        SSL_CTX_set_recv_max_early_data(tls_ctx, IN_SIZE);
+        SSL_CTX_set_mode(tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+
+    int root_fd = open(served_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        perror("Open failed");
+        exit(1);
+    }
+
+    // Every thread gets its own listening socket, epoll instance and file cache
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    if (workers == NULL || threads == NULL) {
+        perror("Allocation failed");
+        exit(1);
+    }
+    for (long i = 0; i < nthreads; i++) {
+        workers[i].listen_fd = open_listener();
+        workers[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        workers[i].cache.root_fd = root_fd;
+        if (workers[i].epoll_fd < 0) {
+            perror("Epoll creation failed");
+            exit(1);
+        }
+    }
+    printf("Serving %s on port %d with %ld thread(s)%s\n", served_dir, server_port, nthreads,
+           tls_ctx != NULL ? " over TLS" : "");
+    fflush(stdout);
+    for (long i = 1; i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, serve_loop, &workers[i]) != 0) {
+            perror("Thread creation failed");
+            exit(1);
+        }
+    serve_loop(&workers[0]);
+    return 0;
+}
@@ -4,6 +4,13 @@ Create a TCP peer-to-peer program in C where:
 - The user can choose to run the program as a client or a server.
 - The client sends a string to the server.
 - The server receives the string, reverses it, and sends the reversed string back to the client.
+- Extension: in peer mode one process listens and dials other peers at the same time, keeps many sessions open
+  and serves reverse requests on all of them while sending its own.
+- Extension: files are transferred in bulk, striped over several connections, checksummed per chunk and resumable.
+- Extension: content is distributed by a swarm of peers trading hashed chunks, so the origin is not the bottleneck.
+- Extension: a changed file is synced by sending only its difference from the receiver's old copy (rsync-style).
+- Extension: strings of any length (spaces included) are reversed with SIMD, MB-GB files as a stream, and
+  optionally by UTF-8 character.
 */
 
 /*
@@ -11,8 +18,41 @@ Description:
 - The program defines functions for creating sockets, binding, connecting, sending, and receiving data.
 - The `peer_server` function listens for incoming connections and processes the received string.
 - The `peer_client` function prompts the user to enter a string, sends it to the server, and receives the reversed string back.
+- Peer mode runs a single epoll loop (peer2peer_loop.h) holding every inbound and outbound session. Requests and
+  replies are framed (type, length), so both sides of a session can send requests at the same time.
+- Usage: ./peer2peer                                              choose client or server (original behaviour)
+         ./peer2peer peer <port> [host:port]...                   listen on port and dial the given peers; every
+                                                                  line typed is sent to all connected peers
+         ./peer2peer load <port> <size> <window> <seconds> [host:port]...
+                                                                  as peer, but keep window requests of size bytes
+                                                                  in flight on every session and report the rate
+                                                                  served and consumed each second
+         ./peer2peer receive <port> <dir>                         accept bulk transfers into dir
+         ./peer2peer send <host:port> <file> [streams] [chunk-kb] send a file striped over streams connections
+                                                                  (default 4) in chunks of chunk-kb (default 1024)
+         ./peer2peer manifest <file> <manifest> [chunk-kb]     hash the file's chunks (default 256 KB) into a manifest
+         ./peer2peer swarm <port> <manifest> <file> <linger-s> [host:port]...
+                                                                  join the swarm of the manifest: fetch the chunks
+                                                                  file lacks from all peers and serve the ones it
+                                                                  has; exit linger-s seconds after completing
+                                                                  (-1: keep seeding)
+         ./peer2peer reverse <file|-> [utf8]                      write the file reversed to standard output
+         ./peer2peer reverse-send <host:port> <file|-> [utf8]     the same, reversed by a peer-mode node
+         ./peer2peer sync-receive <port> <dir>                    accept delta syncs of files in dir
+         ./peer2peer sync <host:port> <file> [block]              send the file as a delta against the receiver's
+                                                                  copy (block size picked by the receiver if 0;
+                                                                  it keeps requests within 700 B..128 KB)
+- Bulk transfers (peer2peer_bulk.h) resume where they stopped when the sender is run again after a disconnect.
+- Swarm nodes (peer2peer_swarm.h) dialling one peer learn the others from it; e.g. a seed and four fetchers:
+    ./peer2peer manifest big.bin big.manifest && ./peer2peer swarm 10400 big.manifest big.bin -1 &
+    for p in 10401 10402 10403 10404; do ./peer2peer swarm $p big.manifest copy$p.bin 5 127.0.0.1:10400 & done
+- Reversal (peer2peer_reverse.h) goes 32 bytes per AVX2 shuffle. Large inputs are taken back to front in 1 MB
+  chunks straight from the file mapping, so the reversed stream starts at once and memory stays flat.
+- Delta syncs (peer2peer_delta.h) cost the block signatures plus the changed bytes.
+- Build: gcc peer2peer_TCP.c -o peer2peer -pthread -lm
 */
 
+#define _GNU_SOURCE     // accept4
 #include <stdio.h>      // Standard I/O library
 #include <stdlib.h>     // Standard library functions
 #include <string.h>     // String manipulation functions
@@ -21,17 +61,21 @@ Description:
 #include <sys/socket.h> // Socket API
 #include <arpa/inet.h>  // Definitions for internet operations
 #include <sys/types.h>  // Data types used in system calls
+#include "peer2peer_loop.h" // Event loop of the peer modes
+#include "peer2peer_bulk.h" // Striped file transfer
+#include "peer2peer_swarm.h" // Swarm distribution
+#include "peer2peer_delta.h" // Delta sync
+#include "peer2peer_reverse.h" // Vectorized and streaming reversal
 
 #define PORT 10320      // Port number for the server
 
+#define PEER_REVERSE 1          // Frame type: reverse the payload
+#define PEER_REVERSED 2         // Frame type: reply to PEER_REVERSE with the reversed payload
+#define PEER_REVERSE_UTF8 3     // Frame type: reverse the payload by UTF-8 character (answered with PEER_REVERSED)
+
 // Function to reverse a given string
 void reverseString(char str[]) {
-    int n = strlen(str);
-    for (int i = 0; i < n / 2; i++) {
-        char temp = str[i];
-        str[i] = str[n - i - 1];
-        str[n - i - 1] = temp;
-    }
+    reverse_in_place(str, strlen(str));
 }
 
 // Function to create a TCP socket and handle errors
@@ -62,14 +106,35 @@ void connect_to_peer(int socket_id, struct sockaddr_in *address) {
     }
 }
 
-// Function to send data through the socket
+// Function to send a string and its terminating NUL through the socket, however many writes it takes
 void send_data(int socket_id, char *data) {
-    write(socket_id, data, strlen(data) + 1);
+    if (bulk_write_all(socket_id, data, strlen(data) + 1) < 0)
+        perror("Send failed");
 }
 
-// Function to receive data through the socket
-void receive_data(int socket_id, char *buffer, size_t size) {
-    read(socket_id, buffer, size);
+// Function to receive a NUL-terminated string of any length through the socket; the caller frees it
+char *receive_data(int socket_id) {
+    size_t size = 256, used = 0;
+    char *buffer = malloc(size);
+    while (buffer != NULL) {
+        ssize_t n = read(socket_id, buffer + used, size - used);
+        if (n <= 0) {
+            buffer[used] = '\0';                   // Peer closed early: keep what came
+            return buffer;
+        }
+        if (memchr(buffer + used, '\0', n) != NULL)
+            return buffer;
+        used += n;
+        if (used == size) {
+            char *bigger = realloc(buffer, size * 2);
+            if (bigger == NULL)
+                free(buffer);
+            buffer = bigger;
+            size *= 2;
+        }
+    }
+    perror("Out of memory");
+    exit(EXIT_FAILURE);
 }
 
 // Server function to accept connections and handle string reversal
@@ -86,8 +151,7 @@ void peer_server(int socket_id) {
     }
 
     // Buffer to store the received string
-    char buffer[256];
-    receive_data(new_socket_id, buffer, sizeof(buffer));
+    char *buffer = receive_data(new_socket_id);
     printf("Received string: %s\n", buffer);
 
     // Reverse the received string
@@ -98,32 +162,462 @@ void peer_server(int socket_id) {
     send_data(new_socket_id, buffer);
     printf("Reversed string sent to peer.\n");
 
+    free(buffer);
     close(new_socket_id); // Close the client socket after communication
 }
 
 // Client function to send string and receive the reversed string from the server
 void peer_client(int socket_id) {
-    char buff[256];
+    char *buff = NULL;
+    size_t size = 0;
     printf("Enter a string: ");
-    scanf("%s", buff);  // Read input string from the user
+    ssize_t len = getline(&buff, &size, stdin);  // Read the whole line from the user, spaces included
+    if (len < 0) {
+        free(buff);
+        close(socket_id);
+        return;
+    }
+    if (len > 0 && buff[len - 1] == '\n')
+        buff[len - 1] = '\0';
 
     // Send the input string to the server
     send_data(socket_id, buff);
     printf("Sent string to the peer.\n");
 
     // Buffer to store the reply from the server
-    char reply[256];
-    receive_data(socket_id, reply, sizeof(reply));
+    char *reply = receive_data(socket_id);
     printf("Peer's reply: %s\n", reply);
+    free(reply);
+    free(buff);
 
     close(socket_id); // Close the socket after communication
 }
 
+// State of a peer-mode node
+struct peer_node {
+    int load;                   // Keep requests in flight on every session (load mode)
+    size_t size;                // Payload size of load requests
+    int window;                 // Requests in flight per session
+    char *payload, *expected;   // Load payload and its reversal
+    unsigned long long served, consumed, bytes_served, bytes_consumed, mismatches;
+};
+
+// Function to queue a load request on a session
+static void peer_request(struct peer_node *node, struct peer_session *s) {
+    if (peer_send(s, PEER_REVERSE, node->payload, node->size) < 0)
+        fprintf(stderr, "Out of memory queueing a request to %s\n", s->name);
+}
+
+// Handler: a session opened (either direction); in load mode fill its window
+static void peer_opened(struct peer_loop *l, struct peer_session *s) {
+    struct peer_node *node = l->ctx;
+    printf("Connected %s peer %s\n", s->outbound ? "to" : "from", s->name);
+    for (int i = 0; node->load && i < node->window; i++)
+        peer_request(node, s);
+}
+
+// Handler: a session closed
+static void peer_closed(struct peer_loop *l, struct peer_session *s) {
+    (void)l;
+    printf("Lost peer %s%s\n", s->name, s->outbound ? " (redialling)" : "");
+}
+
+// Handler: a frame arrived. Requests are answered with the reversal written straight into the output buffer;
+// replies are printed, or in load mode checked and replaced by a new request
+static void peer_frame_in(struct peer_loop *l, struct peer_session *s, uint32_t type, char *payload, size_t len) {
+    struct peer_node *node = l->ctx;
+    if (type == PEER_REVERSE || type == PEER_REVERSE_UTF8) {
+        char *reply = peer_reserve(s, PEER_REVERSED, len);
+        if (reply == NULL) {
+            peer_close(l, s);
+            return;
+        }
+        if (type == PEER_REVERSE_UTF8)
+            reverse_copy_utf8(reply, payload, len);
+        else
+            reverse_copy(reply, payload, len);
+        node->served++;
+        node->bytes_served += len;
+    } else if (type == PEER_REVERSED && node->load) {
+        if (len != node->size || memcmp(payload, node->expected, len) != 0)
+            node->mismatches++;
+        node->consumed++;
+        node->bytes_consumed += len;
+        peer_request(node, s);
+    } else if (type == PEER_REVERSED) {
+        printf("Peer %s's reply: %.*s\n", s->name, (int)len, payload);
+        node->consumed++;
+    } else {
+        fprintf(stderr, "Unknown frame type %u from %s\n", type, s->name);
+        peer_close(l, s);
+    }
+}
+
+// Handler: a line typed in peer mode is sent to every connected peer
+static void peer_line_in(struct peer_loop *l, int fd) {
+    static char line[65536];
+    static size_t used;
+    ssize_t n = read(fd, line + used, sizeof(line) - used);
+    if (n <= 0) {
+        epoll_ctl(l->epfd, EPOLL_CTL_DEL, fd, NULL);   // End of input: keep serving peers
+        return;
+    }
+    used += n;
+    char *start = line, *nl;
+    while ((nl = memchr(start, '\n', line + used - start)) != NULL || (start == line && used == sizeof(line))) {
+        size_t len = nl != NULL ? (size_t)(nl - start) : used;
+        int sent = 0;
+        for (int i = 0; i < l->nsessions; i++)
+            if (l->sessions[i]->connected && peer_send(l->sessions[i], PEER_REVERSE, start, len) == 0)
+                sent++;
+        printf("Sent string to %d peer%s.\n", sent, sent == 1 ? "" : "s");
+        start += nl != NULL ? len + 1 : len;
+    }
+    used -= start - line;
+    memmove(line, start, used);
+}
+
+// Peer mode: listen on port and dial every given peer on one event loop. Every session, inbound or outbound,
+// serves reverse requests; in load mode every session also carries this node's own requests
+void peer_node_run(int port, char **peers, int npeers, struct peer_node *node, int seconds) {
+    struct peer_loop l;
+    if (peer_loop_init(&l, port) < 0) {
+        perror("Peer setup failed");
+        exit(EXIT_FAILURE);
+    }
+    l.ctx = node;
+    l.on_open = peer_opened;
+    l.on_close = peer_closed;
+    l.on_frame = peer_frame_in;
+    for (int i = 0; i < npeers; i++)
+        if (peer_dial(&l, peers[i]) < 0)
+            fprintf(stderr, "Cannot resolve peer %s\n", peers[i]);
+    if (!node->load) {
+        l.on_input = peer_line_in;
+        peer_watch_input(&l, STDIN_FILENO);
+    }
+    printf("Peer listening on port %d, dialling %d peer%s\n", port, npeers, npeers == 1 ? "" : "s");
+    fflush(stdout);
+
+    double start = peer_now_ms(), last = start;
+    unsigned long long served = 0, consumed = 0, bytes_served = 0, bytes_consumed = 0;
+    while (seconds <= 0 || peer_now_ms() - start < seconds * 1000.0) {
+        peer_loop_run(&l, node->load ? 100 : -1);
+        double now = peer_now_ms();
+        if (node->load && now - last >= 1000) {
+            double dt = (now - last) / 1000;
+            int open = 0;
+            for (int i = 0; i < l.nsessions; i++)
+                open += l.sessions[i]->connected;
+            printf("sessions %d  served %.0f req/s %.1f MB/s  consumed %.0f req/s %.1f MB/s\n", open,
+                   (node->served - served) / dt, (node->bytes_served - bytes_served) / dt / 1e6,
+                   (node->consumed - consumed) / dt, (node->bytes_consumed - bytes_consumed) / dt / 1e6);
+            fflush(stdout);
+            served = node->served, consumed = node->consumed;
+            bytes_served = node->bytes_served, bytes_consumed = node->bytes_consumed;
+            last = now;
+        }
+        if (!node->load)
+            fflush(stdout);
+    }
+    double elapsed = (peer_now_ms() - start) / 1000;
+    printf("Total: served %llu requests (%.1f MB), consumed %llu (%.1f MB) in %.1f s, %llu mismatched replies\n",
+           node->served, node->bytes_served / 1e6, node->consumed, node->bytes_consumed / 1e6, elapsed,
+           node->mismatches);
+    peer_loop_free(&l);
+}
+
+// State of a streaming reverse through a peer
+struct reverse_job {
+    const char *src;            // Mapped input
+    size_t end;                 // Input before this offset is not sent yet
+    int utf8, window, inflight;
+    int out;                    // Where the reversed stream goes
+    unsigned long long received;
+    int failed;
+};
+
+// Function to send the next chunk of the input, taken from its end
+static void reverse_job_next(struct reverse_job *job, struct peer_session *s) {
+    size_t start = reverse_chunk_start(job->src, job->end, REVERSE_CHUNK, job->utf8);
+    if (peer_send(s, job->utf8 ? PEER_REVERSE_UTF8 : PEER_REVERSE, job->src + start, job->end - start) < 0) {
+        job->failed = 1;
+        return;
+    }
+    job->end = start;
+    job->inflight++;
+}
+
+static void reverse_job_opened(struct peer_loop *l, struct peer_session *s) {
+    struct reverse_job *job = l->ctx;
+    while (job->end > 0 && job->inflight < job->window && !job->failed)
+        reverse_job_next(job, s);
+}
+
+// Handler: a reversed chunk came back (chunks are answered in order): write it out and send another
+static void reverse_job_frame(struct peer_loop *l, struct peer_session *s, uint32_t type, char *payload,
+                              size_t len) {
+    struct reverse_job *job = l->ctx;
+    if (type != PEER_REVERSED || reverse_write_all(job->out, payload, len) < 0) {
+        job->failed = 1;
+        return;
+    }
+    job->inflight--;
+    job->received += len;
+    if (job->end > 0)
+        reverse_job_next(job, s);
+    (void)l;
+}
+
+static void reverse_job_closed(struct peer_loop *l, struct peer_session *s) {
+    struct reverse_job *job = l->ctx;
+    (void)s;
+    job->failed = 1;
+}
+
+// Handler: the peer could not be reached; give up rather than redial (the session never opened)
+static void reverse_job_unreachable(struct peer_loop *l, struct peer_session *s) {
+    struct reverse_job *job = l->ctx;
+    fprintf(stderr, "Cannot reach peer %s\n", s->name);
+    s->outbound = 0;
+    job->failed = 1;
+}
+
+// Function to map a file (or read all of standard input for "-"); NULL on failure
+static char *map_input(const char *path, size_t *n) {
+    if (strcmp(path, "-") == 0) {
+        size_t size = 1 << 20, used = 0;
+        char *buf = malloc(size);
+        ssize_t got;
+        while (buf != NULL && (got = read(STDIN_FILENO, buf + used, size - used)) > 0)
+            if ((used += got) == size) {
+                char *bigger = realloc(buf, size *= 2);
+                if (bigger == NULL)
+                    free(buf);
+                buf = bigger;
+            }
+        *n = used;
+        return buf;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return NULL;
+    }
+    *n = st.st_size;
+    char *map = mmap(NULL, *n ? *n : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+// Reverse modes: reverse a file (or standard input) to standard output, locally, or through a peer. The input
+// is taken back to front in chunks, so output starts with the first chunk
+int reverse_run(const char *peer, const char *path, int utf8) {
+    size_t n;
+    char *src = map_input(path, &n);
+    if (src == NULL)
+        return -1;
+    double start = peer_now_ms();
+    int rc;
+    if (peer == NULL)
+        rc = reverse_stream(STDOUT_FILENO, src, n, utf8);
+    else {
+        struct reverse_job job = {.src = src, .end = n, .utf8 = utf8, .window = 4, .out = STDOUT_FILENO};
+        struct peer_loop l;
+        if (peer_loop_init(&l, 0) < 0) {
+            perror("Event loop setup failed");
+            return -1;
+        }
+        l.ctx = &job;
+        l.on_open = reverse_job_opened;
+        l.on_frame = reverse_job_frame;
+        l.on_close = reverse_job_closed;
+        l.on_dial_failed = reverse_job_unreachable;
+        if (peer_dial(&l, peer) < 0) {
+            fprintf(stderr, "Cannot resolve peer %s\n", peer);
+            peer_loop_free(&l);
+            return -1;
+        }
+        while (!job.failed && (job.end > 0 || job.inflight > 0))
+            peer_loop_run(&l, 1000);
+        peer_loop_free(&l);
+        rc = job.failed ? -1 : 0;
+    }
+    double secs = (peer_now_ms() - start) / 1000;
+    if (rc == 0)
+        fprintf(stderr, "Reversed %zu bytes in %.3f s (%.0f MB/s)\n", n, secs, secs > 0 ? n / secs / 1e6 : 0.0);
+    if (strcmp(path, "-") == 0)
+        free(src);
+    else
+        munmap(src, n ? n : 1);
+    return rc;
+}
+
+// Swarm mode: fetch the chunks the file lacks from every peer, rarest first, while serving the ones it holds.
+// Returns once the file is complete and linger seconds have passed (never if linger < 0)
+int swarm_run(int port, const char *manifest, const char *path, int linger, char **peers, int npeers) {
+    struct swarm sw = {0};
+    struct peer_loop l;
+    if (swarm_load_manifest(manifest, &sw.m) < 0) {
+        fprintf(stderr, "Cannot read manifest %s\n", manifest);
+        return -1;
+    }
+    if (swarm_open(&sw, path, port) < 0 || peer_loop_init(&l, port) < 0) {
+        perror("Swarm setup failed");
+        return -1;
+    }
+    srandom(sw.node);
+    l.ctx = &sw;
+    l.on_open = swarm_opened;
+    l.on_close = swarm_closed;
+    l.on_dial_failed = swarm_dial_failed;
+    l.on_frame = swarm_frame;
+    for (int i = 0; i < npeers; i++)
+        if (peer_dial(&l, peers[i]) < 0)
+            fprintf(stderr, "Cannot resolve peer %s\n", peers[i]);
+    printf("Swarm %s: %u of %u chunks here, listening on port %d\n", sw.m.name, sw.m.nchunks - sw.missing,
+           sw.m.nchunks, port);
+    fflush(stdout);
+
+    double start = peer_now_ms(), last = start, done = sw.missing == 0 ? start : 0;
+    unsigned long long down = 0, up = 0;
+    while (done == 0 || linger < 0 || peer_now_ms() - done < linger * 1000.0) {
+        peer_loop_run(&l, 100);
+        double now = peer_now_ms();
+        if (done == 0 && sw.missing == 0) {
+            done = now;
+            printf("Complete: %llu bytes in %.2f s (%.1f MB/s), %llu bad chunks\n", (unsigned long long)sw.m.size,
+                   (now - start) / 1000, sw.bytes_down / ((now - start) / 1000) / 1e6, sw.bad_chunks);
+            for (int i = 0; i < l.nsessions; i++) {
+                struct swarm_peer *p = l.sessions[i]->user;
+                if (p != NULL && p->received > 0)
+                    printf("  %llu chunks from %s\n", p->received, l.sessions[i]->name);
+            }
+        }
+        if (now - last >= 1000) {
+            int open = 0;
+            for (int i = 0; i < l.nsessions; i++)
+                open += l.sessions[i]->connected;
+            double dt = (now - last) / 1000;
+            printf("chunks %u/%u  peers %d  down %.1f MB/s  up %.1f MB/s\n", sw.m.nchunks - sw.missing, sw.m.nchunks,
+                   open, (sw.bytes_down - down) / dt / 1e6, (sw.bytes_up - up) / dt / 1e6);
+            down = sw.bytes_down, up = sw.bytes_up, last = now;
+        }
+        fflush(stdout);
+    }
+    printf("Uploaded %.1f MB\n", sw.bytes_up / 1e6);
+    for (int i = 0; i < l.nsessions; i++) {
+        swarm_forget(&sw, l.sessions[i]);
+        free(l.sessions[i]->user);
+    }
+    peer_loop_free(&l);
+    close(sw.fd);
+    return 0;
+}
+
 // Main function where the user selects to run as client or server
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "peer") == 0) {
+        struct peer_node node = {0};
+        peer_node_run(atoi(argv[2]), argv + 3, argc - 3, &node, 0);
+        return 0;
+    }
+    if (argc > 5 && strcmp(argv[1], "load") == 0) {
+        struct peer_node node = {.load = 1, .size = strtoul(argv[3], NULL, 10), .window = atoi(argv[4])};
+        if (node.size == 0 || node.size > PEER_FRAME_MAX || node.window <= 0) {
+            fprintf(stderr, "Size must be 1..%u bytes and window at least 1\n", PEER_FRAME_MAX);
+            return 1;
+        }
+        node.payload = malloc(node.size);
+        node.expected = malloc(node.size);
+        if (node.payload == NULL || node.expected == NULL) {
+            perror("malloc");
+            return 1;
+        }
+        for (size_t i = 0; i < node.size; i++)
+            node.payload[i] = 'a' + i % 26 + (i / 26 % 2) * ('A' - 'a');
+        reverse_copy(node.expected, node.payload, node.size);
+        peer_node_run(atoi(argv[2]), argv + 6, argc - 6, &node, atoi(argv[5]));
+        free(node.payload);
+        free(node.expected);
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "receive") == 0) {
+        int socket_id = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(socket_id, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[2])),
+                                      .sin_addr.s_addr = INADDR_ANY};
+        bind_socket(socket_id, &address);
+        listen(socket_id, BULK_STREAMS_MAX);
+        printf("Receiving files into %s on port %s\n", argv[3], argv[2]);
+        fflush(stdout);
+        bulk_receive(socket_id, argv[3]);
+        return 1;
+    }
+    if (argc > 3 && strcmp(argv[1], "send") == 0) {
+        struct sockaddr_in address;
+        int streams = argc > 4 ? atoi(argv[4]) : 4;
+        unsigned long chunk_kb = argc > 5 ? strtoul(argv[5], NULL, 10) : BULK_CHUNK_DEFAULT / 1024;
+        if (streams < 1 || streams > BULK_STREAMS_MAX || chunk_kb == 0 || chunk_kb > BULK_CHUNK_MAX / 1024) {
+            fprintf(stderr, "Streams must be 1..%d and the chunk 1..%u KB\n", BULK_STREAMS_MAX, BULK_CHUNK_MAX / 1024);
+            return 1;
+        }
+        if (peer_resolve(argv[2], &address) < 0) {
+            fprintf(stderr, "Cannot resolve %s\n", argv[2]);
+            return 1;
+        }
+        return bulk_send(&address, argv[3], streams, chunk_kb * 1024) == 0 ? 0 : 1;
+    }
+    if (argc > 3 && strcmp(argv[1], "manifest") == 0) {
+        unsigned long chunk_kb = argc > 4 ? strtoul(argv[4], NULL, 10) : SWARM_CHUNK_DEFAULT / 1024;
+        if (chunk_kb == 0 || chunk_kb > PEER_FRAME_MAX / 2048) {
+            fprintf(stderr, "The chunk must be 1..%u KB\n", PEER_FRAME_MAX / 2048);
+            return 1;
+        }
+        return swarm_make_manifest(argv[2], argv[3], chunk_kb * 1024) == 0 ? 0 : 1;
+    }
+    if (argc > 3 && strcmp(argv[1], "sync-receive") == 0) {
+        int socket_id = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(socket_id, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[2])),
+                                      .sin_addr.s_addr = INADDR_ANY};
+        bind_socket(socket_id, &address);
+        listen(socket_id, 5);
+        signal(SIGPIPE, SIG_IGN);
+        printf("Syncing files into %s on port %s\n", argv[3], argv[2]);
+        fflush(stdout);
+        for (;;) {
+            int new_socket_id = accept(socket_id, NULL, NULL);
+            if (new_socket_id < 0)
+                continue;
+            delta_receive(new_socket_id, argv[3]);   // One sync at a time: two of one file must not interleave
+            close(new_socket_id);
+        }
+    }
+    if (argc > 3 && strcmp(argv[1], "sync") == 0) {
+        struct sockaddr_in address;
+        if (peer_resolve(argv[2], &address) < 0) {
+            fprintf(stderr, "Cannot resolve %s\n", argv[2]);
+            return 1;
+        }
+        signal(SIGPIPE, SIG_IGN);
+        return delta_send(&address, argv[3], argc > 4 ? strtoul(argv[4], NULL, 10) : 0) == 0 ? 0 : 1;
+    }
+    if (argc > 2 && strcmp(argv[1], "reverse") == 0)
+        return reverse_run(NULL, argv[2], argc > 3 && strcmp(argv[3], "utf8") == 0) == 0 ? 0 : 1;
+    if (argc > 3 && strcmp(argv[1], "reverse-send") == 0)
+        return reverse_run(argv[2], argv[3], argc > 4 && strcmp(argv[4], "utf8") == 0) == 0 ? 0 : 1;
+    if (argc > 5 && strcmp(argv[1], "swarm") == 0)
+        return swarm_run(atoi(argv[2]), argv[3], argv[4], atoi(argv[5]), argv + 6, argc - 6) == 0 ? 0 : 1;
+
     int role;
     printf("Choose your role (1 for Client, 2 for Server): ");
     scanf("%d", &role);
+    for (int c = getchar(); c != '\n' && c != EOF; c = getchar())
+        ;                                                   // Drop the rest of the line before the string
 
     int socket_id = create_socket(); // Create a socket
 
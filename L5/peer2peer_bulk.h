@@ -0,0 +1,698 @@
+/*
+peer2peer_bulk.h
+- Bulk file transfer for peer2peer_TCP.c, striped over several TCP connections (link with -pthread).
+- The file is cut into fixed-size chunks. Each sender stream pulls the next missing chunk from a shared queue and
+  sends a header (index, length, CRC-32C) followed by the bytes. The bytes go out with sendfile(), and the checksum
+  is computed from an mmap of the same file. The receiver checks the CRC and pwrite()s each chunk at its offset,
+  so chunks may arrive in any order on any stream.
+- With several streams in flight, one connection's window no longer limits the transfer, and neither does its
+  recovery from a loss. This is what makes striping faster on high-latency links.
+- The receiver writes into <name>.part and records verified chunks in <name>.part.state (a header and one byte per
+  chunk). Each stream syncs the part file every BULK_SYNC_CHUNKS chunks and only then records them, so the state
+  file never claims a chunk that is not on disk. A transfer is identified by the name, size, modification time and
+  chunk size, so a sender that comes back after a disconnect (or a restart of either side) only sends the chunks
+  still missing. When the last chunk is in, the part file is renamed into place and the transfer is freed once
+  its last stream is gone; only its id and the file's inode are kept, to answer the sender's closing offer. Two
+  transfers of one name never run at once: the second offer is refused.
+- The sender works in rounds. It offers the file on a control connection and receives the bitmap of chunks the
+  receiver holds, then stripes the missing ones. Chunks lost with a broken stream or that failed their checksum
+  show up in the next offer. The sender gives up after BULK_RETRIES rounds in a row without progress.
+*/
+
+#ifndef PEER2PEER_BULK_H
+#define PEER2PEER_BULK_H
+
+#include <stdio.h>      // printf, snprintf
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcmp, strrchr
+#include <stdint.h>     // Fixed-width wire fields
+#include <endian.h>     // htobe64, be64toh
+#include <errno.h>      // EINTR
+#include <fcntl.h>      // open
+#include <limits.h>     // PATH_MAX
+#include <pthread.h>    // One thread per stream
+#include <signal.h>     // SIGPIPE
+#include <unistd.h>     // read, write, pwrite, ftruncate
+#include <sys/mman.h>   // mmap of the source
+#include <sys/stat.h>   // fstat
+#include <sys/sendfile.h> // Zero-copy sending
+#include <sys/socket.h> // Socket API
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h>  // htonl
+#include "peer2peer_loop.h" // peer_now_ms
+
+#define BULK_MAGIC "BULK"            // Starts every bulk connection
+#define BULK_OFFER 1                 // Connection type: offer a file, answered with the chunk bitmap
+#define BULK_JOIN 2                  // Connection type: a stream carrying chunks of an offered file
+#define BULK_STATE_MAGIC "BST1"      // Starts a receiver state file
+#define BULK_CHUNK_DEFAULT (1u << 20) // Default chunk size
+#define BULK_CHUNK_MAX (64u << 20)   // Largest chunk size accepted
+#define BULK_STREAMS_MAX 64          // Most parallel streams
+#define BULK_RETRIES 10              // Rounds in a row without progress before the sender gives up
+#define BULK_SYNC_CHUNKS 16          // Chunks a stream writes between syncs of the part file
+#define BULK_DONE_MAX 64             // Finished transfers remembered, to answer the sender's last offer
+
+// First message on every connection; fields in network byte order. An offer is followed by name_len bytes of
+// file name
+struct bulk_hello {
+    char magic[4];
+    uint32_t type;
+    uint64_t id;                // Transfer identity
+    uint64_t size;              // File size
+    uint32_t chunk;             // Chunk size
+    uint32_t name_len;
+};
+
+// Answer to an offer, followed by nchunks bytes (1: the receiver holds the chunk)
+struct bulk_reply {
+    uint32_t status;            // 0, or 1 if the offer is refused
+    uint32_t reserved;
+    uint64_t nchunks;
+};
+
+// Header of one chunk on a stream
+struct bulk_chunk {
+    uint64_t index;
+    uint32_t length;
+    uint32_t crc;               // CRC-32C of the chunk
+};
+
+// Head of a receiver state file (host byte order; the file stays on the receiving machine)
+struct bulk_state {
+    char magic[4];
+    uint32_t chunk;
+    uint64_t id, size;
+};
+
+static uint32_t bulk_crc_table[8][256];
+
+// Function to build the CRC-32C (Castagnoli) tables for slicing-by-8; call before starting threads
+static inline void bulk_crc_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        bulk_crc_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            bulk_crc_table[t][i] = (bulk_crc_table[t - 1][i] >> 8) ^ bulk_crc_table[0][bulk_crc_table[t - 1][i] & 0xff];
+}
+
+// Function to compute the CRC-32C of a buffer, eight bytes per step
+static inline uint32_t bulk_crc32c(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t c = 0xffffffff;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v = le64toh(v) ^ c;
+        c = bulk_crc_table[7][v & 0xff] ^ bulk_crc_table[6][(v >> 8) & 0xff] ^ bulk_crc_table[5][(v >> 16) & 0xff]
+            ^ bulk_crc_table[4][(v >> 24) & 0xff] ^ bulk_crc_table[3][(v >> 32) & 0xff]
+            ^ bulk_crc_table[2][(v >> 40) & 0xff] ^ bulk_crc_table[1][(v >> 48) & 0xff]
+            ^ bulk_crc_table[0][v >> 56];
+    }
+    while (len--)
+        c = (c >> 8) ^ bulk_crc_table[0][(c ^ *p++) & 0xff];
+    return ~c;
+}
+
+// Function to write a whole buffer; 0 or -1
+static inline int bulk_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes; 1 done, 0 clean end of stream before any byte, -1 error or short read
+static inline int bulk_read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, p + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0 && got == 0 ? 0 : -1;
+        got += n;
+    }
+    return 1;
+}
+
+// Function to get the length of a chunk (the last one may be short)
+static inline uint32_t bulk_chunk_len(uint64_t size, uint32_t chunk, uint64_t index) {
+    uint64_t left = size - index * chunk;
+    return left < chunk ? (uint32_t)left : chunk;
+}
+
+/* Receiver */
+
+struct bulk_transfer {
+    uint64_t id, size, nchunks, remaining;
+    uint32_t chunk;
+    char path[2 * PATH_MAX], part[2 * PATH_MAX + 8], state[2 * PATH_MAX + 16];
+    int fd, state_fd;
+    unsigned char *have;        // One byte per chunk
+    int complete;
+    int finished;               // The part file was renamed into place
+    int users;                  // Threads using the transfer: offers, streams and the one finishing it. The last
+                                // one out of a complete transfer frees it
+    struct bulk_transfer *next;
+};
+
+// A finished transfer: the file it became, so a later offer of the same id can be answered from it
+struct bulk_done {
+    uint64_t id, size, nchunks;
+    dev_t dev;
+    ino_t ino;
+};
+
+struct bulk_receiver {
+    char dir[PATH_MAX];
+    pthread_mutex_t lock;       // Guards the transfer list, every transfer's bitmap and the finished list
+    struct bulk_transfer *transfers;
+    struct bulk_done done[BULK_DONE_MAX];
+    int done_next;              // Oldest entry of done, replaced next
+};
+
+// Function to open (or resume) the part and state files of a transfer; 0 or -1
+static inline int bulk_transfer_open(struct bulk_transfer *t) {
+    snprintf(t->part, sizeof(t->part), "%s.part", t->path);
+    snprintf(t->state, sizeof(t->state), "%s.part.state", t->path);
+    t->have = calloc(t->nchunks ? t->nchunks : 1, 1);
+    t->fd = open(t->part, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    t->state_fd = open(t->state, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (t->have == NULL || t->fd < 0 || t->state_fd < 0)
+        return -1;
+
+    struct bulk_state head;
+    if (pread(t->state_fd, &head, sizeof(head), 0) == sizeof(head) && memcmp(head.magic, BULK_STATE_MAGIC, 4) == 0
+        && head.id == t->id && head.size == t->size && head.chunk == t->chunk
+        && pread(t->state_fd, t->have, t->nchunks, sizeof(head)) == (ssize_t)t->nchunks) {
+        for (uint64_t i = 0; i < t->nchunks; i++)
+            t->remaining -= t->have[i] != 0;
+        printf("Resuming %s: %llu of %llu chunks already here\n", t->path,
+               (unsigned long long)(t->nchunks - t->remaining), (unsigned long long)t->nchunks);
+        return 0;
+    }
+    // A different (or no) earlier transfer: start over
+    memcpy(head.magic, BULK_STATE_MAGIC, 4);
+    head.id = t->id;
+    head.size = t->size;
+    head.chunk = t->chunk;
+    if (ftruncate(t->fd, t->size) < 0 || ftruncate(t->state_fd, 0) < 0
+        || pwrite(t->state_fd, &head, sizeof(head), 0) != sizeof(head)
+        || pwrite(t->state_fd, t->have, t->nchunks, sizeof(head)) != (ssize_t)t->nchunks)
+        return -1;
+    return 0;
+}
+
+// Function to close a transfer's files and free it; it is no longer on the list. Called locked
+static inline void bulk_transfer_free(struct bulk_transfer *t) {
+    if (t->fd >= 0)
+        close(t->fd);
+    if (t->state_fd >= 0)
+        close(t->state_fd);
+    free(t->have);
+    free(t);
+}
+
+// Function to finish a transfer once every chunk is in: the part file takes the real name. Called unlocked, by
+// the one thread that marked the transfer complete while holding a use of it, so the files stay open
+static inline void bulk_transfer_done(struct bulk_transfer *t) {
+    if (fsync(t->fd) < 0 || rename(t->part, t->path) < 0) {
+        perror("Finishing transfer failed");   // The part and state files stay: a later offer finishes it
+        return;
+    }
+    unlink(t->state);
+    t->finished = 1;
+    printf("Received %s (%llu bytes)\n", t->path, (unsigned long long)t->size);
+    fflush(stdout);
+}
+
+// Function to drop a thread's use of a transfer. The last user of a complete transfer takes it off the list and
+// frees it, remembering the finished file; a slower stream may still be writing a duplicate chunk after the last
+// one is in, so this waits for every user. Called locked
+static inline void bulk_transfer_put(struct bulk_receiver *r, struct bulk_transfer *t) {
+    if (--t->users > 0 || !t->complete)
+        return;
+    struct stat st;
+    if (t->finished && fstat(t->fd, &st) == 0) {
+        struct bulk_done *d = &r->done[r->done_next];
+        r->done_next = (r->done_next + 1) % BULK_DONE_MAX;
+        d->id = t->id;
+        d->size = t->size;
+        d->nchunks = t->nchunks;
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+    }
+    struct bulk_transfer **pp = &r->transfers;
+    while (*pp != t)
+        pp = &(*pp)->next;
+    *pp = t->next;
+    bulk_transfer_free(t);
+}
+
+// Function to tell whether a transfer of this id already became a file that is still there unchanged in size.
+// Called locked
+static inline const struct bulk_done *bulk_find_done(struct bulk_receiver *r, const struct bulk_hello *h,
+                                                     const char *path) {
+    struct stat st;
+    for (int i = 0; i < BULK_DONE_MAX; i++) {
+        struct bulk_done *d = &r->done[i];
+        if (d->id == h->id && d->nchunks > 0 && stat(path, &st) == 0 && st.st_dev == d->dev
+            && st.st_ino == d->ino && (uint64_t)st.st_size == d->size)
+            return d;
+    }
+    return NULL;
+}
+
+// Function to answer an offer: find its transfer, or start (or resume) it, and copy the bitmap of chunks held.
+// A file received earlier under this id counts as held in full while it is still in place. An offer of a name
+// that a live transfer with another id is writing is refused (both would write the same part and state files);
+// an idle one is dropped and the part file started over. Returns the bitmap (nchunks bytes), or NULL if refused
+static inline unsigned char *bulk_offer(struct bulk_receiver *r, const struct bulk_hello *h, const char *name,
+                                        uint64_t *nchunks) {
+    const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    if (base[0] == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 || h->chunk == 0
+        || h->chunk > BULK_CHUNK_MAX)
+        return NULL;
+    char path[2 * PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", r->dir, base);
+    pthread_mutex_lock(&r->lock);
+    const struct bulk_done *d = bulk_find_done(r, h, path);
+    if (d != NULL) {
+        unsigned char *have = malloc(d->nchunks);
+        if (have != NULL)
+            memset(have, 1, d->nchunks);
+        *nchunks = d->nchunks;
+        pthread_mutex_unlock(&r->lock);
+        return have;
+    }
+    struct bulk_transfer *t, **pp = &r->transfers;
+    while ((t = *pp) != NULL && t->id != h->id && strcmp(t->path, path) != 0)
+        pp = &t->next;
+    if (t != NULL && t->id != h->id) {              // Same file name, another transfer
+        if (t->users > 0) {
+            fprintf(stderr, "Refusing %s: another transfer of that name is running\n", path);
+            pthread_mutex_unlock(&r->lock);
+            return NULL;
+        }
+        *pp = t->next;
+        bulk_transfer_free(t);
+        t = NULL;
+    }
+    if (t == NULL && (t = calloc(1, sizeof(*t))) != NULL) {
+        t->id = h->id;
+        t->size = h->size;
+        t->chunk = h->chunk;
+        t->nchunks = t->remaining = (h->size + h->chunk - 1) / h->chunk;
+        memcpy(t->path, path, sizeof(path));
+        if (bulk_transfer_open(t) < 0) {
+            perror(t->part);
+            bulk_transfer_free(t);
+            t = NULL;
+        } else {
+            t->next = r->transfers;
+            r->transfers = t;
+            t->complete = t->remaining == 0;        // Every chunk was already here
+        }
+    }
+    unsigned char *have = t != NULL ? malloc(t->nchunks ? t->nchunks : 1) : NULL;
+    if (have == NULL) {
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+    }
+    memcpy(have, t->have, t->nchunks);
+    *nchunks = t->nchunks;
+    int finish = t->complete && !t->finished && t->users == 0;
+    t->users++;
+    pthread_mutex_unlock(&r->lock);
+    if (finish)
+        bulk_transfer_done(t);
+    pthread_mutex_lock(&r->lock);
+    bulk_transfer_put(r, t);
+    pthread_mutex_unlock(&r->lock);
+    return have;
+}
+
+// Function to sync the chunks a stream wrote since its last sync and then record them in the state file, so a
+// crash never resumes with a chunk that was lost. Syncing a batch at a time keeps the streams from queueing on
+// the disk for every chunk. Returns the number of chunks recorded, or -1 if the sync failed
+static inline long bulk_record_chunks(struct bulk_receiver *r, struct bulk_transfer *t, const uint64_t *pending,
+                                     int npending) {
+    if (npending == 0)
+        return 0;
+    if (fdatasync(t->fd) < 0) {
+        perror(t->part);
+        return -1;
+    }
+    long stored = 0;
+    int finish = 0;
+    pthread_mutex_lock(&r->lock);
+    for (int i = 0; i < npending; i++) {
+        uint64_t index = pending[i];
+        if (t->have[index] || t->complete)
+            continue;
+        t->have[index] = 1;
+        if (pwrite(t->state_fd, t->have + index, 1, sizeof(struct bulk_state) + index) == 1)
+            stored++;
+        if (--t->remaining == 0)
+            t->complete = finish = 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    if (finish)
+        bulk_transfer_done(t);
+    return stored;
+}
+
+// Function to take in the chunks of one stream until the sender ends it; chunks failing their checksum are
+// dropped (the sender's next offer sees them missing). Every BULK_SYNC_CHUNKS chunks, and when the stream ends,
+// the written chunks are synced and recorded. The caller holds a use of t.
+// Returns the number of chunks stored, -1 on a broken stream
+static inline long bulk_receive_chunks(struct bulk_receiver *r, struct bulk_transfer *t, int fd) {
+    char *buf = malloc(t->chunk);
+    uint64_t pending[BULK_SYNC_CHUNKS];
+    int npending = 0, broken = 0;
+    long stored = 0;
+    if (buf == NULL)
+        return -1;
+    for (;;) {
+        struct bulk_chunk c;
+        int got = bulk_read_all(fd, &c, sizeof(c));
+        if (got <= 0) {
+            broken = got < 0;
+            break;
+        }
+        uint64_t index = be64toh(c.index);
+        uint32_t len = ntohl(c.length);
+        if (index >= t->nchunks || len != bulk_chunk_len(t->size, t->chunk, index)
+            || bulk_read_all(fd, buf, len) != 1) {
+            broken = 1;
+            break;
+        }
+        if (bulk_crc32c(buf, len) != ntohl(c.crc)) {
+            fprintf(stderr, "Chunk %llu of %s failed its checksum\n", (unsigned long long)index, t->path);
+            continue;
+        }
+        if (pwrite(t->fd, buf, len, (off_t)index * t->chunk) != (ssize_t)len) {
+            perror(t->part);
+            broken = 1;
+            break;
+        }
+        pending[npending++] = index;
+        if (npending == BULK_SYNC_CHUNKS) {
+            long n = bulk_record_chunks(r, t, pending, npending);
+            npending = 0;
+            if (n < 0) {
+                broken = 1;
+                break;
+            }
+            stored += n;
+        }
+    }
+    free(buf);
+    long n = bulk_record_chunks(r, t, pending, npending);   // Chunks written whole are kept even if the stream broke
+    if (n < 0 || broken)
+        return -1;
+    return stored + n;
+}
+
+struct bulk_conn {
+    struct bulk_receiver *r;
+    int fd;
+};
+
+// Thread serving one bulk connection: an offer is answered with the bitmap, a stream is taken in
+static inline void *bulk_receiver_thread(void *arg) {
+    struct bulk_conn *c = arg;
+    struct bulk_receiver *r = c->r;
+    int fd = c->fd;
+    free(c);
+
+    struct bulk_hello h;
+    char name[PATH_MAX];
+    if (bulk_read_all(fd, &h, sizeof(h)) != 1 || memcmp(h.magic, BULK_MAGIC, 4) != 0) {
+        close(fd);
+        return NULL;
+    }
+    h.id = be64toh(h.id);
+    h.size = be64toh(h.size);
+    h.chunk = ntohl(h.chunk);
+    uint32_t name_len = ntohl(h.name_len);
+
+    if (ntohl(h.type) == BULK_OFFER) {
+        if (name_len == 0 || name_len >= sizeof(name) || bulk_read_all(fd, name, name_len) != 1) {
+            close(fd);
+            return NULL;
+        }
+        name[name_len] = '\0';
+        uint64_t nchunks = 0;
+        unsigned char *have = bulk_offer(r, &h, name, &nchunks);
+        struct bulk_reply reply = {htonl(have == NULL), 0, htobe64(nchunks)};
+        if (bulk_write_all(fd, &reply, sizeof(reply)) == 0 && have != NULL)
+            bulk_write_all(fd, have, nchunks);
+        free(have);
+    } else if (ntohl(h.type) == BULK_JOIN) {
+        struct bulk_transfer *t;
+        pthread_mutex_lock(&r->lock);
+        for (t = r->transfers; t != NULL && t->id != h.id; t = t->next)
+            ;
+        if (t != NULL)                             // Unknown if it is finished and freed: nothing left to send
+            t->users++;
+        pthread_mutex_unlock(&r->lock);
+        if (t != NULL) {
+            if (bulk_receive_chunks(r, t, fd) < 0)
+                fprintf(stderr, "Stream of %s broke off\n", t->path);
+            pthread_mutex_lock(&r->lock);
+            bulk_transfer_put(r, t);
+            pthread_mutex_unlock(&r->lock);
+        }
+    }
+    close(fd);   // After the last chunk is stored: the sender waits for this before its next offer
+    return NULL;
+}
+
+// Function to accept bulk connections forever, one thread each, storing files in dir
+static inline void bulk_receive(int listen_fd, const char *dir) {
+    static struct bulk_receiver r;
+    snprintf(r.dir, sizeof(r.dir), "%s", dir);
+    pthread_mutex_init(&r.lock, NULL);
+    bulk_crc_init();
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("Accept failed");
+            return;
+        }
+        struct bulk_conn *c = malloc(sizeof(*c));
+        pthread_t thread;
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        c->r = &r;
+        c->fd = fd;
+        if (pthread_create(&thread, NULL, bulk_receiver_thread, c) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+/* Sender */
+
+struct bulk_sender {
+    struct sockaddr_in addr;
+    int fd;                     // Source file
+    const unsigned char *map;   // The same file mapped, for checksums
+    uint64_t id, size, nchunks;
+    uint32_t chunk;
+    uint64_t *missing, nmissing;
+    uint64_t next;              // Next entry of missing to send (shared by the streams)
+    uint64_t sent_chunks, sent_bytes;
+};
+
+// Function to open a connection to the receiver and send the hello; the socket, or -1
+static inline int bulk_connect(const struct bulk_sender *s, uint32_t type, const char *name) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)&s->addr, sizeof(s->addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct bulk_hello h;
+    memcpy(h.magic, BULK_MAGIC, 4);
+    h.type = htonl(type);
+    h.id = htobe64(s->id);
+    h.size = htobe64(s->size);
+    h.chunk = htonl(s->chunk);
+    h.name_len = htonl(name != NULL ? strlen(name) : 0);
+    if (bulk_write_all(fd, &h, sizeof(h)) < 0 || (name != NULL && bulk_write_all(fd, name, strlen(name)) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Thread running one stream: send missing chunks until none are left, then wait for the receiver to store them
+static inline void *bulk_stream_thread(void *arg) {
+    struct bulk_sender *s = arg;
+    int fd = bulk_connect(s, BULK_JOIN, NULL);
+    if (fd < 0)
+        return NULL;
+    for (;;) {
+        uint64_t i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+        if (i >= s->nmissing)
+            break;
+        uint64_t index = s->missing[i];
+        uint32_t len = bulk_chunk_len(s->size, s->chunk, index);
+        off_t offset = (off_t)index * s->chunk;
+        struct bulk_chunk c = {htobe64(index), htonl(len), htonl(bulk_crc32c(s->map + offset, len))};
+        if (bulk_write_all(fd, &c, sizeof(c)) < 0)
+            break;
+        size_t left = len;
+        while (left > 0) {
+            ssize_t n = sendfile(fd, s->fd, &offset, left);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            left -= n;
+        }
+        if (left > 0)
+            break;   // Stream broken: the chunk stays missing for the next round
+        __atomic_fetch_add(&s->sent_chunks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->sent_bytes, len, __ATOMIC_RELAXED);
+    }
+    char byte;
+    shutdown(fd, SHUT_WR);
+    while (read(fd, &byte, 1) > 0)   // The receiver closes once everything sent is stored
+        ;
+    close(fd);
+    return NULL;
+}
+
+// Function to offer the file and collect the indexes of the chunks the receiver lacks; 0, -1 if the receiver is
+// unreachable, -2 if it refused the file
+static inline int bulk_round_offer(struct bulk_sender *s, const char *name) {
+    int fd = bulk_connect(s, BULK_OFFER, name);
+    if (fd < 0)
+        return -1;
+    struct bulk_reply reply;
+    unsigned char *have = malloc(s->nchunks ? s->nchunks : 1);
+    int rc = -1;
+    if (have != NULL && bulk_read_all(fd, &reply, sizeof(reply)) == 1) {
+        if (ntohl(reply.status) != 0 || be64toh(reply.nchunks) != s->nchunks)
+            rc = -2;
+        else if (bulk_read_all(fd, have, s->nchunks) == 1 || s->nchunks == 0) {
+            s->nmissing = 0;
+            for (uint64_t i = 0; i < s->nchunks; i++)
+                if (!have[i])
+                    s->missing[s->nmissing++] = i;
+            rc = 0;
+        }
+    }
+    free(have);
+    close(fd);
+    return rc;
+}
+
+// Function to send a file to a receiver over nstreams connections. Returns 0 once the receiver holds every chunk
+static inline int bulk_send(const struct sockaddr_in *addr, const char *path, int nstreams, uint32_t chunk) {
+    struct bulk_sender s = {.addr = *addr, .chunk = chunk};
+    struct stat st;
+    s.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (s.fd < 0 || fstat(s.fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    s.size = st.st_size;
+    s.nchunks = (s.size + chunk - 1) / chunk;
+    s.map = s.size > 0 ? mmap(NULL, s.size, PROT_READ, MAP_SHARED, s.fd, 0) : NULL;
+    s.missing = malloc((s.nchunks ? s.nchunks : 1) * sizeof(*s.missing));
+    if (s.map == MAP_FAILED || s.missing == NULL) {
+        perror("Mapping the file failed");
+        close(s.fd);
+        return -1;
+    }
+    if (s.size > 0)
+        madvise((void *)s.map, s.size, MADV_SEQUENTIAL);
+    bulk_crc_init();
+    signal(SIGPIPE, SIG_IGN);   // sendfile() has no MSG_NOSIGNAL; a broken stream must fail, not kill the sender
+
+    // Identity: FNV-1a over the name, size, modification time and chunk size
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    uint64_t key[3] = {s.size, (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec, chunk};
+    s.id = 1469598103934665603ull;
+    for (const char *p = name; *p; p++)
+        s.id = (s.id ^ (unsigned char)*p) * 1099511628211ull;
+    for (size_t i = 0; i < sizeof(key); i++)
+        s.id = (s.id ^ ((unsigned char *)key)[i]) * 1099511628211ull;
+
+    double start = peer_now_ms();
+    uint64_t last_missing = UINT64_MAX;
+    int stalls = 0, rc = -1;
+    for (int round = 1;; round++) {
+        int offered = bulk_round_offer(&s, name);
+        if (offered == -2) {
+            fprintf(stderr, "Receiver refused %s\n", name);
+            break;
+        }
+        if (offered == 0 && s.nmissing == 0) {
+            rc = 0;
+            break;
+        }
+        if (offered < 0 || s.nmissing >= last_missing) {
+            if (++stalls > BULK_RETRIES) {
+                fprintf(stderr, "No progress after %d attempts, giving up\n", BULK_RETRIES);
+                break;
+            }
+            sleep(1);
+            if (offered < 0) {
+                fprintf(stderr, "Receiver unreachable, retrying\n");
+                continue;
+            }
+        } else
+            stalls = 0;
+        last_missing = s.nmissing;
+
+        printf("Round %d: sending %llu of %llu chunks over %d streams\n", round, (unsigned long long)s.nmissing,
+               (unsigned long long)s.nchunks, nstreams);
+        fflush(stdout);
+        pthread_t threads[BULK_STREAMS_MAX];
+        s.next = 0;
+        int started = 0;
+        for (int i = 0; i < nstreams; i++)
+            if (pthread_create(&threads[started], NULL, bulk_stream_thread, &s) == 0)
+                started++;
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    double secs = (peer_now_ms() - start) / 1000;
+    if (rc == 0)
+        printf("Sent %s: %llu bytes in %.2f s (%.1f MB/s), %llu chunk%s sent this run\n", name,
+               (unsigned long long)s.size, secs, secs > 0 ? s.sent_bytes / secs / 1e6 : 0.0,
+               (unsigned long long)s.sent_chunks, s.sent_chunks == 1 ? "" : "s");
+    if (s.map != NULL)
+        munmap((void *)s.map, s.size);
+    free(s.missing);
+    close(s.fd);
+    return rc;
+}
+
+#endif
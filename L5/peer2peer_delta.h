@@ -0,0 +1,415 @@
+/*
+peer2peer_delta.h
+- rsync-style delta synchronisation for peer2peer_TCP.c: a changed file is sent as the difference from the
+  receiver's old copy.
+- The receiver cuts its old copy (the basis) into blocks. For each block it sends a signature: a weak rolling
+  checksum and a strong hash (the first 16 bytes of its SHA-256).
+- The sender hashes the weak checksums into a table and slides a block-sized window over the new file one byte
+  at a time. Each step updates the checksum in O(1). When the weak checksum matches a block and the strong hash
+  confirms it, a reference to the block is emitted and the window jumps a whole block. Otherwise the byte becomes
+  a literal. Runs of consecutive blocks are coalesced into one reference.
+- The receiver rebuilds the file from literals and basis blocks into <name>.sync.tmp. It checks the SHA-256 of
+  the whole file sent at the end and renames the result over the basis, so a failed sync leaves the old copy as
+  it was.
+- Traffic is about count * 20 bytes of signatures plus the changed bytes. The block size defaults to the square
+  root of the basis size, as in rsync. Requested sizes are held to DELTA_BLOCK_MIN..DELTA_BLOCK_MAX too, and the
+  block grows if the basis would need more than DELTA_COUNT_MAX signatures.
+*/
+
+#ifndef PEER2PEER_DELTA_H
+#define PEER2PEER_DELTA_H
+
+#include <stdio.h>      // printf, snprintf
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcmp
+#include <stdint.h>     // Fixed-width fields
+#include <math.h>       // sqrt for the default block size
+#include <endian.h>     // htobe64, be64toh
+#include <fcntl.h>      // open
+#include <unistd.h>     // pread, write
+#include <sys/mman.h>   // mmap of the new file
+#include <sys/stat.h>   // fstat, fchmod
+#include "peer2peer_bulk.h"  // bulk_write_all, bulk_read_all
+#include "peer2peer_swarm.h" // sha256
+
+#define DELTA_MAGIC "DLTA"           // Starts a sync connection
+#define DELTA_BLOCK_MIN 700          // Smallest block size
+#define DELTA_BLOCK_MAX (128 * 1024) // Largest block size
+#define DELTA_COUNT_MAX (1u << 24)   // Most signatures in one sync (320 MB of them)
+#define DELTA_LITERAL_MAX (256 * 1024) // Longest literal run sent in one op
+#define DELTA_LITERAL 1              // Op: len literal bytes follow
+#define DELTA_COPY 2                 // Op: count basis blocks starting at block
+#define DELTA_END 3                  // Op: the SHA-256 of the new file follows
+
+// Opens a sync; fields in network byte order, then name_len bytes of file name
+struct delta_hello {
+    char magic[4];
+    uint32_t block;             // Block size wanted, 0 to let the receiver choose
+    uint64_t size;              // Size of the new file
+    uint32_t name_len;
+    uint32_t reserved;
+};
+
+// Receiver's answer: the block size, then count signatures
+struct delta_sigs {
+    uint32_t block;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct delta_sig {
+    uint32_t weak;
+    uint8_t strong[16];
+};
+
+// One instruction of the delta
+struct delta_op {
+    uint32_t type;
+    uint32_t len;               // Literal length, or number of blocks of a copy
+    uint64_t block;             // First block of a copy
+};
+
+// Receiver's verdict after DELTA_END
+struct delta_result {
+    uint32_t status;            // 0 if the rebuilt file matched
+    uint32_t reserved;
+    uint64_t reused;            // Bytes taken from the basis
+};
+
+// Function to compute the weak checksum of a block (rsync's: two 16-bit sums, the second position-weighted)
+static inline uint32_t delta_weak(const unsigned char *p, size_t len, uint32_t *a_out, uint32_t *b_out) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    *a_out = a & 0xffff;
+    *b_out = b & 0xffff;
+    return *a_out | *b_out << 16;
+}
+
+// Function to choose a block size for a basis of the given size
+static inline uint32_t delta_block_size(uint64_t size) {
+    uint32_t block = (uint32_t)sqrt((double)size) & ~7u;
+    return block < DELTA_BLOCK_MIN ? DELTA_BLOCK_MIN : block > DELTA_BLOCK_MAX ? DELTA_BLOCK_MAX : block;
+}
+
+/* Receiver */
+
+// Function to serve one sync connection: send the basis signatures, rebuild the file from the delta and put it in
+// place. Returns 0 if the file was updated
+static inline int delta_receive(int fd, const char *dir) {
+    struct delta_hello h;
+    char name[256], path[PATH_MAX + 256], tmp[PATH_MAX + 272];
+    if (bulk_read_all(fd, &h, sizeof(h)) != 1 || memcmp(h.magic, DELTA_MAGIC, 4) != 0 || ntohl(h.name_len) == 0
+        || ntohl(h.name_len) >= sizeof(name) || bulk_read_all(fd, name, ntohl(h.name_len)) != 1)
+        return -1;
+    name[ntohl(h.name_len)] = '\0';
+    if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    snprintf(tmp, sizeof(tmp), "%s.sync.tmp", path);
+
+    // Signatures of the basis (none if there is no old copy)
+    int basis = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st = {0};
+    if (basis >= 0 && fstat(basis, &st) < 0)
+        st.st_size = 0;
+    uint32_t block = ntohl(h.block) ? ntohl(h.block) : delta_block_size(st.st_size);
+    if (block < DELTA_BLOCK_MIN)
+        block = DELTA_BLOCK_MIN;
+    if ((uint64_t)st.st_size > (uint64_t)block * DELTA_COUNT_MAX)   // Fewer, larger blocks
+        block = ((st.st_size + DELTA_COUNT_MAX - 1) / DELTA_COUNT_MAX + 7) & ~7ull;
+    if (block > DELTA_BLOCK_MAX)
+        block = DELTA_BLOCK_MAX;
+    uint64_t count = (st.st_size + block - 1) / block;
+    struct delta_sigs head = {htonl(block), 0, htobe64(count)};
+    struct delta_sig *sigs = count <= DELTA_COUNT_MAX ? malloc((count ? count : 1) * sizeof(*sigs)) : NULL;
+    unsigned char *buf = malloc(block > DELTA_LITERAL_MAX ? block : DELTA_LITERAL_MAX);
+    if (sigs == NULL || buf == NULL) {                 // Also a basis too large to sign
+        free(sigs);
+        free(buf);
+        if (basis >= 0)
+            close(basis);
+        return -1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        ssize_t n = pread(basis, buf, block, (off_t)i * block);
+        uint32_t a, b;
+        uint8_t strong[32];
+        n = n > 0 ? n : 0;
+        sigs[i].weak = htonl(delta_weak(buf, n, &a, &b));
+        sha256(buf, n, strong);
+        memcpy(sigs[i].strong, strong, 16);
+    }
+    int rc = -1;
+    uint64_t reused = 0, written = 0;
+    mode_t mode = basis >= 0 && st.st_mode != 0 ? st.st_mode & 07777 : 0644;   // The rebuilt file keeps the old mode
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    struct sha256 whole;
+    sha256_init(&whole);
+    if (out < 0 || fchmod(out, mode) < 0 || bulk_write_all(fd, &head, sizeof(head)) < 0
+        || bulk_write_all(fd, sigs, count * sizeof(*sigs)) < 0)
+        goto done;
+
+    // Apply the delta
+    for (;;) {
+        struct delta_op op;
+        if (bulk_read_all(fd, &op, sizeof(op)) != 1)
+            goto done;
+        uint32_t type = ntohl(op.type), len = ntohl(op.len);
+        uint64_t first = be64toh(op.block);
+        if (type == DELTA_END)
+            break;
+        if (type == DELTA_LITERAL) {
+            if (len > DELTA_LITERAL_MAX || bulk_read_all(fd, buf, len) != 1 || write(out, buf, len) != (ssize_t)len)
+                goto done;
+            sha256_update(&whole, buf, len);
+            written += len;
+        } else if (type == DELTA_COPY) {
+            if (first >= count || len > count - first)
+                goto done;
+            for (uint64_t i = first; i < first + len; i++) {
+                ssize_t n = pread(basis, buf, block, (off_t)i * block);
+                if (n <= 0 || write(out, buf, n) != n)
+                    goto done;
+                sha256_update(&whole, buf, n);
+                reused += n;
+                written += n;
+            }
+        } else
+            goto done;
+    }
+    uint8_t want[32], got[32];
+    sha256_final(&whole, got);
+    if (bulk_read_all(fd, want, 32) != 1)
+        goto done;
+    rc = memcmp(want, got, 32) == 0 && written == be64toh(h.size) ? 0 : -1;
+    if (rc == 0 && (fsync(out) < 0 || rename(tmp, path) < 0))
+        rc = -1;
+    struct delta_result result = {htonl(rc != 0), 0, htobe64(reused)};
+    bulk_write_all(fd, &result, sizeof(result));
+    if (rc == 0)
+        printf("Updated %s: %llu bytes, %llu taken from the old copy\n", path, (unsigned long long)written,
+               (unsigned long long)reused);
+    else
+        fprintf(stderr, "Rebuilt %s does not match, old copy kept\n", path);
+    fflush(stdout);
+done:
+    if (out >= 0) {
+        close(out);
+        if (rc != 0)
+            unlink(tmp);
+    }
+    if (basis >= 0)
+        close(basis);
+    free(sigs);
+    free(buf);
+    return rc;
+}
+
+/* Sender */
+
+// Output buffer, so the many small ops of a delta leave in large writes
+struct delta_out {
+    int fd;
+    size_t used;
+    unsigned long long sent;
+    unsigned char buf[64 * 1024];
+};
+
+static inline int delta_flush(struct delta_out *o) {
+    if (o->used > 0 && bulk_write_all(o->fd, o->buf, o->used) < 0)
+        return -1;
+    o->sent += o->used;
+    o->used = 0;
+    return 0;
+}
+
+static inline int delta_put(struct delta_out *o, const void *p, size_t len) {
+    if (o->used + len > sizeof(o->buf)) {
+        if (delta_flush(o) < 0)
+            return -1;
+        if (len > sizeof(o->buf)) {
+            o->sent += len;
+            return bulk_write_all(o->fd, p, len);
+        }
+    }
+    memcpy(o->buf + o->used, p, len);
+    o->used += len;
+    return 0;
+}
+
+// Function to emit the literal bytes p[0..len) in ops of at most DELTA_LITERAL_MAX
+static inline int delta_literal(struct delta_out *o, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        uint32_t n = len < DELTA_LITERAL_MAX ? len : DELTA_LITERAL_MAX;
+        struct delta_op op = {htonl(DELTA_LITERAL), htonl(n), 0};
+        if (delta_put(o, &op, sizeof(op)) < 0 || delta_put(o, p, n) < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static inline int delta_copy(struct delta_out *o, uint64_t first, uint32_t count) {
+    struct delta_op op = {htonl(DELTA_COPY), htonl(count), htobe64(first)};
+    return count == 0 ? 0 : delta_put(o, &op, sizeof(op));
+}
+
+// Function to sync a file to a receiver; block 0 lets the receiver choose. Returns 0 once the receiver has the
+// new version
+static inline int delta_send(const struct sockaddr_in *addr, const char *path, uint32_t block) {
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file < 0 || fstat(file, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    size_t size = st.st_size;
+    const unsigned char *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0) : NULL;
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        close(file);
+        return -1;
+    }
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("Connection failed");
+        if (data != NULL)
+            munmap((void *)data, size);
+        close(file);
+        return -1;
+    }
+    double start = peer_now_ms();
+    struct delta_hello h = {DELTA_MAGIC, htonl(block), htobe64(size), htonl(strlen(name)), 0};
+    struct delta_sigs head;
+    struct delta_sig *sigs = NULL;
+    uint32_t *table = NULL, *next = NULL;
+    struct delta_out *o = malloc(sizeof(*o));
+    uint64_t count = 0, literal = 0, copied = 0;
+    int rc = -1;
+    if (o == NULL || bulk_write_all(fd, &h, sizeof(h)) < 0 || bulk_write_all(fd, name, strlen(name)) < 0
+        || bulk_read_all(fd, &head, sizeof(head)) != 1)
+        goto done;
+    block = ntohl(head.block);
+    count = be64toh(head.count);
+    if (block < DELTA_BLOCK_MIN || block > DELTA_BLOCK_MAX || count > DELTA_COUNT_MAX)
+        goto done;
+    sigs = malloc((count ? count : 1) * sizeof(*sigs));
+    if (sigs == NULL || bulk_read_all(fd, sigs, count * sizeof(*sigs)) != 1)
+        goto done;
+    o->fd = fd;
+    o->used = 0;
+    o->sent = sizeof(h) + strlen(name);
+
+    // Hash table of weak checksums: table[hash] is the first block + 1, next[] chains blocks with the same hash.
+    // A short last block can only match the window at the end of the new file, where it shrinks to the same length
+    uint32_t mask = 1;
+    while (mask < 2 * count)
+        mask <<= 1;
+    mask--;
+    table = calloc(mask + 1, sizeof(*table));
+    next = calloc(count + 1, sizeof(*next));
+    if (table == NULL || next == NULL)
+        goto done;
+    for (uint64_t i = count; i-- > 0;) {
+        uint32_t w = ntohl(sigs[i].weak), hash = (w ^ w >> 16) & mask;
+        next[i] = table[hash];
+        table[hash] = i + 1;
+    }
+
+    // Rolling scan
+    size_t pos = 0, lit_start = 0;
+    uint64_t run_first = 0;
+    uint32_t run_len = 0, a = 0, b = 0, weak = 0;
+    int rolling = 0;            // a and b describe the window at pos
+    while (pos < size) {
+        size_t len = size - pos < block ? size - pos : block;
+        if (!rolling) {
+            weak = delta_weak(data + pos, len, &a, &b);
+            rolling = 1;
+        }
+        uint64_t match = UINT64_MAX;
+        uint8_t strong[32];
+        int hashed = 0;         // The strong hash of the window is computed once, on the first weak match
+        for (uint32_t c = table[(weak ^ weak >> 16) & mask]; c != 0; c = next[c - 1]) {
+            uint64_t i = c - 1;
+            if (ntohl(sigs[i].weak) != weak)
+                continue;
+            if (!hashed++)
+                sha256(data + pos, len, strong);
+            if (memcmp(strong, sigs[i].strong, 16) == 0) {
+                match = i;
+                break;
+            }
+        }
+        if (match != UINT64_MAX) {
+            // Emit pending literals, then extend or start a run of consecutive blocks
+            if (pos > lit_start) {
+                if (delta_copy(o, run_first, run_len) < 0 || delta_literal(o, data + lit_start, pos - lit_start) < 0)
+                    goto done;
+                literal += pos - lit_start;
+                run_len = 0;
+            }
+            if (run_len > 0 && match == run_first + run_len && run_len < UINT32_MAX)
+                run_len++;
+            else {
+                if (delta_copy(o, run_first, run_len) < 0)
+                    goto done;
+                run_first = match;
+                run_len = 1;
+            }
+            copied += len;
+            pos += len;
+            lit_start = pos;
+            rolling = 0;
+            continue;
+        }
+        // Slide the window one byte: drop data[pos], take data[pos + len] (the window shrinks at the end)
+        if (pos + len < size) {
+            a = (a - data[pos] + data[pos + len]) & 0xffff;
+            b = (b - (uint32_t)len * data[pos] + a) & 0xffff;
+        } else {
+            a = (a - data[pos]) & 0xffff;
+            b = (b - (uint32_t)len * data[pos]) & 0xffff;
+        }
+        weak = a | b << 16;
+        pos++;
+    }
+    if (size > lit_start) {
+        if (delta_copy(o, run_first, run_len) < 0 || delta_literal(o, data + lit_start, size - lit_start) < 0)
+            goto done;
+        literal += size - lit_start;
+        run_len = 0;
+    }
+    uint8_t digest[32];
+    struct delta_op end = {htonl(DELTA_END), 0, 0};
+    struct delta_result result;
+    sha256(data, size, digest);
+    if (delta_copy(o, run_first, run_len) < 0 || delta_put(o, &end, sizeof(end)) < 0
+        || delta_put(o, digest, 32) < 0 || delta_flush(o) < 0 || bulk_read_all(fd, &result, sizeof(result)) != 1)
+        goto done;
+    rc = ntohl(result.status) == 0 ? 0 : -1;
+    if (rc == 0)
+        printf("Synced %s: %zu bytes, %llu literal and %llu from %llu old blocks of %u; sent %llu bytes and "
+               "received %llu of signatures in %.2f s\n", name, size, (unsigned long long)literal,
+               (unsigned long long)copied, (unsigned long long)count, block, o->sent,
+               (unsigned long long)(sizeof(head) + count * sizeof(*sigs)), (peer_now_ms() - start) / 1000);
+done:
+    if (rc != 0)
+        fprintf(stderr, "Sync of %s failed\n", name);
+    free(o);
+    free(sigs);
+    free(table);
+    free(next);
+    close(fd);
+    if (data != NULL)
+        munmap((void *)data, size);
+    close(file);
+    return rc;
+}
+
+#endif
@@ -0,0 +1,424 @@
+/*
+peer2peer_loop.h
+- Event loop for the peer modes of peer2peer_TCP.c. One epoll instance accepts peers and dials others at the same
+  time, and every session is full duplex whichever side opened it.
+- Messages are framed: an 8-byte header (type and payload length, network byte order) and then the payload. Either
+  side may send at any time.
+- Each session buffers its input and output. A complete frame is handed to the handler straight from the input
+  buffer. A reply can be written in place in the output buffer (peer_reserve()), so its payload is copied once.
+- A session whose output has backed up past PEER_OUT_HIGH is not read until it drains. A peer that sends requests
+  without reading the answers therefore cannot grow this process's memory without bound.
+- An outbound session that fails or closes is redialled after PEER_REDIAL_MS, so nodes may start in any order.
+  on_dial_failed lets the application give up on a peer that cannot be reached instead.
+*/
+
+#ifndef PEER2PEER_LOOP_H
+#define PEER2PEER_LOOP_H
+
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // malloc, realloc, free
+#include <string.h>     // memcpy, memmove
+#include <stdint.h>     // Fixed-width frame fields
+#include <errno.h>      // EAGAIN, EINPROGRESS
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // read, close
+#include <netdb.h>      // getaddrinfo for peer names
+#include <sys/socket.h> // Socket API
+#include <sys/epoll.h>  // Event loop
+#include <netinet/in.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>  // htonl, inet_ntop
+
+#define PEER_FRAME_MAX (256u << 20)  // Largest payload accepted in one frame
+#define PEER_READ_CHUNK (256 * 1024) // Room made in the input buffer for each read
+#define PEER_OUT_HIGH (8u << 20)     // Output backlog at which a session stops being read
+#define PEER_REDIAL_MS 1000          // Delay before an outbound session is dialled again
+
+// Frame header; both fields in network byte order
+struct peer_frame {
+    uint32_t type;
+    uint32_t length;            // Payload bytes that follow
+};
+
+// Growable byte buffer; bytes start..end are pending
+struct peer_buf {
+    char *data;
+    size_t start, end, cap;
+};
+
+struct peer_session {
+    int fd;                     // -1 while closed (an outbound session waiting to be redialled)
+    int outbound;               // Dialled by this node
+    int connected;
+    int reading;                // Input is read (cleared while the output is backed up)
+    unsigned events;            // Events registered with epoll
+    char name[64];              // Peer address, "ip:port"
+    struct sockaddr_in addr;
+    double redial_at;
+    struct peer_buf in, out;
+    unsigned long long frames_in, frames_out, bytes_in, bytes_out;
+    void *user;                 // For the application
+};
+
+struct peer_loop {
+    int epfd, listen_fd;        // listen_fd -1 if the node does not listen
+    int input_fd;               // Extra descriptor watched for the application (e.g. stdin), or -1
+    struct peer_session **sessions;
+    int nsessions, cap;
+    // Handlers, any may be NULL. A frame's payload is valid only during the call
+    void (*on_open)(struct peer_loop *l, struct peer_session *s);
+    void (*on_frame)(struct peer_loop *l, struct peer_session *s, uint32_t type, char *payload, size_t len);
+    void (*on_close)(struct peer_loop *l, struct peer_session *s);
+    // An outbound dial failed (the session never opened). Clearing s->outbound drops the session, else it is
+    // redialled
+    void (*on_dial_failed)(struct peer_loop *l, struct peer_session *s);
+    void (*on_input)(struct peer_loop *l, int fd);
+    void *ctx;
+};
+
+static inline double peer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Function to make room for len more bytes at the end of a buffer; -1 if out of memory
+static inline int peer_buf_room(struct peer_buf *b, size_t len) {
+    if (b->start == b->end)
+        b->start = b->end = 0;
+    if (b->cap - b->end >= len)
+        return 0;
+    if (b->start > 0 && b->cap - (b->end - b->start) >= len) {   // Enough once the pending bytes move down
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+        return 0;
+    }
+    size_t cap = b->cap ? b->cap : 64 * 1024;
+    while (cap - (b->end - b->start) < len)
+        cap *= 2;
+    char *data = malloc(cap);
+    if (data == NULL)
+        return -1;
+    if (b->data != NULL)
+        memcpy(data, b->data + b->start, b->end - b->start);
+    free(b->data);
+    b->data = data;
+    b->end -= b->start;
+    b->start = 0;
+    b->cap = cap;
+    return 0;
+}
+
+// Function to register the events a session needs now: connect completion, input unless backed up, and
+// output while there is some
+static inline void peer_update_events(struct peer_loop *l, struct peer_session *s) {
+    if (s->fd < 0)
+        return;
+    unsigned events = !s->connected ? EPOLLOUT
+                                    : (s->reading ? EPOLLIN : 0) | (s->out.end > s->out.start ? EPOLLOUT : 0);
+    if (events != s->events) {
+        struct epoll_event ev = {.events = events, .data.ptr = s};
+        epoll_ctl(l->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->events = events;
+    }
+}
+
+// Function to append a frame header and room for its payload to a session's output; returns where the payload
+// goes (valid until the next call that queues output), or NULL if out of memory
+static inline char *peer_reserve(struct peer_session *s, uint32_t type, size_t len) {
+    if (peer_buf_room(&s->out, sizeof(struct peer_frame) + len) < 0)
+        return NULL;
+    struct peer_frame h = {htonl(type), htonl((uint32_t)len)};
+    memcpy(s->out.data + s->out.end, &h, sizeof(h));
+    char *payload = s->out.data + s->out.end + sizeof(h);
+    s->out.end += sizeof(h) + len;
+    s->frames_out++;
+    return payload;
+}
+
+// Function to queue a frame with a copy of its payload; 0 or -1
+static inline int peer_send(struct peer_session *s, uint32_t type, const void *payload, size_t len) {
+    char *p = peer_reserve(s, type, len);
+    if (p == NULL)
+        return -1;
+    if (len > 0)
+        memcpy(p, payload, len);
+    return 0;
+}
+
+// Function to open a non-blocking connection for an outbound session
+static inline void peer_connect(struct peer_loop *l, struct peer_session *s) {
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    s->connected = 0;
+    s->events = EPOLLOUT;
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = s};
+    if (s->fd < 0 || (connect(s->fd, (struct sockaddr *)&s->addr, sizeof(s->addr)) < 0 && errno != EINPROGRESS)
+        || epoll_ctl(l->epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+        if (s->fd >= 0)
+            close(s->fd);
+        s->fd = -1;
+        s->redial_at = peer_now_ms() + PEER_REDIAL_MS;
+        if (l->on_dial_failed != NULL)
+            l->on_dial_failed(l, s);
+    }
+}
+
+// Function to add a session to the loop's table; NULL if out of memory
+static inline struct peer_session *peer_add(struct peer_loop *l) {
+    if (l->nsessions == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 16;
+        struct peer_session **p = realloc(l->sessions, cap * sizeof(*p));
+        if (p == NULL)
+            return NULL;
+        l->sessions = p;
+        l->cap = cap;
+    }
+    struct peer_session *s = calloc(1, sizeof(*s));
+    if (s != NULL)
+        l->sessions[l->nsessions++] = s;
+    return s;
+}
+
+// Function to resolve "host:port" to an IPv4 address; 0 or -1
+static inline int peer_resolve(const char *hostport, struct sockaddr_in *addr) {
+    char host[256];
+    const char *colon = strrchr(hostport, ':');
+    if (colon == NULL || colon - hostport >= (long)sizeof(host))
+        return -1;
+    memcpy(host, hostport, colon - hostport);
+    host[colon - hostport] = '\0';
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+        return -1;
+    memcpy(addr, res->ai_addr, sizeof(*addr));
+    freeaddrinfo(res);
+    return 0;
+}
+
+// Function to dial a peer at an address; the session is redialled whenever it is lost (clear outbound before
+// peer_close() to drop it for good). Returns the session, or NULL if out of memory
+static inline struct peer_session *peer_dial_addr(struct peer_loop *l, const struct sockaddr_in *addr,
+                                                  const char *name) {
+    struct peer_session *s = peer_add(l);
+    if (s == NULL)
+        return NULL;
+    s->addr = *addr;
+    s->outbound = 1;
+    s->reading = 1;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    peer_connect(l, s);
+    return s;
+}
+
+// Function to dial a peer given as "host:port"; 0 or -1
+static inline int peer_dial(struct peer_loop *l, const char *hostport) {
+    struct sockaddr_in addr;
+    if (peer_resolve(hostport, &addr) < 0 || peer_dial_addr(l, &addr, hostport) == NULL)
+        return -1;
+    return 0;
+}
+
+// Function to set up a loop that listens on port (0: dial only). Returns 0, or -1 with errno set
+static inline int peer_loop_init(struct peer_loop *l, int port) {
+    memset(l, 0, sizeof(*l));
+    l->listen_fd = l->input_fd = -1;
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (l->epfd < 0)
+        return -1;
+    if (port == 0)
+        return 0;
+    l->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(l->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = INADDR_ANY};
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};   // NULL marks the listening socket
+    if (l->listen_fd < 0 || bind(l->listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0
+        || listen(l->listen_fd, 128) < 0 || epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->listen_fd, &ev) < 0)
+        return -1;
+    return 0;
+}
+
+// Function to watch one more descriptor for the application; on_input runs when it is readable
+static inline int peer_watch_input(struct peer_loop *l, int fd) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = l};   // The loop itself marks the input
+    l->input_fd = fd;
+    return epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Function to close a session. An outbound one is kept and redialled later; an inbound one is freed at the end
+// of the loop iteration (events for it may still be pending in this one)
+static inline void peer_close(struct peer_loop *l, struct peer_session *s) {
+    if (s->fd < 0)
+        return;
+    int was_connected = s->connected;
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->fd = -1;
+    s->connected = 0;
+    s->in.start = s->in.end = 0;
+    s->out.start = s->out.end = 0;
+    s->redial_at = peer_now_ms() + PEER_REDIAL_MS;
+    if (was_connected && l->on_close != NULL)
+        l->on_close(l, s);
+    else if (!was_connected && s->outbound && l->on_dial_failed != NULL)
+        l->on_dial_failed(l, s);
+}
+
+// Function to send as much queued output as the socket takes; -1 if the connection failed
+static inline int peer_flush(struct peer_loop *l, struct peer_session *s) {
+    while (s->out.end > s->out.start) {
+        ssize_t n = send(s->fd, s->out.data + s->out.start, s->out.end - s->out.start, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return -1;
+        s->out.start += n;
+        s->bytes_out += n;
+    }
+    if (!s->reading && s->out.end - s->out.start < PEER_OUT_HIGH / 2)
+        s->reading = 1;                            // Drained enough: take input again
+    peer_update_events(l, s);
+    return 0;
+}
+
+// Function to read once from a session and hand every complete frame to the handler; -1 if the session ends
+static inline int peer_read(struct peer_loop *l, struct peer_session *s) {
+    if (peer_buf_room(&s->in, PEER_READ_CHUNK) < 0)
+        return -1;
+    ssize_t n = read(s->fd, s->in.data + s->in.end, s->in.cap - s->in.end);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (n <= 0)
+        return -1;
+    s->in.end += n;
+    s->bytes_in += n;
+    while (s->in.end - s->in.start >= sizeof(struct peer_frame) && s->fd >= 0) {
+        struct peer_frame h;
+        memcpy(&h, s->in.data + s->in.start, sizeof(h));
+        size_t len = ntohl(h.length);
+        if (len > PEER_FRAME_MAX)
+            return -1;
+        if (s->in.end - s->in.start < sizeof(h) + len) {
+            if (peer_buf_room(&s->in, sizeof(h) + len - (s->in.end - s->in.start)) < 0)
+                return -1;                         // Make room for the rest of a large frame
+            break;
+        }
+        char *payload = s->in.data + s->in.start + sizeof(h);
+        s->in.start += sizeof(h) + len;
+        s->frames_in++;
+        if (l->on_frame != NULL)
+            l->on_frame(l, s, ntohl(h.type), payload, len);
+    }
+    if (s->fd >= 0 && s->out.end - s->out.start >= PEER_OUT_HIGH)
+        s->reading = 0;                            // Backed up: stop reading until the peer takes our output
+    return 0;
+}
+
+// Function to accept every pending inbound session
+static inline void peer_accept(struct peer_loop *l) {
+    for (;;) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept4(l->listen_fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct peer_session *s = peer_add(l);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+        if (s == NULL || epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            if (s != NULL)
+                s->fd = -1;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->fd = fd;
+        s->addr = addr;
+        s->connected = s->reading = 1;
+        s->events = EPOLLIN;
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        snprintf(s->name, sizeof(s->name), "%s:%d", ip, ntohs(addr.sin_port));
+        if (l->on_open != NULL)
+            l->on_open(l, s);
+    }
+}
+
+// Function to handle readiness of a session
+static inline void peer_event(struct peer_loop *l, struct peer_session *s, unsigned events) {
+    if (s->fd < 0)
+        return;                                    // Closed earlier in this iteration
+    if (!s->connected) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            peer_close(l, s);
+            return;
+        }
+        int one = 1;
+        setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->connected = 1;
+        if (l->on_open != NULL)
+            l->on_open(l, s);
+    } else if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && peer_read(l, s) < 0) {
+        peer_close(l, s);
+        return;
+    }
+    if (s->fd >= 0 && peer_flush(l, s) < 0)
+        peer_close(l, s);
+}
+
+// Function to run one iteration: wait up to timeout_ms for events, handle them, flush the output handlers
+// queued, redial lost peers and free closed inbound sessions
+static inline void peer_loop_run(struct peer_loop *l, int timeout_ms) {
+    struct epoll_event events[256];
+    int n = epoll_wait(l->epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.ptr == NULL)
+            peer_accept(l);
+        else if (events[i].data.ptr == l) {
+            if (l->on_input != NULL)
+                l->on_input(l, l->input_fd);
+        } else
+            peer_event(l, events[i].data.ptr, events[i].events);
+    }
+
+    double now = peer_now_ms();
+    for (int i = 0; i < l->nsessions;) {
+        struct peer_session *s = l->sessions[i];
+        if (s->fd >= 0 && s->connected && s->out.end > s->out.start && peer_flush(l, s) < 0)
+            peer_close(l, s);
+        if (s->fd < 0 && s->outbound && now >= s->redial_at)
+            peer_connect(l, s);
+        if (s->fd < 0 && !s->outbound) {
+            free(s->in.data);
+            free(s->out.data);
+            free(s);
+            l->sessions[i] = l->sessions[--l->nsessions];
+            continue;
+        }
+        i++;
+    }
+}
+
+// Function to close every session and release the loop
+static inline void peer_loop_free(struct peer_loop *l) {
+    for (int i = 0; i < l->nsessions; i++) {
+        struct peer_session *s = l->sessions[i];
+        if (s->fd >= 0)
+            close(s->fd);
+        free(s->in.data);
+        free(s->out.data);
+        free(s);
+    }
+    free(l->sessions);
+    if (l->listen_fd >= 0)
+        close(l->listen_fd);
+    close(l->epfd);
+}
+
+#endif
@@ -0,0 +1,597 @@
+/*
+peer2peer_swarm.h
+- Swarm distribution for peer2peer_TCP.c on the peer event loop (peer2peer_loop.h).
+- Content is cut into fixed-size chunks listed in a manifest: name, size, chunk size and one SHA-256 per chunk.
+  The swarm is named by the SHA-256 of the manifest file, and a node only talks to peers naming the same swarm.
+- On connecting, peers exchange a hello (swarm, node id, listening port) and a bitfield of the chunks they hold.
+  They also send the list of peers they know, so nodes that dial only the origin still meet and trade with each
+  other. Between two nodes one session is kept: of two, the one dialled by the larger node id is closed.
+- Each session keeps up to SWARM_PIPELINE chunk requests in flight. The next chunk requested is the one held by
+  the fewest connected peers (rarest first, ties broken at random), so copies spread and the origin is not
+  asked for what others already have.
+- A received chunk is checked against its hash and written at its offset. It is then announced to every peer at
+  once, so it can be served onward while the rest is still arriving. Chunks are served by reading them from the
+  file straight into the session's output buffer.
+*/
+
+#ifndef PEER2PEER_SWARM_H
+#define PEER2PEER_SWARM_H
+
+#include <stdio.h>      // Manifest files
+#include <stdlib.h>     // calloc, free, random
+#include <string.h>     // memcmp
+#include <stdint.h>     // Fixed-width fields
+#include <endian.h>     // htobe64, be64toh
+#include <fcntl.h>      // open
+#include <unistd.h>     // pread, pwrite, ftruncate
+#include <sys/stat.h>   // fstat
+#include <sys/random.h> // getrandom for node ids
+#include "peer2peer_loop.h" // Sessions and framing
+
+#define SWARM_HELLO 16          // Frame: swarm id (32 bytes), node id (8), listening port (2)
+#define SWARM_BITFIELD 17       // Frame: one byte per chunk, 1 if held
+#define SWARM_HAVE 18           // Frame: 4-byte index of a chunk just completed
+#define SWARM_REQUEST 19        // Frame: 4-byte index of a chunk wanted
+#define SWARM_PIECE 20          // Frame: 4-byte index and the chunk
+#define SWARM_PEERS 21          // Frame: known peers, 16 bytes each (node id, IPv4 address, port, 2 zero bytes)
+
+#define SWARM_CHUNK_DEFAULT (256 * 1024) // Default chunk size of new manifests
+#define SWARM_PIPELINE 4        // Requests in flight per session
+#define SWARM_HELLO_LEN 42
+
+/* SHA-256 (FIPS 180-4) */
+
+struct sha256 {
+    uint32_t h[8];
+    uint8_t block[64];
+    size_t used;
+    uint64_t total;
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t sha256_rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// Function to mix one 64-byte block into the state
+static inline void sha256_block(uint32_t h[8], const uint8_t *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = k + (sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25)) + ((e & f) ^ (~e & g))
+                      + sha256_k[i] + w[i];
+        uint32_t t2 = (sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
+    }
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e, h[5] += f, h[6] += g, h[7] += k;
+}
+
+static inline void sha256_init(struct sha256 *st) {
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(st->h, iv, sizeof(iv));
+    st->used = 0;
+    st->total = 0;
+}
+
+static inline void sha256_update(struct sha256 *st, const void *data, size_t len) {
+    const uint8_t *p = data;
+    st->total += len;
+    if (st->used > 0) {
+        size_t take = len < 64 - st->used ? len : 64 - st->used;
+        memcpy(st->block + st->used, p, take);
+        st->used += take, p += take, len -= take;
+        if (st->used < 64)
+            return;
+        sha256_block(st->h, st->block);
+        st->used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64)
+        sha256_block(st->h, p);
+    memcpy(st->block, p, len);
+    st->used = len;
+}
+
+static inline void sha256_final(struct sha256 *st, uint8_t out[32]) {
+    uint64_t bits = st->total * 8;
+    uint8_t pad = 0x80;
+    sha256_update(st, &pad, 1);
+    pad = 0;
+    while (st->used != 56)
+        sha256_update(st, &pad, 1);
+    for (int i = 7; i >= 0; i--) {
+        uint8_t b = bits >> (8 * i);
+        sha256_update(st, &b, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = st->h[i] >> 24;
+        out[4 * i + 1] = st->h[i] >> 16;
+        out[4 * i + 2] = st->h[i] >> 8;
+        out[4 * i + 3] = st->h[i];
+    }
+}
+
+static inline void sha256(const void *data, size_t len, uint8_t out[32]) {
+    struct sha256 st;
+    sha256_init(&st);
+    sha256_update(&st, data, len);
+    sha256_final(&st, out);
+}
+
+/* Manifest */
+
+struct swarm_manifest {
+    char name[256];
+    uint64_t size;
+    uint32_t chunk, nchunks;
+    uint8_t (*hashes)[32];
+    uint8_t id[32];             // SHA-256 of the manifest file
+};
+
+// Function to write the manifest of a file: "swarm-manifest 1", name, size and chunk lines, then one hex hash per
+// chunk. Returns 0 or -1
+static inline int swarm_make_manifest(const char *path, const char *out, uint32_t chunk) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    FILE *fp = NULL;
+    char *buf = malloc(chunk);
+    if (fd < 0 || fstat(fd, &st) < 0 || buf == NULL || (fp = fopen(out, "w")) == NULL) {
+        perror(fd < 0 ? path : out);
+        if (fd >= 0)
+            close(fd);
+        free(buf);
+        return -1;
+    }
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    fprintf(fp, "swarm-manifest 1\nname %s\nsize %llu\nchunk %u\n", name, (unsigned long long)st.st_size, chunk);
+    for (off_t off = 0; off < st.st_size; off += chunk) {
+        ssize_t n = pread(fd, buf, chunk, off);
+        if (n <= 0)
+            break;
+        uint8_t h[32];
+        sha256(buf, n, h);
+        for (int i = 0; i < 32; i++)
+            fprintf(fp, "%02x", h[i]);
+        fputc('\n', fp);
+    }
+    close(fd);
+    free(buf);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Function to get the value of a hex digit, or -1
+static inline int swarm_hex(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Function to read a manifest; 0 or -1. Every chunk needs its line of 64 hex digits and a newline, and chunk
+// indexes must fit the 4-byte index of the frames
+static inline int swarm_load_manifest(const char *path, struct swarm_manifest *m) {
+    memset(m, 0, sizeof(*m));
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+    char *text = len >= 0 ? malloc(len + 1) : NULL;
+    int ok = text != NULL && fread(text, 1, len, fp) == (size_t)len;
+    fclose(fp);
+    if (!ok) {
+        free(text);
+        return -1;
+    }
+    text[len] = '\0';
+    sha256(text, len, m->id);
+
+    unsigned long long size;
+    int used;
+    if (sscanf(text, "swarm-manifest 1\nname %255[^\n]\nsize %llu\nchunk %u\n%n", m->name, &size, &m->chunk, &used) != 3
+        || m->chunk == 0 || m->chunk > PEER_FRAME_MAX - 4) {
+        free(text);
+        return -1;
+    }
+    uint64_t nchunks = size / m->chunk + (size % m->chunk != 0);
+    if (nchunks >= UINT32_MAX || nchunks > (uint64_t)(len - used) / 65) {
+        free(text);
+        return -1;
+    }
+    m->size = size;
+    m->nchunks = nchunks;
+    m->hashes = malloc((m->nchunks ? m->nchunks : 1) * sizeof(*m->hashes));
+    const char *p = text + used;
+    for (uint32_t i = 0; m->hashes != NULL && i < m->nchunks; i++, p += 65) {
+        int bad = p[64] != '\n';
+        for (int k = 0; k < 32 && !bad; k++) {
+            int hi = swarm_hex(p[2 * k]), lo = swarm_hex(p[2 * k + 1]);
+            bad = hi < 0 || lo < 0;
+            m->hashes[i][k] = hi << 4 | lo;
+        }
+        if (bad) {
+            free(m->hashes);
+            m->hashes = NULL;
+            free(text);
+            return -1;
+        }
+    }
+    free(text);
+    return m->hashes != NULL ? 0 : -1;
+}
+
+/* Swarm node */
+
+// Per-session state (peer_session.user)
+struct swarm_peer {
+    uint64_t node;              // Peer's node id, 0 until its hello
+    uint64_t dialled;           // Node id a peer list gave for it (a learned peer), 0 otherwise
+    uint16_t port;              // Peer's listening port
+    int inflight;               // Our requests outstanding on the session
+    unsigned char *has;         // Chunks the peer holds
+    unsigned long long received; // Chunks received from it
+};
+
+struct swarm {
+    struct swarm_manifest m;
+    int fd;                     // The content file
+    unsigned char *have;
+    uint32_t missing;
+    uint16_t *avail;            // Connected peers holding each chunk
+    struct peer_session **requested; // Session a missing chunk is requested from, or NULL
+    uint64_t node;
+    uint16_t port;
+    unsigned long long bytes_down, bytes_up, chunks_down, bad_chunks;
+};
+
+// Function to open the content file and check which chunks it already holds; 0 or -1
+static inline int swarm_open(struct swarm *sw, const char *path, int port) {
+    struct swarm_manifest *m = &sw->m;
+    sw->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    sw->have = calloc(m->nchunks + 1, 1);
+    sw->avail = calloc(m->nchunks + 1, sizeof(*sw->avail));
+    sw->requested = calloc(m->nchunks + 1, sizeof(*sw->requested));
+    char *buf = malloc(m->chunk);
+    struct stat st;
+    if (sw->fd < 0 || sw->have == NULL || sw->avail == NULL || sw->requested == NULL || buf == NULL
+        || fstat(sw->fd, &st) < 0) {
+        free(buf);
+        return -1;
+    }
+    if ((uint64_t)st.st_size != m->size && ftruncate(sw->fd, m->size) < 0) {
+        free(buf);
+        return -1;
+    }
+    sw->missing = m->nchunks;
+    for (uint32_t i = 0; i < m->nchunks && st.st_size > 0; i++) {
+        ssize_t n = pread(sw->fd, buf, m->chunk, (off_t)i * m->chunk);
+        uint8_t h[32];
+        sha256(buf, n > 0 ? n : 0, h);
+        if (memcmp(h, m->hashes[i], 32) == 0) {
+            sw->have[i] = 1;
+            sw->missing--;
+        }
+    }
+    free(buf);
+    if (getrandom(&sw->node, sizeof(sw->node), 0) != sizeof(sw->node) || sw->node == 0)
+        sw->node = ((uint64_t)getpid() << 32) ^ (uint64_t)peer_now_ms();
+    sw->port = port;
+    return 0;
+}
+
+static inline uint32_t swarm_chunk_len(const struct swarm *sw, uint32_t i) {
+    uint64_t left = sw->m.size - (uint64_t)i * sw->m.chunk;
+    return left < sw->m.chunk ? left : sw->m.chunk;
+}
+
+// Function to send a 4-byte index frame
+static inline void swarm_send_index(struct peer_session *s, uint32_t type, uint32_t i) {
+    uint32_t be = htonl(i);
+    peer_send(s, type, &be, 4);
+}
+
+// Function to keep a session's request pipeline full: rarest chunk first among those the peer holds and nobody
+// has been asked for; a random starting point breaks ties
+static inline void swarm_fill(struct swarm *sw, struct peer_session *s) {
+    struct swarm_peer *p = s->user;
+    uint32_t n = sw->m.nchunks;
+    while (p != NULL && p->has != NULL && p->inflight < SWARM_PIPELINE && sw->missing > 0) {
+        uint32_t start = random() % n, best = UINT32_MAX;
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t i = start + k < n ? start + k : start + k - n;
+            if (!sw->have[i] && sw->requested[i] == NULL && p->has[i]
+                && (best == UINT32_MAX || sw->avail[i] < sw->avail[best]))
+                best = i;
+        }
+        if (best == UINT32_MAX)
+            return;
+        sw->requested[best] = s;
+        p->inflight++;
+        swarm_send_index(s, SWARM_REQUEST, best);
+    }
+}
+
+// Function to send a session the peers this node knows (other than itself)
+static inline void swarm_send_peers(struct peer_loop *l, struct peer_session *to) {
+    unsigned char *list = malloc(16 * (size_t)l->nsessions + 1), *q = list;
+    if (list == NULL)
+        return;
+    for (int i = 0; i < l->nsessions; i++) {
+        struct peer_session *s = l->sessions[i];
+        struct swarm_peer *p = s->user;
+        if (s == to || !s->connected || p == NULL || p->node == 0)
+            continue;
+        uint64_t node = htobe64(p->node);
+        uint16_t port = htons(p->port), zero = 0;
+        memcpy(q, &node, 8);
+        memcpy(q + 8, &s->addr.sin_addr.s_addr, 4);
+        memcpy(q + 12, &port, 2);
+        memcpy(q + 14, &zero, 2);
+        q += 16;
+    }
+    peer_send(to, SWARM_PEERS, list, q - list);
+    free(list);
+}
+
+// Function to find the session of a node (other than except); NULL if none
+static inline struct peer_session *swarm_find_node(struct peer_loop *l, uint64_t node, struct peer_session *except) {
+    for (int i = 0; i < l->nsessions; i++) {
+        struct swarm_peer *p = l->sessions[i]->user;
+        if (l->sessions[i] != except && p != NULL && (p->node == node || p->dialled == node))
+            return l->sessions[i];
+    }
+    return NULL;
+}
+
+// Function to forget what a session held and asked for (it closed)
+static inline void swarm_forget(struct swarm *sw, struct peer_session *s) {
+    struct swarm_peer *p = s->user;
+    if (p == NULL)
+        return;
+    for (uint32_t i = 0; i < sw->m.nchunks; i++) {
+        if (p->has != NULL && p->has[i])
+            sw->avail[i]--;
+        if (sw->requested[i] == s)
+            sw->requested[i] = NULL;
+    }
+    free(p->has);
+    p->has = NULL;
+    p->inflight = 0;
+    p->node = 0;
+}
+
+// Handler: a session opened; introduce this node and what it holds
+static inline void swarm_opened(struct peer_loop *l, struct peer_session *s) {
+    struct swarm *sw = l->ctx;
+    struct swarm_peer *p = s->user;
+    if (p == NULL && (p = s->user = calloc(1, sizeof(*p))) == NULL) {
+        peer_close(l, s);
+        return;
+    }
+    unsigned char hello[SWARM_HELLO_LEN];
+    uint64_t node = htobe64(sw->node);
+    uint16_t port = htons(sw->port);
+    memcpy(hello, sw->m.id, 32);
+    memcpy(hello + 32, &node, 8);
+    memcpy(hello + 40, &port, 2);
+    peer_send(s, SWARM_HELLO, hello, sizeof(hello));
+    peer_send(s, SWARM_BITFIELD, sw->have, sw->m.nchunks);
+}
+
+// Handler: a session closed; a peer learned from a list is dropped rather than redialled
+static inline void swarm_closed(struct peer_loop *l, struct peer_session *s) {
+    struct swarm *sw = l->ctx;
+    struct swarm_peer *p = s->user;
+    swarm_forget(sw, s);
+    if (p != NULL && p->dialled != 0)
+        s->outbound = 0;
+    free(p);
+    s->user = NULL;
+    // Chunks it was asked for go to the others
+    for (int i = 0; i < l->nsessions; i++)
+        if (l->sessions[i] != s && l->sessions[i]->connected)
+            swarm_fill(sw, l->sessions[i]);
+}
+
+// Function to take in a hello; 0, or -1 to close the session
+static inline int swarm_hello(struct peer_loop *l, struct peer_session *s, const unsigned char *payload, size_t len) {
+    struct swarm *sw = l->ctx;
+    struct swarm_peer *p = s->user;
+    uint64_t node;
+    uint16_t port;
+    if (len != SWARM_HELLO_LEN || memcmp(payload, sw->m.id, 32) != 0 || p->node != 0)
+        return -1;                                   // Another swarm
+    memcpy(&node, payload + 32, 8);
+    memcpy(&port, payload + 40, 2);
+    node = be64toh(node);
+    if (node == sw->node) {
+        s->outbound = 0;                             // Dialled ourselves
+        return -1;
+    }
+    struct peer_session *other = swarm_find_node(l, node, s);
+    if (other != NULL && ((struct swarm_peer *)other->user)->has != NULL) {
+        // Two sessions with one node: close the one dialled by the larger id (both ends agree), or this one if
+        // both were dialled by the same side
+        uint64_t dialler = s->outbound ? sw->node : node, other_dialler = other->outbound ? sw->node : node;
+        if (dialler == other_dialler || dialler > other_dialler) {
+            s->outbound = 0;
+            return -1;
+        }
+        other->outbound = 0;
+        peer_close(l, other);
+    } else if (other != NULL) {
+        other->outbound = 0;                         // A pending dial to the same node
+        peer_close(l, other);
+        free(other->user);
+        other->user = NULL;
+    }
+    p->node = node;
+    p->port = ntohs(port);
+    p->has = calloc(sw->m.nchunks + 1, 1);
+    if (p->has == NULL)
+        return -1;
+    swarm_send_peers(l, s);
+    return 0;
+}
+
+// Handler: a dial failed. A peer learned from a list is dropped, so one that is gone is not redialled forever;
+// peers given on the command line are kept and redialled
+static inline void swarm_dial_failed(struct peer_loop *l, struct peer_session *s) {
+    struct swarm_peer *p = s->user;
+    (void)l;
+    if (p != NULL && p->dialled != 0) {
+        s->outbound = 0;                             // Freed by the loop
+        free(p);
+        s->user = NULL;
+    }
+}
+
+// Function to dial the peers of a list that this node does not know yet
+static inline void swarm_learn(struct peer_loop *l, const unsigned char *list, size_t len) {
+    struct swarm *sw = l->ctx;
+    for (size_t off = 0; off + 16 <= len; off += 16) {
+        uint64_t node;
+        struct sockaddr_in addr = {.sin_family = AF_INET};
+        memcpy(&node, list + off, 8);
+        node = be64toh(node);
+        memcpy(&addr.sin_addr.s_addr, list + off + 8, 4);
+        memcpy(&addr.sin_port, list + off + 12, 2);
+        if (node == sw->node || swarm_find_node(l, node, NULL) != NULL)
+            continue;
+        char name[64], ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        snprintf(name, sizeof(name), "%s:%d", ip, ntohs(addr.sin_port));
+        struct swarm_peer *p = calloc(1, sizeof(*p));
+        struct peer_session *s = p != NULL ? peer_dial_addr(l, &addr, name) : NULL;
+        if (s == NULL) {
+            free(p);
+            continue;
+        }
+        p->dialled = node;   // So a second list naming it does not dial it again
+        s->user = p;
+    }
+}
+
+// Function to store a received chunk after checking its hash, then announce it to every peer
+static inline void swarm_piece(struct peer_loop *l, struct peer_session *s, const char *payload, size_t len) {
+    struct swarm *sw = l->ctx;
+    struct swarm_peer *p = s->user;
+    uint32_t i;
+    if (len < 4)
+        return;
+    memcpy(&i, payload, 4);
+    i = ntohl(i);
+    if (i >= sw->m.nchunks)
+        return;
+    if (sw->requested[i] == s) {
+        sw->requested[i] = NULL;
+        p->inflight--;
+    }
+    uint8_t h[32];
+    if (sw->have[i] || len - 4 != swarm_chunk_len(sw, i))
+        return;
+    sha256(payload + 4, len - 4, h);
+    if (memcmp(h, sw->m.hashes[i], 32) != 0) {
+        sw->bad_chunks++;                            // Asked for again, perhaps elsewhere
+        return;
+    }
+    if (pwrite(sw->fd, payload + 4, len - 4, (off_t)i * sw->m.chunk) != (ssize_t)(len - 4)) {
+        perror("pwrite");
+        return;
+    }
+    sw->have[i] = 1;
+    sw->missing--;
+    sw->chunks_down++;
+    sw->bytes_down += len - 4;
+    p->received++;
+    for (int k = 0; k < l->nsessions; k++) {
+        struct swarm_peer *q = l->sessions[k]->user;
+        if (l->sessions[k]->connected && q != NULL && q->has != NULL && !q->has[i])
+            swarm_send_index(l->sessions[k], SWARM_HAVE, i);
+    }
+}
+
+// Handler: a frame arrived on a swarm session
+static inline void swarm_frame(struct peer_loop *l, struct peer_session *s, uint32_t type, char *payload,
+                               size_t len) {
+    struct swarm *sw = l->ctx;
+    struct swarm_peer *p = s->user;
+    uint32_t i = 0;
+    if (len >= 4) {
+        memcpy(&i, payload, 4);
+        i = ntohl(i);
+    }
+    if (type == SWARM_HELLO) {
+        if (swarm_hello(l, s, (unsigned char *)payload, len) < 0)
+            peer_close(l, s);
+        return;
+    }
+    if (p == NULL || p->has == NULL) {
+        peer_close(l, s);                            // Nothing before the hello
+        return;
+    }
+    switch (type) {
+    case SWARM_BITFIELD:
+        for (uint32_t k = 0; k < sw->m.nchunks && k < len; k++)
+            if (payload[k] && !p->has[k]) {
+                p->has[k] = 1;
+                sw->avail[k]++;
+            }
+        swarm_fill(sw, s);
+        break;
+    case SWARM_HAVE:
+        if (len == 4 && i < sw->m.nchunks && !p->has[i]) {
+            p->has[i] = 1;
+            sw->avail[i]++;
+            swarm_fill(sw, s);
+        }
+        break;
+    case SWARM_REQUEST:
+        if (len == 4 && i < sw->m.nchunks && sw->have[i]) {
+            uint32_t n = swarm_chunk_len(sw, i);
+            char *out = peer_reserve(s, SWARM_PIECE, 4 + (size_t)n);
+            if (out == NULL) {
+                peer_close(l, s);
+                return;
+            }
+            uint32_t be = htonl(i);
+            memcpy(out, &be, 4);
+            if (pread(sw->fd, out + 4, n, (off_t)i * sw->m.chunk) != (ssize_t)n)
+                memset(out + 4, 0, n);               // The peer rejects it by hash
+            sw->bytes_up += n;
+        }
+        break;
+    case SWARM_PIECE:
+        swarm_piece(l, s, payload, len);
+        if (s->fd >= 0)
+            swarm_fill(sw, s);
+        break;
+    case SWARM_PEERS:
+        swarm_learn(l, (unsigned char *)payload, len);
+        break;
+    default:
+        peer_close(l, s);
+    }
+}
+
+#endif
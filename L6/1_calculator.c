@@ -4,30 +4,808 @@ Create a TCP client-server calculator program in C where:
 - The client sends two operands and an operator (addition, subtraction, multiplication, division, or modulus) to the server.
 - The server performs the operation and returns the result to the client.
 - The client displays the result.
+- Extension: batch requests carry millions of operations as columns and are evaluated with AVX2.
+- Extension: a pipelined RPC mode keeps thousands of tagged requests in flight on one connection, and the server
+  completes them in any order from a worker pool.
+- Extension: clients send arithmetic expressions over named variables, which the server compiles once and
+  evaluates over whole columns of input.
+- Extension: a bignum mode computes exact results for integers of any length.
 */
 
 /*
 client.c
 - This program creates a TCP client that connects to a server on IP 127.0.0.1 and port 10202.
 - The client takes two operands and an operator choice from the user, sends them to the server, and receives the calculated result.
+- Usage: ./client                           one operation typed by the user (original behaviour)
+         ./client batch <count> [per-batch]  evaluate count random operations in batches of per-batch (default
+                                            1048576) over one connection, check every result and report ops/s.
+                                            Products come back as exact 64-bit integers
+         ./client rpc <count> [window]       send count random RPC requests with up to window (default 8192) in
+                                            flight, check every reply and report ops/s and how many came back
+                                            out of order. Replies are doubles, so a product beyond 2^53 comes
+                                            back rounded (the check computes it the same way)
+         ./client rpc                        read "first choice second" lines from stdin, send them all at once
+                                            and print the results in input order
+         ./client expr <expression> [vars [rows [repeats]]]
+                                            evaluate the expression over rows (default 1) of random values of
+                                            the comma-separated variables, repeats times on one connection, and
+                                            show the timings and the first rows, e.g.
+                                            ./client expr "sqrt(x*x + y*y) / (1 + z)" x,y,z 1000000 5
+         ./client expr-check                 check that the server compiles expressions with hundreds of
+                                            literals correctly and refuses too many variables and hexadecimal
+         ./client big <first> <choice> <second>
+                                            exact result of first op second for integers of any length. Decimal
+                                            operands get a decimal result; 0x-prefixed ones a hexadecimal one
+         ./client big-bench <digits> [repeats]
+                                            time each operation on random operands of digits digits (division
+                                            by one of half as many) and report the server's times
+- A batch request is a header (BATCH_MAGIC, count) and then three columns: count int32 left operands, count int32
+  right operands and count opcode bytes. Everything is in host byte order, as the single request already is.
+  The reply is a header (BATCH_MAGIC, count, server evaluation time in ns) followed by count 8-byte results
+  (union batch_result): the int64 product for a multiplication, which a double could round, and a double for
+  every other operation. Division by zero gives inf or NaN as in IEEE arithmetic; modulus by zero and unknown
+  opcodes give NaN.
+- An RPC connection starts with RPC_MAGIC, followed by a stream of struct rpc_request. Each request carries a
+  64-bit id, and its reply (struct rpc_reply) repeats it, so replies may come back in any order. The client side
+  (rpc_open, rpc_call, rpc_call_future, rpc_wait, rpc_close) gathers requests into large writes. A reader thread
+  matches each reply to its slot (id modulo the window) and runs the completion callback there. A future is a
+  callback that stores the result for rpc_wait.
+- An expression request is struct expr_header, the expression text, the variable names (comma separated) and then
+  one column of count doubles per variable, in the order the names are given. The reply is struct expr_reply
+  (with an error message if the expression was rejected), followed by count doubles. Expressions use decimal
+  numbers (no hexadecimal), the variables, + - * / % ^ (power), unary minus, parentheses and the functions sqrt,
+  abs, exp, log, sin, cos, min, max and pow.
+- A bignum request is struct big_header followed by both operands, in decimal (an optional sign, then digits) or
+  in binary (a sign byte, 0 or 1, then the magnitude's bytes, least significant first). The reply is struct
+  big_reply and the result in the same format. / and % truncate toward zero, as for C integers.
+- Build: gcc client.c -o client -lm -pthread
 */
 
 #include <stdio.h>      // Standard I/O library
 #include <stdlib.h>     // Standard library functions
 #include <string.h>     // String manipulation functions
+#include <stdint.h>     // Fixed-width integer types
+#include <math.h>       // NAN, trunc
+#include <time.h>       // clock_gettime
+#include <signal.h>     // signal, SIGPIPE
+#include <pthread.h>    // Reader thread of the RPC client
 #include <sys/types.h>  // Data types used in system calls
 #include <sys/socket.h> // Socket API
+#include <sys/uio.h>    // writev
 #include <netinet/in.h> // Structures for internet addresses
 #include <unistd.h>     // POSIX API for UNIX system calls
 #include <arpa/inet.h>  // Definitions for internet operations
 
 #define PORTNO 10202    // Port number for server connection
+#define BATCH_MAGIC 0x424c4143u  // "CALB": starts a batch request (a single request starts with an operand)
+#define BATCH_MAX (1u << 24)     // Most operations in one batch
+#define RPC_MAGIC 0x524c4143u    // "CALR": starts a pipelined RPC connection
+#define RPC_WINDOW 8192          // Default requests in flight on one connection
+#define RPC_WINDOW_MAX (1u << 20)
+#define EXPR_MAGIC 0x454c4143u   // "CALE": starts an expression connection
+#define BIG_MAGIC 0x4e4c4143u    // "CALN": starts a bignum connection
+#define BIG_DECIMAL 0            // Operands and result as decimal text
+#define BIG_BINARY 1             // Operands and result as a sign byte and little-endian magnitude bytes
+#define RPC_OUT_BUF 65536        // Requests gathered before one write
 
 int sock, addrlen, client_fd, valread;
 struct sockaddr_in address;             // Structure for server address
 int num[3] = {0};                       // Array to store operands and operator choice
 char result[100] = {0};                 // Buffer for result received from server
 
+// Header of a batch request
+struct batch_header {
+    uint32_t magic;             // BATCH_MAGIC
+    uint32_t count;             // Operations that follow, at most BATCH_MAX
+};
+
+// Header of a batch reply, followed by count union batch_result
+struct batch_reply {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t eval_ns;           // Time the server spent evaluating
+};
+
+// One result of a batch: the exact product for a multiplication, a double for every other operation
+union batch_result {
+    double value;
+    int64_t product;
+};
+
+// One RPC request; its reply carries the same id
+struct rpc_request {
+    uint64_t id;
+    int32_t lhs;
+    int32_t rhs;
+    uint32_t op;
+    uint32_t pad;
+};
+
+struct rpc_reply {
+    uint64_t id;
+    double result;
+};
+
+// Completion callback: runs on the client's reader thread. lost is 1 (and result NaN) if the connection ended
+// before the reply came
+typedef void (*rpc_callback)(uint64_t id, double result, int lost, void *arg);
+
+struct rpc_slot {
+    uint64_t id;
+    rpc_callback cb;
+    void *arg;
+    int busy;
+};
+
+struct rpc_client {
+    int fd;
+    uint64_t next_id;            // Ids are given out 1, 2, 3... in call order
+    uint32_t mask;               // Window - 1; request id waits in slot id & mask
+    struct rpc_slot *slots;
+    int failed;                  // Connection ended: calls complete at once as lost
+    pthread_mutex_t lock;        // Guards next_id, slots and failed
+    pthread_cond_t freed;        // A slot was freed
+    pthread_mutex_t send_lock;   // Guards out; never held together with lock
+    char out[RPC_OUT_BUF];       // Requests not yet written
+    size_t out_len;
+    pthread_t reader;
+};
+
+// Header of an expression request
+struct expr_header {
+    uint32_t magic;              // EXPR_MAGIC
+    uint32_t expr_len;           // Bytes of expression text that follow
+    uint32_t names_len;          // Bytes of variable names after the expression
+    uint32_t count;              // Rows in each variable's column
+};
+
+// Reply to an expression request, followed by count doubles
+struct expr_reply {
+    uint32_t magic;
+    uint32_t count;              // 0 if the expression was rejected
+    uint64_t plan_hash;          // Cache key of the compiled plan
+    uint32_t cached;             // 1 if the plan was found in the cache and nothing was parsed
+    uint32_t ninsns;             // Instructions in the plan
+    uint64_t compile_ns;         // Time to find or build the plan
+    uint64_t eval_ns;            // Time to evaluate it over all rows
+    char error[64];              // Why the expression was rejected, empty otherwise
+};
+
+// Header of a bignum request
+struct big_header {
+    uint32_t magic;              // BIG_MAGIC
+    uint32_t op;                 // 1: +  2: -  3: *  4: /  5: %
+    uint32_t format;             // BIG_DECIMAL or BIG_BINARY
+    uint32_t lhs_len;            // Bytes of the first operand
+    uint32_t rhs_len;            // Bytes of the second operand, which follows the first
+};
+
+// Reply to a bignum request, followed by len bytes of result
+struct big_reply {
+    uint32_t magic;
+    uint32_t len;
+    uint64_t convert_ns;         // Time spent reading the operands and writing the result
+    uint64_t eval_ns;            // Time spent on the arithmetic
+    char error[64];              // Why no result was computed, empty otherwise
+};
+
+// A result to wait for
+struct rpc_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    double result;
+};
+
+// Function to write several buffers as one message, retrying on partial writes
+int writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n <= 0)
+            return -1;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++, cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to evaluate one operation as the server does for an RPC request, or a batch one other than a product
+double calc_one(int32_t a, uint8_t op, int32_t b) {
+    switch (op) {
+    case 1: return (double)a + b;
+    case 2: return (double)a - b;
+    case 3: return (double)a * b;
+    case 4: return (double)a / b;
+    case 5: return (double)a - trunc((double)a / b) * b;
+    default: return NAN;
+    }
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to send count random operations in batches and check every result
+void PerformBatchTask(uint64_t count, uint32_t per_batch) {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    int32_t *lhs = malloc(per_batch * sizeof(int32_t)), *rhs = malloc(per_batch * sizeof(int32_t));
+    uint8_t *op = malloc(per_batch);
+    union batch_result *res = malloc(per_batch * sizeof(union batch_result));
+    if (lhs == NULL || rhs == NULL || op == NULL || res == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t state = 88172645463325252ull, wrong = 0, done = 0;
+    double wire = 0, server = 0;
+    while (done < count) {
+        uint32_t n = count - done < per_batch ? count - done : per_batch;
+        for (uint32_t i = 0; i < n; i++) {      // xorshift64: operands over the whole int range, opcodes 1..5
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            lhs[i] = (int32_t)state;
+            rhs[i] = (int32_t)(state >> 32);
+            op[i] = 1 + (state >> 20) % 5;
+        }
+        struct batch_header h = {BATCH_MAGIC, n};
+        struct batch_reply r;
+        double start = now_seconds();
+        struct iovec iov[4] = {{&h, sizeof(h)}, {lhs, n * sizeof(int32_t)}, {rhs, n * sizeof(int32_t)}, {op, n}};
+        if (writev_all(sock, iov, 4) < 0 || read_all(sock, &r, sizeof(r)) < 0 || r.magic != BATCH_MAGIC || r.count != n
+            || read_all(sock, res, n * sizeof(union batch_result)) < 0) {
+            perror("Batch failed");
+            exit(EXIT_FAILURE);
+        }
+        wire += now_seconds() - start;
+        server += r.eval_ns / 1e9;
+        for (uint32_t i = 0; i < n; i++) {
+            if (op[i] == 3) {
+                wrong += res[i].product != (int64_t)lhs[i] * rhs[i];
+                continue;
+            }
+            double want = calc_one(lhs[i], op[i], rhs[i]);
+            if (!(want == res[i].value || (isnan(want) && isnan(res[i].value))))
+                wrong++;
+        }
+        done += n;
+    }
+    printf("%llu operations in %.3f s: %.1f M ops/s end to end, %.1f M ops/s evaluated by the server, "
+           "%llu wrong results\n", (unsigned long long)count, wire, count / wire / 1e6, count / server / 1e6,
+           (unsigned long long)wrong);
+    free(lhs);
+    free(rhs);
+    free(op);
+    free(res);
+}
+
+// Function to write the gathered requests; the caller holds send_lock. A failed write shuts the socket down so the
+// reader thread fails what is outstanding
+void rpc_flush_locked(struct rpc_client *c) {
+    struct iovec iov = {c->out, c->out_len};
+    if (c->out_len > 0 && writev_all(c->fd, &iov, 1) < 0)
+        shutdown(c->fd, SHUT_RDWR);
+    c->out_len = 0;
+}
+
+// Function to write the gathered requests now
+void rpc_flush(struct rpc_client *c) {
+    pthread_mutex_lock(&c->send_lock);
+    rpc_flush_locked(c);
+    pthread_mutex_unlock(&c->send_lock);
+}
+
+// Function run by the reader thread: match replies to their slots and complete them
+void *rpc_reader(void *arg) {
+    struct rpc_client *c = arg;
+    struct rpc_reply buf[4096];
+    struct rpc_slot done[4096];                 // Slots of the replies in buf, taken out under the lock
+    double res[4096];
+    size_t have = 0;
+    ssize_t n;
+    while ((n = read(c->fd, (char *)buf + have, sizeof(buf) - have)) > 0) {
+        have += n;
+        size_t cnt = have / sizeof(struct rpc_reply), k = 0;
+        pthread_mutex_lock(&c->lock);
+        for (size_t i = 0; i < cnt; i++) {
+            struct rpc_slot *s = &c->slots[buf[i].id & c->mask];
+            if (!s->busy || s->id != buf[i].id)
+                continue;                       // Not a request of ours
+            res[k] = buf[i].result;
+            done[k++] = *s;
+            s->busy = 0;
+        }
+        pthread_cond_broadcast(&c->freed);
+        pthread_mutex_unlock(&c->lock);
+        for (size_t i = 0; i < k; i++)
+            done[i].cb(done[i].id, res[i], 0, done[i].arg);
+        have -= cnt * sizeof(struct rpc_reply);
+        memmove(buf, (char *)buf + cnt * sizeof(struct rpc_reply), have);
+    }
+    // Connection closed: fail whatever is still outstanding
+    pthread_mutex_lock(&c->lock);
+    c->failed = 1;
+    pthread_cond_broadcast(&c->freed);
+    for (uint32_t i = 0; i <= c->mask; i++) {
+        if (!c->slots[i].busy)
+            continue;
+        struct rpc_slot s = c->slots[i];
+        c->slots[i].busy = 0;
+        pthread_mutex_unlock(&c->lock);
+        s.cb(s.id, NAN, 1, s.arg);
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// Function to connect to the server and start the reader thread; window is rounded up to a power of two
+int rpc_open(struct rpc_client *c, uint32_t window) {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1)
+        return -1;
+    signal(SIGPIPE, SIG_IGN);                   // A dead server shows up as a failed write
+    memset(c, 0, sizeof(*c));
+    c->fd = sock;
+    c->next_id = 1;
+    uint32_t size = 1;
+    while (size < window)
+        size <<= 1;
+    c->mask = size - 1;
+    c->slots = calloc(size, sizeof(struct rpc_slot));
+    if (c->slots == NULL)
+        return -1;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->freed, NULL);
+    pthread_mutex_init(&c->send_lock, NULL);
+    uint32_t magic = RPC_MAGIC;
+    memcpy(c->out, &magic, sizeof(magic));
+    c->out_len = sizeof(magic);
+    return pthread_create(&c->reader, NULL, rpc_reader, c) == 0 ? 0 : -1;
+}
+
+// Function to send lhs op rhs without waiting for the reply. cb(id, result, arg) runs when it arrives. Blocks
+// only while the request's slot still holds one sent a window earlier. Returns the request id
+uint64_t rpc_call(struct rpc_client *c, int32_t lhs, uint8_t op, int32_t rhs, rpc_callback cb, void *arg) {
+    pthread_mutex_lock(&c->lock);
+    uint64_t id = c->next_id++;
+    struct rpc_slot *s = &c->slots[id & c->mask];
+    if (s->busy && !c->failed) {
+        pthread_mutex_unlock(&c->lock);
+        rpc_flush(c);                           // The request it waits for may still be in our buffer
+        pthread_mutex_lock(&c->lock);
+        while (s->busy && !c->failed)
+            pthread_cond_wait(&c->freed, &c->lock);
+    }
+    if (c->failed) {
+        pthread_mutex_unlock(&c->lock);
+        cb(id, NAN, 1, arg);
+        return id;
+    }
+    *s = (struct rpc_slot){id, cb, arg, 1};
+    pthread_mutex_unlock(&c->lock);
+
+    struct rpc_request r = {id, lhs, rhs, op, 0};
+    pthread_mutex_lock(&c->send_lock);
+    if (c->out_len + sizeof(r) > sizeof(c->out))
+        rpc_flush_locked(c);
+    memcpy(c->out + c->out_len, &r, sizeof(r));
+    c->out_len += sizeof(r);
+    pthread_mutex_unlock(&c->send_lock);
+    return id;
+}
+
+void rpc_future_complete(uint64_t id, double result, int lost, void *arg) {
+    struct rpc_future *f = arg;
+    (void)id, (void)lost;
+    pthread_mutex_lock(&f->lock);
+    f->result = result;
+    f->done = 1;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+}
+
+// Function to send lhs op rhs and complete the future f with its result
+uint64_t rpc_call_future(struct rpc_client *c, int32_t lhs, uint8_t op, int32_t rhs, struct rpc_future *f) {
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    f->done = 0;
+    return rpc_call(c, lhs, op, rhs, rpc_future_complete, f);
+}
+
+// Function to wait for a future and return its result (NaN if the connection was lost)
+double rpc_wait(struct rpc_client *c, struct rpc_future *f) {
+    rpc_flush(c);
+    pthread_mutex_lock(&f->lock);
+    while (!f->done)
+        pthread_cond_wait(&f->cond, &f->lock);
+    pthread_mutex_unlock(&f->lock);
+    pthread_mutex_destroy(&f->lock);
+    pthread_cond_destroy(&f->cond);
+    return f->result;
+}
+
+// Function to send what is gathered, wait for every outstanding reply and close the connection
+void rpc_close(struct rpc_client *c) {
+    rpc_flush(c);
+    shutdown(c->fd, SHUT_WR);                   // The server answers everything, then closes its side
+    pthread_join(c->reader, NULL);
+    close(c->fd);
+    free(c->slots);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->freed);
+    pthread_mutex_destroy(&c->send_lock);
+}
+
+// Function to derive the operands of benchmark request id, so its reply can be checked without a table
+void rpc_bench_operands(uint64_t id, int32_t *lhs, uint8_t *op, int32_t *rhs) {
+    uint64_t x = id * 0x9e3779b97f4a7c15ull;
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 29;
+    *lhs = (int32_t)x;
+    *rhs = (int32_t)(x >> 32);
+    *op = 1 + (x >> 7) % 5;
+}
+
+struct rpc_bench {
+    uint64_t done, wrong, reordered, newest;
+};
+
+void rpc_bench_reply(uint64_t id, double result, int lost, void *arg) {
+    struct rpc_bench *b = arg;
+    if (lost)
+        return;
+    int32_t lhs, rhs;
+    uint8_t op;
+    rpc_bench_operands(id, &lhs, &op, &rhs);
+    double want = calc_one(lhs, op, rhs);
+    if (!(want == result || (isnan(want) && isnan(result))))
+        b->wrong++;
+    if (id < b->newest)
+        b->reordered++;
+    else
+        b->newest = id;
+    b->done++;
+}
+
+// Function to send count random requests over one pipelined connection and check every reply
+void PerformRpcTask(uint64_t count, uint32_t window) {
+    struct rpc_client c;
+    struct rpc_bench b = {0, 0, 0, 0};
+    if (rpc_open(&c, window) < 0) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    double start = now_seconds();
+    for (uint64_t id = 1; id <= count; id++) {  // A fresh client numbers its requests 1, 2, 3...
+        int32_t lhs, rhs;
+        uint8_t op;
+        rpc_bench_operands(id, &lhs, &op, &rhs);
+        rpc_call(&c, lhs, op, rhs, rpc_bench_reply, &b);
+    }
+    rpc_close(&c);
+    double took = now_seconds() - start;
+    printf("%llu requests in %.3f s: %.2f M requests/s, %llu wrong, %llu completed out of order, %llu lost\n",
+           (unsigned long long)count, took, count / took / 1e6, (unsigned long long)b.wrong,
+           (unsigned long long)b.reordered, (unsigned long long)(count - b.done));
+}
+
+// Function to send every "first choice second" line of stdin at once and print the results in input order
+void PerformRpcLines() {
+    struct rpc_line {
+        int num[3];
+        struct rpc_future f;
+    } **lines = NULL;
+    size_t n = 0, cap = 0;
+    struct rpc_client c;
+    if (rpc_open(&c, RPC_WINDOW) < 0) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    int a, op, b;
+    while (scanf("%d %d %d", &a, &op, &b) == 3) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            lines = realloc(lines, cap * sizeof(*lines));
+        }
+        if (lines == NULL || (lines[n] = malloc(sizeof(**lines))) == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        lines[n]->num[0] = a, lines[n]->num[1] = op, lines[n]->num[2] = b;
+        rpc_call_future(&c, a, op, b, &lines[n]->f);
+        n++;
+    }
+    const char *sign = "?+-*/%";
+    for (size_t i = 0; i < n; i++) {
+        int *v = lines[i]->num;
+        printf("%d %c %d = %0.2f\n", v[0], v[1] >= 1 && v[1] <= 5 ? sign[v[1]] : '?', v[2], rpc_wait(&c, &lines[i]->f));
+        free(lines[i]);
+    }
+    free(lines);
+    rpc_close(&c);
+}
+
+// Function to evaluate an expression over rows of random variable values, repeats times on one connection
+void PerformExprTask(const char *expr, const char *names, uint32_t rows, int repeats) {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    int nvars = names[0] ? 1 : 0;
+    for (const char *p = names; *p; p++)
+        nvars += *p == ',';
+    double *cols = malloc(((size_t)nvars * rows + 1) * sizeof(double)), *res = malloc(rows * sizeof(double) + 1);
+    if (cols == NULL || res == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < (size_t)nvars * rows; i++) {  // Values in [-10, 10)
+        state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+        cols[i] = (state >> 11) * 0x1p-53 * 20 - 10;
+    }
+    struct expr_header h = {EXPR_MAGIC, strlen(expr), strlen(names), rows};
+    struct expr_reply r;
+    if (repeats < 1)
+        repeats = 1;
+    for (int run = 1; run <= repeats; run++) {
+        struct iovec iov[4] = {{&h, sizeof(h)}, {(void *)expr, h.expr_len}, {(void *)names, h.names_len},
+                               {cols, (size_t)nvars * rows * sizeof(double)}};
+        if (writev_all(sock, iov, 4) < 0 || read_all(sock, &r, sizeof(r)) < 0 || r.magic != EXPR_MAGIC) {
+            perror("Expression request failed");
+            exit(EXIT_FAILURE);
+        }
+        if (r.error[0]) {
+            printf("Error: %.64s\n", r.error);
+            break;
+        }
+        if (r.count != rows || read_all(sock, res, rows * sizeof(double)) < 0) {
+            perror("Expression reply failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("Run %d: plan %016llx (%u instructions) %s in %.1f us, %u rows evaluated in %.3f ms (%.1f M rows/s)\n",
+               run, (unsigned long long)r.plan_hash, r.ninsns, r.cached ? "found in cache" : "compiled",
+               r.compile_ns / 1e3, rows, r.eval_ns / 1e6, r.eval_ns ? rows / (r.eval_ns / 1e3) : 0.0);
+    }
+    for (uint32_t i = 0; i < rows && i < 5 && !r.error[0]; i++) {
+        printf("Row %u:", i);
+        const char *p = names;
+        for (int v = 0; v < nvars; v++) {
+            int len = strcspn(p, ",");
+            printf(" %.*s = %g", len, p, cols[(size_t)v * rows + i]);
+            p += len + (p[len] == ',');
+        }
+        printf("%s result = %g\n", nvars ? "," : "", res[i]);
+    }
+    free(cols);
+    free(res);
+}
+
+// Function to send one expression over rows values of x on the open connection. Returns 0 with the results in
+// res, 1 if the server rejected the expression (its reason in r), -1 if the connection failed
+int expr_request(const char *expr, const char *names, int nvars, uint32_t rows, const double *cols, double *res,
+                 struct expr_reply *r) {
+    struct expr_header h = {EXPR_MAGIC, strlen(expr), strlen(names), rows};
+    struct iovec iov[4] = {{&h, sizeof(h)}, {(void *)expr, h.expr_len}, {(void *)names, h.names_len},
+                           {(void *)cols, (size_t)nvars * rows * sizeof(double)}};
+    if (writev_all(sock, iov, 4) < 0 || read_all(sock, r, sizeof(*r)) < 0 || r->magic != EXPR_MAGIC)
+        return -1;
+    if (r->error[0])
+        return 1;
+    return r->count == rows && read_all(sock, res, rows * sizeof(double)) == 0 ? 0 : -1;
+}
+
+// Function to check the server's expression compiler on expressions that are long or must be refused: many
+// distinct literals (each once needed a register of its own), too many variables and a hexadecimal literal
+void PerformExprCheck() {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    enum { ROWS = 1000, TERMS = 300 };
+    static double x[17 * ROWS], res[ROWS], want[ROWS];
+    static char expr[16 * TERMS];
+    struct expr_reply r;
+    int checks = 0, failed = 0;
+    for (int i = 0; i < 17 * ROWS; i++)
+        x[i] = i % ROWS - ROWS / 2 + 0.25;
+    for (int kind = 0; kind < 3; kind++) {
+        // x+0+1+...+299, x*0+x*1+...+x*199 and (x+0)+(x+1)+...+(x+69): 300, 200 and 70 distinct literals
+        int terms = kind == 0 ? TERMS : kind == 1 ? 200 : 70;
+        size_t len = kind == 0 ? snprintf(expr, sizeof(expr), "x") : 0;
+        for (int k = 0; k < terms; k++)
+            if (kind == 0)
+                len += snprintf(expr + len, sizeof(expr) - len, "+%d", k);
+            else
+                len += snprintf(expr + len, sizeof(expr) - len, kind == 1 ? "%sx*%d" : "%s(x+%d)", k ? "+" : "", k);
+        for (int i = 0; i < ROWS; i++) {        // The same operations in the same order give the same doubles
+            double v = kind == 0 ? x[i] : 0;
+            for (int k = 0; k < terms; k++) {
+                double t = kind == 0 ? k : kind == 1 ? x[i] * k : x[i] + k;
+                v = kind != 0 && k == 0 ? t : v + t;
+            }
+            want[i] = v;
+        }
+        int rc = expr_request(expr, "x", 1, ROWS, x, res, &r);
+        if (rc < 0) {
+            perror("Expression request failed");
+            exit(EXIT_FAILURE);
+        }
+        int wrong = rc != 0;
+        for (int i = 0; rc == 0 && i < ROWS; i++)
+            wrong += res[i] != want[i];
+        printf("%d literals: %s\n", terms, rc ? r.error : wrong ? "wrong results" : "ok");
+        checks++, failed += wrong != 0;
+    }
+    const char *refused[][2] = {{"a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q", "a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q"},
+                                {"x+0x10", "x"}};
+    for (int k = 0; k < 2; k++) {
+        int nvars = k == 0 ? 17 : 1;
+        int rc = expr_request(refused[k][0], refused[k][1], nvars, ROWS, x, res, &r);
+        if (rc < 0) {
+            perror("Expression request failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("%s: %s\n", refused[k][0], rc ? r.error : "accepted");
+        checks++, failed += rc != 1;
+    }
+    printf("%d checks, %d failed\n", checks, failed);
+    close(sock);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// Function to send one bignum request and wait for the reply; returns the result (malloc'd) or NULL on an error
+char *big_request(uint32_t op, uint32_t format, const char *lhs, size_t lhs_len, const char *rhs, size_t rhs_len,
+                  struct big_reply *r) {
+    struct big_header h = {BIG_MAGIC, op, format, lhs_len, rhs_len};
+    struct iovec iov[3] = {{&h, sizeof(h)}, {(void *)lhs, lhs_len}, {(void *)rhs, rhs_len}};
+    if (writev_all(sock, iov, 3) < 0 || read_all(sock, r, sizeof(*r)) < 0 || r->magic != BIG_MAGIC) {
+        perror("Bignum request failed");
+        exit(EXIT_FAILURE);
+    }
+    char *out = malloc(r->len + 1);
+    if (out == NULL || read_all(sock, out, r->len) < 0) {
+        perror("Bignum reply failed");
+        exit(EXIT_FAILURE);
+    }
+    out[r->len] = '\0';
+    if (r->error[0]) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Function to turn [-]0x<hex digits> into the binary form; returns its length, or 0 if it is not hexadecimal
+size_t big_hex_to_binary(const char *s, char *out) {
+    int neg = *s == '-';
+    s += neg + 2;
+    size_t digits = strlen(s), n = 1;
+    out[0] = neg;
+    for (size_t i = 0; i < digits; i++) {                   // From the last digit, two per byte
+        char c = s[digits - 1 - i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+              : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (v < 0)
+            return 0;
+        if (i % 2 == 0)
+            out[n++] = v;
+        else
+            out[n - 1] |= v << 4;
+    }
+    return digits > 0 ? n : 0;
+}
+
+// Function to compute one exact operation on operands typed as decimal or 0x hexadecimal
+void PerformBigTask(const char *lhs, int op, const char *rhs) {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    int hex = strncmp(lhs + (*lhs == '-'), "0x", 2) == 0;
+    if (hex != (strncmp(rhs + (*rhs == '-'), "0x", 2) == 0)) {
+        printf("Give both operands in decimal or both in 0x hexadecimal\n");
+        return;
+    }
+    struct big_reply r;
+    char *out;
+    if (hex) {
+        char *a = malloc(strlen(lhs) / 2 + 2), *b = malloc(strlen(rhs) / 2 + 2);
+        size_t alen = a ? big_hex_to_binary(lhs, a) : 0, blen = b ? big_hex_to_binary(rhs, b) : 0;
+        if (alen == 0 || blen == 0) {
+            printf("Not a hexadecimal number\n");
+            return;
+        }
+        out = big_request(op, BIG_BINARY, a, alen, b, blen, &r);
+        free(a);
+        free(b);
+    } else
+        out = big_request(op, BIG_DECIMAL, lhs, strlen(lhs), rhs, strlen(rhs), &r);
+    if (out == NULL) {
+        printf("Error: %.64s\n", r.error);
+        return;
+    }
+    printf("The result of the operation is: ");
+    if (hex) {                                              // Sign byte, then bytes from the most significant
+        size_t i = r.len - 1;
+        printf("%s0x", out[0] ? "-" : "");
+        if (i == 0)
+            printf("0");
+        else
+            printf("%x", (unsigned char)out[i--]);
+        for (; i > 0; i--)
+            printf("%02x", (unsigned char)out[i]);
+        printf("\n");
+    } else
+        printf("%s\n", out);
+    printf("(computed in %.1f us, converted in %.1f us)\n", r.eval_ns / 1e3, r.convert_ns / 1e3);
+    free(out);
+}
+
+// Function to time every operation on random decimal operands with the given number of digits
+void PerformBigBench(size_t digits, int repeats) {
+    if (connect(sock, (struct sockaddr *)&address, addrlen) == -1) {
+        perror("\nCLIENT ERROR");
+        exit(EXIT_FAILURE);
+    }
+    char *a = malloc(digits + 1), *b = malloc(digits + 1);
+    if (a == NULL || b == NULL || digits == 0) {
+        printf("Need a number of digits\n");
+        return;
+    }
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < digits; i++) {
+        state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+        a[i] = '0' + (state >> 20) % 10;
+        b[i] = '0' + (state >> 40) % 10;
+    }
+    a[0] = b[0] = '7';                                      // Full length
+    const char *name[] = {"", "+", "-", "*", "/", "%"};
+    for (int op = 1; op <= 5; op++) {
+        size_t blen = op >= 4 ? (digits + 1) / 2 : digits;  // Divide by a number of half the length
+        uint64_t eval = 0, convert = 0;
+        size_t len = 0;
+        for (int k = 0; k < repeats; k++) {
+            struct big_reply r;
+            char *out = big_request(op, BIG_DECIMAL, a, digits, b, blen, &r);
+            if (out == NULL) {
+                printf("Error: %.64s\n", r.error);
+                return;
+            }
+            eval += r.eval_ns;
+            convert += r.convert_ns;
+            len = r.len;
+            free(out);
+        }
+        printf("%zu digits %s %zu digits: %.1f us computing, %.1f us converting, %zu digits of result\n", digits,
+               name[op], blen, eval / 1e3 / repeats, convert / 1e3 / repeats, len);
+    }
+    free(a);
+    free(b);
+}
+
 // Function to create and configure the client socket
 void CreateClientSocket() {
     sock = socket(AF_INET, SOCK_STREAM, 0);           // Create a TCP socket
@@ -66,8 +844,52 @@ void PerformClientTask() {
     printf("%s\n", result);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     CreateClientSocket();  // Create and configure client socket
+    if (argc > 2 && strcmp(argv[1], "batch") == 0) {
+        unsigned long per_batch = argc > 3 ? strtoul(argv[3], NULL, 10) : 1u << 20;
+        if (per_batch == 0 || per_batch > BATCH_MAX) {
+            printf("Batches hold 1..%u operations\n", BATCH_MAX);
+            return 1;
+        }
+        PerformBatchTask(strtoull(argv[2], NULL, 10), per_batch);
+        close(sock);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "rpc") == 0) {
+        unsigned long window = argc > 3 ? strtoul(argv[3], NULL, 10) : RPC_WINDOW;
+        if (window == 0 || window > RPC_WINDOW_MAX) {
+            printf("The window holds 1..%u requests\n", RPC_WINDOW_MAX);
+            return 1;
+        }
+        if (argc > 2)
+            PerformRpcTask(strtoull(argv[2], NULL, 10), window);
+        else
+            PerformRpcLines();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "expr-check") == 0)
+        PerformExprCheck();
+    if (argc > 2 && strcmp(argv[1], "expr") == 0) {
+        unsigned long rows = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+        if (rows > BATCH_MAX) {
+            printf("At most %u rows\n", BATCH_MAX);
+            return 1;
+        }
+        PerformExprTask(argv[2], argc > 3 ? argv[3] : "", rows, argc > 5 ? atoi(argv[5]) : 1);
+        close(sock);
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[1], "big") == 0) {
+        PerformBigTask(argv[2], atoi(argv[3]), argv[4]);
+        close(sock);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "big-bench") == 0) {
+        PerformBigBench(strtoul(argv[2], NULL, 10), argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 10);
+        close(sock);
+        return 0;
+    }
     PerformClientTask();   // Perform client task (send data and receive result)
     close(client_fd);      // Close the connection
     return 0;              // Exit program
@@ -77,18 +899,94 @@ server.c
 - This program creates a TCP server that listens on IP 127.0.0.1 and port 10202.
 - For each connected client, it forks a child process to handle the client's calculation request.
 - The server receives operands and operator choice, performs the calculation, and sends the result back to the client.
+- A connection whose first word is BATCH_MAGIC carries batch requests instead, one after another until the client
+  closes it (see client.c for the format). A single request whose first operand equals BATCH_MAGIC (1112293699)
+  would be taken for a batch.
+- Batches are evaluated 8 operations per step with AVX2. The operands are widened to double, each operator that
+  occurs among the 8 is applied to all of them, and its results are blended in where the opcode matches, so a
+  step where all 8 share an operator costs one vector operation. Doubles hold every int sum, difference,
+  quotient and remainder exactly. Products are not widened: _mm256_mul_epi32 multiplies the sign-extended ints
+  into exact int64s, blended in like the rest. Modulus is a - trunc(a / b) * b. CPUs without AVX2 use a scalar
+  loop that gives the same results.
+- A connection whose first word is RPC_MAGIC (1380729155) carries pipelined RPC requests. The connection's
+  process reads requests in large chunks and queues each chunk as one job. RPC_WORKERS threads take jobs and
+  evaluate them, and replies join one output buffer as each job finishes, so they leave in completion order,
+  not arrival order. A writer thread sends whatever has gathered in one write. The reader stops reading while
+  RPC_BACKLOG requests are queued or unsent, so a client that stops reading replies cannot exhaust memory.
+- A connection whose first word is EXPR_MAGIC (1162625347) carries expression requests. An expression is parsed
+  once by recursive descent into a plan: up to EXPR_MAX_INSNS six-byte register instructions {op, dst, a, b}.
+  Variables are registers 0..n-1 and temporaries are reused in stack order, so a plan stays small. Constants
+  (constant subexpressions are folded) go to a pool of their own, up to EXPR_MAX_CONSTS, shared by equal ones;
+  a flag in op marks an operand that names a constant, so literals never compete for the registers.
+  Plans live in a cache shared by all connection processes, keyed by a hash of the expression and the variable
+  names. The full key is compared on a hit, so another expression with the same hash cannot be mistaken for it.
+  A repeated expression is looked up and never parsed again.
+- A plan runs over EXPR_BLOCK rows at a time. Each instruction processes a whole block before the next starts,
+  so the interpreter's cost is spread over the block and every register stays in cache. Arithmetic, min, max,
+  sqrt, abs and negation use AVX2 loops. The other functions, and CPUs without AVX2, use libm one value at a
+  time.
+- A connection whose first word is BIG_MAGIC (1313620291) carries bignum requests: exact integer arithmetic on
+  operands of any length, instead of the float the single request computes with. Numbers are arrays of 64-bit
+  limbs, least significant first. Multiplication is schoolbook below BIG_KARATSUBA limbs, Karatsuba below
+  BIG_TOOM3 and Toom-3 above that. The thresholds were tuned on an AVX2 Xeon. A much longer operand is cut into
+  slices the size of the shorter one. Division by one limb multiplies by a precomputed inverse instead of using
+  the hardware divide. Divisors below BIG_DIV_NEWTON limbs are divided the schoolbook way, one quotient limb per
+  step estimated with that same inverse. Longer divisors are normalized, Newton's iteration builds their
+  reciprocal at doubling precision, and the quotient taken from it is corrected by the few units it can be off.
+  The reciprocal is as long as the quotient, so below the threshold schoolbook wins: a 262000-digit number over a
+  50-digit one takes 0.4 ms instead of 43 ms. Decimal conversion splits long numbers at powers 10^(19 * 2^i):
+  parsing multiplies the high half by the power and adds the low half, and printing divides by it, reusing one
+  reciprocal per power. The powers and reciprocals are kept for the life of the connection's process, so only its
+  first number of a size pays for them. Parsing then costs about one multiplication of the number's length and
+  printing two or three (a division is two), instead of growing with the square of the length. That is still well
+  above the multiplication itself: a product is twice as long as its operands and both are converted, so a
+  decimal multiply of two 100000-digit numbers spends about 12 times as long converting as multiplying. The
+  binary format skips conversion.
+- Build: gcc server.c -o server -lm -pthread
 */
 
 #include <stdio.h>      // Standard I/O library
 #include <string.h>     // String manipulation functions
 #include <stdlib.h>     // Standard library functions
+#include <stdint.h>     // Fixed-width integer types
+#include <stddef.h>     // offsetof
+#include <math.h>       // NAN, trunc
+#include <time.h>       // clock_gettime
+#include <immintrin.h>  // AVX2 intrinsics
+#include <pthread.h>    // RPC worker pool
+#include <errno.h>      // EOWNERDEAD
+#include <sys/mman.h>   // Shared mapping of the plan cache
 #include <sys/types.h>  // Data types used in system calls
 #include <sys/socket.h> // Socket API
+#include <sys/uio.h>    // writev
 #include <netinet/in.h> // Structures for internet addresses
 #include <unistd.h>     // POSIX API for UNIX system calls
 #include <arpa/inet.h>  // Definitions for internet operations
 
 #define PORTNO 10202    // Port number for server connection
+#define BATCH_MAGIC 0x424c4143u  // "CALB": starts a batch request
+#define BATCH_MAX (1u << 24)     // Most operations in one batch
+#define RPC_MAGIC 0x524c4143u    // "CALR": starts a pipelined RPC connection
+#define RPC_WORKERS 4            // Worker threads per RPC connection
+#define RPC_BACKLOG 65536        // Requests queued or unsent before the reader pauses
+#define EXPR_MAGIC 0x454c4143u   // "CALE": starts an expression connection
+#define EXPR_TEXT_MAX 65536      // Longest expression accepted
+#define EXPR_NAMES_MAX 1024      // Longest variable name list accepted
+#define EXPR_MAX_VARS 16         // Most variables in one expression
+#define EXPR_MAX_REGS 64         // Registers of a plan: variables and temporaries
+#define EXPR_MAX_CONSTS 512      // Distinct constants of a plan
+#define EXPR_MAX_INSNS 1024      // Instructions of a plan
+#define EXPR_KEY_MAX 1024        // Longest expression and names that can be cached
+#define EXPR_CACHE 512           // Plans in the cache (a power of two)
+#define EXPR_BLOCK 512           // Rows evaluated per pass over the plan
+#define BIG_MAGIC 0x4e4c4143u    // "CALN": starts a bignum connection
+#define BIG_MAX_LEN (1u << 18)   // Longest operand accepted, in bytes
+#define BIG_DECIMAL 0            // Operands and result as decimal text
+#define BIG_BINARY 1             // Operands and result as a sign byte and little-endian magnitude bytes
+#define BIG_KARATSUBA 24         // Limbs from which multiplication uses Karatsuba
+#define BIG_TOOM3 96             // Limbs from which it uses Toom-3
+#define BIG_DIV_NEWTON 2048      // Divisor limbs from which division uses a Newton reciprocal
+#define BIG_DC_CONVERT 64        // Limbs from which decimal conversion splits the number in halves
 
 int server_fd, new_socket, addrlen, valread;
 struct sockaddr_in address;             // Structure for server address
@@ -96,6 +994,1628 @@ int num[3] = {0};                       // Array to store operands and operator
 float result = 0;                       // Variable to store calculation result
 char msg[100];                          // Message buffer to send the result to client
 
+struct batch_header {
+    uint32_t magic;
+    uint32_t count;
+};
+
+struct batch_reply {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t eval_ns;
+};
+
+union batch_result {
+    double value;
+    int64_t product;            // Multiplication: int products need up to 63 bits, more than a double holds
+};
+
+struct rpc_request {
+    uint64_t id;
+    int32_t lhs;
+    int32_t rhs;
+    uint32_t op;
+    uint32_t pad;
+};
+
+struct rpc_reply {
+    uint64_t id;
+    double result;
+};
+
+struct expr_header {
+    uint32_t magic;
+    uint32_t expr_len;
+    uint32_t names_len;
+    uint32_t count;
+};
+
+struct expr_reply {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t plan_hash;
+    uint32_t cached;
+    uint32_t ninsns;
+    uint64_t compile_ns;
+    uint64_t eval_ns;
+    char error[64];
+};
+
+struct big_header {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t format;
+    uint32_t lhs_len;
+    uint32_t rhs_len;
+};
+
+struct big_reply {
+    uint32_t magic;
+    uint32_t len;
+    uint64_t convert_ns;
+    uint64_t eval_ns;
+    char error[64];
+};
+
+// An arbitrary-precision integer
+struct big {
+    uint64_t *d;                 // Limbs, least significant first
+    size_t n;                    // Limbs in use, without leading zero limbs: zero has none
+    size_t cap;
+    int neg;
+};
+
+// A divisor shifted so its top bit is set, with a reciprocal of p fractional limbs (see big_divisor_init)
+struct big_divisor {
+    struct big bn, x;
+    int s;
+    size_t p;
+};
+
+// Operations of a plan; the binary ones come first
+enum { EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MOD, EXPR_POW, EXPR_MIN, EXPR_MAX,
+       EXPR_NEG, EXPR_SQRT, EXPR_ABS, EXPR_EXP, EXPR_LOG, EXPR_SIN, EXPR_COS };
+
+#define EXPR_CONST_A 0x40        // Flags in expr_insn.op: the operand is an index into consts, not a register
+#define EXPR_CONST_B 0x80
+#define EXPR_OP 0x3f
+
+// One instruction: dst = a op b (b repeats a for unary operations)
+struct expr_insn {
+    uint8_t op, dst;
+    uint16_t a, b;
+};
+
+// A compiled expression. It holds no pointers, so it can be copied in and out of the shared cache
+struct expr_plan {
+    uint64_t hash;               // Of key; 0 marks an empty cache slot
+    uint32_t key_len;
+    char key[EXPR_KEY_MAX];      // Expression, NUL, variable names
+    uint8_t nvars, result_const; // result_const: the expression is the constant consts[result]
+    uint16_t result;             // Register holding the value of the expression
+    uint16_t ninsns, nconsts;
+    double consts[EXPR_MAX_CONSTS];
+    struct expr_insn insn[EXPR_MAX_INSNS];
+};
+
+// Plans shared by every connection process
+struct expr_cache {
+    pthread_mutex_t lock;        // Process-shared and robust: a child that dies holding it does not wedge the rest
+    uint64_t hits, misses;
+    struct expr_plan slot[EXPR_CACHE];
+};
+
+struct expr_cache *plan_cache;   // NULL if the shared mapping failed: every expression is then compiled
+
+// Requests that arrived in one read
+struct rpc_job {
+    struct rpc_job *next;
+    uint32_t n;
+    struct rpc_request req[];
+};
+
+// State shared by the reader, the workers and the writer of one RPC connection
+struct rpc_conn {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t work;         // A job was queued or the input ended
+    pthread_cond_t replies;      // Replies gathered or a worker finished
+    pthread_cond_t space;        // The backlog went down
+    struct rpc_job *head, *tail;
+    int eof;                     // No more jobs will be queued
+    int workers;                 // Workers still running
+    size_t backlog;              // Requests queued, being evaluated or waiting to be sent
+    struct rpc_reply *out;       // Replies waiting for the writer
+    size_t out_len, out_cap;
+};
+
+// Function to write several buffers as one message, retrying on partial writes
+int writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n <= 0)
+            return -1;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++, cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read and discard len bytes; 0, or -1 if the connection ended first
+int skip_all(int fd, uint64_t len) {
+    char buf[65536];
+    while (len > 0) {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if (read_all(fd, buf, n) < 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to evaluate one operation as a double (RPC requests, and batch ones other than products)
+double calc_one(int32_t a, uint8_t op, int32_t b) {
+    switch (op) {
+    case 1: return (double)a + b;
+    case 2: return (double)a - b;
+    case 3: return (double)a * b;
+    case 4: return (double)a / b;
+    case 5: return (double)a - trunc((double)a / b) * b;
+    default: return NAN;
+    }
+}
+
+void calc_batch_scalar(const int32_t *lhs, const int32_t *rhs, const uint8_t *op, union batch_result *out,
+                       uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        if (op[i] == 3)
+            out[i].product = (int64_t)lhs[i] * rhs[i];
+        else
+            out[i].value = calc_one(lhs[i], op[i], rhs[i]);
+    }
+}
+
+// Function to apply operator k (any but multiplication) to four operand pairs
+__attribute__((target("avx2")))
+static inline __m256d calc_apply(int k, __m256d a, __m256d b) {
+    switch (k) {
+    case 1: return _mm256_add_pd(a, b);
+    case 2: return _mm256_sub_pd(a, b);
+    case 4: return _mm256_div_pd(a, b);
+    default: {
+        __m256d q = _mm256_round_pd(_mm256_div_pd(a, b), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        return _mm256_sub_pd(a, _mm256_mul_pd(q, b));   // b == 0 makes q infinite or NaN, and the result NaN
+    }
+    }
+}
+
+// Function to multiply four int pairs exactly; the int64 products travel as the bits of a double lane
+__attribute__((target("avx2")))
+static inline __m256d calc_product(__m128i a, __m128i b) {
+    return _mm256_castsi256_pd(_mm256_mul_epi32(_mm256_cvtepi32_epi64(a), _mm256_cvtepi32_epi64(b)));
+}
+
+// Function to evaluate a batch 8 operations per step
+__attribute__((target("avx2")))
+void calc_batch_avx2(const int32_t *lhs, const int32_t *rhs, const uint8_t *op, union batch_result *out,
+                     uint32_t n) {
+    const __m256d nan = _mm256_set1_pd(NAN);
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(lhs + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(rhs + i));
+        __m256i o = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(op + i)));
+        __m256d alo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(a));
+        __m256d ahi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1));
+        __m256d blo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(b));
+        __m256d bhi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1));
+        __m256d rlo = nan, rhi = nan;
+        for (int k = 1; k <= 5; k++) {
+            __m256i m = _mm256_cmpeq_epi32(o, _mm256_set1_epi32(k));
+            int bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+            if (bits == 0)
+                continue;
+            __m256d xlo, xhi;
+            if (k == 3) {
+                xlo = calc_product(_mm256_castsi256_si128(a), _mm256_castsi256_si128(b));
+                xhi = calc_product(_mm256_extracti128_si256(a, 1), _mm256_extracti128_si256(b, 1));
+            } else {
+                xlo = calc_apply(k, alo, blo);
+                xhi = calc_apply(k, ahi, bhi);
+            }
+            if (bits == 0xff) {                 // One operator for all 8
+                rlo = xlo;
+                rhi = xhi;
+                break;
+            }
+            rlo = _mm256_blendv_pd(rlo, xlo, _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(m))));
+            rhi = _mm256_blendv_pd(rhi, xhi,
+                                   _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(m, 1))));
+        }
+        _mm256_storeu_pd(&out[i].value, rlo);
+        _mm256_storeu_pd(&out[i + 4].value, rhi);
+    }
+    calc_batch_scalar(lhs + i, rhs + i, op + i, out + i, n - i);
+}
+
+// Function to evaluate a batch with the widest kernel this CPU supports
+void calc_batch(const int32_t *lhs, const int32_t *rhs, const uint8_t *op, union batch_result *out, uint32_t n) {
+    static void (*kernel)(const int32_t *, const int32_t *, const uint8_t *, union batch_result *, uint32_t) = NULL;
+    if (kernel == NULL) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? calc_batch_avx2 : calc_batch_scalar;
+    }
+    kernel(lhs, rhs, op, out, n);
+}
+
+// Function to answer batch requests on one connection until the client closes it. The first magic was already read
+void ServeBatches(int fd) {
+    int32_t *lhs = NULL, *rhs = NULL;
+    uint8_t *op = NULL;
+    union batch_result *res = NULL;
+    uint32_t cap = 0, count;
+    uint64_t total = 0;
+    while (read_all(fd, &count, sizeof(count)) == 0 && count <= BATCH_MAX) {
+        if (count > cap) {
+            free(lhs), free(rhs), free(op), free(res);
+            cap = count;
+            lhs = malloc(cap * sizeof(int32_t));
+            rhs = malloc(cap * sizeof(int32_t));
+            op = malloc(cap);
+            res = malloc(cap * sizeof(union batch_result));
+            if (lhs == NULL || rhs == NULL || op == NULL || res == NULL) {
+                perror("malloc");
+                break;
+            }
+        }
+        if (read_all(fd, lhs, count * sizeof(int32_t)) < 0 || read_all(fd, rhs, count * sizeof(int32_t)) < 0
+            || read_all(fd, op, count) < 0)
+            break;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        calc_batch(lhs, rhs, op, res, count);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        struct batch_reply r = {BATCH_MAGIC, count,
+                                (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000u + t1.tv_nsec - t0.tv_nsec};
+        struct iovec iov[2] = {{&r, sizeof(r)}, {res, count * sizeof(union batch_result)}};
+        if (writev_all(fd, iov, 2) < 0)
+            break;
+        total += count;
+        uint32_t magic;
+        if (read_all(fd, &magic, sizeof(magic)) < 0 || magic != BATCH_MAGIC)
+            break;
+    }
+    printf("\nBatch client done: %llu operations evaluated.\n", (unsigned long long)total);
+    free(lhs), free(rhs), free(op), free(res);
+}
+
+// Function run by each worker: evaluate queued jobs and hand their replies to the writer
+void *rpc_worker(void *arg) {
+    struct rpc_conn *c = arg;
+    pthread_mutex_lock(&c->lock);
+    while (1) {
+        while (c->head == NULL && !c->eof)
+            pthread_cond_wait(&c->work, &c->lock);
+        struct rpc_job *job = c->head;
+        if (job == NULL)
+            break;
+        c->head = job->next;
+        if (c->head == NULL)
+            c->tail = NULL;
+        pthread_mutex_unlock(&c->lock);
+
+        struct rpc_reply *r = malloc(job->n * sizeof(struct rpc_reply));
+        for (uint32_t i = 0; r != NULL && i < job->n; i++) {
+            struct rpc_request *q = &job->req[i];
+            r[i].id = q->id;
+            r[i].result = calc_one(q->lhs, q->op <= 0xff ? q->op : 0, q->rhs);
+        }
+
+        pthread_mutex_lock(&c->lock);
+        if (r != NULL && c->out_len + job->n > c->out_cap) {
+            size_t cap = c->out_cap ? c->out_cap : 4096;
+            while (cap < c->out_len + job->n)
+                cap *= 2;
+            struct rpc_reply *grown = realloc(c->out, cap * sizeof(struct rpc_reply));
+            if (grown == NULL) {
+                free(r);
+                r = NULL;
+            } else {
+                c->out = grown;
+                c->out_cap = cap;
+            }
+        }
+        if (r != NULL) {
+            memcpy(c->out + c->out_len, r, job->n * sizeof(struct rpc_reply));
+            c->out_len += job->n;
+            pthread_cond_signal(&c->replies);
+        } else {                                // Out of memory: the client sees these as lost
+            perror("malloc");
+            c->backlog -= job->n;
+            pthread_cond_signal(&c->space);
+        }
+        free(r);
+        free(job);
+    }
+    c->workers--;
+    pthread_cond_signal(&c->replies);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// Function run by the writer: send the gathered replies until every worker has finished
+void *rpc_writer(void *arg) {
+    struct rpc_conn *c = arg;
+    struct rpc_reply *buf = NULL;
+    size_t cap = 0, n;
+    int ok = 1;
+    pthread_mutex_lock(&c->lock);
+    while (1) {
+        while (c->out_len == 0 && c->workers > 0)
+            pthread_cond_wait(&c->replies, &c->lock);
+        if (c->out_len == 0)
+            break;
+        struct rpc_reply *t = buf;              // Take the gathered replies, leave an empty buffer
+        buf = c->out;
+        c->out = t;
+        n = c->out_len;
+        c->out_len = 0;
+        size_t tc = cap;
+        cap = c->out_cap;
+        c->out_cap = tc;
+        pthread_mutex_unlock(&c->lock);
+        struct iovec iov = {buf, n * sizeof(struct rpc_reply)};
+        if (ok && writev_all(c->fd, &iov, 1) < 0) {
+            ok = 0;                             // Client gone: stop its reader too, keep draining
+            shutdown(c->fd, SHUT_RDWR);
+        }
+        pthread_mutex_lock(&c->lock);
+        c->backlog -= n;
+        pthread_cond_signal(&c->space);
+    }
+    pthread_mutex_unlock(&c->lock);
+    free(buf);
+    return NULL;
+}
+
+// Function to serve pipelined RPC requests on one connection until the client closes it. The magic was already read
+void ServeRpc(int fd) {
+    struct rpc_conn c = {.fd = fd, .workers = RPC_WORKERS};
+    pthread_t workers[RPC_WORKERS], writer;
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.work, NULL);
+    pthread_cond_init(&c.replies, NULL);
+    pthread_cond_init(&c.space, NULL);
+    for (int i = 0; i < RPC_WORKERS; i++)
+        pthread_create(&workers[i], NULL, rpc_worker, &c);
+    pthread_create(&writer, NULL, rpc_writer, &c);
+
+    static char buf[RPC_BACKLOG / 16 * sizeof(struct rpc_request)];
+    size_t have = 0;
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf + have, sizeof(buf) - have)) > 0) {
+        have += n;
+        uint32_t cnt = have / sizeof(struct rpc_request);
+        if (cnt == 0)
+            continue;
+        struct rpc_job *job = malloc(sizeof(*job) + cnt * sizeof(struct rpc_request));
+        if (job == NULL) {
+            perror("malloc");
+            break;
+        }
+        job->next = NULL;
+        job->n = cnt;
+        memcpy(job->req, buf, cnt * sizeof(struct rpc_request));
+        have -= cnt * sizeof(struct rpc_request);
+        memmove(buf, buf + cnt * sizeof(struct rpc_request), have);
+
+        pthread_mutex_lock(&c.lock);
+        while (c.backlog >= RPC_BACKLOG)
+            pthread_cond_wait(&c.space, &c.lock);
+        if (c.tail)
+            c.tail->next = job;
+        else
+            c.head = job;
+        c.tail = job;
+        c.backlog += cnt;
+        pthread_cond_signal(&c.work);
+        pthread_mutex_unlock(&c.lock);
+        total += cnt;
+    }
+
+    pthread_mutex_lock(&c.lock);
+    c.eof = 1;
+    pthread_cond_broadcast(&c.work);
+    pthread_mutex_unlock(&c.lock);
+    for (int i = 0; i < RPC_WORKERS; i++)
+        pthread_join(workers[i], NULL);
+    pthread_join(writer, NULL);
+    printf("\nRPC client done: %llu requests answered.\n", (unsigned long long)total);
+    free(c.out);
+    pthread_mutex_destroy(&c.lock);
+    pthread_cond_destroy(&c.work);
+    pthread_cond_destroy(&c.replies);
+    pthread_cond_destroy(&c.space);
+}
+
+// Function to apply one operation to one value or pair (for constant folding and the scalar kernel)
+double expr_scalar(int op, double x, double y) {
+    switch (op) {
+    case EXPR_ADD: return x + y;
+    case EXPR_SUB: return x - y;
+    case EXPR_MUL: return x * y;
+    case EXPR_DIV: return x / y;
+    case EXPR_MOD: return fmod(x, y);
+    case EXPR_POW: return pow(x, y);
+    case EXPR_MIN: return x < y ? x : y;
+    case EXPR_MAX: return x > y ? x : y;
+    case EXPR_NEG: return -x;
+    case EXPR_SQRT: return sqrt(x);
+    case EXPR_ABS: return fabs(x);
+    case EXPR_EXP: return exp(x);
+    case EXPR_LOG: return log(x);
+    case EXPR_SIN: return sin(x);
+    default: return cos(x);
+    }
+}
+
+void expr_apply_scalar(int op, double *dst, const double *a, const double *b, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        dst[i] = expr_scalar(op, a[i], b[i]);
+}
+
+// Function to apply one operation to n values, 4 per step where AVX2 has the operation
+__attribute__((target("avx2")))
+void expr_apply_avx2(int op, double *dst, const double *a, const double *b, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    if (op <= EXPR_DIV || (op >= EXPR_MIN && op <= EXPR_ABS)) {
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i), r;
+            switch (op) {
+            case EXPR_ADD: r = _mm256_add_pd(x, y); break;
+            case EXPR_SUB: r = _mm256_sub_pd(x, y); break;
+            case EXPR_MUL: r = _mm256_mul_pd(x, y); break;
+            case EXPR_DIV: r = _mm256_div_pd(x, y); break;
+            case EXPR_MIN: r = _mm256_min_pd(x, y); break;
+            case EXPR_MAX: r = _mm256_max_pd(x, y); break;
+            case EXPR_NEG: r = _mm256_xor_pd(x, sign); break;
+            case EXPR_SQRT: r = _mm256_sqrt_pd(x); break;
+            default: r = _mm256_andnot_pd(sign, x); break;
+            }
+            _mm256_storeu_pd(dst + i, r);
+        }
+    }
+    expr_apply_scalar(op, dst + i, a + i, b + i, n - i);
+}
+
+// Function to fill n values with the constant x
+static inline void expr_broadcast(double *dst, double x, uint32_t n) {
+    for (uint32_t k = 0; k < n; k++)
+        dst[k] = x;
+}
+
+// Function to run a plan over count rows. Variable v's column starts at cols + v * count. Folding leaves at most
+// one constant operand per instruction; it is broadcast over the block just before the instruction runs
+void expr_run(const struct expr_plan *plan, const double *cols, uint32_t count, double *out) {
+    static void (*kernel)(int, double *, const double *, const double *, size_t) = NULL;
+    static double regs[EXPR_MAX_REGS][EXPR_BLOCK], konst[EXPR_BLOCK];
+    const double *src[EXPR_MAX_REGS];
+    if (kernel == NULL) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? expr_apply_avx2 : expr_apply_scalar;
+    }
+    for (int r = 0; r < EXPR_MAX_REGS; r++)
+        src[r] = regs[r];
+    for (uint32_t base = 0; base < count; base += EXPR_BLOCK) {
+        uint32_t n = count - base < EXPR_BLOCK ? count - base : EXPR_BLOCK;
+        for (int v = 0; v < plan->nvars; v++)
+            src[v] = cols + (size_t)v * count + base;
+        for (int k = 0; k < plan->ninsns; k++) {
+            const struct expr_insn *in = &plan->insn[k];
+            const double *a = src[in->a], *b = src[in->b];
+            if (in->op & EXPR_CONST_A)
+                expr_broadcast(konst, plan->consts[in->a], n), a = konst;
+            else if (in->op & EXPR_CONST_B)
+                expr_broadcast(konst, plan->consts[in->b], n), b = konst;
+            kernel(in->op & EXPR_OP, regs[in->dst], a, b, n);
+        }
+        if (plan->result_const)
+            expr_broadcast(out + base, plan->consts[plan->result], n);
+        else
+            memcpy(out + base, src[plan->result], n * sizeof(double));
+    }
+}
+
+// State of one compilation
+struct expr_compiler {
+    const char *p;               // Next character of the expression
+    const char *start;
+    const char *names[EXPR_MAX_VARS];
+    int name_len[EXPR_MAX_VARS];
+    struct expr_plan *plan;
+    int top;                     // Next free temporary register
+    int depth;                   // Nesting, limited so a hostile expression cannot exhaust the stack
+    char error[64];
+};
+
+// A compiled subexpression: a register, or a constant not yet given one
+struct expr_val {
+    int reg;                     // -1 for a constant
+    double value;
+};
+
+struct expr_val expr_fail(struct expr_compiler *c, const char *what) {
+    if (!c->error[0])
+        snprintf(c->error, sizeof(c->error), "%s at offset %d", what, (int)(c->p - c->start));
+    return (struct expr_val){-1, NAN};
+}
+
+void expr_skip(struct expr_compiler *c) {
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\n')
+        c->p++;
+}
+
+// Function to give a value an operand: its register, or for a constant its index in the pool (shared by equal
+// constants)
+int expr_operand(struct expr_compiler *c, struct expr_val v) {
+    if (v.reg >= 0)
+        return v.reg;
+    struct expr_plan *pl = c->plan;
+    for (int k = 0; k < pl->nconsts; k++)
+        if (memcmp(&pl->consts[k], &v.value, sizeof(double)) == 0)
+            return k;
+    if (pl->nconsts == EXPR_MAX_CONSTS) {
+        expr_fail(c, "too many constants");
+        return 0;
+    }
+    pl->consts[pl->nconsts] = v.value;
+    return pl->nconsts++;
+}
+
+// Function to free a temporary once an instruction has consumed it; temporaries are freed in stack order
+void expr_release(struct expr_compiler *c, int reg) {
+    if (reg >= c->plan->nvars && reg == c->top - 1)
+        c->top--;
+}
+
+// Function to emit dst = a op b, folding it if both are constants (b is ignored by unary operations)
+struct expr_val expr_emit(struct expr_compiler *c, int op, struct expr_val a, struct expr_val b) {
+    if (op >= EXPR_NEG)
+        b = a;
+    if (c->error[0])
+        return a;
+    if (a.reg < 0 && b.reg < 0)
+        return (struct expr_val){-1, expr_scalar(op, a.value, b.value)};
+    int ra = expr_operand(c, a), rb = expr_operand(c, b);
+    if (b.reg >= 0)
+        expr_release(c, rb);
+    if (a.reg >= 0 && a.reg != b.reg)
+        expr_release(c, ra);
+    struct expr_plan *pl = c->plan;
+    if (c->top >= EXPR_MAX_REGS)
+        return expr_fail(c, "expression too complex");
+    if (pl->ninsns == EXPR_MAX_INSNS)
+        return expr_fail(c, "expression too long");
+    int dst = c->top++;
+    int flags = (a.reg < 0 ? EXPR_CONST_A : 0) | (b.reg < 0 ? EXPR_CONST_B : 0);
+    pl->insn[pl->ninsns++] = (struct expr_insn){op | flags, dst, ra, rb};
+    return (struct expr_val){dst, 0};
+}
+
+struct expr_val expr_parse_sum(struct expr_compiler *c);
+
+// primary := number | variable | function '(' sum [',' sum] ')' | '(' sum ')'
+// number := decimal digits with an optional fraction and exponent (1, 2.5, .5, 1e-3); no hexadecimal
+struct expr_val expr_parse_primary(struct expr_compiler *c) {
+    static const struct { const char *name; int op, args; } funcs[] = {
+        {"sqrt", EXPR_SQRT, 1}, {"abs", EXPR_ABS, 1}, {"exp", EXPR_EXP, 1}, {"log", EXPR_LOG, 1},
+        {"sin", EXPR_SIN, 1}, {"cos", EXPR_COS, 1}, {"min", EXPR_MIN, 2}, {"max", EXPR_MAX, 2},
+        {"pow", EXPR_POW, 2},
+    };
+    expr_skip(c);
+    if ((*c->p >= '0' && *c->p <= '9') || *c->p == '.') {
+        char *end;
+        double v = strtod(c->p, &end);
+        if (c->p[0] == '0' && (c->p[1] == 'x' || c->p[1] == 'X'))
+            v = 0, end = (char *)c->p + 1;      // strtod reads hexadecimal too: take the 0 alone, x is then refused
+        c->p = end;
+        return (struct expr_val){-1, v};
+    }
+    if (*c->p == '(') {
+        c->p++;
+        struct expr_val v = expr_parse_sum(c);
+        expr_skip(c);
+        if (*c->p != ')')
+            return expr_fail(c, "expected ')'");
+        c->p++;
+        return v;
+    }
+    const char *name = c->p;
+    while ((*c->p >= 'a' && *c->p <= 'z') || (*c->p >= 'A' && *c->p <= 'Z') || *c->p == '_'
+           || (c->p > name && *c->p >= '0' && *c->p <= '9'))
+        c->p++;
+    int len = c->p - name;
+    if (len == 0)
+        return expr_fail(c, *c->p ? "unexpected character" : "unexpected end");
+    expr_skip(c);
+    if (*c->p != '(') {
+        for (int v = 0; v < c->plan->nvars; v++)
+            if (c->name_len[v] == len && memcmp(c->names[v], name, len) == 0)
+                return (struct expr_val){v, 0};
+        c->p = name;
+        return expr_fail(c, "unknown variable");
+    }
+    for (size_t f = 0; f < sizeof(funcs) / sizeof(funcs[0]); f++) {
+        if ((int)strlen(funcs[f].name) != len || memcmp(funcs[f].name, name, len) != 0)
+            continue;
+        c->p++;
+        struct expr_val a = expr_parse_sum(c), b = a;
+        expr_skip(c);
+        if (funcs[f].args == 2) {
+            if (*c->p != ',')
+                return expr_fail(c, "expected ','");
+            c->p++;
+            b = expr_parse_sum(c);
+            expr_skip(c);
+        }
+        if (*c->p != ')')
+            return expr_fail(c, "expected ')'");
+        c->p++;
+        return expr_emit(c, funcs[f].op, a, b);
+    }
+    c->p = name;
+    return expr_fail(c, "unknown function");
+}
+
+// power := primary ['^' unary]   (right associative, binds tighter than unary minus on its left)
+struct expr_val expr_parse_unary(struct expr_compiler *c);
+
+struct expr_val expr_parse_power(struct expr_compiler *c) {
+    struct expr_val base = expr_parse_primary(c);
+    expr_skip(c);
+    if (*c->p != '^')
+        return base;
+    c->p++;
+    return expr_emit(c, EXPR_POW, base, expr_parse_unary(c));
+}
+
+// unary := '-' unary | '+' unary | power
+struct expr_val expr_parse_unary(struct expr_compiler *c) {
+    struct expr_val v;
+    expr_skip(c);
+    if (++c->depth > 200)
+        return expr_fail(c, "expression nested too deeply");
+    if (*c->p == '-') {
+        c->p++;
+        v = expr_emit(c, EXPR_NEG, expr_parse_unary(c), (struct expr_val){-1, 0});
+    } else if (*c->p == '+') {
+        c->p++;
+        v = expr_parse_unary(c);
+    } else
+        v = expr_parse_power(c);
+    c->depth--;
+    return v;
+}
+
+// product := unary (('*' | '/' | '%') unary)*
+struct expr_val expr_parse_product(struct expr_compiler *c) {
+    struct expr_val v = expr_parse_unary(c);
+    while (expr_skip(c), *c->p == '*' || *c->p == '/' || *c->p == '%') {
+        int op = *c->p == '*' ? EXPR_MUL : *c->p == '/' ? EXPR_DIV : EXPR_MOD;
+        c->p++;
+        v = expr_emit(c, op, v, expr_parse_unary(c));
+    }
+    return v;
+}
+
+// sum := product (('+' | '-') product)*
+struct expr_val expr_parse_sum(struct expr_compiler *c) {
+    struct expr_val v = expr_parse_product(c);
+    while (expr_skip(c), *c->p == '+' || *c->p == '-') {
+        int op = *c->p == '+' ? EXPR_ADD : EXPR_SUB;
+        c->p++;
+        v = expr_emit(c, op, v, expr_parse_product(c));
+    }
+    return v;
+}
+
+// Function to compile a NUL-terminated expression over comma-separated variable names into plan. Returns 0, or -1
+// with the reason in error
+int expr_compile(struct expr_plan *plan, const char *expr, const char *names, char *error, size_t error_len) {
+    struct expr_compiler c = {.p = expr, .start = expr, .plan = plan, .top = 0};
+    memset(plan, 0, offsetof(struct expr_plan, insn));
+    for (const char *n = names; *n;) {
+        int len = strcspn(n, ",");
+        while (len > 0 && n[0] == ' ')
+            n++, len--;
+        int trimmed = len;
+        while (trimmed > 0 && n[trimmed - 1] == ' ')
+            trimmed--;
+        if (plan->nvars == EXPR_MAX_VARS || trimmed == 0) {
+            snprintf(error, error_len, plan->nvars == EXPR_MAX_VARS ? "too many variables" : "empty variable name");
+            return -1;
+        }
+        c.names[plan->nvars] = n;
+        c.name_len[plan->nvars++] = trimmed;
+        n += len + (n[len] == ',');
+    }
+    c.top = plan->nvars;
+    struct expr_val v = expr_parse_sum(&c);
+    expr_skip(&c);
+    if (*c.p)
+        expr_fail(&c, "unexpected character");
+    int result = c.error[0] ? 0 : expr_operand(&c, v);
+    if (c.error[0]) {
+        snprintf(error, error_len, "%s", c.error);
+        return -1;
+    }
+    plan->result = result;
+    plan->result_const = v.reg < 0;
+    return 0;
+}
+
+// Function to create the plan cache in memory that the connection processes forked later will share
+void CreatePlanCache() {
+    pthread_mutexattr_t attr;
+    plan_cache = mmap(NULL, sizeof(struct expr_cache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (plan_cache == MAP_FAILED) {
+        perror("Plan cache");
+        plan_cache = NULL;
+        return;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&plan_cache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Function to lock the cache. If its holder died mid-copy a slot may be torn, so the cache starts over empty
+void expr_cache_lock() {
+    if (pthread_mutex_lock(&plan_cache->lock) == EOWNERDEAD) {
+        for (int i = 0; i < EXPR_CACHE; i++)
+            plan_cache->slot[i].hash = 0;
+        pthread_mutex_consistent(&plan_cache->lock);
+    }
+}
+
+// Function to find the plan for key (expression, NUL, names) in the shared cache, or compile and add it. Returns
+// 1 for a cache hit, 0 after compiling, -1 with the reason in error
+int expr_plan_for(struct expr_plan *plan, const char *key, uint32_t key_len, char *error, size_t error_len) {
+    uint64_t hash = 14695981039346656037ull;    // FNV-1a
+    for (uint32_t i = 0; i < key_len; i++)
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ull;
+    hash |= 1;                                  // 0 marks an empty slot
+    int cacheable = plan_cache != NULL && key_len <= EXPR_KEY_MAX;
+    struct expr_plan *slot = cacheable ? &plan_cache->slot[hash & (EXPR_CACHE - 1)] : NULL;
+    if (cacheable) {
+        expr_cache_lock();
+        int hit = slot->hash == hash && slot->key_len == key_len && memcmp(slot->key, key, key_len) == 0;
+        if (hit) {
+            memcpy(plan, slot, sizeof(*plan));
+            plan_cache->hits++;
+        }
+        pthread_mutex_unlock(&plan_cache->lock);
+        if (hit)
+            return 1;
+    }
+    if (expr_compile(plan, key, key + strlen(key) + 1, error, error_len) < 0)
+        return -1;
+    plan->hash = hash;
+    plan->key_len = cacheable ? key_len : 0;
+    if (cacheable) {
+        memcpy(plan->key, key, key_len);
+        expr_cache_lock();
+        memcpy(slot, plan, sizeof(*plan));      // Replaces whatever plan had this slot
+        plan_cache->misses++;
+        pthread_mutex_unlock(&plan_cache->lock);
+    }
+    return 0;
+}
+
+// Function to answer expression requests on one connection until the client closes it. The magic was already read
+void ServeExpressions(int fd) {
+    struct expr_header h;
+    struct expr_plan plan;
+    char *key = NULL;
+    double *cols = NULL, *res = NULL;
+    size_t cols_cap = 0, res_cap = 0;
+    uint64_t total = 0;
+    while (read_all(fd, &h.expr_len, sizeof(h) - sizeof(h.magic)) == 0 && h.expr_len <= EXPR_TEXT_MAX
+           && h.names_len <= EXPR_NAMES_MAX && h.count <= BATCH_MAX) {
+        uint32_t key_len = h.expr_len + 1 + h.names_len;
+        key = realloc(key, key_len + 1);
+        if (key == NULL || read_all(fd, key, h.expr_len) < 0 || read_all(fd, key + h.expr_len + 1, h.names_len) < 0)
+            break;
+        key[h.expr_len] = key[key_len] = '\0';
+        if (strlen(key) != h.expr_len || strlen(key + h.expr_len + 1) != h.names_len)
+            break;                              // NUL inside the text
+        int nvars = h.names_len > 0;
+        for (uint32_t i = 0; i < h.names_len; i++)
+            nvars += key[h.expr_len + 1 + i] == ',';
+        size_t need = (size_t)nvars * h.count;
+        struct expr_reply r = {EXPR_MAGIC, 0, 0, 0, 0, 0, 0, ""};
+        if (nvars > EXPR_MAX_VARS) {            // Read past the columns and answer with the reason
+            if (skip_all(fd, need * sizeof(double)) < 0)
+                break;
+            snprintf(r.error, sizeof(r.error), "too many variables");
+        } else {
+            if (need > cols_cap) {
+                free(cols);
+                cols_cap = need;
+                if ((cols = malloc(cols_cap * sizeof(double))) == NULL)
+                    break;
+            }
+            if (h.count > res_cap) {
+                free(res);
+                res_cap = h.count;
+                if ((res = malloc(res_cap * sizeof(double))) == NULL)
+                    break;
+            }
+            if (read_all(fd, cols, need * sizeof(double)) < 0)
+                break;
+        }
+
+        struct timespec t0, t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int found = r.error[0] ? -1 : expr_plan_for(&plan, key, key_len, r.error, sizeof(r.error));
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        r.compile_ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000u + t1.tv_nsec - t0.tv_nsec;
+        if (found >= 0) {
+            expr_run(&plan, cols, h.count, res);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            r.count = h.count;
+            r.plan_hash = plan.hash;
+            r.cached = found;
+            r.ninsns = plan.ninsns;
+            r.eval_ns = (uint64_t)(t2.tv_sec - t1.tv_sec) * 1000000000u + t2.tv_nsec - t1.tv_nsec;
+            total += h.count;
+        }
+        struct iovec iov[2] = {{&r, sizeof(r)}, {res, r.count * sizeof(double)}};
+        if (writev_all(fd, iov, 2) < 0)
+            break;
+        uint32_t magic;
+        if (read_all(fd, &magic, sizeof(magic)) < 0 || magic != EXPR_MAGIC)
+            break;
+    }
+    if (plan_cache != NULL)
+        printf("\nExpression client done: %llu rows evaluated, plan cache %llu hits, %llu misses.\n",
+               (unsigned long long)total, (unsigned long long)plan_cache->hits,
+               (unsigned long long)plan_cache->misses);
+    free(key);
+    free(cols);
+    free(res);
+}
+
+// Function to make room for n limbs, keeping the value
+void big_reserve(struct big *x, size_t n) {
+    if (n <= x->cap)
+        return;
+    size_t cap = x->cap ? x->cap : 4;
+    while (cap < n)
+        cap *= 2;
+    if ((x->d = realloc(x->d, cap * sizeof(uint64_t))) == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    x->cap = cap;
+}
+
+void big_free(struct big *x) {
+    free(x->d);
+    *x = (struct big){NULL, 0, 0, 0};
+}
+
+// Function to drop leading zero limbs; zero is never negative
+void big_norm(struct big *x) {
+    while (x->n > 0 && x->d[x->n - 1] == 0)
+        x->n--;
+    if (x->n == 0)
+        x->neg = 0;
+}
+
+void big_set(struct big *x, const uint64_t *d, size_t n, int neg) {
+    big_reserve(x, n);
+    if (n > 0)
+        memmove(x->d, d, n * sizeof(uint64_t));
+    x->n = n;
+    x->neg = neg;
+    big_norm(x);
+}
+
+// Function to replace r by t, taking over t's limbs
+void big_move(struct big *r, struct big *t) {
+    big_free(r);
+    *r = *t;
+    *t = (struct big){NULL, 0, 0, 0};
+}
+
+// Function to compare magnitudes of normalized limb arrays: -1, 0 or 1
+int big_cmp_n(const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    if (an != bn)
+        return an < bn ? -1 : 1;
+    while (an-- > 0)
+        if (a[an] != b[an])
+            return a[an] < b[an] ? -1 : 1;
+    return 0;
+}
+
+// Function to add a[0..an) into r[0..rn), carrying as far as rn
+void big_add_at(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t c = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        unsigned __int128 t = (unsigned __int128)r[i] + a[i] + c;
+        r[i] = (uint64_t)t;
+        c = t >> 64;
+    }
+    for (; c && i < rn; i++)
+        c = ++r[i] == 0;
+}
+
+// Function to subtract a[0..an) from r[0..rn), borrowing as far as rn
+void big_sub_at(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t b = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        unsigned __int128 t = (unsigned __int128)r[i] - a[i] - b;
+        r[i] = (uint64_t)t;
+        b = (t >> 64) != 0;
+    }
+    for (; b && i < rn; i++)
+        b = r[i]-- == 0;
+}
+
+// Function to add a * m into r[0..n); returns the carry out of r[n - 1]
+uint64_t big_addmul_1(uint64_t *r, const uint64_t *a, size_t n, uint64_t m) {
+    uint64_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned __int128 t = (unsigned __int128)a[i] * m + r[i] + c;
+        r[i] = (uint64_t)t;
+        c = t >> 64;
+    }
+    return c;
+}
+
+// Function to subtract a * m from r[0..n); returns the borrow out of r[n - 1]
+uint64_t big_submul_1(uint64_t *r, const uint64_t *a, size_t n, uint64_t m) {
+    uint64_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned __int128 t = (unsigned __int128)a[i] * m + c;
+        uint64_t lo = (uint64_t)t;
+        c = (uint64_t)(t >> 64) + (r[i] < lo);
+        r[i] -= lo;
+    }
+    return c;
+}
+
+// Function to divide u1 2^64 + u0 by a d with its top bit set (u1 < d), given v = floor((2^128 - 1) / d) - 2^64.
+// Two multiplications and at most two corrections replace a hardware divide (Moller and Granlund, 2011)
+uint64_t big_div_2by1(uint64_t *r, uint64_t u1, uint64_t u0, uint64_t d, uint64_t v) {
+    unsigned __int128 q = (unsigned __int128)v * u1 + ((unsigned __int128)u1 << 64 | u0);
+    uint64_t q1 = (uint64_t)(q >> 64) + 1, rem = u0 - q1 * d;
+    if (rem > (uint64_t)q) {
+        q1--;
+        rem += d;
+    }
+    if (rem >= d) {
+        q1++;
+        rem -= d;
+    }
+    *r = rem;
+    return q1;
+}
+
+// Function to divide x[0..n) in place by d; returns the remainder. Both are shifted so that d's top bit is set
+uint64_t big_divrem_1(uint64_t *x, size_t n, uint64_t d) {
+    int s = __builtin_clzll(d);
+    uint64_t dn = d << s, v = (uint64_t)(~(unsigned __int128)0 / dn), rem = 0;
+    if (n == 0)
+        return 0;
+    if (s > 0)
+        rem = x[n - 1] >> (64 - s);
+    for (size_t i = n; i-- > 0;) {
+        uint64_t u0 = s > 0 ? x[i] << s | (i > 0 ? x[i - 1] >> (64 - s) : 0) : x[i];
+        x[i] = big_div_2by1(&rem, rem, u0, dn, v);
+    }
+    return rem >> s;
+}
+
+// Function to set d[0..bn) = |a - b| for an <= bn; returns 1 if a < b
+int big_absdiff(uint64_t *d, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    size_t x = an, y = bn;
+    while (x > 0 && a[x - 1] == 0)
+        x--;
+    while (y > 0 && b[y - 1] == 0)
+        y--;
+    int less = big_cmp_n(a, x, b, y) < 0;
+    const uint64_t *big = less ? b : a, *small = less ? a : b;
+    size_t bigl = less ? y : x, smalll = less ? x : y;
+    memset(d, 0, bn * sizeof(uint64_t));
+    if (bigl > 0)
+        memcpy(d, big, bigl * sizeof(uint64_t));
+    big_sub_at(d, bn, small, smalll);
+    return less;
+}
+
+// Function to set r = a + b, or a - b if negate_b; r may be a or b
+void big_addsub(struct big *r, const struct big *a, const struct big *b, int negate_b) {
+    int aneg = a->neg, bneg = b->neg ^ negate_b;
+    struct big t = {0};
+    const struct big *x = a, *y = b;
+    int xneg = aneg;
+    if (aneg == bneg) {                         // Same signs: add magnitudes
+        if (x->n < y->n)
+            x = b, y = a;
+        big_reserve(&t, x->n + 1);
+        big_set(&t, x->d, x->n, 0);
+        t.d[x->n] = 0;
+        big_add_at(t.d, x->n + 1, y->d, y->n);
+        t.n = x->n + 1;
+        t.neg = aneg;
+    } else {                                    // Opposite signs: subtract the smaller magnitude
+        if (big_cmp_n(a->d, a->n, b->d, b->n) < 0)
+            x = b, y = a, xneg = bneg;
+        big_set(&t, x->d, x->n, 0);
+        big_sub_at(t.d, t.n, y->d, y->n);
+        t.neg = xneg;
+    }
+    big_norm(&t);
+    big_move(r, &t);
+}
+
+// Function to shift a magnitude left by s < 64 bits
+void big_shl_bits(struct big *x, int s) {
+    if (s == 0 || x->n == 0)
+        return;
+    big_reserve(x, x->n + 1);
+    x->d[x->n] = 0;
+    for (size_t i = x->n + 1; i-- > 1;)
+        x->d[i] = x->d[i] << s | x->d[i - 1] >> (64 - s);
+    x->d[0] <<= s;
+    x->n++;
+    big_norm(x);
+}
+
+// Function to shift a magnitude right by s < 64 bits, dropping the bits shifted out
+void big_shr_bits(struct big *x, int s) {
+    if (s == 0 || x->n == 0)
+        return;
+    for (size_t i = 0; i + 1 < x->n; i++)
+        x->d[i] = x->d[i] >> s | x->d[i + 1] << (64 - s);
+    x->d[x->n - 1] >>= s;
+    big_norm(x);
+}
+
+// Function to multiply a magnitude by 2^(64k), or divide it (truncating) if k is negative
+void big_shift_limbs(struct big *x, long k) {
+    if (x->n == 0)
+        return;
+    if (k >= 0) {
+        big_reserve(x, x->n + k);
+        memmove(x->d + k, x->d, x->n * sizeof(uint64_t));
+        memset(x->d, 0, k * sizeof(uint64_t));
+        x->n += k;
+    } else if ((size_t)-k >= x->n)
+        x->n = 0;
+    else {
+        memmove(x->d, x->d - k, (x->n + k) * sizeof(uint64_t));
+        x->n += k;
+    }
+    big_norm(x);
+}
+
+// Schoolbook multiplication: r[0..an + bn) = a * b
+void big_mul_basecase(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    memset(r, 0, an * sizeof(uint64_t));
+    for (size_t j = 0; j < bn; j++)
+        r[an + j] = big_addmul_1(r + j, a, an, b[j]);
+}
+
+void big_mul_balanced(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n);
+void big_mul(struct big *r, const struct big *a, const struct big *b);
+
+// Karatsuba: a * b = z2 x^2 + (z0 + z2 -+ |a0 - a1| |b0 - b1|) x + z0 with x = 2^(64h), three half-size products
+void big_mul_karatsuba(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n) {
+    size_t h = n / 2, hi = n - h;
+    uint64_t *t = malloc((6 * hi + 1) * sizeof(uint64_t));
+    if (t == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *da = t, *db = t + hi, *z1 = t + 2 * hi, *mid = t + 4 * hi;
+    big_mul_balanced(r, a, b, h);                            // z0 in r[0..2h)
+    big_mul_balanced(r + 2 * h, a + h, b + h, hi);           // z2 in r[2h..2n)
+    int sa = big_absdiff(da, a, h, a + h, hi), sb = big_absdiff(db, b, h, b + h, hi);
+    big_mul_balanced(z1, da, db, hi);
+    memcpy(mid, r + 2 * h, 2 * hi * sizeof(uint64_t));      // mid = z0 + z2 -+ z1 = a0 b1 + a1 b0
+    mid[2 * hi] = 0;
+    big_add_at(mid, 2 * hi + 1, r, 2 * h);
+    if (sa == sb)
+        big_sub_at(mid, 2 * hi + 1, z1, 2 * hi);
+    else
+        big_add_at(mid, 2 * hi + 1, z1, 2 * hi);
+    size_t midn = 2 * hi + 1;
+    while (midn > 0 && mid[midn - 1] == 0)
+        midn--;
+    big_add_at(r + h, 2 * n - h, mid, midn);
+    free(t);
+}
+
+// Toom-3: split into thirds, evaluate at 0, 1, -1, -2 and infinity, multiply the five values and interpolate
+void big_mul_toom3(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n) {
+    size_t k = (n + 2) / 3, k2 = n - 2 * k;
+    struct big a0 = {0}, a1 = {0}, a2 = {0}, b0 = {0}, b1 = {0}, b2 = {0};
+    struct big p1 = {0}, pm1 = {0}, pm2 = {0}, q1 = {0}, qm1 = {0}, qm2 = {0};
+    struct big r0 = {0}, r1 = {0}, rm1 = {0}, r2 = {0}, r3 = {0}, rinf = {0};
+    big_set(&a0, a, k, 0), big_set(&a1, a + k, k, 0), big_set(&a2, a + 2 * k, k2, 0);
+    big_set(&b0, b, k, 0), big_set(&b1, b + k, k, 0), big_set(&b2, b + 2 * k, k2, 0);
+    // p(1) = a0 + a1 + a2, p(-1) = a0 - a1 + a2, p(-2) = 2 (p(-1) + a2) - a0
+    big_addsub(&p1, &a0, &a2, 0), big_addsub(&pm1, &p1, &a1, 1), big_addsub(&p1, &p1, &a1, 0);
+    big_addsub(&pm2, &pm1, &a2, 0), big_addsub(&pm2, &pm2, &pm2, 0), big_addsub(&pm2, &pm2, &a0, 1);
+    big_addsub(&q1, &b0, &b2, 0), big_addsub(&qm1, &q1, &b1, 1), big_addsub(&q1, &q1, &b1, 0);
+    big_addsub(&qm2, &qm1, &b2, 0), big_addsub(&qm2, &qm2, &qm2, 0), big_addsub(&qm2, &qm2, &b0, 1);
+    big_mul(&r0, &a0, &b0), big_mul(&r1, &p1, &q1), big_mul(&rm1, &pm1, &qm1);
+    big_mul(&r3, &pm2, &qm2), big_mul(&rinf, &a2, &b2);
+    // Bodrato's interpolation sequence; every division is exact
+    big_addsub(&r3, &r3, &r1, 1), big_divrem_1(r3.d, r3.n, 3), big_norm(&r3);    // r3 = (r(-2) - r(1)) / 3
+    big_addsub(&r1, &r1, &rm1, 1), big_shr_bits(&r1, 1);                          // r1 = (r(1) - r(-1)) / 2
+    big_addsub(&r2, &rm1, &r0, 1);                                                 // r2 = r(-1) - r(0)
+    big_addsub(&r3, &r2, &r3, 1), big_shr_bits(&r3, 1);                           // r3 = (r2 - r3) / 2 + 2 r(inf)
+    big_addsub(&r3, &r3, &rinf, 0), big_addsub(&r3, &r3, &rinf, 0);
+    big_addsub(&r2, &r2, &r1, 0), big_addsub(&r2, &r2, &rinf, 1);                 // r2 = r2 + r1 - r(inf)
+    big_addsub(&r1, &r1, &r3, 1);                                                  // r1 = r1 - r3
+    // The coefficients are those of a product of nonnegative polynomials, so all are >= 0
+    memset(r, 0, 2 * n * sizeof(uint64_t));
+    struct big *c[5] = {&r0, &r1, &r2, &r3, &rinf};
+    for (int i = 0; i < 5; i++)
+        big_add_at(r + i * k, 2 * n - i * k, c[i]->d, c[i]->n);
+    struct big *all[] = {&a0, &a1, &a2, &b0, &b1, &b2, &p1, &pm1, &pm2, &q1, &qm1, &qm2,
+                         &r0, &r1, &rm1, &r2, &r3, &rinf};
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+        big_free(all[i]);
+}
+
+// Function to multiply two n-limb numbers with the method that suits n
+void big_mul_balanced(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n) {
+    if (n < BIG_KARATSUBA)
+        big_mul_basecase(r, a, n, b, n);
+    else if (n < BIG_TOOM3)
+        big_mul_karatsuba(r, a, b, n);
+    else
+        big_mul_toom3(r, a, b, n);
+}
+
+// Function to set r[0..an + bn) = a * b for an >= bn >= 1. A much longer a is cut into bn-limb slices
+void big_mul_n(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    if (bn < BIG_KARATSUBA) {
+        big_mul_basecase(r, a, an, b, bn);
+        return;
+    }
+    if (an == bn) {
+        big_mul_balanced(r, a, b, bn);
+        return;
+    }
+    uint64_t *t = malloc(2 * bn * sizeof(uint64_t));
+    if (t == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(r, 0, (an + bn) * sizeof(uint64_t));
+    for (size_t i = 0; i < an; i += bn) {
+        size_t len = an - i < bn ? an - i : bn;
+        if (len == bn)
+            big_mul_balanced(t, a + i, b, bn);
+        else
+            big_mul_n(t, b, bn, a + i, len);
+        big_add_at(r + i, an + bn - i, t, len + bn);
+    }
+    free(t);
+}
+
+// Function to set r = a * b; r may be a or b
+void big_mul(struct big *r, const struct big *a, const struct big *b) {
+    struct big t = {0};
+    if (a->n > 0 && b->n > 0) {
+        big_reserve(&t, a->n + b->n);
+        if (a->n >= b->n)
+            big_mul_n(t.d, a->d, a->n, b->d, b->n);
+        else
+            big_mul_n(t.d, b->d, b->n, a->d, a->n);
+        t.n = a->n + b->n;
+        t.neg = a->neg ^ b->neg;
+        big_norm(&t);
+    }
+    big_move(r, &t);
+}
+
+// Function to compute x with x / 2^(64p) just below 2^(64m) / b, for b of m limbs with its top bit set.
+// Newton's step x' = x + x (1 - b x) doubles the correct limbs, so each step works at twice the precision of the
+// last one, using only as many top limbs of b, and the whole reciprocal costs about two full multiplications
+void big_recip(struct big *x, const struct big *b, size_t p) {
+    size_t hs[64], k = 0;
+    for (size_t h = p; h > 1; h = h / 2 + 1) {
+        hs[k++] = h;
+        if (h == 2)
+            break;
+    }
+    uint64_t top = b->d[b->n - 1];                          // One limb from the top limb: below by a few units
+    unsigned __int128 x1 = top == UINT64_MAX ? UINT64_MAX : ~(unsigned __int128)0 / ((unsigned __int128)top + 1);
+    uint64_t base[2] = {(uint64_t)x1, (uint64_t)(x1 >> 64)};
+    big_set(x, base, 2, 0);
+    struct big bh = {0}, e = {0}, one = {0};
+    uint64_t unit = 1;
+    size_t l = 1;
+    while (k > 0) {
+        size_t h = hs[--k];
+        big_shift_limbs(x, h - l);                          // Same value with h fractional limbs
+        if (b->n >= h + 1)                                  // b truncated to h + 1 limbs
+            big_set(&bh, b->d + b->n - (h + 1), h + 1, 0);
+        else {
+            big_set(&bh, b->d, b->n, 0);
+            big_shift_limbs(&bh, h + 1 - b->n);
+        }
+        big_mul(&e, &bh, x);                                // e = 1 - bh x, with 2h + 1 fractional limbs
+        big_set(&one, &unit, 1, 0);
+        big_shift_limbs(&one, 2 * h + 1);
+        big_addsub(&e, &one, &e, 1);
+        big_mul(&e, x, &e);                                 // x += x e, then one unit less to stay below
+        big_shift_limbs(&e, -(long)(2 * h + 1));
+        big_addsub(x, x, &e, 0);
+        big_set(&one, &unit, 1, 0);
+        big_addsub(x, x, &one, 1);
+        l = h;
+    }
+    big_free(&bh), big_free(&e), big_free(&one);
+}
+
+// Function to prepare b (two limbs or more) for repeated division by dividends of up to b->n + p - 3 limbs: b is
+// shifted left until its top bit is set and its reciprocal is taken with p fractional limbs
+void big_divisor_init(struct big_divisor *dv, const struct big *b, size_t p) {
+    dv->s = __builtin_clzll(b->d[b->n - 1]);
+    big_set(&dv->bn, b->d, b->n, 0);
+    big_shl_bits(&dv->bn, dv->s);
+    dv->p = p;
+    big_recip(&dv->x, &dv->bn, p);
+}
+
+void big_divisor_free(struct big_divisor *dv) {
+    big_free(&dv->bn), big_free(&dv->x);
+    dv->p = 0;
+}
+
+// Function to divide the magnitude of a by a prepared divisor, with q and r distinct from a. The quotient
+// an x / 2^(64(p + m)) needs only the top limbs of an: dropping the low m - 1 costs under one unit, so it is at
+// most a few units low, and the remainder's sign fixes it
+void big_divmod_pre(struct big *q, struct big *r, const struct big *a, const struct big_divisor *dv) {
+    struct big an = {0}, t = {0};
+    size_t m = dv->bn.n, k = 0;
+    uint64_t unit = 1;
+    big_set(&an, a->d, a->n, 0), big_shl_bits(&an, dv->s);
+    if (an.n > m - 1)
+        k = m - 1;
+    big_set(&t, an.d + k, an.n - k, 0);
+    big_mul(q, &t, &dv->x);
+    big_shift_limbs(q, -(long)(dv->p + m - k));
+    big_mul(&t, q, &dv->bn);
+    big_addsub(r, &an, &t, 1);
+    big_set(&t, &unit, 1, 0);
+    while (r->neg)
+        big_addsub(q, q, &t, 1), big_addsub(r, r, &dv->bn, 0);
+    while (big_cmp_n(r->d, r->n, dv->bn.d, dv->bn.n) >= 0)
+        big_addsub(q, q, &t, 0), big_addsub(r, r, &dv->bn, 1);
+    big_shr_bits(r, dv->s);
+    big_free(&an), big_free(&t);
+}
+
+// Function to divide the magnitude of a (at least as long as b) by b of two limbs or more the schoolbook way
+// (Knuth's algorithm D), into q and r distinct from a. Both are shifted until b's top bit is set. Each quotient
+// limb is estimated from the top two limbs of the remainder by big_div_2by1, checked against b's second limb,
+// which leaves it at most one too large, and b is added back in the rare case that it was
+void big_divmod_basecase(struct big *q, struct big *r, const struct big *a, const struct big *b) {
+    size_t m = b->n, n = a->n + 1 - m;                      // n quotient limbs, the top one possibly zero
+    int s = __builtin_clzll(b->d[m - 1]);
+    struct big u = {0}, d = {0};
+    big_set(&d, b->d, m, 0), big_shl_bits(&d, s);
+    big_set(&u, a->d, a->n, 0), big_shl_bits(&u, s);
+    big_reserve(&u, a->n + 1);
+    if (u.n == a->n)                                        // The remainder window needs a top limb
+        u.d[u.n] = 0;
+    big_reserve(q, n);
+    uint64_t top = d.d[m - 1], second = d.d[m - 2], v = (uint64_t)(~(unsigned __int128)0 / top);
+    for (size_t j = n; j-- > 0;) {
+        uint64_t u2 = u.d[j + m], u1 = u.d[j + m - 1], u0 = u.d[j + m - 2], qhat, rhat;
+        if (u2 >= top)                                      // u2 == top: the limb is at most 2^64 - 1
+            qhat = UINT64_MAX;
+        else {
+            qhat = big_div_2by1(&rhat, u2, u1, top, v);
+            while ((unsigned __int128)qhat * second > ((unsigned __int128)rhat << 64 | u0)) {
+                qhat--;
+                if ((rhat += top) < top)                    // rhat no longer fits a limb: the test holds
+                    break;
+            }
+        }
+        uint64_t borrow = big_submul_1(u.d + j, d.d, m, qhat), was = u.d[j + m];
+        u.d[j + m] = was - borrow;
+        for (int negative = was < borrow; negative;) {      // One too large: add b back
+            unsigned char c = 0;
+            qhat--;
+            for (size_t i = 0; i < m; i++) {
+                unsigned __int128 t = (unsigned __int128)u.d[j + i] + d.d[i] + c;
+                u.d[j + i] = (uint64_t)t;
+                c = t >> 64;
+            }
+            negative = !(c && ++u.d[j + m] == 0);           // Carrying out of the top limb ends the deficit
+        }
+        q->d[j] = qhat;
+    }
+    q->n = n;
+    q->neg = 0;
+    big_norm(q);
+    big_set(r, u.d, m, 0);
+    big_shr_bits(r, s);
+    big_free(&u), big_free(&d);
+}
+
+// Function to set q = trunc(a / b) and r = a - q b (the sign of a), as C's / and % do; b must not be zero.
+// One-limb divisors use a preinverted two-by-one division, divisors below BIG_DIV_NEWTON limbs the schoolbook
+// division above, and longer ones multiply by a Newton reciprocal
+void big_divmod(struct big *q, struct big *r, const struct big *a, const struct big *b) {
+    struct big qt = {0}, rt = {0};
+    int qneg = a->neg ^ b->neg, rneg = a->neg;
+    if (big_cmp_n(a->d, a->n, b->d, b->n) < 0)
+        big_set(&rt, a->d, a->n, 0);
+    else if (b->n == 1) {
+        big_set(&qt, a->d, a->n, 0);
+        uint64_t rem = big_divrem_1(qt.d, qt.n, b->d[0]);
+        big_norm(&qt);
+        big_set(&rt, &rem, 1, 0);
+    } else if (b->n < BIG_DIV_NEWTON)
+        big_divmod_basecase(&qt, &rt, a, b);
+    else {
+        struct big_divisor dv = {0};
+        big_divisor_init(&dv, b, a->n - b->n + 3);
+        big_divmod_pre(&qt, &rt, a, &dv);
+        big_divisor_free(&dv);
+    }
+    qt.neg = qt.n ? qneg : 0;
+    rt.neg = rt.n ? rneg : 0;
+    big_move(q, &qt);
+    big_move(r, &rt);
+}
+
+// Powers pow[i] = 10^(19 * 2^i) and their reciprocals, kept for the life of the connection's process: a bignum
+// connection is served by one thread, and its later numbers reuse them instead of paying for them again
+struct big big_pow10[48];
+struct big_divisor big_pow10_dv[48];
+
+// Function to make sure pow[i] = 10^(19 * 2^i) is there for i < levels, squaring the last one already computed
+void big_pow10_table(struct big *pow, int levels) {
+    uint64_t p19 = 10000000000000000000ull;
+    if (pow[0].n == 0)
+        big_set(&pow[0], &p19, 1, 0);
+    for (int i = 1; i < levels; i++)
+        if (pow[i].n == 0)
+            big_mul(&pow[i], &pow[i - 1], &pow[i - 1]);
+}
+
+// Function to read len decimal digits into x. Long runs are split so the low part has 19 * 2^i digits, and
+// x = high * 10^(19 * 2^i) + low, so the conversion costs a few multiplications instead of len^2 / 19^2 steps
+int big_parse_digits(struct big *x, const char *s, size_t len, struct big *pow) {
+    if (len <= 19 * BIG_DC_CONVERT) {
+        x->n = 0;
+        big_reserve(x, len / 19 + 2);
+        for (size_t i = 0, step = len % 19 ? len % 19 : 19; i < len; i += step, step = 19) {
+            uint64_t chunk = 0, scale = 1;
+            for (size_t j = i; j < i + step; j++) {
+                if (s[j] < '0' || s[j] > '9')
+                    return -1;
+                chunk = chunk * 10 + (s[j] - '0');
+                scale *= 10;
+            }
+            uint64_t c = chunk;                             // x = x * scale + chunk
+            for (size_t k = 0; k < x->n; k++) {
+                unsigned __int128 t = (unsigned __int128)x->d[k] * scale + c;
+                x->d[k] = (uint64_t)t;
+                c = t >> 64;
+            }
+            if (c)
+                x->d[x->n++] = c;
+        }
+        x->neg = 0;
+        big_norm(x);
+        return 0;
+    }
+    int i = 0;
+    while (((size_t)19 << (i + 1)) < len)
+        i++;
+    size_t low = (size_t)19 << i;
+    struct big lo = {0};
+    big_pow10_table(pow, i + 1);
+    int rc = big_parse_digits(x, s, len - low, pow) < 0 || big_parse_digits(&lo, s + len - low, low, pow) < 0 ? -1 : 0;
+    if (rc == 0) {
+        big_mul(x, x, &pow[i]);
+        big_addsub(x, x, &lo, 0);
+    }
+    big_free(&lo);
+    return rc;
+}
+
+// Function to parse an optionally signed decimal number; 0, or -1 if it is not one
+int big_from_decimal(struct big *x, const char *s, size_t len) {
+    int neg = 0;
+    if (len > 0 && (*s == '-' || *s == '+')) {
+        neg = *s == '-';
+        s++, len--;
+    }
+    int rc = len == 0 ? -1 : big_parse_digits(x, s, len, big_pow10);
+    x->neg = x->n ? neg : 0;
+    return rc;
+}
+
+// Function to write x, which is below 10^(19 * 2^i), as exactly 19 * 2^i digits. Long numbers are divided by
+// pow[i - 1] and both halves written the same way; every division at one level shares the reciprocal in dv[i - 1].
+// A number below pow[i - 1] (the top of a padded width) skips its division. Short ones take 19 digits per one-limb
+// division
+void big_write_digits(const struct big *x, struct big *pow, struct big_divisor *dv, int i, char *out) {
+    size_t width = (size_t)19 << i;
+    if (i <= 1 || x->n < BIG_DC_CONVERT) {                 // pow[0] has one limb and takes big_divrem_1
+        struct big t = {0};
+        big_set(&t, x->d, x->n, 0);
+        for (size_t c = width / 19; c-- > 0;) {
+            uint64_t chunk = t.n ? big_divrem_1(t.d, t.n, 10000000000000000000ull) : 0;
+            big_norm(&t);
+            for (int j = 18; j >= 0; j--, chunk /= 10)
+                out[c * 19 + j] = '0' + chunk % 10;
+        }
+        big_free(&t);
+        return;
+    }
+    if (big_cmp_n(x->d, x->n, pow[i - 1].d, pow[i - 1].n) < 0) {
+        memset(out, '0', width / 2);
+        big_write_digits(x, pow, dv, i - 1, out + width / 2);
+        return;
+    }
+    struct big q = {0}, r = {0};
+    if (dv[i - 1].p == 0)                                   // Dividends below pow[i], up to twice as long
+        big_divisor_init(&dv[i - 1], &pow[i - 1], pow[i - 1].n + 3);
+    big_divmod_pre(&q, &r, x, &dv[i - 1]);
+    big_write_digits(&q, pow, dv, i - 1, out);
+    big_write_digits(&r, pow, dv, i - 1, out + width / 2);
+    big_free(&q), big_free(&r);
+}
+
+// Function to write x in decimal to a new string; its length goes to len
+char *big_to_decimal(const struct big *x, size_t *len) {
+    int i = 0;
+    while (((size_t)19 << i) < x->n * 20)                  // A limb has under 20 digits
+        i++;
+    if (i > 0)
+        big_pow10_table(big_pow10, i);
+    char *out = malloc(((size_t)19 << i) + 2), *digits = out + 1;
+    if (out == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    big_write_digits(x, big_pow10, big_pow10_dv, i, digits);
+    size_t width = (size_t)19 << i, skip = 0;
+    while (skip + 1 < width && digits[skip] == '0')
+        skip++;
+    if (x->neg)
+        digits[--skip] = '-';
+    memmove(out, digits + skip, width - skip);
+    *len = width - skip;
+    out[*len] = '\0';
+    return out;
+}
+
+// Function to read the binary form: a sign byte (0 or 1), then the magnitude's bytes, least significant first
+int big_from_binary(struct big *x, const unsigned char *s, size_t len) {
+    if (len == 0 || s[0] > 1)
+        return -1;
+    size_t bytes = len - 1;
+    big_reserve(x, bytes / 8 + 1);
+    memset(x->d, 0, (bytes / 8 + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < bytes; i++)
+        x->d[i / 8] |= (uint64_t)s[1 + i] << (8 * (i % 8));
+    x->n = bytes / 8 + 1;
+    x->neg = s[0];
+    big_norm(x);
+    return 0;
+}
+
+char *big_to_binary(const struct big *x, size_t *len) {
+    char *out = malloc(8 * x->n + 1);
+    if (out == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    out[0] = x->neg;
+    size_t bytes = 8 * x->n;
+    for (size_t i = 0; i < bytes; i++)
+        out[1 + i] = x->d[i / 8] >> (8 * (i % 8));
+    while (bytes > 0 && out[bytes] == 0)
+        bytes--;
+    *len = bytes + 1;
+    return out;
+}
+
+// Function to answer bignum requests on one connection until the client closes it. The magic was already read
+void ServeBignums(int fd) {
+    struct big_header h;
+    struct big a = {0}, b = {0}, r = {0}, rem = {0};
+    char *in = NULL;
+    uint64_t answered = 0;
+    while (read_all(fd, &h.op, sizeof(h) - sizeof(h.magic)) == 0 && h.format <= BIG_BINARY
+           && h.lhs_len <= BIG_MAX_LEN && h.rhs_len <= BIG_MAX_LEN) {
+        if ((in = realloc(in, h.lhs_len + h.rhs_len + 1)) == NULL || read_all(fd, in, h.lhs_len + h.rhs_len) < 0)
+            break;
+        struct big_reply reply = {BIG_MAGIC, 0, 0, 0, ""};
+        char *out = NULL;
+        size_t out_len = 0;
+        struct timespec t0, t1, t2, t3;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int bad = h.format == BIG_DECIMAL
+                  ? big_from_decimal(&a, in, h.lhs_len) < 0 || big_from_decimal(&b, in + h.lhs_len, h.rhs_len) < 0
+                  : big_from_binary(&a, (unsigned char *)in, h.lhs_len) < 0
+                    || big_from_binary(&b, (unsigned char *)in + h.lhs_len, h.rhs_len) < 0;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (bad)
+            snprintf(reply.error, sizeof(reply.error), "operands are not %s numbers",
+                     h.format == BIG_DECIMAL ? "decimal" : "binary");
+        else if (h.op < 1 || h.op > 5)
+            snprintf(reply.error, sizeof(reply.error), "unknown operation %u", h.op);
+        else if (h.op >= 4 && b.n == 0)
+            snprintf(reply.error, sizeof(reply.error), "division by zero");
+        else {
+            if (h.op == 1 || h.op == 2)
+                big_addsub(&r, &a, &b, h.op == 2);
+            else if (h.op == 3)
+                big_mul(&r, &a, &b);
+            else
+                big_divmod(h.op == 4 ? &r : &rem, h.op == 4 ? &rem : &r, &a, &b);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            out = h.format == BIG_DECIMAL ? big_to_decimal(&r, &out_len) : big_to_binary(&r, &out_len);
+            clock_gettime(CLOCK_MONOTONIC, &t3);
+            reply.len = out_len;
+            reply.eval_ns = (uint64_t)(t2.tv_sec - t1.tv_sec) * 1000000000u + t2.tv_nsec - t1.tv_nsec;
+            reply.convert_ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000u + t1.tv_nsec - t0.tv_nsec
+                               + (uint64_t)(t3.tv_sec - t2.tv_sec) * 1000000000u + t3.tv_nsec - t2.tv_nsec;
+            answered++;
+        }
+        struct iovec iov[2] = {{&reply, sizeof(reply)}, {out, out_len}};
+        int failed = writev_all(fd, iov, 2) < 0;
+        free(out);
+        uint32_t magic;
+        if (failed || read_all(fd, &magic, sizeof(magic)) < 0 || magic != BIG_MAGIC)
+            break;
+    }
+    printf("\nBignum client done: %llu operations answered.\n", (unsigned long long)answered);
+    free(in);
+    big_free(&a), big_free(&b), big_free(&r), big_free(&rem);
+}
+
 // Function to create and configure the server socket
 void CreateServerSocket() {
     server_fd = socket(AF_INET, SOCK_STREAM, 0);      // Create a TCP socket
@@ -126,8 +2646,22 @@ void PerformServerTask() {
 
         // Fork a child process to handle the client's request
         if (fork() == 0) {
-            // Child process: receive data from client
-            valread = read(new_socket, num, sizeof(num));
+            // Child process: receive data from client. A connection that starts with a magic word speaks that protocol
+            void (*serve)(int) = NULL;
+            if (read_all(new_socket, num, sizeof(num[0])) == 0) {
+                switch ((uint32_t)num[0]) {
+                case BATCH_MAGIC: serve = ServeBatches; break;
+                case RPC_MAGIC: serve = ServeRpc; break;
+                case EXPR_MAGIC: serve = ServeExpressions; break;
+                case BIG_MAGIC: serve = ServeBignums; break;
+                }
+            }
+            if (serve != NULL) {
+                serve(new_socket);
+                close(new_socket);
+                exit(0);
+            }
+            valread = read_all(new_socket, num + 1, sizeof(num) - sizeof(num[0]));
             if (valread < 0) {
                 perror("Read failed");
                 close(new_socket);
@@ -166,6 +2700,7 @@ void PerformServerTask() {
 
 int main() {
     CreateServerSocket();        // Create and configure server socket
+    CreatePlanCache();           // Shared by the connection processes, so it must exist before any fork
     PerformServerTask();         // Perform server task (handle client requests)
     shutdown(server_fd, SHUT_RDWR);  // Shutdown the server
     return 0;                    // Exit program
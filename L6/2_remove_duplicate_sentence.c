@@ -4,17 +4,24 @@ Create a TCP client-server program in C where:
 - The client sends a string to the server.
 - The server removes duplicate characters from the string and sends back the modified string.
 - The client displays the modified string.
+- Extension: the server can also remove duplicate words or duplicate sentences from large text documents.
 */
 
 /*
 client.c
 - This program creates a TCP client that connects to a server on IP 127.0.0.1 and port 10202.
-- The client takes a string input from the user, sends it to the server, and receives the modified string with duplicate characters removed.
+- The client takes a string input from the user, sends it to the server, and receives the modified string with duplicates removed.
+- Usage: ./client [c|w|s] [file]
+    c = remove duplicate characters (default), w = remove duplicate words, s = remove duplicate sentences.
+    If a file is given, the whole document is sent instead of reading one string from the user.
+- Every request is framed as a 1-byte mode and an 8-byte length followed by the text; the reply is an 8-byte length and the text.
 */
 
 #include <stdio.h>      // Standard I/O library
 #include <stdlib.h>     // Standard library functions
 #include <string.h>     // String manipulation functions
+#include <stdint.h>     // Fixed-width integer types
+#include <endian.h>     // Host/network conversion for 64-bit lengths
 #include <sys/types.h>  // Data types used in system calls
 #include <sys/socket.h> // Socket API
 #include <netinet/in.h> // Structures for internet addresses
@@ -26,7 +33,55 @@ client.c
 int sock, addrlen, client_fd, valread;
 struct sockaddr_in address;             // Structure for server address
 char str[100];                          // Buffer for input string
-char result[100];                       // Buffer for result received from server
+char mode = 'c';                        // Dedup mode: 'c' characters, 'w' words, 's' sentences
+const char *doc_path = NULL;            // Optional document to send instead of a typed string
+
+// Function to write a whole buffer, retrying on partial writes
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to load a whole document into memory
+char *load_document(const char *path, uint64_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror("Open failed");
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char *data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t)size) {
+        perror("Read failed");
+        exit(1);
+    }
+    fclose(fp);
+    *len = size;
+    return data;
+}
 
 // Function to create and configure the client socket
 void CreateClientSocket() {
@@ -49,29 +104,65 @@ void PerformClientTask() {
         exit(1);
     }
 
-    // Input string from user
-    printf("Enter string: ");
-    scanf("%s", str);
+    // Input the text: either a whole document or one string from the user
+    char *text;
+    uint64_t text_len;
+    if (doc_path != NULL) {
+        text = load_document(doc_path, &text_len);
+    } else {
+        printf("Enter string: ");
+        if (fgets(str, sizeof(str), stdin) == NULL)
+            exit(1);
+        str[strcspn(str, "\n")] = '\0';
+        text = str;
+        text_len = strlen(str);
+    }
 
-    // Send the string to the server
-    send(sock, str, strlen(str), 0);
-    printf("String sent to server.\n");
+    // Send the request header (mode + length) followed by the text
+    char header[9];
+    uint64_t wire_len = htobe64(text_len);
+    header[0] = mode;
+    memcpy(header + 1, &wire_len, sizeof(wire_len));
+    if (write_all(sock, header, sizeof(header)) < 0 || write_all(sock, text, text_len) < 0) {
+        perror("Send failed");
+        close(sock);
+        exit(1);
+    }
+    printf("Text sent to server (%llu bytes).\n", (unsigned long long)text_len);
 
-    // Receive the modified string from the server
-    memset(result, 0, sizeof(result));
-    valread = read(sock, result, sizeof(result) - 1);
-    if (valread < 0) {
+    // Receive the modified text from the server
+    uint64_t result_len;
+    if (read_all(sock, &result_len, sizeof(result_len)) < 0) {
+        perror("Read failed");
+        close(sock);
+        exit(1);
+    }
+    result_len = be64toh(result_len);
+    char *result = malloc(result_len + 1);
+    if (result == NULL || read_all(sock, result, result_len) < 0) {
         perror("Read failed");
         close(sock);
         exit(1);
     }
-    result[valread] = '\0';
+    result[result_len] = '\0';
 
     // Display the result received from the server
-    printf("Result from server: %s\n", result);
+    printf("Result from server: ");
+    fwrite(result, 1, result_len, stdout);
+    printf("\n");
+    free(result);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        mode = argv[1][0];   // Dedup mode: c, w or s
+    if (argc > 2)
+        doc_path = argv[2];  // Document to send
+    if (mode != 'c' && mode != 'w' && mode != 's') {
+        printf("Usage: %s [c|w|s] [file]\n", argv[0]);
+        return 1;
+    }
+
     CreateClientSocket();  // Create and configure client socket
     PerformClientTask();   // Perform client task (send data and receive result)
     close(sock);           // Close the socket
@@ -80,26 +171,282 @@ int main() {
 /*
 server.c
 - This program creates a TCP server that listens on IP 127.0.0.1 and port 10202.
-- For each connected client, it forks a child process to handle the client's string processing request.
-- The server receives a string from the client, removes duplicate characters, and sends back the modified string.
+- For each connected client, it forks a child process to handle the client's string processing requests.
+- The server receives a text and removes duplicate characters, words or sentences, keeping first occurrences in order.
+- Words are runs of non-whitespace bytes; sentences run up to and including a '.', '!' or '?' terminator.
+- All per-request memory (the received text, the token hash set with its interned keys and the reply)
+  comes from one arena, so no token is malloc'ed and everything is released by a single arena reset.
 */
 
 #include <stdio.h>      // Standard I/O library
 #include <string.h>     // String manipulation functions
 #include <stdlib.h>     // Standard library functions
+#include <stdint.h>     // Fixed-width integer types
+#include <endian.h>     // Host/network conversion for 64-bit lengths
 #include <sys/types.h>  // Data types used in system calls
 #include <sys/socket.h> // Socket API
 #include <netinet/in.h> // Structures for internet addresses
 #include <unistd.h>     // POSIX API for UNIX system calls
 #include <arpa/inet.h>  // Definitions for internet operations
 
-#define PORTNO 10202    // Port number for server connection
+#define PORTNO 10202                 // Port number for server connection
+#define MAX_TEXT (1ULL << 30)        // Largest document accepted in one request
+#define ARENA_BLOCK (1 << 20)        // Minimum size of an arena block
+#define TEXT_PAD 16                  // Readable slack after the text for block-wise scanning
 
 int server_fd, new_socket, addrlen, valread;
 struct sockaddr_in address;             // Structure for server address
-char str[100];                          // Buffer for string received from client
-char result[100];                       // Buffer for modified string to send back to client
-char msg[100];                          // Message buffer for sending result
+
+// Bump allocator: memory is handed out from large blocks and only ever released all at once
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;            // Previously filled block
+    size_t used, size;                  // Bytes handed out / usable bytes in this block
+    char data[];                        // Block storage
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;                   // Block currently being filled
+} Arena;
+
+// Function to allocate bytes from the arena, adding a block when the current one is full
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;     // Keep every allocation 8-byte aligned
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (block == NULL) {
+            perror("Arena allocation failed");
+            exit(1);
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = block_size;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// Function to release everything allocated from the arena in one step (the newest block is kept for reuse)
+void arena_reset(Arena *arena) {
+    if (arena->head == NULL)
+        return;
+    while (arena->head->next != NULL) {
+        ArenaBlock *next = arena->head->next;
+        arena->head->next = next->next;
+        free(next);
+    }
+    arena->head->used = 0;
+}
+
+// Function to return all arena memory to the system
+void arena_free(Arena *arena) {
+    while (arena->head != NULL) {
+        ArenaBlock *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+// Open-addressing (linear probing) hash set of tokens; interned keys live in the arena
+typedef struct {
+    const char *key;                    // Interned token bytes (NULL marks an empty slot)
+    uint32_t tag;                       // Upper half of the token hash, checked before the bytes
+    uint32_t len;                       // Token length
+} Slot;
+
+typedef struct {
+    Slot *slots;                        // Slot array (allocated from the arena)
+    size_t mask;                        // Capacity - 1 (capacity is a power of two)
+    size_t count;                       // Number of stored tokens
+    Arena *arena;                       // Arena backing the slot array and the keys
+} TokenSet;
+
+// Function to load the last 1-7 bytes of a token as one word.
+// Token storage is always padded by at least 8 bytes, so the full 8-byte load stays in bounds.
+uint64_t load_tail(const char *p, size_t n) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w & (~0ULL >> (64 - 8 * n));
+}
+
+// Function to hash a token eight bytes at a time
+uint64_t hash_token(const char *p, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    while (n >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+        p += 8;
+        n -= 8;
+    }
+    if (n > 0)
+        h = (h ^ load_tail(p, n)) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 29);
+}
+
+// Function to compare two padded tokens of equal length a word at a time
+int tokens_equal(const char *a, const char *b, size_t n) {
+    while (n >= 8) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y)
+            return 0;
+        a += 8;
+        b += 8;
+        n -= 8;
+    }
+    return n == 0 || load_tail(a, n) == load_tail(b, n);
+}
+
+// Function to create a token set with room for the expected number of tokens
+void tokenset_init(TokenSet *set, Arena *arena, size_t expected) {
+    size_t capacity = 1024;
+    while (capacity < expected * 2)
+        capacity <<= 1;
+    set->arena = arena;
+    set->mask = capacity - 1;
+    set->count = 0;
+    set->slots = arena_alloc(arena, capacity * sizeof(Slot));
+    memset(set->slots, 0, capacity * sizeof(Slot));
+}
+
+// Function to double the slot array; the old array is simply left in the arena
+void tokenset_grow(TokenSet *set) {
+    Slot *old = set->slots;
+    size_t old_capacity = set->mask + 1;
+    tokenset_init(set, set->arena, old_capacity);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key == NULL)
+            continue;
+        size_t pos = hash_token(old[i].key, old[i].len) & set->mask;
+        while (set->slots[pos].key != NULL)
+            pos = (pos + 1) & set->mask;
+        set->slots[pos] = old[i];
+        set->count++;
+    }
+}
+
+// Function to insert a token; returns 1 if it was new and 0 if it was already present
+int tokenset_insert(TokenSet *set, const char *key, size_t len) {
+    uint64_t hash = hash_token(key, len);
+    uint32_t tag = hash >> 32;
+    size_t pos = hash & set->mask;
+    while (set->slots[pos].key != NULL) {
+        Slot *slot = &set->slots[pos];
+        if (slot->tag == tag && slot->len == len && tokens_equal(slot->key, key, len))
+            return 0;                   // Duplicate token
+        pos = (pos + 1) & set->mask;
+    }
+    char *copy = arena_alloc(set->arena, len + 8);  // Compact padded copy keeps key compares in cache
+    memcpy(copy, key, len);
+    set->slots[pos].key = copy;
+    set->slots[pos].tag = tag;
+    set->slots[pos].len = len;
+    if (++set->count * 2 > set->mask + 1)
+        tokenset_grow(set);             // Keep the load factor at or below 1/2
+    return 1;
+}
+
+// Token classes recognised by the tokenizer
+#define CLASS_SPACE 0                   // ' ', '\t', '\n', '\v', '\f', '\r' separate tokens
+#define CLASS_TERMINATOR 1              // '.', '!' and '?' end a sentence
+
+// Function to test one byte against a token class
+int in_class(unsigned char c, int cls) {
+    if (cls == CLASS_SPACE)
+        return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+    return c == '.' || c == '!' || c == '?';
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>  // SSE2 intrinsics for scanning 16 bytes at a time
+
+// Function to build a 16-bit mask of the bytes in a block that belong to a class
+unsigned class_mask16(const char *p, int cls) {
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    if (cls == CLASS_SPACE) {
+        __m128i ctl = _mm_sub_epi8(c, _mm_set1_epi8('\t'));  // '\t'..'\r' map to 0..4
+        __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl);
+        return _mm_movemask_epi8(_mm_or_si128(is_ctl, _mm_cmpeq_epi8(c, _mm_set1_epi8(' '))));
+    }
+    __m128i t = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('.')),
+                             _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('!')),
+                                          _mm_cmpeq_epi8(c, _mm_set1_epi8('?'))));
+    return _mm_movemask_epi8(t);
+}
+#endif
+
+// Function to find the first position at or after i whose membership in cls equals want.
+// The text is padded by TEXT_PAD bytes so block loads may run past len.
+size_t scan_class(const char *text, size_t i, size_t len, int cls, int want) {
+#ifdef __SSE2__
+    while (i < len) {
+        unsigned mask = class_mask16(text + i, cls);
+        if (!want)
+            mask = ~mask & 0xFFFF;
+        if (mask != 0) {
+            i += __builtin_ctz(mask);
+            return i < len ? i : len;
+        }
+        i += 16;
+    }
+    return len;
+#else
+    while (i < len && in_class(text[i], cls) != want)
+        i++;
+    return i;
+#endif
+}
+
+// Function to remove duplicate characters, keeping the first occurrence of each
+size_t dedup_chars(const char *text, size_t len, char *out) {
+    unsigned char seen[256] = {0};
+    size_t s = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        out[s] = c;
+        s += !seen[c];                  // Branch-free append of unseen characters
+        seen[c] = 1;
+    }
+    return s;
+}
+
+// Function to remove duplicate words or sentences; kept tokens are joined by single spaces
+size_t dedup_tokens(const char *text, size_t len, char *out, int sentences, Arena *arena) {
+    TokenSet set;
+    tokenset_init(&set, arena, 4096);   // Grows on demand; vocabularies are small next to the text
+
+    size_t s = 0, i = 0;
+    while (i < len) {
+        // Skip whitespace before the token
+        i = scan_class(text, i, len, CLASS_SPACE, 0);
+        if (i == len)
+            break;
+
+        // Find the end of the token
+        size_t start = i;
+        if (sentences) {
+            i = scan_class(text, i, len, CLASS_TERMINATOR, 1);
+            i = scan_class(text, i, len, CLASS_TERMINATOR, 0);  // Include the whole "?!" / "..." run
+        } else {
+            i = scan_class(text, i, len, CLASS_SPACE, 1);
+        }
+
+        // Emit the token only on its first occurrence
+        if (tokenset_insert(&set, text + start, i - start)) {
+            if (s > 0)
+                out[s++] = ' ';
+            memcpy(out + s, text + start, i - start);
+            s += i - start;
+        }
+    }
+    return s;
+}
 
 // Function to create and configure the server socket
 void CreateServerSocket() {
@@ -114,6 +461,75 @@ void CreateServerSocket() {
     addrlen = sizeof(address);                        // Address length
 }
 
+// Function to read exactly len bytes, retrying on partial reads
+int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to write a whole buffer, retrying on partial writes
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to serve dedup requests on one connection until the client disconnects
+void HandleClient(int fd) {
+    Arena arena = {NULL};
+    char header[9];
+
+    while (read_all(fd, header, sizeof(header)) == 0) {
+        char mode = header[0];
+        uint64_t len;
+        memcpy(&len, header + 1, sizeof(len));
+        len = be64toh(len);
+        if (len > MAX_TEXT || (mode != 'c' && mode != 'w' && mode != 's')) {
+            fprintf(stderr, "Rejected request (mode %c, %llu bytes)\n", mode, (unsigned long long)len);
+            break;
+        }
+
+        // The text, the reply and the interned token copies all live in the arena. Joining tokens may add a
+        // space after each one (sentences such as "0.1.2." have none between them), so the reply can be 2 * len
+        char *text = arena_alloc(&arena, len + TEXT_PAD);  // Padding lets the tokenizer read whole blocks
+        char *result = arena_alloc(&arena, (mode == 'c' ? len : 2 * len) + 8);
+        if (read_all(fd, text, len) < 0) {
+            perror("Read failed");
+            break;
+        }
+
+        size_t result_len;
+        if (mode == 'c')
+            result_len = dedup_chars(text, len, result + 8);
+        else
+            result_len = dedup_tokens(text, len, result + 8, mode == 's', &arena);
+
+        // Send the reply length followed by the modified text
+        uint64_t wire_len = htobe64(result_len);
+        memcpy(result, &wire_len, sizeof(wire_len));
+        if (write_all(fd, result, result_len + 8) < 0) {
+            perror("Send failed");
+            break;
+        }
+
+        arena_reset(&arena);            // Free everything used by this request at once
+    }
+    arena_free(&arena);
+}
+
 // Function to handle client requests for string processing
 void PerformServerTask() {
     bind(server_fd, (struct sockaddr *)&address, addrlen); // Bind socket to IP and port
@@ -131,44 +547,10 @@ void PerformServerTask() {
 
         // Fork a child process to handle the client's request
         if (fork() == 0) {
-            close(server_fd); // Child does not need the listening socket
-
-            // Clear buffers and read string from client
-            memset(str, 0, sizeof(str));
-            valread = read(new_socket, str, sizeof(str) - 1);
-            if (valread < 0) {
-                perror("Read failed");
-                close(new_socket);
-                exit(1);
-            }
-            str[valread] = '\0';
-
-            // Remove duplicate characters from the string
-            int length = strlen(str);
-            for (int i = 0; i < length; i++) {
-                if (str[i] != '0') {
-                    for (int j = i + 1; j < length; j++) {
-                        if (str[i] == str[j]) {
-                            str[j] = '0'; // Mark duplicate characters as '0'
-                        }
-                    }
-                }
-            }
-
-            // Copy unique characters to the result buffer
-            int s = 0;
-            for (int k = 0; k < length; k++) {
-                if (str[k] != '0') {
-                    result[s++] = str[k];
-                }
-            }
-            result[s] = '\0'; // Null-terminate the result string
-
-            // Send the modified string back to the client
-            send(new_socket, result, strlen(result), 0);
-
-            close(new_socket); // Close the client socket
-            exit(0);           // Exit the child process
+            close(server_fd);       // Child does not need the listening socket
+            HandleClient(new_socket);
+            close(new_socket);      // Close the client socket
+            exit(0);                // Exit the child process
         } else {
             close(new_socket); // Parent process: close the client socket and continue to accept new clients
         }